@@ -21,6 +21,7 @@
 #include "device/device.h"
 #include "render/scene.h"
 #include "render/session.h"
+#include "render/stats.h"
 #include "render/integrator.h"
 
 #include "util/util_args.h"
@@ -46,6 +47,7 @@ struct Options {
 	Session *session;
 	Scene *scene;
 	string filepath;
+	string update_stats_path;
 	int width, height;
 	SceneParams scene_params;
 	SessionParams session_params;
@@ -122,6 +124,10 @@ static void scene_init()
 	/* Read XML */
 	xml_read_file(options.scene, options.filepath.c_str());
 
+	if(options.update_stats_path != "") {
+		options.scene->enable_update_stats();
+	}
+
 	/* Camera width/height override? */
 	if(!(options.width == 0 || options.height == 0)) {
 		options.scene->camera->width = options.width;
@@ -138,6 +144,13 @@ static void scene_init()
 
 static void session_exit()
 {
+	if(options.session && options.session->scene->update_stats) {
+		if(!options.session->scene->update_stats->write_json(options.update_stats_path)) {
+			fprintf(stderr, "Failed to write scene update statistics to %s\n",
+			        options.update_stats_path.c_str());
+		}
+	}
+
 	if(options.session) {
 		delete options.session;
 		options.session = NULL;
@@ -328,6 +341,7 @@ static void options_parse(int argc, const char **argv)
 	options.width = 0;
 	options.height = 0;
 	options.filepath = "";
+	options.update_stats_path = "";
 	options.session = NULL;
 	options.quiet = false;
 
@@ -373,6 +387,7 @@ static void options_parse(int argc, const char **argv)
 		"--height %d", &options.height, "Window height in pixel",
 		"--tile-width %d", &options.session_params.tile_size.x, "Tile width in pixels",
 		"--tile-height %d", &options.session_params.tile_size.y, "Tile height in pixels",
+		"--update-stats %s", &options.update_stats_path, "File path to write scene update timing and memory statistics to, as JSON",
 		"--list-devices", &list, "List information about all available devices",
 #ifdef WITH_CYCLES_LOGGING
 		"--debug", &debug, "Enable debug logging",
@@ -233,6 +233,8 @@ def register_passes(engine, scene, srl):
     if srl.use_pass_emit:                  engine.register_pass(scene, srl,  "Emit",          3, "RGB",  'COLOR')
     if srl.use_pass_environment:           engine.register_pass(scene, srl,  "Env",           3, "RGB",  'COLOR')
 
+    if srl.cycles.pass_debug_sample_count: engine.register_pass(scene, srl,  "Debug Sample Count", 1, "X", 'VALUE')
+
     for aov in srl.cycles.aovs:
         if(aov.type == 'COLOR'):
             engine.register_pass(scene, srl, aov.name, 3, "RGB", 'COLOR')
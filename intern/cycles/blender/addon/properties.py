@@ -94,6 +94,7 @@ enum_tile_order = (
     ('TOP_TO_BOTTOM', "Top to Bottom", "Render from top to bottom"),
     ('BOTTOM_TO_TOP', "Bottom to Top", "Render from bottom to top"),
     ('HILBERT_SPIRAL', "Hilbert Spiral", "Render in a Hilbert Spiral"),
+    ('MORTON', "Morton", "Render tiles along a Z-order curve, keeping neighboring tiles close together"),
     )
 
 enum_use_layer_samples = (
@@ -295,6 +296,32 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 min=0.0, max=1.0,
                 default=0.05,
                 )
+        cls.use_light_tree = BoolProperty(
+                name="Light Tree",
+                description="Pick lights based on their distance and estimated power, "
+                            "rather than area or count alone (faster for scenes with many lights)",
+                default=False,
+                )
+
+        cls.use_adaptive_sampling = BoolProperty(
+                name="Adaptive Sampling",
+                description="Stop sampling pixels once their noise is below the threshold, "
+                            "CPU only and not used with progressive refine",
+                default=False,
+                )
+        cls.adaptive_threshold = FloatProperty(
+                name="Adaptive Threshold",
+                description="Noise level at which pixels stop sampling, lower values give less noise but render longer",
+                min=0.0001, max=1.0,
+                default=0.01,
+                precision=4,
+                )
+        cls.adaptive_min_samples = IntProperty(
+                name="Adaptive Min Samples",
+                description="Number of samples rendered for every pixel before testing for noise",
+                min=2, max=4096,
+                default=16,
+                )
 
         cls.caustics_reflective = BoolProperty(
                 name="Reflective Caustics",
@@ -392,6 +419,13 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 default=1024,
                 min=2, max=65536
                 )
+        cls.volume_delta_tracking = BoolProperty(
+                name="Delta Tracking",
+                description="Render heterogeneous volumes with unbiased delta tracking instead of stepping, "
+                            "using a coarse density bound computed for every volume object "
+                            "(faster for dense smoke, world volumes still use stepping)",
+                default=False,
+                )
 
         cls.dicing_rate = FloatProperty(
                 name="Dicing Rate",
@@ -539,11 +573,23 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 default=0,
                 min=0, max=16,
                 )
+        cls.use_persistent_bvh = BoolProperty(
+                name="Persistent BVH",
+                description="Keep object BVHs between frames of an animation render, refitting deforming meshes "
+                            "and rebuilding only the top level BVH (needs Persistent Images)",
+                default=False,
+                )
         cls.use_bvh_embree = BoolProperty(
                 name="Use embree",
                 description="Use embree as ray accelerator",
                 default=False,
                 )
+        cls.use_ray_stream = BoolProperty(
+                name="Ray Streams",
+                description="Trace camera rays of neighbouring pixels together as packets, faster for coherent "
+                            "scenes without motion blur or hair (CPU only)",
+                default=False,
+                )
         cls.tile_order = EnumProperty(
                 name="Tile Order",
                 description="Tile order for rendering",
@@ -732,6 +778,7 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
         cls.debug_use_cpu_sse3 = BoolProperty(name="SSE3", default=True)
         cls.debug_use_cpu_sse2 = BoolProperty(name="SSE2", default=True)
         cls.debug_use_qbvh = BoolProperty(name="QBVH", default=True)
+        cls.debug_use_obvh = BoolProperty(name="OBVH", default=True)
         cls.debug_use_cpu_split_kernel = BoolProperty(name="Split Kernel", default=False)
 
         cls.debug_use_cuda_adaptive_compile = BoolProperty(name="Adaptive Compile", default=False)
@@ -1377,6 +1424,12 @@ class CyclesRenderLayerSettings(bpy.types.PropertyGroup):
                 default=False,
                 update=update_render_passes,
                 )
+        cls.pass_debug_sample_count = BoolProperty(
+                name="Debug Sample Count",
+                description="Store the number of samples rendered for each pixel",
+                default=False,
+                update=update_render_passes,
+                )
         cls.aovs = bpy.props.CollectionProperty(type=CyclesAOVSettings)
         cls.active_aov = IntProperty(default=0)
         cls.use_pass_crypto_object = BoolProperty(
@@ -1428,6 +1481,32 @@ class CyclesRenderLayerSettings(bpy.types.PropertyGroup):
                 default=False,
                 update=update_render_passes,
                 )
+        cls.use_denoising = BoolProperty(
+                name="Use Denoising",
+                description="Denoise the rendered image, CPU only",
+                default=False,
+                )
+        cls.denoising_radius = IntProperty(
+                name="Denoising Radius",
+                description="Size of the image area that's used to denoise a pixel "
+                            "(higher values are smoother, but might lose detail and are slower)",
+                min=1, max=25,
+                default=8,
+                )
+        cls.denoising_strength = FloatProperty(
+                name="Denoising Strength",
+                description="Controls neighbor pixel weighting for the denoising filter "
+                            "(lower values preserve more detail, but aren't as smooth)",
+                min=0.0, max=1.0,
+                default=0.5,
+                )
+        cls.denoising_feature_strength = FloatProperty(
+                name="Denoising Feature Strength",
+                description="Controls removal of noisy image feature passes "
+                            "(lower values preserve more detail, but aren't as smooth)",
+                min=0.0, max=1.0,
+                default=0.5,
+                )
     @classmethod
     def unregister(cls):
         del bpy.types.SceneRenderLayer.cycles
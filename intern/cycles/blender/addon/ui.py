@@ -227,6 +227,7 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         sub.prop(cscene, "sample_clamp_direct")
         sub.prop(cscene, "sample_clamp_indirect")
         sub.prop(cscene, "light_sampling_threshold")
+        sub.prop(cscene, "use_light_tree")
 
         if cscene.progressive == 'PATH' or use_branched_path(context) is False:
             col = split.column()
@@ -261,6 +262,14 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         if not (use_opencl(context) and cscene.feature_set != 'EXPERIMENTAL'):
             layout.row().prop(cscene, "sampling_pattern", text="Pattern")
 
+        row = layout.row(align=True)
+        row.active = use_cpu(context) and not cscene.use_progressive_refine
+        row.prop(cscene, "use_adaptive_sampling", text="Adaptive")
+        sub = row.row(align=True)
+        sub.active = cscene.use_adaptive_sampling
+        sub.prop(cscene, "adaptive_threshold", text="Threshold")
+        sub.prop(cscene, "adaptive_min_samples", text="Min Samples")
+
         for rl in scene.render.layers:
             if rl.samples > 0:
                 layout.separator()
@@ -290,6 +299,7 @@ class CyclesRender_PT_geometry(CyclesButtonsPanel, Panel):
             sub.label("Volume Sampling:")
             sub.prop(cscene, "volume_step_size")
             sub.prop(cscene, "volume_max_steps")
+            sub.prop(cscene, "volume_delta_tracking")
 
             col = split.column()
 
@@ -305,6 +315,8 @@ class CyclesRender_PT_geometry(CyclesButtonsPanel, Panel):
             row = layout.row()
             row.prop(cscene, "volume_step_size")
             row.prop(cscene, "volume_max_steps")
+            row = layout.row()
+            row.prop(cscene, "volume_delta_tracking")
 
         layout.prop(ccscene, "use_curves", text="Use Hair")
         col = layout.column()
@@ -490,6 +502,9 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
 
         col.label(text="Final Render:")
         col.prop(rd, "use_persistent_data", text="Persistent Images")
+        sub = col.row()
+        sub.active = rd.use_persistent_data
+        sub.prop(cscene, "use_persistent_bvh")
 
         col.separator()
 
@@ -498,6 +513,9 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         row.active = use_cpu(context)
         row.prop(cscene, "use_bvh_embree")
         row = col.row()
+        row.active = use_cpu(context) and not cscene.use_bvh_embree
+        row.prop(cscene, "use_ray_stream")
+        row = col.row()
         col.prop(cscene, "debug_use_spatial_splits")
         row = col.row()
         row.active = not cscene.use_bvh_embree
@@ -651,6 +669,14 @@ class CyclesRender_PT_layer_passes(CyclesButtonsPanel, Panel):
           col.prop(crl, "pass_debug_ray_bounces")
 
         layout.prop(crl, "write_denoising_data")
+        layout.prop(crl, "pass_debug_sample_count")
+
+        layout.prop(crl, "use_denoising")
+        col = layout.column(align=True)
+        col.active = crl.use_denoising
+        col.prop(crl, "denoising_radius", text="Radius")
+        col.prop(crl, "denoising_strength", slider=True, text="Strength")
+        col.prop(crl, "denoising_feature_strength", slider=True, text="Feature Strength")
 
         layout.label("Cryptomatte:")
         row = layout.row(align=True)
@@ -1706,6 +1732,7 @@ class CyclesRender_PT_debug(CyclesButtonsPanel, Panel):
         row.prop(cscene, "debug_use_cpu_avx", toggle=True)
         row.prop(cscene, "debug_use_cpu_avx2", toggle=True)
         col.prop(cscene, "debug_use_qbvh")
+        col.prop(cscene, "debug_use_obvh")
         col.prop(cscene, "debug_use_cpu_split_kernel")
 
         col = layout.column()
@@ -29,6 +29,7 @@
 
 #include "util/util_algorithm.h"
 #include "util/util_foreach.h"
+#include "util/util_hash.h"
 #include "util/util_logging.h"
 #include "util/util_math.h"
 
@@ -1151,7 +1152,10 @@ Mesh *BlenderSync::sync_mesh(BL::Object& b_ob,
 	}
 	Mesh *mesh;
 
-	if(!mesh_map.sync(&mesh, key)) {
+	bool recalc = mesh_map.sync(&mesh, key);
+	mesh_objects.insert(std::make_pair(mesh, std::make_pair(b_ob, hide_tris)));
+
+	if(!recalc) {
 		/* if transform was applied to mesh, need full update */
 		if(object_updated && mesh->transform_applied);
 		/* test if shaders changed, these can be object level so mesh
@@ -1278,6 +1282,231 @@ Mesh *BlenderSync::sync_mesh(BL::Object& b_ob,
 	return mesh;
 }
 
+/* Shared Meshes
+ *
+ * Different objects often evaluate to the same geometry, for example copies
+ * of an object with the same modifiers, which can't be instanced through the
+ * mesh datablock. Such meshes are detected by a content hash and compared in
+ * full, after which the objects all use one mesh so its data is stored and
+ * its BVH built only once. The duplicate keeps its shaders and geometry
+ * flags, so it is not synced again as long as the Blender data is unchanged.
+ */
+
+template<typename T>
+static uint64_t hash_array(const array<T>& data, uint64_t hash)
+{
+	return hash_data_64(data.data(), data.size()*sizeof(T), hash);
+}
+
+static uint64_t hash_attributes(const AttributeSet& attributes, uint64_t hash)
+{
+	foreach(const Attribute& attr, attributes.attributes) {
+		hash = hash_data_64(attr.name.c_str(), attr.name.length(), hash);
+		hash = hash_data_64(&attr.std, sizeof(attr.std), hash);
+		hash = hash_data_64(&attr.element, sizeof(attr.element), hash);
+		if(attr.buffer.size()) {
+			hash = hash_data_64(&attr.buffer[0], attr.buffer.size(), hash);
+		}
+	}
+	return hash;
+}
+
+static uint64_t mesh_content_hash(Mesh *mesh)
+{
+	uint64_t hash = hash_data_64(&mesh->geometry_flags, sizeof(int));
+	foreach(Shader *shader, mesh->used_shaders) {
+		hash = hash_data_64(&shader, sizeof(shader), hash);
+	}
+	hash = hash_array(mesh->verts, hash);
+	hash = hash_array(mesh->triangles, hash);
+	hash = hash_array(mesh->shader, hash);
+	hash = hash_array(mesh->smooth, hash);
+	hash = hash_array(mesh->curve_keys, hash);
+	hash = hash_array(mesh->curve_radius, hash);
+	hash = hash_array(mesh->curve_first_key, hash);
+	hash = hash_array(mesh->curve_shader, hash);
+	hash = hash_attributes(mesh->attributes, hash);
+	hash = hash_attributes(mesh->curve_attributes, hash);
+	return hash;
+}
+
+static bool attributes_equal(const AttributeSet& a, const AttributeSet& b)
+{
+	if(a.attributes.size() != b.attributes.size())
+		return false;
+
+	list<Attribute>::const_iterator it = a.attributes.begin();
+	list<Attribute>::const_iterator jt = b.attributes.begin();
+
+	for(; it != a.attributes.end(); ++it, ++jt) {
+		if(it->name != jt->name ||
+		   it->std != jt->std ||
+		   it->type != jt->type ||
+		   it->element != jt->element ||
+		   it->flags != jt->flags ||
+		   it->buffer != jt->buffer)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool mesh_content_equal(Mesh *a, Mesh *b)
+{
+	return a->geometry_flags == b->geometry_flags &&
+	       a->used_shaders == b->used_shaders &&
+	       a->verts == b->verts &&
+	       a->triangles == b->triangles &&
+	       a->shader == b->shader &&
+	       a->smooth == b->smooth &&
+	       a->curve_keys == b->curve_keys &&
+	       a->curve_radius == b->curve_radius &&
+	       a->curve_first_key == b->curve_first_key &&
+	       a->curve_shader == b->curve_shader &&
+	       attributes_equal(a->attributes, b->attributes) &&
+	       attributes_equal(a->curve_attributes, b->curve_attributes);
+}
+
+Mesh *BlenderSync::find_mesh(const BL::ID& key)
+{
+	Mesh *mesh = mesh_map.find(key);
+	map<Mesh*, Mesh*>::iterator it = mesh_source.find(mesh);
+	return (it != mesh_source.end())? it->second: mesh;
+}
+
+void BlenderSync::sync_shared_meshes()
+{
+	/* Motion is synced into the mesh per object, and subdivision is diced
+	 * per object, so these meshes can not be shared. Baking is left alone
+	 * as it works on the geometry of a single object. */
+	const bool use_sharing = scene->need_motion() == Scene::MOTION_NONE &&
+	                         !scene->bake_manager->get_baking();
+
+	/* forget meshes which will be removed */
+	for(map<Mesh*, uint64_t>::iterator it = mesh_hash.begin(); it != mesh_hash.end(); ) {
+		if(mesh_map.is_used(it->first)) ++it;
+		else mesh_hash.erase(it++);
+	}
+
+	foreach(Mesh *mesh, scene->meshes) {
+		if(mesh_synced.find(mesh) != mesh_synced.end()) {
+			mesh_source.erase(mesh);
+			mesh_hash[mesh] = mesh_content_hash(mesh);
+		}
+	}
+
+	/* sync duplicates again when their source changed or is removed */
+	for(map<Mesh*, Mesh*>::iterator it = mesh_source.begin(); it != mesh_source.end(); ) {
+		Mesh *mesh = it->first;
+		Mesh *source = it->second;
+
+		if(!mesh_map.is_used(mesh)) {
+			mesh_source.erase(it++);
+			continue;
+		}
+
+		if(use_sharing &&
+		   mesh_map.is_used(source) &&
+		   mesh_hash.find(source) != mesh_hash.end() &&
+		   mesh_hash[source] == mesh_hash[mesh])
+		{
+			++it;
+			continue;
+		}
+
+		mesh_source.erase(it++);
+
+		map<Mesh*, pair<BL::Object, bool> >::iterator jt = mesh_objects.find(mesh);
+		if(jt != mesh_objects.end()) {
+			BL::Object b_ob = jt->second.first;
+			BL::ID b_ob_data = b_ob.data();
+			BL::ID key = (BKE_object_is_modified(b_ob))? b_ob: b_ob_data;
+
+			mesh_map.set_recalc(key);
+			sync_mesh(b_ob, false, jt->second.second);
+			mesh_hash[mesh] = mesh_content_hash(mesh);
+		}
+	}
+
+	if(use_sharing) {
+		/* Meshes which kept their data from a previous sync are preferred as
+		 * source, so their BVH does not need to be built again. */
+		map<uint64_t, Mesh*> hash_source;
+		int num_shared = 0;
+
+		for(int synced = 0; synced < 2; synced++) {
+			foreach(Mesh *mesh, scene->meshes) {
+				const bool is_synced = mesh_synced.find(mesh) != mesh_synced.end();
+
+				if(is_synced != (synced == 1) ||
+				   !mesh_map.is_used(mesh) ||
+				   mesh_source.find(mesh) != mesh_source.end() ||
+				   mesh_hash.find(mesh) == mesh_hash.end() ||
+				   mesh->subdivision_type != Mesh::SUBDIVISION_NONE ||
+				   mesh->transform_applied ||
+				   (mesh->verts.size() == 0 && mesh->curve_keys.size() == 0))
+				{
+					continue;
+				}
+
+				const uint64_t hash = mesh_hash[mesh];
+				map<uint64_t, Mesh*>::iterator it = hash_source.find(hash);
+
+				if(it == hash_source.end()) {
+					hash_source[hash] = mesh;
+					continue;
+				}
+
+				Mesh *source = it->second;
+				if(!is_synced || !mesh_content_equal(mesh, source))
+					continue;
+
+				/* keep what sync_mesh() compares to detect changes */
+				vector<Shader*> used_shaders = mesh->used_shaders;
+				int geometry_flags = mesh->geometry_flags;
+
+				mesh->clear();
+				mesh->used_shaders = used_shaders;
+				mesh->geometry_flags = geometry_flags;
+				mesh->tag_update(scene, true);
+
+				mesh_source[mesh] = source;
+				num_shared++;
+			}
+		}
+
+		/* meshes sharing a mesh which is now a duplicate itself */
+		for(map<Mesh*, Mesh*>::iterator it = mesh_source.begin(); it != mesh_source.end(); ++it) {
+			map<Mesh*, Mesh*>::iterator jt = mesh_source.find(it->second);
+			if(jt != mesh_source.end())
+				it->second = jt->second;
+		}
+
+		if(num_shared) {
+			VLOG(1) << "Shared " << num_shared << " identical meshes between objects.";
+		}
+	}
+
+	/* objects use the mesh holding the geometry */
+	foreach(Object *object, scene->objects) {
+		if(!object->mesh)
+			continue;
+
+		map<Mesh*, Mesh*>::iterator it = mesh_source.find(object->mesh);
+		if(it != mesh_source.end()) {
+			Mesh *mesh = object->mesh;
+			object->mesh = it->second;
+			if(mesh->need_update || object->mesh->need_update)
+				object->tag_update(scene);
+		}
+		else if(object->mesh->need_update) {
+			object->tag_update(scene);
+		}
+	}
+}
+
 void BlenderSync::sync_mesh_motion(BL::Object& b_ob,
                                    Object *object,
                                    float motion_time)
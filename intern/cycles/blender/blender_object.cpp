@@ -704,6 +704,7 @@ void BlenderSync::sync_objects(BL::SpaceView3D& b_v3d, float motion_time)
 		object_map.pre_sync();
 		particle_system_map.pre_sync();
 		motion_times.clear();
+		mesh_objects.clear();
 	}
 	else {
 		mesh_motion_synced.clear();
@@ -814,6 +815,9 @@ void BlenderSync::sync_objects(BL::SpaceView3D& b_v3d, float motion_time)
 	if(!cancel && !motion) {
 		sync_background_light(use_portal);
 
+		/* share identical meshes, before unused meshes are removed */
+		sync_shared_meshes();
+
 		/* handle removed data and modified pointers */
 		if(light_map.post_sync())
 			scene->light_manager->tag_update(scene);
@@ -174,6 +174,11 @@ void BlenderSession::create_session()
 
 void BlenderSession::reset_session(BL::BlendData& b_data_, BL::Scene& b_scene_)
 {
+	/* nodes kept by the sync can only be reused for the same data */
+	const bool sync_reusable = sync != NULL &&
+	                           b_data.ptr.data == b_data_.ptr.data &&
+	                           b_scene.ptr.data == b_scene_.ptr.data;
+
 	b_data = b_data_;
 	b_render = b_engine.render();
 	b_scene = b_scene_;
@@ -187,12 +192,16 @@ void BlenderSession::reset_session(BL::BlendData& b_data_, BL::Scene& b_scene_)
 
 	if(scene->params.modified(scene_params) ||
 	   session->params.modified(session_params) ||
-	   !scene_params.persistent_data)
+	   !scene_params.persistent_data ||
+	   (scene_params.persistent_bvh && !sync_reusable))
 	{
 		/* if scene or session parameters changed, it's easier to simply re-create
 		 * them rather than trying to distinguish which settings need to be updated
 		 */
 
+		delete sync;
+		sync = NULL;
+
 		delete session;
 
 		create_session();
@@ -210,8 +219,12 @@ void BlenderSession::reset_session(BL::BlendData& b_data_, BL::Scene& b_scene_)
 	 */
 	session->stats.mem_peak = session->stats.mem_used;
 
-	/* sync object should be re-created */
-	sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, is_cpu);
+	/* sync object should be re-created, unless it keeps the nodes and their
+	 * BVHs from the previous render, then everything is synced into those */
+	if(scene_params.persistent_bvh)
+		sync->tag_recalc_all();
+	else
+		sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, is_cpu);
 
 	/* for final render we will do full data sync per render layer, only
 	 * do some basic syncing here, no objects or materials for speed */
@@ -485,8 +498,11 @@ void BlenderSession::render()
 
 	session->device_free();
 
-	delete sync;
-	sync = NULL;
+	/* with persistent BVH the next frame syncs into the same nodes */
+	if(!scene->params.persistent_bvh) {
+		delete sync;
+		sync = NULL;
+	}
 }
 
 static void populate_bake_data(BakeData *data, const
@@ -676,6 +692,9 @@ void BlenderSession::do_write_update_render_result(BL::RenderResult& b_rr,
 			else if(b_pass.name().substr(0, 10) == "Denoising ") {
 				read = buffers->get_denoising_pass_rect(b_pass.name(), exposure, sample, components, &pixels[0]);
 			}
+			else if(b_pass.name() == "Debug Sample Count") {
+				read = buffers->get_sample_count_rect(components, &pixels[0]);
+			}
 			if(!read) {
 				memset(&pixels[0], 0, pixels.size()*sizeof(float));
 			}
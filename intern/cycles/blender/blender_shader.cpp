@@ -729,7 +729,7 @@ static ShaderNode *add_node(BlenderSync &sync,
 
                 BL::Object b_ob = b_curve_node.object();
                 BL::ID key = (sync.BKE_object_is_modified(b_ob))? b_ob: b_curve_node.object().data();
-                Mesh* mesh = sync.mesh_map.find(key);
+                Mesh* mesh = sync.find_mesh(key);
 
                 if (mesh) {
 
@@ -36,6 +36,7 @@
 #include "util/util_debug.h"
 #include "util/util_foreach.h"
 #include "util/util_opengl.h"
+#include "util/util_optimization.h"
 #include "util/util_hash.h"
 
 CCL_NAMESPACE_BEGIN
@@ -211,6 +212,22 @@ bool BlenderSync::sync_recalc()
 	return recalc;
 }
 
+void BlenderSync::tag_recalc_all()
+{
+	/* full sync into the existing nodes, used when they are kept between
+	 * final renders, frame changes do not set any recalc flags there */
+	PointerRNA cscene = RNA_pointer_get(&b_scene.ptr, "cycles");
+	dicing_rate = preview ? RNA_float_get(&cscene, "preview_dicing_rate") : RNA_float_get(&cscene, "dicing_rate");
+	max_subdivisions = RNA_int_get(&cscene, "max_subdivisions");
+
+	shader_map.set_recalc_all();
+	object_map.set_recalc_all();
+	mesh_map.set_recalc_all();
+	light_map.set_recalc_all();
+	particle_system_map.set_recalc_all();
+	world_recalc = true;
+}
+
 void BlenderSync::sync_data(BL::RenderSettings& b_render,
                             BL::SpaceView3D& b_v3d,
                             BL::Object& b_override,
@@ -250,6 +267,16 @@ void BlenderSync::sync_data(BL::RenderSettings& b_render,
 
 /* Integrator */
 
+/* Adaptive sampling needs every tile to be rendered with all its samples at
+ * once, which is the case for final renders on the CPU without progressive
+ * refine. */
+static bool use_adaptive_sampling(PointerRNA& cscene, bool preview, bool is_cpu)
+{
+	return !preview && is_cpu &&
+	       get_boolean(cscene, "use_adaptive_sampling") &&
+	       !get_boolean(cscene, "use_progressive_refine");
+}
+
 void BlenderSync::sync_integrator()
 {
 #ifdef __CAMERA_MOTION__
@@ -276,6 +303,10 @@ void BlenderSync::sync_integrator()
 
 	integrator->volume_max_steps = get_int(cscene, "volume_max_steps");
 	integrator->volume_step_size = get_float(cscene, "volume_step_size");
+	integrator->volume_delta_tracking = get_boolean(cscene, "volume_delta_tracking");
+	if(integrator->volume_delta_tracking != previntegrator.volume_delta_tracking) {
+		scene->mesh_manager->tag_update(scene);
+	}
 
 	integrator->caustics_reflective = get_boolean(cscene, "caustics_reflective");
 	integrator->caustics_refractive = get_boolean(cscene, "caustics_refractive");
@@ -322,6 +353,19 @@ void BlenderSync::sync_integrator()
 	integrator->sample_all_lights_indirect = get_boolean(cscene, "sample_all_lights_indirect");
 	integrator->light_sampling_threshold = get_float(cscene, "light_sampling_threshold");
 
+	integrator->use_light_tree = get_boolean(cscene, "use_light_tree");
+	if(integrator->use_light_tree != previntegrator.use_light_tree) {
+		scene->light_manager->tag_update(scene);
+	}
+
+	if(use_adaptive_sampling(cscene, preview, is_cpu)) {
+		integrator->adaptive_threshold = get_float(cscene, "adaptive_threshold");
+		integrator->adaptive_min_samples = get_int(cscene, "adaptive_min_samples");
+	}
+	else {
+		integrator->adaptive_threshold = 0.0f;
+	}
+
 	int diffuse_samples = get_int(cscene, "diffuse_samples");
 	int glossy_samples = get_int(cscene, "glossy_samples");
 	int transmission_samples = get_int(cscene, "transmission_samples");
@@ -659,6 +703,23 @@ void BlenderSync::sync_film(BL::RenderLayer& b_rlay,
 			b_engine.add_pass("Denoising Image", 3, "RGB", b_srlay.name().c_str(), 0);
 			b_engine.add_pass("Denoising Image Variance", 3, "RGB", b_srlay.name().c_str(), 0);
 		}
+
+		/* The denoiser runs on the CPU for final renders, using the same
+		 * feature passes which are written for external denoising. */
+		scene->film->use_denoising = get_boolean(crp, "use_denoising") && is_cpu && !preview;
+		if(scene->film->use_denoising) {
+			scene->film->denoising_radius = get_int(crp, "denoising_radius");
+			scene->film->denoising_strength = get_float(crp, "denoising_strength");
+			scene->film->denoising_feature_strength = get_float(crp, "denoising_feature_strength");
+			passes.denoising_passes = true;
+		}
+
+		PointerRNA cscene = RNA_pointer_get(&b_scene.ptr, "cycles");
+		passes.adaptive_passes = use_adaptive_sampling(cscene, preview, is_cpu);
+		if(get_boolean(crp, "pass_debug_sample_count")) {
+			b_engine.add_pass("Debug Sample Count", 1, "X", b_srlay.name().c_str(), 0);
+			passes.adaptive_passes = true;
+		}
 	}
 
 	scene->film->pass_alpha_threshold = b_srlay.pass_alpha_threshold();
@@ -682,7 +743,18 @@ SceneParams BlenderSync::get_scene_params(BL::Scene& b_scene,
 	else if(shadingsystem == 1)
 		params.shadingsystem = SHADINGSYSTEM_OSL;
 	
-	if(background)
+	if(background && params.shadingsystem != SHADINGSYSTEM_OSL)
+		params.persistent_data = r.use_persistent_data();
+	else
+		params.persistent_data = false;
+
+	/* object BVHs are kept and refitted, so also need the dynamic BVH */
+	params.persistent_bvh = params.persistent_data &&
+	                        get_boolean(cscene, "use_persistent_bvh");
+
+	if(params.persistent_bvh)
+		params.bvh_type = SceneParams::BVH_DYNAMIC;
+	else if(background)
 		params.bvh_type = SceneParams::BVH_STATIC;
 	else
 		params.bvh_type = (SceneParams::BVHType)get_enum(
@@ -696,16 +768,13 @@ SceneParams BlenderSync::get_scene_params(BL::Scene& b_scene,
 	params.num_bvh_time_steps = RNA_int_get(&cscene, "debug_bvh_time_steps");
 	if(is_cpu) {
 		params.use_bvh_embree = RNA_boolean_get(&cscene, "use_bvh_embree");
+		params.use_ray_stream = get_boolean(cscene, "use_ray_stream");
 	}
 	else {
 		params.use_bvh_embree = false;
+		params.use_ray_stream = false;
 	}
 
-	if(background && params.shadingsystem != SHADINGSYSTEM_OSL)
-		params.persistent_data = r.use_persistent_data();
-	else
-		params.persistent_data = false;
-
 	int texture_limit;
 	if(background) {
 		texture_limit = RNA_enum_get(&cscene, "texture_limit_render");
@@ -733,11 +802,18 @@ SceneParams BlenderSync::get_scene_params(BL::Scene& b_scene,
 #if !(defined(__GNUC__) && (defined(i386) || defined(_M_IX86)))
 	if(is_cpu) {
 		params.use_qbvh = DebugFlags().cpu.qbvh && system_cpu_support_sse2();
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX2
+		/* Only the AVX2 kernel can traverse OBVH. */
+		params.use_obvh = params.use_qbvh &&
+		                  DebugFlags().cpu.obvh &&
+		                  system_cpu_support_avx2();
+#endif
 	}
 	else
 #endif
 	{
 		params.use_qbvh = false;
+		params.use_obvh = false;
 	}
 
 	return params;
@@ -891,6 +967,7 @@ SessionParams BlenderSync::get_session_params(BL::RenderEngine& b_engine,
 	params.text_timeout = (double)get_float(cscene, "debug_text_timeout");
 
 	params.progressive_refine = get_boolean(cscene, "use_progressive_refine");
+	params.use_save_buffers = background && b_scene.render().use_save_buffers();
 
 	if(background) {
 		if(params.progressive_refine)
@@ -71,6 +71,7 @@ public:
 	/* sync */
 	bool sync_recalc_materials();
 	bool sync_recalc();
+	void tag_recalc_all();
 	void sync_data(BL::RenderSettings& b_render,
 	               BL::SpaceView3D& b_v3d,
 	               BL::Object& b_override,
@@ -110,6 +111,10 @@ public:
 	static PassType get_pass_type(BL::RenderPass& b_pass);
 	bool BKE_object_is_modified(BL::Object& b_ob);
 
+	/* Mesh holding the geometry for the key, which is another mesh when
+	 * identical meshes are shared between objects. */
+	Mesh *find_mesh(const BL::ID& key);
+
 private:
 	/* sync */
 	void sync_lamps(bool update_all);
@@ -129,6 +134,7 @@ private:
 
 	void sync_nodes(Shader *shader, BL::ShaderNodeTree& b_ntree);
 	Mesh *sync_mesh(BL::Object& b_ob, bool object_updated, bool hide_tris);
+	void sync_shared_meshes();
 	void sync_curves(Mesh *mesh,
 	                 BL::Mesh& b_mesh,
 	                 BL::Object& b_ob,
@@ -198,6 +204,12 @@ public:
 private:
 	set<Mesh*> mesh_synced;
 	set<Mesh*> mesh_motion_synced;
+	/* Identical meshes are shared between objects: the duplicate mesh is
+	 * kept empty and maps to the mesh holding the geometry. */
+	map<Mesh*, Mesh*> mesh_source;
+	map<Mesh*, uint64_t> mesh_hash;
+	/* Object and hide_tris used to sync each mesh in this pass. */
+	map<Mesh*, pair<BL::Object, bool> > mesh_objects;
 	set<float> motion_times;
 	void *world_map;
 	bool world_recalc;
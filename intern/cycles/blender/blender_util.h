@@ -605,6 +605,7 @@ public:
 	id_map(vector<T*> *scene_data_)
 	{
 		scene_data = scene_data_;
+		recalc_all = false;
 	}
 
 	T *find(const BL::ID& id)
@@ -627,9 +628,14 @@ public:
 		b_recalc.insert(id.ptr.data);
 	}
 
+	void set_recalc_all()
+	{
+		recalc_all = true;
+	}
+
 	bool has_recalc()
 	{
-		return !(b_recalc.empty());
+		return recalc_all || !(b_recalc.empty());
 	}
 
 	void pre_sync()
@@ -655,7 +661,7 @@ public:
 			recalc = true;
 		}
 		else {
-			recalc = (b_recalc.find(id.ptr.data) != b_recalc.end());
+			recalc = recalc_all || (b_recalc.find(id.ptr.data) != b_recalc.end());
 			if(parent.ptr.data)
 				recalc = recalc || (b_recalc.find(parent.ptr.data) != b_recalc.end());
 		}
@@ -672,6 +678,11 @@ public:
 		return (data) ? used_set.find(data) != used_set.end() : false;
 	}
 
+	bool is_used(T *data)
+	{
+		return used_set.find(data) != used_set.end();
+	}
+
 	void used(T *data)
 	{
 		/* tag data as still in use */
@@ -717,6 +728,7 @@ public:
 
 		used_set.clear();
 		b_recalc.clear();
+		recalc_all = false;
 		b_map = new_map;
 
 		return deleted;
@@ -727,6 +739,7 @@ protected:
 	map<K, T*> b_map;
 	set<T*> used_set;
 	set<void*> b_recalc;
+	bool recalc_all;
 };
 
 /* Object Key */
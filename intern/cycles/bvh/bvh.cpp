@@ -22,6 +22,7 @@
 
 #include "bvh/bvh2.h"
 #include "bvh/bvh4.h"
+#include "bvh/bvh8.h"
 #include "bvh/bvh_build.h"
 #include "bvh/bvh_node.h"
 
@@ -59,7 +60,9 @@ BVH *BVH::create(const BVHParams& params, const vector<Object*>& objects)
 	if(params.use_bvh_embree)
 		return new BVHEmbree(params, objects);
 #endif
-	if(params.use_qbvh)
+	if(params.use_obvh)
+		return new BVH8(params, objects);
+	else if(params.use_qbvh)
 		return new BVH4(params, objects);
 	else
 		return new BVH2(params, objects);
@@ -192,6 +195,7 @@ void BVH::pack_instances(size_t nodes_size, size_t leaf_nodes_size)
 	 * top level BVH, adjusting indexes and offsets where appropriate.
 	 */
 	const bool use_qbvh = params.use_qbvh;
+	const bool use_obvh = params.use_obvh;
 
 	/* Adjust primitive index to point to the triangle in the global array, for
 	 * meshes with transform applied and already in the top level BVH.
@@ -366,6 +370,22 @@ void BVH::pack_instances(size_t nodes_size, size_t leaf_nodes_size)
 			size_t bvh_nodes_size = bvh->pack.nodes.size();
 
 			for(size_t i = 0, j = 0; i < bvh_nodes_size; j++) {
+				if(use_obvh) {
+					/* Wide nodes store child indices in the last two elements. */
+					memcpy(pack_nodes + pack_nodes_offset,
+					       bvh_nodes + i,
+					       BVH_ONODE_SIZE*sizeof(int4));
+					for(int k = BVH_ONODE_SIZE - 2; k < BVH_ONODE_SIZE; k++) {
+						int4& data = pack_nodes[pack_nodes_offset + k];
+						for(int c = 0; c < 4; c++) {
+							data[c] += (data[c] < 0)? -noffset_leaf: noffset;
+						}
+					}
+					pack_nodes_offset += BVH_ONODE_SIZE;
+					i += BVH_ONODE_SIZE;
+					continue;
+				}
+
 				size_t nsize, nsize_bbox;
 				if(bvh_nodes[i].x & PATH_RAY_NODE_UNALIGNED) {
 					nsize = use_qbvh
@@ -0,0 +1,405 @@
+/*
+ * Copyright 2011-2017, Blender Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bvh/bvh8.h"
+
+#include "render/mesh.h"
+#include "render/object.h"
+
+#include "bvh/bvh_node.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Collapse binary subtree into up to eight children, opening the inner node
+ * with the largest surface area first, so the biggest boxes are tested
+ * together in a single node.
+ */
+static int node_obvh_children(const BVHNode *node,
+                              const BVHNode *children[BVH_ONODE_CHILDREN])
+{
+	int num_children = 0;
+	children[num_children++] = node->get_child(0);
+	children[num_children++] = node->get_child(1);
+
+	while(num_children < BVH_ONODE_CHILDREN) {
+		int best_child = -1;
+		float best_area = -FLT_MAX;
+		for(int i = 0; i < num_children; i++) {
+			if(children[i]->is_leaf()) {
+				continue;
+			}
+			const float area = children[i]->bounds.safe_area();
+			if(area > best_area) {
+				best_child = i;
+				best_area = area;
+			}
+		}
+		if(best_child == -1) {
+			break;
+		}
+		const BVHNode *best_node = children[best_child];
+		children[best_child] = best_node->get_child(0);
+		children[num_children++] = best_node->get_child(1);
+	}
+
+	return num_children;
+}
+
+static size_t node_obvh_inner_count(const BVHNode *node)
+{
+	const BVHNode *children[BVH_ONODE_CHILDREN];
+	const int num_children = node_obvh_children(node, children);
+	size_t count = 1;
+	for(int i = 0; i < num_children; i++) {
+		if(!children[i]->is_leaf()) {
+			count += node_obvh_inner_count(children[i]);
+		}
+	}
+	return count;
+}
+
+/* Quantize child bounds along a single axis. Bounds are rounded outwards, so
+ * de-quantized boxes always enclose the original ones. De-quantization uses
+ * fmaf() to match the FMA instruction used by the AVX2 kernel bit for bit.
+ */
+static void node_obvh_quantize_axis(const float *lower,
+                                    const float *upper,
+                                    const int child_mask,
+                                    float *r_origin,
+                                    float *r_step,
+                                    uchar *r_lower,
+                                    uchar *r_upper)
+{
+	float node_lower = FLT_MAX, node_upper = -FLT_MAX;
+	for(int i = 0; i < BVH_ONODE_CHILDREN; i++) {
+		if(child_mask & (1 << i)) {
+			node_lower = min(node_lower, lower[i]);
+			node_upper = max(node_upper, upper[i]);
+		}
+	}
+
+	if(child_mask == 0) {
+		node_lower = node_upper = 0.0f;
+	}
+
+	float step = (node_upper - node_lower) / 255.0f;
+	/* Make sure the grid covers the whole node despite of rounding. */
+	while(fmaf(255.0f, step, node_lower) < node_upper) {
+		step = nextafterf(step, FLT_MAX);
+	}
+
+	for(int i = 0; i < BVH_ONODE_CHILDREN; i++) {
+		int q_lower = 0, q_upper = 0;
+		if((child_mask & (1 << i)) && step > 0.0f) {
+			q_lower = clamp((int)floorf((lower[i] - node_lower) / step), 0, 255);
+			while(q_lower > 0 && fmaf((float)q_lower, step, node_lower) > lower[i]) {
+				q_lower--;
+			}
+			q_upper = clamp((int)ceilf((upper[i] - node_lower) / step), 0, 255);
+			while(q_upper < 255 && fmaf((float)q_upper, step, node_lower) < upper[i]) {
+				q_upper++;
+			}
+		}
+		r_lower[i] = (uchar)q_lower;
+		r_upper[i] = (uchar)q_upper;
+	}
+
+	*r_origin = node_lower;
+	*r_step = step;
+}
+
+BVH8::BVH8(const BVHParams& params_, const vector<Object*>& objects_)
+: BVH(params_, objects_)
+{
+	params.use_obvh = true;
+}
+
+void BVH8::pack_leaf(const BVHStackEntry& e, const LeafNode *leaf)
+{
+	float4 data[BVH_ONODE_LEAF_SIZE];
+	memset(data, 0, sizeof(data));
+	if(leaf->num_triangles() == 1 && pack.prim_index[leaf->lo] == -1) {
+		/* object */
+		data[0].x = __int_as_float(~(leaf->lo));
+		data[0].y = __int_as_float(0);
+	}
+	else {
+		/* triangle */
+		data[0].x = __int_as_float(leaf->lo);
+		data[0].y = __int_as_float(leaf->hi);
+	}
+	data[0].z = __uint_as_float(leaf->visibility);
+	if(leaf->num_triangles() != 0) {
+		data[0].w = __uint_as_float(pack.prim_type[leaf->lo]);
+	}
+
+	memcpy(&pack.leaf_nodes[e.idx], data, sizeof(float4)*BVH_ONODE_LEAF_SIZE);
+}
+
+void BVH8::pack_inner(const BVHStackEntry& e,
+                      const BVHStackEntry *en,
+                      int num)
+{
+	BoundBox bounds[BVH_ONODE_CHILDREN];
+	int child[BVH_ONODE_CHILDREN];
+	for(int i = 0; i < num; ++i) {
+		assert(!en[i].node->is_unaligned);
+		bounds[i] = en[i].node->bounds;
+		child[i] = en[i].encodeIdx();
+	}
+	pack_aligned_node(e.idx,
+	                  bounds,
+	                  child,
+	                  e.node->visibility,
+	                  e.node->time_from,
+	                  e.node->time_to,
+	                  num);
+}
+
+void BVH8::pack_aligned_node(int idx,
+                             const BoundBox *bounds,
+                             const int *child,
+                             const uint visibility,
+                             const float time_from,
+                             const float time_to,
+                             const int num)
+{
+	float4 data[BVH_ONODE_SIZE];
+	memset(data, 0, sizeof(data));
+
+	/* Children with empty bounds are never recorded as intersection, kernel
+	 * only tests children which are in this mask.
+	 */
+	int child_mask = 0;
+	for(int i = 0; i < num; i++) {
+		if(bounds[i].valid()) {
+			child_mask |= (1 << i);
+		}
+	}
+
+	data[0].x = __uint_as_float(visibility & ~PATH_RAY_NODE_UNALIGNED);
+	data[0].y = time_from;
+	data[0].z = time_to;
+	data[0].w = __int_as_float(child_mask);
+
+	for(int axis = 0; axis < 3; axis++) {
+		float lower[BVH_ONODE_CHILDREN], upper[BVH_ONODE_CHILDREN];
+		for(int i = 0; i < BVH_ONODE_CHILDREN; i++) {
+			lower[i] = (child_mask & (1 << i))? bounds[i].min[axis]: 0.0f;
+			upper[i] = (child_mask & (1 << i))? bounds[i].max[axis]: 0.0f;
+		}
+
+		uchar *q = (uchar*)&data[3 + axis];
+		node_obvh_quantize_axis(lower,
+		                        upper,
+		                        child_mask,
+		                        &data[1][axis],
+		                        &data[2][axis],
+		                        q,
+		                        q + BVH_ONODE_CHILDREN);
+	}
+
+	for(int i = 0; i < BVH_ONODE_CHILDREN; i++) {
+		data[6 + i/4][i%4] = __int_as_float((i < num)? child[i]: 0);
+	}
+
+	memcpy(&pack.nodes[idx], data, sizeof(float4)*BVH_ONODE_SIZE);
+}
+
+/* Octo SIMD Nodes */
+
+void BVH8::pack_nodes(const BVHNode *root)
+{
+	/* Calculate size of the arrays required. */
+	const size_t num_leaf_nodes = root->getSubtreeSize(BVH_STAT_LEAF_COUNT);
+	const size_t num_inner_nodes = root->is_leaf()? 0: node_obvh_inner_count(root);
+	const size_t node_size = num_inner_nodes * BVH_ONODE_SIZE;
+	/* Resize arrays. */
+	pack.nodes.clear();
+	pack.leaf_nodes.clear();
+	/* For top level BVH, first merge existing BVH's so we know the offsets. */
+	if(params.top_level) {
+		pack_instances(node_size, num_leaf_nodes*BVH_ONODE_LEAF_SIZE);
+	}
+	else {
+		pack.nodes.resize(node_size);
+		pack.leaf_nodes.resize(num_leaf_nodes*BVH_ONODE_LEAF_SIZE);
+	}
+
+	int nextNodeIdx = 0, nextLeafNodeIdx = 0;
+
+	vector<BVHStackEntry> stack;
+	stack.reserve(BVHParams::MAX_DEPTH*BVH_ONODE_CHILDREN);
+	if(root->is_leaf()) {
+		stack.push_back(BVHStackEntry(root, nextLeafNodeIdx++));
+	}
+	else {
+		stack.push_back(BVHStackEntry(root, nextNodeIdx));
+		nextNodeIdx += BVH_ONODE_SIZE;
+	}
+
+	while(stack.size()) {
+		BVHStackEntry e = stack.back();
+		stack.pop_back();
+
+		if(e.node->is_leaf()) {
+			/* leaf node */
+			const LeafNode *leaf = reinterpret_cast<const LeafNode*>(e.node);
+			pack_leaf(e, leaf);
+		}
+		else {
+			/* Inner node. */
+			const BVHNode *nodes[BVH_ONODE_CHILDREN];
+			const int numnodes = node_obvh_children(e.node, nodes);
+			/* Push entries on the stack. */
+			for(int i = 0; i < numnodes; ++i) {
+				int idx;
+				if(nodes[i]->is_leaf()) {
+					idx = nextLeafNodeIdx++;
+				}
+				else {
+					idx = nextNodeIdx;
+					nextNodeIdx += BVH_ONODE_SIZE;
+				}
+				stack.push_back(BVHStackEntry(nodes[i], idx));
+			}
+			/* Set node. */
+			pack_inner(e, &stack[stack.size()-numnodes], numnodes);
+		}
+	}
+	assert(node_size == nextNodeIdx);
+	/* Root index to start traversal at, to handle case of single leaf node. */
+	pack.root_index = (root->is_leaf())? -1: 0;
+}
+
+void BVH8::refit_nodes()
+{
+	assert(!params.top_level);
+
+	BoundBox bbox = BoundBox::empty;
+	uint visibility = 0;
+	refit_node(0, (pack.root_index == -1)? true: false, bbox, visibility);
+}
+
+void BVH8::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility)
+{
+	if(leaf) {
+		int4 *data = &pack.leaf_nodes[idx];
+		int4 c = data[0];
+		/* Refit leaf node. */
+		for(int prim = c.x; prim < c.y; prim++) {
+			int pidx = pack.prim_index[prim];
+			int tob = pack.prim_object[prim];
+			Object *ob = objects[tob];
+
+			if(pidx == -1) {
+				/* Object instance. */
+				bbox.grow(ob->bounds);
+			}
+			else {
+				/* Primitives. */
+				const Mesh *mesh = ob->mesh;
+
+				if(pack.prim_type[prim] & PRIMITIVE_ALL_CURVE) {
+					/* Curves. */
+					int str_offset = (params.top_level)? mesh->curve_offset: 0;
+					Mesh::Curve curve = mesh->get_curve(pidx - str_offset);
+					int k = PRIMITIVE_UNPACK_SEGMENT(pack.prim_type[prim]);
+
+					curve.bounds_grow(k, &mesh->curve_keys[0], &mesh->curve_radius[0], bbox);
+
+					visibility |= PATH_RAY_CURVE;
+
+					/* Motion curves. */
+					if(mesh->use_motion_blur) {
+						Attribute *attr = mesh->curve_attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
+
+						if(attr) {
+							size_t mesh_size = mesh->curve_keys.size();
+							size_t steps = mesh->motion_steps - 1;
+							float3 *key_steps = attr->data_float3();
+
+							for(size_t i = 0; i < steps; i++)
+								curve.bounds_grow(k, key_steps + i*mesh_size, &mesh->curve_radius[0], bbox);
+						}
+					}
+				}
+				else {
+					/* Triangles. */
+					int tri_offset = (params.top_level)? mesh->tri_offset: 0;
+					Mesh::Triangle triangle = mesh->get_triangle(pidx - tri_offset);
+					const float3 *vpos = &mesh->verts[0];
+
+					triangle.bounds_grow(vpos, bbox);
+
+					/* Motion triangles. */
+					if(mesh->use_motion_blur) {
+						Attribute *attr = mesh->attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
+
+						if(attr) {
+							size_t mesh_size = mesh->verts.size();
+							size_t steps = mesh->motion_steps - 1;
+							float3 *vert_steps = attr->data_float3();
+
+							for(size_t i = 0; i < steps; i++)
+								triangle.bounds_grow(vert_steps + i*mesh_size, bbox);
+						}
+					}
+				}
+			}
+
+			visibility |= ob->visibility;
+		}
+
+		/* Same as in BVH4::refit_node(), this duplicates pack_leaf(). */
+		float4 leaf_data[BVH_ONODE_LEAF_SIZE];
+		leaf_data[0].x = __int_as_float(c.x);
+		leaf_data[0].y = __int_as_float(c.y);
+		leaf_data[0].z = __uint_as_float(visibility);
+		leaf_data[0].w = __uint_as_float(c.w);
+		memcpy(&pack.leaf_nodes[idx], leaf_data, sizeof(float4)*BVH_ONODE_LEAF_SIZE);
+	}
+	else {
+		int4 *data = &pack.nodes[idx];
+		int child[BVH_ONODE_CHILDREN];
+		for(int i = 0; i < BVH_ONODE_CHILDREN; i++) {
+			child[i] = data[6 + i/4][i%4];
+		}
+		/* Refit inner node, set bbox from children. */
+		BoundBox child_bbox[BVH_ONODE_CHILDREN];
+		uint child_visibility[BVH_ONODE_CHILDREN] = {0};
+
+		for(int i = 0; i < BVH_ONODE_CHILDREN; ++i) {
+			child_bbox[i] = BoundBox::empty;
+			if(child[i] != 0) {
+				refit_node((child[i] < 0)? -child[i]-1: child[i], (child[i] < 0),
+				           child_bbox[i], child_visibility[i]);
+				bbox.grow(child_bbox[i]);
+				visibility |= child_visibility[i];
+			}
+		}
+
+		pack_aligned_node(idx,
+		                  child_bbox,
+		                  child,
+		                  visibility,
+		                  0.0f,
+		                  1.0f,
+		                  BVH_ONODE_CHILDREN);
+	}
+}
+
+CCL_NAMESPACE_END
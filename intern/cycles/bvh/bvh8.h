@@ -0,0 +1,83 @@
+/*
+ * Copyright 2011-2017, Blender Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BVH8_H__
+#define __BVH8_H__
+
+#include "bvh/bvh.h"
+#include "bvh/bvh_params.h"
+
+#include "util/util_types.h"
+#include "util/util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+class BVHNode;
+struct BVHStackEntry;
+class BVHParams;
+class BoundBox;
+class LeafNode;
+class Object;
+class Progress;
+
+#define BVH_ONODE_SIZE           8
+#define BVH_ONODE_LEAF_SIZE      1
+#define BVH_ONODE_CHILDREN       8
+
+/* BVH8
+ *
+ * Octo BVH, with each node having up to eight children, to use with AVX2
+ * instructions. Child bounds are quantized to 8 bits relative to the node
+ * bounds, so one node takes the same 128 bytes as a QBVH node while storing
+ * twice as many children:
+ *
+ *   data[0]    visibility, time_from, time_to, mask of stored children
+ *   data[1]    origin of the quantization grid
+ *   data[2]    size of a single quantization step along each axis
+ *   data[3..5] quantized lower (bytes 0-7) and upper (bytes 8-15) bounds
+ *              of the children along X, Y and Z
+ *   data[6..7] child node indices
+ *
+ * Unaligned nodes are not supported, hair BVH with oriented nodes uses QBVH.
+ */
+class BVH8 : public BVH {
+protected:
+	/* constructor */
+	friend class BVH;
+	BVH8(const BVHParams& params, const vector<Object*>& objects);
+
+	/* pack */
+	void pack_nodes(const BVHNode *root);
+
+	void pack_leaf(const BVHStackEntry& e, const LeafNode *leaf);
+	void pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num);
+
+	void pack_aligned_node(int idx,
+	                       const BoundBox *bounds,
+	                       const int *child,
+	                       const uint visibility,
+	                       const float time_from,
+	                       const float time_to,
+	                       const int num);
+
+	/* refit */
+	void refit_nodes();
+	void refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility);
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __BVH8_H__ */
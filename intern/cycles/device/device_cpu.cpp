@@ -27,6 +27,7 @@
 #include "kernel/kernel_oiio_globals.h"
 
 #include "device/device.h"
+#include "device/device_denoising.h"
 #include "device/device_intern.h"
 #include "device/device_split_kernel.h"
 
@@ -138,6 +139,152 @@ int flatten_coverage(KernelGlobals *kg, vector<map<float, float> > & coverage, c
 
 /* End coverage.cpp */
 
+/* Adaptive Sampling */
+
+/* Number of samples between convergence tests of a tile. */
+#define ADAPTIVE_SAMPLING_STEP 4
+
+static inline float *adaptive_pixel_buffer(KernelGlobals *kg, const RenderTile& tile, int x, int y)
+{
+	int index = tile.offset + tile.x + x + (tile.y + y)*tile.stride;
+	return (float*)tile.buffer + index*kg->__data.film.pass_stride;
+}
+
+/* Test which pixels of the tile converged and mark them so the kernel skips
+ * them from now on. The error of a pixel compares the estimate from all
+ * samples against the one from the odd samples only, following "A
+ * hierarchical automatic stopping condition for Monte Carlo global
+ * illumination". A pixel only converges along with its direct neighbors, to
+ * avoid sharp transitions in noise level. Returns true when all pixels of
+ * the tile converged. */
+static bool adaptive_sampling_update(KernelGlobals *kg, const RenderTile& tile)
+{
+	const int pass_combined = kg->__data.film.pass_combined;
+	const int pass_adaptive = kg->__data.film.pass_adaptive;
+	const float threshold = kg->__data.integrator.adaptive_threshold;
+
+	vector<bool> noisy(tile.w*tile.h, false);
+
+	for(int y = 0; y < tile.h; y++) {
+		for(int x = 0; x < tile.w; x++) {
+			float *buffer = adaptive_pixel_buffer(kg, tile, x, y);
+			float *adaptive = buffer + pass_adaptive;
+
+			if(adaptive[4] != 0.0f) {
+				continue;
+			}
+
+			const float num_samples = adaptive[3];
+			const float num_odd_samples = floorf(num_samples*0.5f);
+			if(num_odd_samples == 0.0f) {
+				noisy[x + y*tile.w] = true;
+				continue;
+			}
+
+			/* Both estimates scaled to the full number of samples. */
+			float3 I = make_float3(buffer[pass_combined + 0],
+			                       buffer[pass_combined + 1],
+			                       buffer[pass_combined + 2]);
+			float3 A = make_float3(adaptive[0], adaptive[1], adaptive[2]) *
+			           (num_samples/num_odd_samples);
+
+			float error = (fabsf(I.x - A.x) + fabsf(I.y - A.y) + fabsf(I.z - A.z)) /
+			              (num_samples*1e-4f + sqrtf(max(I.x + I.y + I.z, 0.0f)));
+
+			/* Written so NaN counts as noisy. */
+			if(!(error < threshold*num_samples)) {
+				noisy[x + y*tile.w] = true;
+			}
+		}
+	}
+
+	bool all_converged = true;
+
+	for(int y = 0; y < tile.h; y++) {
+		for(int x = 0; x < tile.w; x++) {
+			float *adaptive = adaptive_pixel_buffer(kg, tile, x, y) + pass_adaptive;
+
+			if(adaptive[4] != 0.0f) {
+				continue;
+			}
+
+			const int i = x + y*tile.w;
+			if(noisy[i] ||
+			   (x > 0 && noisy[i - 1]) ||
+			   (x < tile.w - 1 && noisy[i + 1]) ||
+			   (y > 0 && noisy[i - tile.w]) ||
+			   (y < tile.h - 1 && noisy[i + tile.w]))
+			{
+				all_converged = false;
+			}
+			else {
+				adaptive[4] = 1.0f;
+			}
+		}
+	}
+
+	return all_converged;
+}
+
+/* Scale the passes of converged pixels as if they had been rendered with all
+ * samples of the tile, so they can be read out like any other pixel. Passes
+ * which are only written once and cryptomatte ids are left alone. */
+static void adaptive_sampling_post_adjust(KernelGlobals *kg, const RenderTile& tile)
+{
+	const KernelFilm& film = kg->__data.film;
+	const float num_samples = (float)(tile.sample - tile.start_sample);
+
+	vector<bool> scale_pass(film.pass_adaptive, true);
+
+	if(film.pass_flag & PASS_DEPTH) {
+		scale_pass[film.pass_depth] = false;
+	}
+	if(film.pass_flag & PASS_OBJECT_ID) {
+		scale_pass[film.pass_object_id] = false;
+	}
+	if(film.pass_flag & PASS_MATERIAL_ID) {
+		scale_pass[film.pass_material_id] = false;
+	}
+
+	/* Cryptomatte passes come first among the AOVs, each storing two id and
+	 * weight pairs. */
+	int num_crypto_types = 0;
+	num_crypto_types += (film.use_cryptomatte & CRYPT_OBJECT) != 0;
+	num_crypto_types += (film.use_cryptomatte & CRYPT_OBJECT_PASS_INDEX) != 0;
+	num_crypto_types += (film.use_cryptomatte & CRYPT_MATERIAL) != 0;
+	num_crypto_types += (film.use_cryptomatte & CRYPT_MATERIAL_PASS_INDEX) != 0;
+	num_crypto_types += (film.use_cryptomatte & CRYPT_ASSET) != 0;
+	const int num_crypto_passes = num_crypto_types * (film.use_cryptomatte & 255);
+	for(int i = 0; i < num_crypto_passes; i++) {
+		int offset = film.pass_aov[i] & ~(1 << 31);
+		scale_pass[offset + 0] = false;
+		scale_pass[offset + 2] = false;
+	}
+
+	for(int y = 0; y < tile.h; y++) {
+		for(int x = 0; x < tile.w; x++) {
+			float *buffer = adaptive_pixel_buffer(kg, tile, x, y);
+			float *adaptive = buffer + film.pass_adaptive;
+
+			if(adaptive[4] == 0.0f) {
+				continue;
+			}
+
+			if(adaptive[3] > 0.0f && adaptive[3] < num_samples) {
+				const float scale = num_samples/adaptive[3];
+				for(int i = 0; i < film.pass_adaptive; i++) {
+					if(scale_pass[i]) {
+						buffer[i] *= scale;
+					}
+				}
+			}
+
+			/* Passes now hold the full number of samples. */
+			adaptive[4] = 0.0f;
+		}
+	}
+}
+
 class CPUDevice;
 
 class CPUSplitKernel : public DeviceSplitKernel {
@@ -456,39 +603,46 @@ public:
 		RenderTile tile;
 
 		void(*path_trace_kernel)(KernelGlobals*, float*, unsigned int*, int, int, int, int, int);
+		void(*path_trace_stream_kernel)(KernelGlobals*, float*, unsigned int*, int, int, int, int, int, int);
 
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX2
 		if(system_cpu_support_avx2()) {
 			path_trace_kernel = kernel_cpu_avx2_path_trace;
+			path_trace_stream_kernel = kernel_cpu_avx2_path_trace_stream;
 		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX
 		if(system_cpu_support_avx()) {
 			path_trace_kernel = kernel_cpu_avx_path_trace;
+			path_trace_stream_kernel = kernel_cpu_avx_path_trace_stream;
 		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE41
 		if(system_cpu_support_sse41()) {
 			path_trace_kernel = kernel_cpu_sse41_path_trace;
+			path_trace_stream_kernel = kernel_cpu_sse41_path_trace_stream;
 		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE3
 		if(system_cpu_support_sse3()) {
 			path_trace_kernel = kernel_cpu_sse3_path_trace;
+			path_trace_stream_kernel = kernel_cpu_sse3_path_trace_stream;
 		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE2
 		if(system_cpu_support_sse2()) {
 			path_trace_kernel = kernel_cpu_sse2_path_trace;
+			path_trace_stream_kernel = kernel_cpu_sse2_path_trace_stream;
 		}
 		else
 #endif
 		{
 			path_trace_kernel = kernel_cpu_path_trace;
+			path_trace_stream_kernel = kernel_cpu_path_trace_stream;
 		}
 
 		/* cryptomatte data. This needs a better place than here. */
@@ -528,6 +682,11 @@ public:
 			uint *rng_state = (uint*)tile.rng_state;
 			int start_sample = tile.start_sample;
 			int end_sample = tile.start_sample + tile.num_samples;
+			/* Accurate cryptomatte needs coverage set up for every pixel. */
+			const bool use_ray_stream = kg.__data.bvh.use_ray_stream &&
+			                            !(kg.__data.film.use_cryptomatte & CRYPT_ACCURATE);
+			const bool use_adaptive_sampling = kg.__data.film.pass_adaptive &&
+			                                   kg.__data.integrator.adaptive_threshold > 0.0f;
 
 			for(int sample = start_sample; sample < end_sample; sample++) {
 				if(task.get_cancel() || task_pool.canceled()) {
@@ -536,6 +695,16 @@ public:
 				}
 
 				for(int y = tile.y; y < tile.y + tile.h; y++) {
+					if(use_ray_stream) {
+						for(int x = tile.x; x < tile.x + tile.w; x += BVH_STREAM_SIZE) {
+							path_trace_stream_kernel(&kg, render_buffer, rng_state,
+							                         sample, x, y,
+							                         min(BVH_STREAM_SIZE, tile.x + tile.w - x),
+							                         tile.offset, tile.stride);
+						}
+						continue;
+					}
+
 					for(int x = tile.x; x < tile.x + tile.w; x++) {
 						if(kg.__data.film.use_cryptomatte & CRYPT_ACCURATE) {
 							if(kg.__data.film.use_cryptomatte & CRYPT_OBJECT) {
@@ -561,6 +730,21 @@ public:
 
 				tile.sample = sample + 1;
 
+				/* Stop once all pixels of the tile converged, the thread then
+				 * continues with the next tile. */
+				int num_samples = 1;
+
+				if(use_adaptive_sampling &&
+				   tile.sample < end_sample &&
+				   tile.sample - start_sample >= kg.__data.integrator.adaptive_min_samples &&
+				   (tile.sample - start_sample) % ADAPTIVE_SAMPLING_STEP == 0)
+				{
+					if(adaptive_sampling_update(&kg, tile)) {
+						num_samples += end_sample - tile.sample;
+						tile.sample = end_sample;
+					}
+				}
+
 				if(tile.sample == end_sample) {
 					int aov_index = 0;
 					if(kg.__data.film.use_cryptomatte & CRYPT_ACCURATE) {
@@ -580,9 +764,31 @@ public:
 							aov_index += flatten_coverage(&kg, coverage_asset, tile, aov_index);
 						}
 					}
+
+					/* After flattening the coverage, so the cryptomatte weights
+					 * of converged pixels get scaled as well. */
+					if(use_adaptive_sampling) {
+						adaptive_sampling_post_adjust(&kg, tile);
+					}
+
+					/* With progressive refine the tile gets more samples later on,
+					 * so it can't be denoised in place. */
+					if(kg.__data.film.denoising_radius > 0 && !task.need_finish_queue) {
+						DenoiseParams params;
+						params.radius = kg.__data.film.denoising_radius;
+						params.strength = kg.__data.film.denoising_strength;
+						params.feature_strength = kg.__data.film.denoising_feature_strength;
+						params.pass_stride = kg.__data.film.pass_stride;
+						params.pass_denoising = kg.__data.film.pass_denoising;
+						denoise_tile(params, tile, tile.sample - tile.start_sample);
+					}
 				}
 
-				task.update_progress(&tile, tile.w*tile.h);
+				task.update_progress(&tile, tile.w*tile.h*num_samples);
+
+				if(tile.sample == end_sample) {
+					break;
+				}
 			}
 
 			task.release_tile(tile);
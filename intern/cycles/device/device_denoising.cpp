@@ -0,0 +1,296 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Feature guided NL-means filter, following "Robust Denoising using Feature
+ * and Color Information" by Rousselle et al.
+ *
+ * Every pixel is replaced by a weighted average of the pixels in a window
+ * around it. Weights fall off with the difference of the color patches
+ * around both pixels and with the difference of their normal, albedo and
+ * depth features, both normalized by the variance estimated by the kernel.
+ *
+ * The filter loops over all offsets of the window, and for each offset runs
+ * over the rows of planar images. These inner loops have no dependencies
+ * between pixels, so the compiler vectorizes them for the host instruction
+ * set.
+ */
+
+#include "device/device_denoising.h"
+
+#include "render/buffers.h"
+
+#include "util/util_math.h"
+#include "util/util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Radius of the color patches compared for each pair of pixels. */
+#define DENOISE_PATCH_RADIUS 2
+
+/* Offsets of the feature passes within the denoising data, means are
+ * followed by the sum of squares. */
+#define DENOISE_PASS_NORMAL 0
+#define DENOISE_PASS_ALBEDO 6
+#define DENOISE_PASS_DEPTH 12
+#define DENOISE_PASS_IMAGE 20
+
+namespace {
+
+/* Planar copy of the tile, every channel is stored as a separate image. */
+class DenoiseBuffer {
+public:
+	enum Channel {
+		COLOR_R = 0,
+		COLOR_G,
+		COLOR_B,
+		COLOR_VAR,
+		NORMAL_X,
+		NORMAL_Y,
+		NORMAL_Z,
+		NORMAL_VAR,
+		ALBEDO_R,
+		ALBEDO_G,
+		ALBEDO_B,
+		ALBEDO_VAR,
+		DEPTH,
+		DEPTH_VAR,
+
+		NUM_CHANNELS
+	};
+
+	DenoiseBuffer(int w, int h)
+	: w(w), h(h), data(w*h*NUM_CHANNELS)
+	{
+	}
+
+	float *channel(int c) { return &data[c*w*h]; }
+
+	int w, h;
+	vector<float> data;
+};
+
+/* Read the mean of a feature pass and the variance of that mean. Features
+ * with multiple components share a single variance, the average of all
+ * components. */
+void read_feature(const float *pass, int components, float inv_samples,
+                  float *mean, float *variance)
+{
+	float var = 0.0f;
+	for(int i = 0; i < components; i++) {
+		mean[i] = pass[i]*inv_samples;
+		var += max(0.0f, pass[components + i]*inv_samples - mean[i]*mean[i]);
+	}
+	*variance = var*inv_samples/components;
+}
+
+void load_tile(const DenoiseParams& params,
+               const RenderTile& tile,
+               int num_samples,
+               DenoiseBuffer& buf)
+{
+	const float inv_samples = 1.0f/num_samples;
+	const int n = tile.w*tile.h;
+
+	for(int y = 0; y < tile.h; y++) {
+		for(int x = 0; x < tile.w; x++) {
+			int index = tile.offset + tile.x + x + (tile.y + y)*tile.stride;
+			const float *pass = (float*)tile.buffer + index*params.pass_stride + params.pass_denoising;
+			float *pixel = buf.channel(0) + y*tile.w + x;
+			float mean[3], var;
+
+			read_feature(pass + DENOISE_PASS_IMAGE, 3, inv_samples, mean, &var);
+			pixel[DenoiseBuffer::COLOR_R*n] = mean[0];
+			pixel[DenoiseBuffer::COLOR_G*n] = mean[1];
+			pixel[DenoiseBuffer::COLOR_B*n] = mean[2];
+			pixel[DenoiseBuffer::COLOR_VAR*n] = var;
+
+			read_feature(pass + DENOISE_PASS_NORMAL, 3, inv_samples, mean, &var);
+			pixel[DenoiseBuffer::NORMAL_X*n] = mean[0];
+			pixel[DenoiseBuffer::NORMAL_Y*n] = mean[1];
+			pixel[DenoiseBuffer::NORMAL_Z*n] = mean[2];
+			pixel[DenoiseBuffer::NORMAL_VAR*n] = var;
+
+			read_feature(pass + DENOISE_PASS_ALBEDO, 3, inv_samples, mean, &var);
+			pixel[DenoiseBuffer::ALBEDO_R*n] = mean[0];
+			pixel[DenoiseBuffer::ALBEDO_G*n] = mean[1];
+			pixel[DenoiseBuffer::ALBEDO_B*n] = mean[2];
+			pixel[DenoiseBuffer::ALBEDO_VAR*n] = var;
+
+			read_feature(pass + DENOISE_PASS_DEPTH, 1, inv_samples, mean, &var);
+			pixel[DenoiseBuffer::DEPTH*n] = mean[0];
+			pixel[DenoiseBuffer::DEPTH_VAR*n] = var;
+		}
+	}
+}
+
+/* Normalized squared difference of a feature between two pixels, with the
+ * expected difference due to noise removed. */
+inline float feature_distance(float diff2, float var_p, float var_q, float k2, float tau)
+{
+	return (diff2 - (var_p + min(var_p, var_q))) / (k2*max(tau, var_p + var_q));
+}
+
+/* Average of the distance image over the patch around each pixel, clamped to
+ * the rectangle the distances were computed in. */
+void box_filter(float *dist, float *temp, int w, int x0, int x1, int y0, int y1)
+{
+	const int f = DENOISE_PATCH_RADIUS;
+
+	for(int y = y0; y < y1; y++) {
+		const float *in = dist + y*w;
+		float *out = temp + y*w;
+		for(int x = x0; x < x1; x++) {
+			const int lo = max(x - f, x0), hi = min(x + f + 1, x1);
+			float sum = 0.0f;
+			for(int i = lo; i < hi; i++) {
+				sum += in[i];
+			}
+			out[x] = sum/(hi - lo);
+		}
+	}
+
+	for(int y = y0; y < y1; y++) {
+		const int lo = max(y - f, y0), hi = min(y + f + 1, y1);
+		const float inv_count = 1.0f/(hi - lo);
+		float *out = dist + y*w;
+		for(int x = x0; x < x1; x++) {
+			out[x] = 0.0f;
+		}
+		for(int i = lo; i < hi; i++) {
+			const float *in = temp + i*w;
+			for(int x = x0; x < x1; x++) {
+				out[x] += in[x];
+			}
+		}
+		for(int x = x0; x < x1; x++) {
+			out[x] *= inv_count;
+		}
+	}
+}
+
+}  /* namespace */
+
+void denoise_tile(const DenoiseParams& params, const RenderTile& tile, int num_samples)
+{
+	if(params.radius <= 0 || num_samples <= 0 || tile.w <= 0 || tile.h <= 0) {
+		return;
+	}
+
+	const int w = tile.w, h = tile.h, n = w*h;
+	const int r = params.radius;
+
+	/* Map strengths to the scale of the distances, so 0.5 gives a factor 1. */
+	const float k2 = powf(2.0f, 8.0f*params.strength - 4.0f);
+	const float kf2 = powf(2.0f, 8.0f*params.feature_strength - 4.0f);
+
+	DenoiseBuffer buf(w, h);
+	load_tile(params, tile, num_samples, buf);
+
+	const float *color[3] = {buf.channel(DenoiseBuffer::COLOR_R),
+	                         buf.channel(DenoiseBuffer::COLOR_G),
+	                         buf.channel(DenoiseBuffer::COLOR_B)};
+	const float *color_var = buf.channel(DenoiseBuffer::COLOR_VAR);
+	const float *normal[3] = {buf.channel(DenoiseBuffer::NORMAL_X),
+	                          buf.channel(DenoiseBuffer::NORMAL_Y),
+	                          buf.channel(DenoiseBuffer::NORMAL_Z)};
+	const float *normal_var = buf.channel(DenoiseBuffer::NORMAL_VAR);
+	const float *albedo[3] = {buf.channel(DenoiseBuffer::ALBEDO_R),
+	                          buf.channel(DenoiseBuffer::ALBEDO_G),
+	                          buf.channel(DenoiseBuffer::ALBEDO_B)};
+	const float *albedo_var = buf.channel(DenoiseBuffer::ALBEDO_VAR);
+	const float *depth = buf.channel(DenoiseBuffer::DEPTH);
+	const float *depth_var = buf.channel(DenoiseBuffer::DEPTH_VAR);
+
+	vector<float> dist(n), temp(n);
+	vector<float> accum(3*n, 0.0f), weight_sum(n, 0.0f);
+
+	for(int dy = -r; dy <= r; dy++) {
+		for(int dx = -r; dx <= r; dx++) {
+			/* Pixels p for which the neighbor q = p + offset is inside the tile. */
+			const int x0 = max(0, -dx), x1 = min(w, w - dx);
+			const int y0 = max(0, -dy), y1 = min(h, h - dy);
+			if(x0 >= x1 || y0 >= y1) {
+				continue;
+			}
+			const int d = dx + dy*w;
+
+			/* Color distance per pixel, averaged over patches afterwards. */
+			for(int y = y0; y < y1; y++) {
+				for(int p = y*w + x0; p < y*w + x1; p++) {
+					const int q = p + d;
+					const float var_p = color_var[p], var_q = color_var[q];
+					const float var_cancel = var_p + min(var_p, var_q);
+					const float norm = 1.0f/(1e-10f + k2*(var_p + var_q));
+					float sum = 0.0f;
+					for(int c = 0; c < 3; c++) {
+						const float diff = color[c][p] - color[c][q];
+						sum += (diff*diff - var_cancel)*norm;
+					}
+					dist[p] = sum*(1.0f/3.0f);
+				}
+			}
+
+			box_filter(&dist[0], &temp[0], w, x0, x1, y0, y1);
+
+			/* Combine with feature distances and accumulate. */
+			for(int y = y0; y < y1; y++) {
+				for(int p = y*w + x0; p < y*w + x1; p++) {
+					const int q = p + d;
+					float diff2;
+
+					diff2 = (sqr(normal[0][p] - normal[0][q]) +
+					         sqr(normal[1][p] - normal[1][q]) +
+					         sqr(normal[2][p] - normal[2][q]))*(1.0f/3.0f);
+					float df = feature_distance(diff2, normal_var[p], normal_var[q], kf2, 1e-3f);
+
+					diff2 = (sqr(albedo[0][p] - albedo[0][q]) +
+					         sqr(albedo[1][p] - albedo[1][q]) +
+					         sqr(albedo[2][p] - albedo[2][q]))*(1.0f/3.0f);
+					df = max(df, feature_distance(diff2, albedo_var[p], albedo_var[q], kf2, 1e-3f));
+
+					/* Depth differences are relative to the distance of the pixel. */
+					diff2 = sqr(depth[p] - depth[q]);
+					df = max(df, feature_distance(diff2, depth_var[p], depth_var[q], kf2,
+					                              max(1e-4f*sqr(depth[p]), 1e-8f)));
+
+					const float weight = expf(-max(0.0f, max(dist[p], df)));
+
+					accum[p] += weight*color[0][q];
+					accum[n + p] += weight*color[1][q];
+					accum[2*n + p] += weight*color[2][q];
+					weight_sum[p] += weight;
+				}
+			}
+		}
+	}
+
+	/* Write back into the combined pass, which holds the sum of all samples.
+	 * The center pixel always has weight one, so the sum is never zero. */
+	for(int y = 0; y < h; y++) {
+		for(int x = 0; x < w; x++) {
+			const int p = y*w + x;
+			int index = tile.offset + tile.x + x + (tile.y + y)*tile.stride;
+			float *combined = (float*)tile.buffer + index*params.pass_stride;
+			const float scale = num_samples/weight_sum[p];
+
+			combined[0] = accum[p]*scale;
+			combined[1] = accum[n + p]*scale;
+			combined[2] = accum[2*n + p]*scale;
+		}
+	}
+}
+
+CCL_NAMESPACE_END
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DEVICE_DENOISING_H__
+#define __DEVICE_DENOISING_H__
+
+#include "util/util_types.h"
+
+CCL_NAMESPACE_BEGIN
+
+class RenderTile;
+
+/* Denoising Parameters
+ *
+ * Layout of the render buffer and filter settings, taken from the film. */
+
+class DenoiseParams {
+public:
+	/* Half size of the filter window in pixels. */
+	int radius;
+	/* Filter strength for the color and feature differences, 0..1. */
+	float strength;
+	float feature_strength;
+
+	int pass_stride;
+	int pass_denoising;
+
+	DenoiseParams()
+	{
+		radius = 8;
+		strength = 0.5f;
+		feature_strength = 0.5f;
+		pass_stride = 0;
+		pass_denoising = 0;
+	}
+};
+
+/* Denoise the combined pass of a finished tile in place, using the feature
+ * passes written by the kernel. Only pixels of the tile itself are used as
+ * input, so this runs as soon as the tile is done. */
+void denoise_tile(const DenoiseParams& params, const RenderTile& tile, int num_samples);
+
+CCL_NAMESPACE_END
+
+#endif /* __DEVICE_DENOISING_H__ */
@@ -38,6 +38,16 @@ CCL_NAMESPACE_BEGIN
 #  include "kernel/bvh/qbvh_nodes.h"
 #endif
 
+/* Common OBVH functions. */
+#ifdef __OBVH__
+#  include "kernel/bvh/obvh_nodes.h"
+#endif
+
+/* Packet traversal of coherent ray streams. */
+#ifdef __RAY_STREAM__
+#  include "kernel/bvh/qbvh_stream.h"
+#endif
+
 /* Regular BVH traversal */
 
 #include "kernel/bvh/bvh_nodes.h"
@@ -218,6 +228,36 @@ ccl_device_intersect bool scene_intersect(KernelGlobals *kg,
 #endif /* __KERNEL_CPU__ */
 }
 
+#ifdef __RAY_STREAM__
+/* Packet traversal only handles static triangles in an axis-aligned QBVH,
+ * other scenes trace rays one by one with scene_intersect().
+ */
+ccl_device_inline bool scene_intersect_stream_supported(KernelGlobals *kg)
+{
+#ifdef __EMBREE__
+	if(kernel_data.bvh.scene) {
+		return false;
+	}
+#endif /* __EMBREE__ */
+	return kernel_data.bvh.use_ray_stream &&
+	       kernel_data.bvh.use_qbvh &&
+	       !kernel_data.bvh.use_obvh &&
+	       !kernel_data.bvh.have_motion &&
+	       !kernel_data.bvh.have_curves;
+}
+
+/* Intersect up to BVH_STREAM_SIZE rays with the same visibility at once. */
+ccl_device_inline void scene_intersect_stream(KernelGlobals *kg,
+                                              const Ray *rays,
+                                              Intersection *isects,
+                                              const uint visibility,
+                                              const int num_rays)
+{
+	kernel_assert(scene_intersect_stream_supported(kg));
+	qbvh_intersect_stream(kg, rays, isects, visibility, num_rays);
+}
+#endif /* __RAY_STREAM__ */
+
 #ifdef __SUBSURFACE__
 /* Note: ray is passed by value to work around a possible CUDA compiler bug. */
 ccl_device_intersect void scene_intersect_subsurface(KernelGlobals *kg,
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2011-2017, Blender Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Wide (8 children) BVH nodes with quantized child bounds, see bvh/bvh8.h
+ * for the memory layout.
+ */
+
+struct OBVHStackItem {
+	int addr;
+	float dist;
+};
+
+/* Sort stack items so the closest one ends up on top of the stack. Used for
+ * the rare case of more than two children being hit, so simple insertion
+ * sort is good enough here.
+ */
+ccl_device_inline void obvh_stack_sort(OBVHStackItem *s_first,
+                                       OBVHStackItem *s_last)
+{
+	for(OBVHStackItem *s = s_first + 1; s <= s_last; ++s) {
+		const OBVHStackItem item = *s;
+		OBVHStackItem *t = s;
+		while(t > s_first && (t - 1)->dist < item.dist) {
+			*t = *(t - 1);
+			--t;
+		}
+		*t = item;
+	}
+}
+
+/* Unpack lower and upper quantized bounds of all 8 children along one axis. */
+ccl_device_inline void obvh_node_unpack_axis(const ssei& q,
+                                             avxf *ccl_restrict lower,
+                                             avxf *ccl_restrict upper)
+{
+	*lower = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(q));
+	*upper = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(q, 8)));
+}
+
+/* Calculate entry and exit distances of the ray for all 8 child boxes.
+ *
+ * Child bounds are de-quantized first and then go through the same slab test
+ * as QBVH, so rays parallel to an axis (infinite idir) behave exactly the
+ * same as with other BVH layouts.
+ */
+ccl_device_inline void obvh_node_slabs(KernelGlobals *ccl_restrict kg,
+                                       const float3& P,
+                                       const float3& idir,
+                                       const int node_addr,
+                                       avxf *ccl_restrict tnear,
+                                       avxf *ccl_restrict tfar)
+{
+	const float4 origin = kernel_tex_fetch(__bvh_nodes, node_addr+1);
+	const float4 scale = kernel_tex_fetch(__bvh_nodes, node_addr+2);
+	const float3 P_idir = P*idir;
+
+	avxf lower, upper;
+
+	obvh_node_unpack_axis(kernel_tex_fetch_ssei(__bvh_nodes, node_addr+3), &lower, &upper);
+	const avxf t0_x = msub(madd(lower, avxf(scale.x), avxf(origin.x)), avxf(idir.x), avxf(P_idir.x));
+	const avxf t1_x = msub(madd(upper, avxf(scale.x), avxf(origin.x)), avxf(idir.x), avxf(P_idir.x));
+
+	obvh_node_unpack_axis(kernel_tex_fetch_ssei(__bvh_nodes, node_addr+4), &lower, &upper);
+	const avxf t0_y = msub(madd(lower, avxf(scale.y), avxf(origin.y)), avxf(idir.y), avxf(P_idir.y));
+	const avxf t1_y = msub(madd(upper, avxf(scale.y), avxf(origin.y)), avxf(idir.y), avxf(P_idir.y));
+
+	obvh_node_unpack_axis(kernel_tex_fetch_ssei(__bvh_nodes, node_addr+5), &lower, &upper);
+	const avxf t0_z = msub(madd(lower, avxf(scale.z), avxf(origin.z)), avxf(idir.z), avxf(P_idir.z));
+	const avxf t1_z = msub(madd(upper, avxf(scale.z), avxf(origin.z)), avxf(idir.z), avxf(P_idir.z));
+
+	*tnear = max(max(min(t0_x, t1_x), min(t0_y, t1_y)), min(t0_z, t1_z));
+	*tfar = min(min(max(t0_x, t1_x), max(t0_y, t1_y)), max(t0_z, t1_z));
+}
+
+/* Bitmask of the children which are actually stored in the node. */
+ccl_device_inline int obvh_node_child_mask(KernelGlobals *ccl_restrict kg,
+                                           const int node_addr)
+{
+	return __float_as_int(kernel_tex_fetch(__bvh_nodes, node_addr).w);
+}
+
+ccl_device_inline int obvh_node_intersect(KernelGlobals *ccl_restrict kg,
+                                          const avxf& isect_near,
+                                          const avxf& isect_far,
+                                          const float3& P,
+                                          const float3& idir,
+                                          const int node_addr,
+                                          avxf *ccl_restrict dist)
+{
+	avxf tnear, tfar;
+	obvh_node_slabs(kg, P, idir, node_addr, &tnear, &tfar);
+	tnear = max(tnear, isect_near);
+	tfar = min(tfar, isect_far);
+	*dist = tnear;
+	return movemask(tnear <= tfar) & obvh_node_child_mask(kg, node_addr);
+}
+
+ccl_device_inline int obvh_node_intersect_robust(KernelGlobals *ccl_restrict kg,
+                                                 const avxf& isect_near,
+                                                 const avxf& isect_far,
+                                                 const float3& P,
+                                                 const float3& idir,
+                                                 const int node_addr,
+                                                 const float difl,
+                                                 avxf *ccl_restrict dist)
+{
+	avxf tnear, tfar;
+	obvh_node_slabs(kg, P, idir, node_addr, &tnear, &tfar);
+	tnear = max(tnear, isect_near);
+	tfar = min(tfar, isect_far);
+	const float round_down = 1.0f - difl;
+	const float round_up = 1.0f + difl;
+	*dist = tnear;
+	return movemask(round_down*tnear <= round_up*tfar) & obvh_node_child_mask(kg, node_addr);
+}
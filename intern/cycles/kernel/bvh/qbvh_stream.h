@@ -0,0 +1,301 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Packet traversal of the QBVH, used for streams of coherent camera rays.
+ *
+ * All rays of the packet walk the tree together: every node is fetched once
+ * and tested against each active ray, children are only visited by the rays
+ * which hit them. This saves memory bandwidth and node fetches when rays are
+ * coherent, while the result is the same closest hit as with single ray
+ * traversal.
+ *
+ * Only static triangle scenes are supported, motion blur and hair use the
+ * regular traversal, see scene_intersect_stream_supported().
+ */
+
+struct QBVHStreamStackItem {
+	int addr;
+	uint ray_mask;
+};
+
+/* Per-ray traversal data, in the space of the current instance. */
+struct QBVHStreamRay {
+	float3 P;
+	float3 dir;
+	float3 idir;
+	sse3f idir4;
+#ifdef __KERNEL_AVX2__
+	sse3f P_idir4;
+#else
+	sse3f org4;
+#endif
+	int near_x, near_y, near_z;
+	int far_x, far_y, far_z;
+};
+
+ccl_device_inline void qbvh_stream_ray_update(QBVHStreamRay *sray)
+{
+	sray->idir4 = sse3f(ssef(sray->idir.x), ssef(sray->idir.y), ssef(sray->idir.z));
+#ifdef __KERNEL_AVX2__
+	const float3 P_idir = sray->P*sray->idir;
+	sray->P_idir4 = sse3f(ssef(P_idir.x), ssef(P_idir.y), ssef(P_idir.z));
+#else
+	sray->org4 = sse3f(ssef(sray->P.x), ssef(sray->P.y), ssef(sray->P.z));
+#endif
+	qbvh_near_far_idx_calc(sray->idir,
+	                       &sray->near_x, &sray->near_y, &sray->near_z,
+	                       &sray->far_x, &sray->far_y, &sray->far_z);
+}
+
+ccl_device_noinline void qbvh_intersect_stream(KernelGlobals *kg,
+                                               const Ray *rays,
+                                               Intersection *isects,
+                                               const uint visibility,
+                                               const int num_rays)
+{
+	kernel_assert(num_rays <= BVH_STREAM_SIZE);
+
+	QBVHStreamRay srays[BVH_STREAM_SIZE];
+
+	/* Traversal stack, every item stores which rays are to visit the node. */
+	QBVHStreamStackItem traversal_stack[BVH_QSTACK_SIZE];
+	traversal_stack[0].addr = ENTRYPOINT_SENTINEL;
+	traversal_stack[0].ray_mask = 0;
+
+	int stack_ptr = 0;
+	int node_addr = kernel_data.bvh.root;
+	uint ray_mask = 0;
+	int object = OBJECT_NONE;
+
+	for(int i = 0; i < num_rays; i++) {
+		Intersection *isect = &isects[i];
+		isect->t = rays[i].t;
+		isect->u = 0.0f;
+		isect->v = 0.0f;
+		isect->prim = PRIM_NONE;
+		isect->object = OBJECT_NONE;
+
+		BVH_DEBUG_INIT();
+
+#ifndef __KERNEL_SSE41__
+		if(!isfinite(rays[i].P.x)) {
+			continue;
+		}
+#endif
+
+		srays[i].P = rays[i].P;
+		srays[i].dir = bvh_clamp_direction(rays[i].D);
+		srays[i].idir = bvh_inverse_direction(srays[i].dir);
+		qbvh_stream_ray_update(&srays[i]);
+
+		ray_mask |= (1 << i);
+	}
+
+	if(ray_mask == 0) {
+		return;
+	}
+
+	/* Traversal loop. */
+	do {
+		do {
+			/* Traverse internal nodes. */
+			while(node_addr >= 0 && node_addr != ENTRYPOINT_SENTINEL) {
+#ifdef __VISIBILITY_FLAG__
+				float4 inodes = kernel_tex_fetch(__bvh_nodes, node_addr+0);
+				if((__float_as_uint(inodes.x) & visibility) == 0) {
+					/* Pop. */
+					node_addr = traversal_stack[stack_ptr].addr;
+					ray_mask = traversal_stack[stack_ptr].ray_mask;
+					--stack_ptr;
+					continue;
+				}
+#endif
+
+				/* Test children against every active ray, gathering which
+				 * rays hit each child and the closest entry distance.
+				 */
+				uint child_rays[4] = {0, 0, 0, 0};
+				float child_dist[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+
+				uint mask = ray_mask;
+				while(mask != 0) {
+					const uint i = __bscf(mask);
+					const QBVHStreamRay *sray = &srays[i];
+					Intersection *isect = &isects[i];
+					ssef dist;
+
+					BVH_DEBUG_NEXT_NODE();
+
+					int child_mask = qbvh_aligned_node_intersect(kg,
+					                                             ssef(0.0f),
+					                                             ssef(isect->t),
+#ifdef __KERNEL_AVX2__
+					                                             sray->P_idir4,
+#else
+					                                             sray->org4,
+#endif
+					                                             sray->idir4,
+					                                             sray->near_x, sray->near_y, sray->near_z,
+					                                             sray->far_x, sray->far_y, sray->far_z,
+					                                             node_addr,
+					                                             &dist);
+					while(child_mask != 0) {
+						const int r = __bscf(child_mask);
+						child_rays[r] |= (1 << i);
+						child_dist[r] = min(child_dist[r], ((float*)&dist)[r]);
+					}
+				}
+
+				/* Push hit children farthest first, so the closest child is
+				 * traversed next.
+				 */
+				const float4 cnodes = kernel_tex_fetch(__bvh_nodes, node_addr+7);
+				const int stack_first = stack_ptr + 1;
+				for(int r = 0; r < 4; r++) {
+					if(child_rays[r] == 0) {
+						continue;
+					}
+					int j = ++stack_ptr;
+					kernel_assert(stack_ptr < BVH_QSTACK_SIZE);
+					while(j > stack_first &&
+					      child_dist[r] > child_dist[traversal_stack[j - 1].addr])
+					{
+						traversal_stack[j] = traversal_stack[j - 1];
+						--j;
+					}
+					/* Store child slot for now, so its distance can be
+					 * looked up while sorting.
+					 */
+					traversal_stack[j].addr = r;
+					traversal_stack[j].ray_mask = child_rays[r];
+				}
+				for(int j = stack_first; j <= stack_ptr; j++) {
+					traversal_stack[j].addr = __float_as_int(cnodes[traversal_stack[j].addr]);
+				}
+
+				node_addr = traversal_stack[stack_ptr].addr;
+				ray_mask = traversal_stack[stack_ptr].ray_mask;
+				--stack_ptr;
+			}
+
+			/* If node is leaf, fetch triangle list. */
+			if(node_addr < 0) {
+				float4 leaf = kernel_tex_fetch(__bvh_leaf_nodes, (-node_addr-1));
+
+#ifdef __VISIBILITY_FLAG__
+				if((__float_as_uint(leaf.z) & visibility) == 0) {
+					/* Pop. */
+					node_addr = traversal_stack[stack_ptr].addr;
+					ray_mask = traversal_stack[stack_ptr].ray_mask;
+					--stack_ptr;
+					continue;
+				}
+#endif
+
+				int prim_addr = __float_as_int(leaf.x);
+
+				if(prim_addr >= 0) {
+					const int prim_addr2 = __float_as_int(leaf.y);
+					const uint type = __float_as_int(leaf.w);
+					const uint leaf_ray_mask = ray_mask;
+
+					/* Pop. */
+					node_addr = traversal_stack[stack_ptr].addr;
+					ray_mask = traversal_stack[stack_ptr].ray_mask;
+					--stack_ptr;
+
+					/* Primitive intersection. */
+					kernel_assert((type & PRIMITIVE_ALL) == PRIMITIVE_TRIANGLE);
+					(void)type;
+
+					for(; prim_addr < prim_addr2; prim_addr++) {
+						kernel_assert(kernel_tex_fetch(__prim_type, prim_addr) == type);
+						uint mask = leaf_ray_mask;
+						while(mask != 0) {
+							const uint i = __bscf(mask);
+							Intersection *isect = &isects[i];
+
+							BVH_DEBUG_NEXT_INTERSECTION();
+
+							triangle_intersect(kg,
+							                   isect,
+							                   srays[i].P,
+							                   srays[i].dir,
+							                   visibility,
+							                   object,
+							                   prim_addr);
+						}
+					}
+				}
+				else {
+					/* Instance push, for all rays which reached the instance. */
+					object = kernel_tex_fetch(__prim_object, -prim_addr-1);
+
+					uint mask = ray_mask;
+					while(mask != 0) {
+						const uint i = __bscf(mask);
+						QBVHStreamRay *sray = &srays[i];
+						Intersection *isect = &isects[i];
+
+						isect->t = bvh_instance_push(kg,
+						                             object,
+						                             &rays[i],
+						                             &sray->P,
+						                             &sray->dir,
+						                             &sray->idir,
+						                             isect->t);
+						qbvh_stream_ray_update(sray);
+
+						BVH_DEBUG_NEXT_INSTANCE();
+					}
+
+					++stack_ptr;
+					kernel_assert(stack_ptr < BVH_QSTACK_SIZE);
+					traversal_stack[stack_ptr].addr = ENTRYPOINT_SENTINEL;
+					traversal_stack[stack_ptr].ray_mask = ray_mask;
+
+					node_addr = kernel_tex_fetch(__object_node, object);
+				}
+			}
+		} while(node_addr != ENTRYPOINT_SENTINEL);
+
+		if(stack_ptr >= 0) {
+			kernel_assert(object != OBJECT_NONE);
+
+			/* Instance pop, ray_mask holds the rays which entered it. */
+			uint mask = ray_mask;
+			while(mask != 0) {
+				const uint i = __bscf(mask);
+				QBVHStreamRay *sray = &srays[i];
+				Intersection *isect = &isects[i];
+
+				isect->t = bvh_instance_pop(kg,
+				                            object,
+				                            &rays[i],
+				                            &sray->P,
+				                            &sray->dir,
+				                            &sray->idir,
+				                            isect->t);
+				qbvh_stream_ray_update(sray);
+			}
+
+			object = OBJECT_NONE;
+			node_addr = traversal_stack[stack_ptr].addr;
+			ray_mask = traversal_stack[stack_ptr].ray_mask;
+			--stack_ptr;
+		}
+	} while(node_addr != ENTRYPOINT_SENTINEL);
+}
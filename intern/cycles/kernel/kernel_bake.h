@@ -534,6 +534,62 @@ ccl_device void kernel_shader_evaluate(KernelGlobals *kg,
 
 		object_inverse_dir_transform(kg, &sd, &out);
 	}
+#ifdef __VOLUME__
+	else if(type == SHADER_EVAL_VOLUME) {
+		/* two inputs per point, the object and shader of the volume
+		 * followed by the world space position */
+		uint4 in_volume = input[i*2 + 0];
+		uint4 in_P = input[i*2 + 1];
+
+		/* setup ray */
+		Ray ray;
+		ray.P = make_float3(__uint_as_float(in_P.x),
+		                    __uint_as_float(in_P.y),
+		                    __uint_as_float(in_P.z));
+		ray.D = make_float3(0.0f, 0.0f, 1.0f);
+		ray.t = 0.0f;
+#ifdef __CAMERA_MOTION__
+		ray.time = 0.5f;
+#endif
+
+#ifdef __RAY_DIFFERENTIALS__
+		ray.dD = differential3_zero();
+		ray.dP = differential3_zero();
+#endif
+
+		/* setup shader data and a stack with just this volume */
+		shader_setup_from_volume(kg, &sd, &ray);
+
+#ifdef __KERNEL_CPU__
+		state.volume_stack_storage.resize(2);
+		state.volume_stack = &state.volume_stack_storage[0];
+#endif
+		state.volume_stack[0].object = in_volume.x;
+		state.volume_stack[0].shader = in_volume.y;
+		state.volume_stack[0].t_enter = 0.0f;
+		state.volume_stack[0].t_exit = FLT_MAX;
+		state.volume_stack[0].depth = 0;
+		state.volume_stack[1].shader = SHADER_NONE;
+
+		/* evaluate, output extinction and the largest emission channel */
+		shader_eval_volume(kg, &sd, &state, state.volume_stack, PATH_RAY_SHADOW, SHADER_CONTEXT_SHADOW);
+
+		float3 sigma_t = make_float3(0.0f, 0.0f, 0.0f);
+		float3 emission = make_float3(0.0f, 0.0f, 0.0f);
+
+		for(int j = 0; j < sd.num_closure; j++) {
+			const ShaderClosure *sc = &sd.closure[j];
+
+			if(sc->type == CLOSURE_EMISSION_ID)
+				emission += sc->weight;
+			else if(CLOSURE_IS_VOLUME(sc->type))
+				sigma_t += sc->weight;
+		}
+
+		output[i] = make_float4(sigma_t.x, sigma_t.y, sigma_t.z, max3(emission));
+		return;
+	}
+#endif
 	else { // SHADER_EVAL_BACKGROUND
 		/* setup ray */
 		Ray ray;
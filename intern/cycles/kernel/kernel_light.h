@@ -786,6 +786,138 @@ ccl_device void lamp_light_dPdudv(KernelGlobals *kg, int lamp, float u, float v,
 	}
 }
 
+/* Light Tree
+ *
+ * Hierarchy over triangles and over lamps with a position, see
+ * render/light_tree.h for the node layout. Walking down, a child is picked
+ * with probability proportional to its importance for the shading point. */
+
+/* Energy of the node over the squared distance to its center. The distance
+ * is clamped to the size of the node, so nodes containing the shading point
+ * don't get an unbounded importance. */
+ccl_device_inline float light_tree_node_importance(KernelGlobals *kg, int node, float3 P)
+{
+	const float4 data0 = kernel_tex_fetch(__light_tree_nodes, node*2 + 0);
+	const float4 data1 = kernel_tex_fetch(__light_tree_nodes, node*2 + 1);
+	const float3 bmin = make_float3(data0.x, data0.y, data0.z);
+	const float3 bmax = make_float3(data1.x, data1.y, data1.z);
+
+	const float dist_squared = len_squared(0.5f*(bmin + bmax) - P);
+	const float size_squared = 0.25f*len_squared(bmax - bmin);
+
+	return data0.w / max(max(dist_squared, size_squared), 1e-8f);
+}
+
+/* Probability of going to the left child of an inner node, the left child
+ * directly follows its parent. */
+ccl_device_inline float light_tree_left_probability(KernelGlobals *kg, int node, int right, float3 P)
+{
+	const float left_importance = light_tree_node_importance(kg, node + 1, P);
+	const float right_importance = light_tree_node_importance(kg, right, P);
+	const float total_importance = left_importance + right_importance;
+
+	return (total_importance > 0.0f)? left_importance/total_importance: 0.5f;
+}
+
+/* Pick a leaf of the tree, returns its light distribution index. */
+ccl_device int light_tree_sample(KernelGlobals *kg, int root, float3 P, float randt, float *pdf)
+{
+	int node = root;
+
+	for(;;) {
+		const int right = __float_as_int(kernel_tex_fetch(__light_tree_nodes, node*2 + 1).w);
+
+		if(right < 0) {
+			return ~right;
+		}
+
+		const float p_left = light_tree_left_probability(kg, node, right, P);
+
+		if(randt < p_left) {
+			randt = randt/p_left;
+			*pdf *= p_left;
+			node = node + 1;
+		}
+		else {
+			randt = (p_left < 1.0f)? (randt - p_left)/(1.0f - p_left): randt;
+			*pdf *= 1.0f - p_left;
+			node = right;
+		}
+	}
+}
+
+/* Probability of picking a leaf of the tree. Nodes are in depth first
+ * order, so the leaf is in the left subtree when its index is below the one
+ * of the right child. */
+ccl_device float light_tree_pdf(KernelGlobals *kg, int root, int leaf, float3 P)
+{
+	float pdf = 1.0f;
+	int node = root;
+
+	while(node != leaf) {
+		const int right = __float_as_int(kernel_tex_fetch(__light_tree_nodes, node*2 + 1).w);
+		const float p_left = light_tree_left_probability(kg, node, right, P);
+
+		if(leaf < right) {
+			pdf *= p_left;
+			node = node + 1;
+		}
+		else {
+			pdf *= 1.0f - p_left;
+			node = right;
+		}
+	}
+
+	return pdf;
+}
+
+/* Probability of picking an emissive triangle from shading point P. */
+ccl_device float light_tree_triangle_pdf(KernelGlobals *kg, int object, int prim, float3 P)
+{
+	const uint offset = kernel_tex_fetch(__light_tree_leaf_map, object*2 + 0);
+	if(offset == 0) {
+		return 0.0f;
+	}
+
+	const uint tri_offset = kernel_tex_fetch(__light_tree_leaf_map, object*2 + 1);
+	const uint leaf = kernel_tex_fetch(__light_tree_leaf_map, offset + prim - tri_offset);
+	if(leaf == ~0u) {
+		return 0.0f;
+	}
+
+	return kernel_data.integrator.light_tree_pdf_triangles * light_tree_pdf(kg, 0, leaf, P);
+}
+
+/* Pick a light, with the same probabilities for triangles, lamps with a
+ * position and infinite lamps as the light distribution. Returns the light
+ * distribution index. */
+ccl_device int light_tree_distribution_sample(KernelGlobals *kg, float randt, float3 P, float *pdf)
+{
+	const float p_triangles = kernel_data.integrator.light_tree_pdf_triangles;
+	const float p_lamps = kernel_data.integrator.light_tree_pdf_lamps;
+	const int num_infinite = kernel_data.integrator.num_infinite_lights;
+
+	if(randt < p_triangles || (p_lamps == 0.0f && num_infinite == 0)) {
+		*pdf = p_triangles;
+		return light_tree_sample(kg, 0, P, randt/p_triangles, pdf);
+	}
+
+	randt -= p_triangles;
+
+	if(randt < p_lamps || num_infinite == 0) {
+		*pdf = p_lamps;
+		return light_tree_sample(kg, kernel_data.integrator.light_tree_lamp_root, P, randt/p_lamps, pdf);
+	}
+
+	/* Infinite lamps are picked uniformly, as without the tree. */
+	randt = (randt - p_lamps)/(1.0f - p_triangles - p_lamps);
+	const int i = min((int)(randt*num_infinite), num_infinite - 1);
+	const int node = kernel_data.integrator.light_tree_infinite_offset + i;
+
+	*pdf = kernel_data.integrator.pdf_lights;
+	return ~__float_as_int(kernel_tex_fetch(__light_tree_nodes, node*2 + 1).w);
+}
+
 /* Triangle Light */
 
 /* returns true if the triangle is has motion blur or an instancing transform applied */
@@ -817,9 +949,9 @@ ccl_device_inline bool triangle_world_space_vertices(KernelGlobals *kg, int obje
 	return has_motion;
 }
 
-ccl_device_inline float triangle_light_pdf_area(KernelGlobals *kg, const float3 Ng, const float3 I, float t)
+/* Solid angle pdf from the pdf over the area of the triangle. */
+ccl_device_inline float triangle_light_pdf_area(KernelGlobals *kg, const float3 Ng, const float3 I, float t, float pdf)
 {
-	float pdf = kernel_data.integrator.pdf_triangles;
 	float cos_pi = fabsf(dot(Ng, I));
 
 	if(cos_pi == 0.0f)
@@ -844,10 +976,17 @@ ccl_device_forceinline float triangle_light_pdf(KernelGlobals *kg, ShaderData *s
 	const float3 N = cross(e0, e1);
 	const float distance_to_plane = fabsf(dot(N, sd->I * t))/dot(N, N);
 
+	/* sd contains the point on the light source
+	 * calculate Px, the point that we're shading */
+	const float3 Px = sd->P + sd->I * t;
+
+	/* Probability of picking this triangle with the light tree. */
+	float tree_pdf = 0.0f;
+	if(kernel_data.integrator.use_light_tree) {
+		tree_pdf = light_tree_triangle_pdf(kg, sd->object, sd->prim, Px);
+	}
+
 	if(longest_edge_squared > distance_to_plane*distance_to_plane) {
-		/* sd contains the point on the light source
-		 * calculate Px, the point that we're shading */
-		const float3 Px = sd->P + sd->I * t;
 		const float3 v0_p = V[0] - Px;
 		const float3 v1_p = V[1] - Px;
 		const float3 v2_p = V[2] - Px;
@@ -864,7 +1003,11 @@ ccl_device_forceinline float triangle_light_pdf(KernelGlobals *kg, ShaderData *s
 		/* pdf_triangles is calculated over triangle area, but we're not sampling over its area */
 		if(UNLIKELY(solid_angle == 0.0f)) {
 			return 0.0f;
-		} else {
+		}
+		else if(kernel_data.integrator.use_light_tree) {
+			return tree_pdf / solid_angle;
+		}
+		else {
 			float area = 1.0f;
 			if(has_motion) {
 				/* get the center frame vertices, this is what the PDF was calculated from */
@@ -877,8 +1020,16 @@ ccl_device_forceinline float triangle_light_pdf(KernelGlobals *kg, ShaderData *s
 			return pdf / solid_angle;
 		}
 	}
+	else if(kernel_data.integrator.use_light_tree) {
+		/* Pdf over the area the sample was taken from. */
+		const float area = 0.5f * len(N);
+		if(UNLIKELY(area == 0.0f)) {
+			return 0.0f;
+		}
+		return triangle_light_pdf_area(kg, sd->Ng, sd->I, t, tree_pdf / area);
+	}
 	else {
-		float pdf = triangle_light_pdf_area(kg, sd->Ng, sd->I, t);
+		float pdf = triangle_light_pdf_area(kg, sd->Ng, sd->I, t, kernel_data.integrator.pdf_triangles);
 		if(has_motion) {
 			const float	area = 0.5f * len(N);
 			if(UNLIKELY(area == 0.0f)) {
@@ -896,7 +1047,7 @@ ccl_device_forceinline float triangle_light_pdf(KernelGlobals *kg, ShaderData *s
 }
 
 ccl_device_forceinline void triangle_light_sample(KernelGlobals *kg, int prim, int object,
-	float randu, float randv, float time, LightSample *ls, const float3 P)
+	float randu, float randv, float time, LightSample *ls, const float3 P, float tree_pdf)
 {
 	/* A naive heuristic to decide between costly solid angle sampling
 	 * and simple area sampling, comparing the distance to the triangle plane
@@ -1002,7 +1153,11 @@ ccl_device_forceinline void triangle_light_sample(KernelGlobals *kg, int prim, i
 		/* pdf_triangles is calculated over triangle area, but we're sampling over solid angle */
 		if(UNLIKELY(solid_angle == 0.0f)) {
 			ls->pdf = 0.0f;
-		} else {
+		}
+		else if(kernel_data.integrator.use_light_tree) {
+			ls->pdf = tree_pdf / solid_angle;
+		}
+		else {
 			if(has_motion) {
 				/* get the center frame vertices, this is what the PDF was calculated from */
 				triangle_world_space_vertices(kg, object, prim, -1.0f, V);
@@ -1022,14 +1177,19 @@ ccl_device_forceinline void triangle_light_sample(KernelGlobals *kg, int prim, i
 		ls->P = u * V[0] + v * V[1] + t * V[2];
 		/* compute incoming direction, distance and pdf */
 		ls->D = normalize_len(ls->P - P, &ls->t);
-		ls->pdf = triangle_light_pdf_area(kg, ls->Ng, -ls->D, ls->t);
-		if(has_motion && area != 0.0f) {
-			/* scale the PDF.
-			 * area = the area the sample was taken from
-			 * area_pre = the are from which pdf_triangles was calculated from */
-			triangle_world_space_vertices(kg, object, prim, -1.0f, V);
-			const float area_pre = triangle_area(V[0], V[1], V[2]);
-			ls->pdf = ls->pdf * area_pre / area;
+		if(kernel_data.integrator.use_light_tree) {
+			ls->pdf = (area != 0.0f)? triangle_light_pdf_area(kg, ls->Ng, -ls->D, ls->t, tree_pdf / area): 0.0f;
+		}
+		else {
+			ls->pdf = triangle_light_pdf_area(kg, ls->Ng, -ls->D, ls->t, kernel_data.integrator.pdf_triangles);
+			if(has_motion && area != 0.0f) {
+				/* scale the PDF.
+				 * area = the area the sample was taken from
+				 * area_pre = the are from which pdf_triangles was calculated from */
+				triangle_world_space_vertices(kg, object, prim, -1.0f, V);
+				const float area_pre = triangle_area(V[0], V[1], V[2]);
+				ls->pdf = ls->pdf * area_pre / area;
+			}
 		}
 		ls->u = u;
 		ls->v = v;
@@ -1092,7 +1252,18 @@ ccl_device_noinline bool light_sample(KernelGlobals *kg,
                                       LightSample *ls)
 {
 	/* sample index */
-	int index = light_distribution_sample(kg, randt);
+	int index;
+	float tree_pdf = 1.0f;
+
+	if(kernel_data.integrator.use_light_tree) {
+		index = light_tree_distribution_sample(kg, randt, P, &tree_pdf);
+		if(tree_pdf == 0.0f) {
+			return false;
+		}
+	}
+	else {
+		index = light_distribution_sample(kg, randt);
+	}
 
 	/* fetch light data */
 	float4 l = kernel_tex_fetch(__light_distribution, index);
@@ -1102,7 +1273,7 @@ ccl_device_noinline bool light_sample(KernelGlobals *kg,
 		int object = __float_as_int(l.w);
 		int shader_flag = __float_as_int(l.z);
 
-		triangle_light_sample(kg, prim, object, randu, randv, time, ls, P);
+		triangle_light_sample(kg, prim, object, randu, randv, time, ls, P, tree_pdf);
 		ls->shader |= shader_flag;
 		return (ls->pdf > 0.0f);
 	}
@@ -1118,7 +1289,16 @@ ccl_device_noinline bool light_sample(KernelGlobals *kg,
 			return false;
 		}
 
-		return lamp_light_sample(kg, lamp, randu, randv, P, ls);
+		if(!lamp_light_sample(kg, lamp, randu, randv, P, ls)) {
+			return false;
+		}
+
+		/* Lamp sampling assumes all lamps are picked with equal probability. */
+		if(kernel_data.integrator.use_light_tree) {
+			ls->eval_fac *= kernel_data.integrator.pdf_lights / tree_pdf;
+		}
+
+		return true;
 	}
 }
 
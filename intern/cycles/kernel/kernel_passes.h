@@ -429,10 +429,37 @@ ccl_device_inline void kernel_write_light_passes(KernelGlobals *kg, ccl_global f
 #endif
 }
 
+/* Adaptive sampling data is laid out as the sum of the odd samples (3 floats),
+ * the number of samples taken and a flag set by the device once the pixel
+ * converged. Comparing the sum of all samples against the odd samples alone
+ * gives an estimate of the remaining noise of the pixel. */
+ccl_device_inline bool kernel_adaptive_pixel_converged(KernelGlobals *kg, ccl_global float *buffer)
+{
+	return kernel_data.film.pass_adaptive &&
+	       buffer[kernel_data.film.pass_adaptive + 4] != 0.0f;
+}
+
+ccl_device_inline void kernel_write_adaptive_passes(KernelGlobals *kg, ccl_global float *buffer, int sample, float3 L_sum)
+{
+	if(!kernel_data.film.pass_adaptive) {
+		return;
+	}
+
+	ccl_global float *adaptive = buffer + kernel_data.film.pass_adaptive;
+
+	if(sample & 1) {
+		kernel_write_pass_float(adaptive + 0, sample/2, L_sum.x);
+		kernel_write_pass_float(adaptive + 1, sample/2, L_sum.y);
+		kernel_write_pass_float(adaptive + 2, sample/2, L_sum.z);
+	}
+	kernel_write_pass_float(adaptive + 3, sample, 1.0f);
+}
+
 ccl_device_inline void kernel_write_result(KernelGlobals *kg, ccl_global float *buffer, int sample, PathRadiance *L, float L_transparent, bool is_shadowcatcher)
 {
 	if(!L) {
 		kernel_write_pass_float4(buffer, sample, make_float4(0.0f, 0.0f, 0.0f, 0.0f));
+		kernel_write_adaptive_passes(kg, buffer, sample, make_float3(0.0f, 0.0f, 0.0f));
 		return;
 	}
 
@@ -469,6 +496,7 @@ ccl_device_inline void kernel_write_result(KernelGlobals *kg, ccl_global float *
 	}
 
 	kernel_write_pass_float4(buffer, sample, make_float4(L_sum.x, L_sum.y, L_sum.z, 1.0f - L_transparent));
+	kernel_write_adaptive_passes(kg, buffer, sample, L_sum);
 }
 
 CCL_NAMESPACE_END
@@ -625,7 +625,8 @@ ccl_device_inline void kernel_path_integrate(KernelGlobals *kg,
                                              uint rng_hash,
                                              int sample,
                                              Ray ray,
-                                             ccl_global float *buffer)
+                                             ccl_global float *buffer,
+                                             const Intersection *camera_isect)
 {
 	/* initialize */
 	PathRadiance L;
@@ -659,26 +660,35 @@ ccl_device_inline void kernel_path_integrate(KernelGlobals *kg,
 		/* intersect scene */
 		Intersection isect;
 		uint visibility = path_state_ray_visibility(kg, &state);
+		bool hit;
 
+		if(camera_isect != NULL && visibility == PATH_RAY_CAMERA) {
+			/* Camera ray was already traced as part of a ray stream. */
+			isect = *camera_isect;
+			hit = (isect.prim != PRIM_NONE);
+		}
+		else {
 #ifdef __HAIR__
-		float difl = 0.0f, extmax = 0.0f;
-		uint lcg_state = 0;
-
-		if(kernel_data.bvh.have_curves) {
-			if((kernel_data.cam.resolution == 1) && (state.flag & PATH_RAY_CAMERA)) {	
-				float3 pixdiff = ray.dD.dx + ray.dD.dy;
-				/*pixdiff = pixdiff - dot(pixdiff, ray.D)*ray.D;*/
-				difl = kernel_data.curve.minimum_width * len(pixdiff) * 0.5f;
-			}
+			float difl = 0.0f, extmax = 0.0f;
+			uint lcg_state = 0;
+
+			if(kernel_data.bvh.have_curves) {
+				if((kernel_data.cam.resolution == 1) && (state.flag & PATH_RAY_CAMERA)) {	
+					float3 pixdiff = ray.dD.dx + ray.dD.dy;
+					/*pixdiff = pixdiff - dot(pixdiff, ray.D)*ray.D;*/
+					difl = kernel_data.curve.minimum_width * len(pixdiff) * 0.5f;
+				}
 
-			extmax = kernel_data.curve.maximum_width;
-			lcg_state = lcg_state_init(&state, 0x51633e2d);
-		}
+				extmax = kernel_data.curve.maximum_width;
+				lcg_state = lcg_state_init(&state, 0x51633e2d);
+			}
 
-		bool hit = scene_intersect(kg, ray, visibility, &isect, &lcg_state, difl, extmax, 0x00000000/*TODO:What goes here*/);
+			hit = scene_intersect(kg, ray, visibility, &isect, &lcg_state, difl, extmax, 0x00000000/*TODO:What goes here*/);
 #else
-		bool hit = scene_intersect(kg, ray, visibility, &isect, NULL, 0.0f, 0.0f, 0x00000000/*TODO:What goes here*/);
+			hit = scene_intersect(kg, ray, visibility, &isect, NULL, 0.0f, 0.0f, 0x00000000/*TODO:What goes here*/);
 #endif
+		}
+		camera_isect = NULL;
 
 #ifdef __KERNEL_DEBUG__
 		if(state.flag & PATH_RAY_CAMERA) {
@@ -993,6 +1003,9 @@ ccl_device void kernel_path_trace(KernelGlobals *kg,
 	rng_state += index;
 	buffer += index*pass_stride;
 
+	if(kernel_adaptive_pixel_converged(kg, buffer))
+		return;
+
 	/* initialize random numbers and ray */
 	uint rng_hash;
 	Ray ray;
@@ -1001,10 +1014,58 @@ ccl_device void kernel_path_trace(KernelGlobals *kg,
 
 	/* integrate */
 	if(ray.t != 0.0f)
-		kernel_path_integrate(kg, rng_hash, sample, ray, buffer);
+		kernel_path_integrate(kg, rng_hash, sample, ray, buffer, NULL);
 	else
 		kernel_write_result(kg, buffer, sample, NULL, 0.0f, false);
 }
 
+#ifdef __RAY_STREAM__
+/* Path trace a row of up to BVH_STREAM_SIZE pixels, starting at x, y. Camera
+ * rays of all pixels are traced together as one packet, the rest of the path
+ * is integrated per pixel as usual.
+ */
+ccl_device void kernel_path_trace_stream(KernelGlobals *kg,
+	ccl_global float *buffer, ccl_global uint *rng_state,
+	int sample, int x, int y, int num_pixels, int offset, int stride)
+{
+	kernel_assert(num_pixels <= BVH_STREAM_SIZE);
+
+	int pass_stride = kernel_data.film.pass_stride;
+
+	Ray rays[BVH_STREAM_SIZE];
+	Intersection isects[BVH_STREAM_SIZE];
+	uint rng_hash[BVH_STREAM_SIZE];
+	int pixel_index[BVH_STREAM_SIZE];
+	int num_rays = 0;
+
+	/* initialize random numbers and rays */
+	for(int i = 0; i < num_pixels; i++) {
+		int index = offset + x + i + y*stride;
+
+		if(kernel_adaptive_pixel_converged(kg, buffer + index*pass_stride))
+			continue;
+
+		kernel_path_trace_setup(kg, rng_state + index, sample, x + i, y,
+		                        &rng_hash[num_rays], &rays[num_rays]);
+
+		if(rays[num_rays].t != 0.0f)
+			pixel_index[num_rays++] = index;
+		else
+			kernel_write_result(kg, buffer + index*pass_stride, sample, NULL, 0.0f, false);
+	}
+
+	if(num_rays == 0)
+		return;
+
+	scene_intersect_stream(kg, rays, isects, PATH_RAY_CAMERA, num_rays);
+
+	/* integrate */
+	for(int i = 0; i < num_rays; i++) {
+		kernel_path_integrate(kg, rng_hash[i], sample, rays[i],
+		                      buffer + pixel_index[i]*pass_stride, &isects[i]);
+	}
+}
+#endif  /* __RAY_STREAM__ */
+
 CCL_NAMESPACE_END
 
@@ -58,11 +58,17 @@ KERNEL_TEX(float, texture_float, __attributes_float)
 KERNEL_TEX(float4, texture_float4, __attributes_float3)
 KERNEL_TEX(uchar4, texture_uchar4, __attributes_uchar4)
 
+/* volumes */
+KERNEL_TEX(float4, texture_float4, __object_volume_majorant)
+KERNEL_TEX(float, texture_float, __volume_majorant)
+
 /* lights */
 KERNEL_TEX(float4, texture_float4, __light_distribution)
 KERNEL_TEX(float4, texture_float4, __light_data)
 KERNEL_TEX(float2, texture_float2, __light_background_marginal_cdf)
 KERNEL_TEX(float2, texture_float2, __light_background_conditional_cdf)
+KERNEL_TEX(float4, texture_float4, __light_tree_nodes)
+KERNEL_TEX(uint, texture_uint, __light_tree_leaf_map)
 
 /* particles */
 KERNEL_TEX(float4, texture_float4, __particles)
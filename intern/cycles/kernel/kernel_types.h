@@ -78,6 +78,10 @@ CCL_NAMESPACE_BEGIN
 #ifdef __KERNEL_CPU__
 #  ifdef __KERNEL_SSE2__
 #    define __QBVH__
+#    define __RAY_STREAM__
+#  endif
+#  ifdef __KERNEL_AVX2__
+#    define __OBVH__
 #  endif
 #  define __KERNEL_SHADING__
 #  define __KERNEL_ADV_SHADING__
@@ -244,6 +248,7 @@ CCL_NAMESPACE_BEGIN
 typedef enum ShaderEvalType {
 	SHADER_EVAL_DISPLACE,
 	SHADER_EVAL_BACKGROUND,
+	SHADER_EVAL_VOLUME,
 	/* bake types */
 	SHADER_EVAL_BAKE, /* no real shade, it's used in the code to
 	                   * differentiate the type of shader eval from the above
@@ -1193,9 +1198,15 @@ typedef struct KernelFilm {
 	float mist_falloff;
 
 	int pass_denoising;
-	int pass_pad0;
-	int pass_pad1;
-	int pass_pad2;
+	int pass_adaptive;
+	/* Denoising of finished tiles on the CPU, disabled when radius is 0. */
+	int denoising_radius;
+	float denoising_strength;
+
+	float denoising_feature_strength;
+	int denoising_pad1;
+	int denoising_pad2;
+	int denoising_pad3;
 
 	int pass_aov[32];
 	
@@ -1293,10 +1304,30 @@ typedef struct KernelIntegrator {
 	float light_inv_rr_threshold;
 
 	int start_sample;
-	int pad1, pad2, pad3;
+
+	/* adaptive sampling */
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
+	/* light tree */
+	int use_light_tree;
+
+	int light_tree_lamp_root;
+	int light_tree_infinite_offset;
+	int num_infinite_lights;
+	float light_tree_pdf_triangles;
+
+	float light_tree_pdf_lamps;
+
+	/* volume delta tracking */
+	int volume_delta_tracking;
+	int pad1, pad2;
 } KernelIntegrator;
 static_assert_align(KernelIntegrator, 16);
 
+/* Number of camera rays traced together as one packet in ray stream mode. */
+#define BVH_STREAM_SIZE 8
+
 typedef struct KernelBVH {
 	/* root node */
 	int root;
@@ -1306,10 +1337,12 @@ typedef struct KernelBVH {
 	int have_instancing;
 	int use_qbvh;
 	int use_bvh_steps;
-	int pad1;
+	int use_obvh;
+	int use_ray_stream;
+	int pad1, pad2, pad3;
 #ifdef __EMBREE__
 	RTCScene scene;
-	int pad2, pad3;
+	int pad4, pad5;
 #endif
 } KernelBVH;
 static_assert_align(KernelBVH, 16);
@@ -198,6 +198,146 @@ ccl_device_inline void kernel_volume_step_init(KernelGlobals *kg,
 	*step_offset = path_state_rng_1D_hash(kg, state, 0x1e31d8a4) * step;
 }
 
+/* Volume Majorants
+ *
+ * Upper bounds of the extinction of volume objects, stored by the mesh
+ * manager as a coarse grid over the bounds of every object. These are used
+ * to sample tentative collisions for delta and ratio tracking, where
+ * collisions with the difference between the majorant and the actual
+ * extinction are null collisions that don't change the path. */
+
+ccl_device_inline bool volume_object_has_majorant(KernelGlobals *kg, int object)
+{
+	if(object == OBJECT_NONE)
+		return false;
+
+	float4 header = kernel_tex_fetch(__object_volume_majorant, object*2 + 0);
+	return __float_as_int(header.w) >= 0;
+}
+
+/* tracking is only possible when all volumes in the stack have a grid, so
+ * world volumes fall back to stepping */
+ccl_device bool volume_stack_has_majorant(KernelGlobals *kg, ccl_addr_space VolumeStack *stack)
+{
+	if(!kernel_data.integrator.volume_delta_tracking)
+		return false;
+
+	for(int i = 0; stack[i].shader != SHADER_NONE; i++) {
+		if(!volume_object_has_majorant(kg, stack[i].object))
+			return false;
+	}
+
+	return true;
+}
+
+/* largest majorant of the grid cells overlapping the box spanned by P0 and P1 */
+ccl_device float volume_object_majorant(KernelGlobals *kg, int object, float3 P0, float3 P1)
+{
+	float4 header0 = kernel_tex_fetch(__object_volume_majorant, object*2 + 0);
+	float4 header1 = kernel_tex_fetch(__object_volume_majorant, object*2 + 1);
+	int offset = __float_as_int(header0.w);
+	int res = __float_as_int(header1.w);
+
+	float3 lo = (min(P0, P1) - float4_to_float3(header0)) * float4_to_float3(header1);
+	float3 hi = (max(P0, P1) - float4_to_float3(header0)) * float4_to_float3(header1);
+	float fres = (float)res;
+
+	if(hi.x < 0.0f || hi.y < 0.0f || hi.z < 0.0f || lo.x >= fres || lo.y >= fres || lo.z >= fres)
+		return 0.0f;
+
+	int x0 = (int)max(lo.x, 0.0f), x1 = (int)min(hi.x, fres - 1.0f);
+	int y0 = (int)max(lo.y, 0.0f), y1 = (int)min(hi.y, fres - 1.0f);
+	int z0 = (int)max(lo.z, 0.0f), z1 = (int)min(hi.z, fres - 1.0f);
+	float majorant = 0.0f;
+
+	for(int z = z0; z <= z1; z++) {
+		for(int y = y0; y <= y1; y++) {
+			for(int x = x0; x <= x1; x++) {
+				int index = offset + x + res*(y + res*z);
+				majorant = max(majorant, kernel_tex_fetch(__volume_majorant, index));
+			}
+		}
+	}
+
+	return majorant;
+}
+
+/* sum of the majorants of all volumes in the stack over a segment of the ray */
+ccl_device float volume_stack_majorant(KernelGlobals *kg,
+                                       ccl_addr_space VolumeStack *stack,
+                                       Ray *ray,
+                                       float t0,
+                                       float t1)
+{
+	float3 P0 = ray->P + t0*ray->D;
+	float3 P1 = ray->P + t1*ray->D;
+	float majorant = 0.0f;
+
+	for(int i = 0; stack[i].shader != SHADER_NONE; i++) {
+		/* skip volumes that don't overlap the segment */
+		if(stack[i].t_enter > t1 || stack[i].t_exit < t0)
+			continue;
+
+		majorant += volume_object_majorant(kg, stack[i].object, P0, P1);
+	}
+
+	return majorant;
+}
+
+typedef struct VolumeTracking {
+	float t;            /* distance of the last tentative collision */
+	float segment_end;  /* end of the segment with constant majorant */
+	float segment_size;
+	float majorant;     /* majorant of the current segment */
+} VolumeTracking;
+
+ccl_device void kernel_volume_tracking_init(KernelGlobals *kg,
+                                            ccl_addr_space VolumeStack *stack,
+                                            Ray *ray,
+                                            VolumeTracking *track)
+{
+	/* segments the size of the smallest grid cell, but not more of them
+	 * than the max steps for stepping */
+	float segment_size = FLT_MAX;
+
+	for(int i = 0; stack[i].shader != SHADER_NONE; i++) {
+		float4 header = kernel_tex_fetch(__object_volume_majorant, stack[i].object*2 + 1);
+		segment_size = min(segment_size, 1.0f/max3(float4_to_float3(header)));
+	}
+
+	track->t = 0.0f;
+	track->segment_end = 0.0f;
+	track->segment_size = max(segment_size, ray->t/kernel_data.integrator.volume_max_steps);
+	track->majorant = 0.0f;
+}
+
+/* advance to the next tentative collision, sampling the distance with the
+ * piecewise constant majorant along the ray. segments without any density
+ * are skipped without shader evaluations. returns false if the end of the
+ * ray is reached first. */
+ccl_device bool kernel_volume_tracking_next(KernelGlobals *kg,
+                                            ccl_addr_space VolumeStack *stack,
+                                            Ray *ray,
+                                            VolumeTracking *track,
+                                            float xi)
+{
+	float tau = -logf(1.0f - xi);
+
+	while(tau >= track->majorant*(track->segment_end - track->t)) {
+		tau -= track->majorant*(track->segment_end - track->t);
+		track->t = track->segment_end;
+
+		if(track->t >= ray->t)
+			return false;
+
+		track->segment_end = min(track->t + track->segment_size, ray->t);
+		track->majorant = volume_stack_majorant(kg, stack, ray, track->t, track->segment_end);
+	}
+
+	track->t += tau/track->majorant;
+	return true;
+}
+
 /* Volume Shadows
  *
  * These functions are used to attenuate shadow rays to lights. Both absorption
@@ -279,6 +419,58 @@ ccl_device void kernel_volume_shadow_heterogeneous(KernelGlobals *kg,
 	*throughput = tp;
 }
 
+/* heterogeneous volume with majorant: ratio tracking, multiplying the
+ * throughput by the probability of a null collision at every tentative
+ * collision. unlike stepping this has no bias from the step size, as long
+ * as the majorant is nonzero wherever there is density. if the max steps
+ * are used up before the end of the ray, the remainder is stepped through. */
+ccl_device void kernel_volume_shadow_ratio_tracking(KernelGlobals *kg,
+                                                    ccl_addr_space PathState *state,
+                                                    Ray *ray,
+                                                    ShaderData *sd,
+                                                    float3 *throughput)
+{
+	float3 tp = *throughput;
+	const float tp_eps = 1e-6f;
+	const int max_steps = kernel_data.integrator.volume_max_steps;
+
+	uint lcg_state = lcg_state_init(state, 0x7b3e1d95);
+	VolumeTracking track;
+	kernel_volume_tracking_init(kg, state->volume_stack, ray, &track);
+
+	int i;
+	for(i = 0; i < max_steps; i++) {
+		if(!kernel_volume_tracking_next(kg, state->volume_stack, ray, &track, lcg_step_float(&lcg_state)))
+			break;
+
+		float3 new_P = ray->P + ray->D * track.t;
+		float3 sigma_t;
+
+		sd->ray_length = track.t;
+		if(volume_shader_extinction_sample(kg, sd, state, new_P, &sigma_t)) {
+			tp *= make_float3(1.0f, 1.0f, 1.0f) - sigma_t/track.majorant;
+
+			/* stop if nearly all light is blocked */
+			if(max3(fabs(tp)) < tp_eps) {
+				tp = make_float3(0.0f, 0.0f, 0.0f);
+				break;
+			}
+		}
+	}
+
+	*throughput = tp;
+
+	/* out of steps before the end, step through the rest of the ray
+	 * rather than treating it as transparent */
+	if(i == max_steps && track.t < ray->t) {
+		Ray rest = *ray;
+		rest.P = ray->P + ray->D * track.t;
+		rest.t = ray->t - track.t;
+
+		kernel_volume_shadow_heterogeneous(kg, state, &rest, sd, throughput);
+	}
+}
+
 /* get the volume attenuation over line segment defined by ray, with the
  * assumption that there are no surfaces blocking light between the endpoints */
 ccl_device_noinline void kernel_volume_shadow(KernelGlobals *kg,
@@ -289,8 +481,12 @@ ccl_device_noinline void kernel_volume_shadow(KernelGlobals *kg,
 {
 	shader_setup_from_volume(kg, shadow_sd, ray);
 
-	if(volume_stack_is_heterogeneous(kg, state->volume_stack))
-		kernel_volume_shadow_heterogeneous(kg, state, ray, shadow_sd, throughput);
+	if(volume_stack_is_heterogeneous(kg, state->volume_stack)) {
+		if(volume_stack_has_majorant(kg, state->volume_stack))
+			kernel_volume_shadow_ratio_tracking(kg, state, ray, shadow_sd, throughput);
+		else
+			kernel_volume_shadow_heterogeneous(kg, state, ray, shadow_sd, throughput);
+	}
 	else
 		kernel_volume_shadow_homogeneous(kg, state, ray, shadow_sd, throughput);
 }
@@ -647,6 +843,108 @@ ccl_device VolumeIntegrateResult kernel_volume_integrate_heterogeneous_distance(
 	return VOLUME_PATH_ATTENUATED;
 }
 
+/* heterogeneous volume with majorant: delta tracking, sampling tentative
+ * collisions up to the first real scattering event. for colored extinction
+ * we use spectral tracking as in "Spectral and Decomposition Tracking for
+ * Rendering Heterogeneous Volumes", choosing between scattering and null
+ * collisions proportional to the throughput weighted coefficients, with
+ * absorption accounted for in the throughput. emission is added with a
+ * collision estimator. if the max steps are used up before the end of the
+ * ray, the remainder is integrated with distance sampling by stepping. */
+ccl_device VolumeIntegrateResult kernel_volume_integrate_heterogeneous_tracking(
+    KernelGlobals *kg,
+    ccl_addr_space PathState *state,
+    Ray *ray,
+    ShaderData *sd,
+    PathRadiance *L,
+    ccl_addr_space float3 *throughput)
+{
+	float3 tp = *throughput;
+	const float tp_eps = 1e-6f;
+	const int max_steps = kernel_data.integrator.volume_max_steps;
+
+	/* the first collision uses a stratified number, the following ones
+	 * come from a random sequence per path */
+	float xi = path_state_rng_1D_for_decision(kg, state, PRNG_SCATTER_DISTANCE);
+	sd->randb_closure = path_state_rng_1D_for_decision(kg, state, PRNG_PHASE);
+	uint lcg_state = lcg_state_init(state, 0x5c2a8f17);
+
+	VolumeTracking track;
+	kernel_volume_tracking_init(kg, state->volume_stack, ray, &track);
+
+	int i;
+	for(i = 0; i < max_steps; i++) {
+		if(!kernel_volume_tracking_next(kg, state->volume_stack, ray, &track, xi))
+			break;
+
+		xi = lcg_step_float(&lcg_state);
+
+		float3 new_P = ray->P + ray->D * track.t;
+		VolumeShaderCoefficients coeff;
+
+		/* no density is a null collision with weight one */
+		sd->ray_length = track.t;
+		if(!volume_shader_sample(kg, sd, state, new_P, &coeff))
+			continue;
+
+		int closure_flag = sd->runtime_flag;
+		float inv_majorant = 1.0f/track.majorant;
+
+		if(L && (closure_flag & SD_RUNTIME_EMISSION)) {
+			path_radiance_accum_emission(L, tp, coeff.emission*inv_majorant, state->bounce);
+		}
+
+#ifdef __VOLUME_SCATTER__
+		float3 sigma_s = coeff.sigma_s;
+#else
+		float3 sigma_s = make_float3(0.0f, 0.0f, 0.0f);
+#endif
+		/* negative where the majorant is too small but nonzero, which
+		 * is weighted accordingly and only costs noise */
+		float3 sigma_n = make_float3(track.majorant, track.majorant, track.majorant) - coeff.sigma_a - coeff.sigma_s;
+
+		float p_scatter = average(tp * sigma_s);
+		float p_null = average(tp * fabs(sigma_n));
+		float p_sum = p_scatter + p_null;
+
+		/* everything absorbed */
+		if(p_sum == 0.0f) {
+			tp = make_float3(0.0f, 0.0f, 0.0f);
+			break;
+		}
+
+		if(lcg_step_float(&lcg_state) * p_sum < p_scatter) {
+			/* prepare to scatter to new direction */
+			sd->P = new_P;
+			*throughput = tp * sigma_s * (inv_majorant * p_sum/p_scatter);
+
+			return VOLUME_PATH_SCATTERED;
+		}
+
+		tp *= sigma_n * (inv_majorant * p_sum/p_null);
+
+		/* stop if nearly all light blocked */
+		if(max3(fabs(tp)) < tp_eps) {
+			tp = make_float3(0.0f, 0.0f, 0.0f);
+			break;
+		}
+	}
+
+	*throughput = tp;
+
+	/* out of steps before the end, integrate the rest of the ray rather
+	 * than treating it as transparent */
+	if(i == max_steps && track.t < ray->t) {
+		Ray rest = *ray;
+		rest.P = ray->P + ray->D * track.t;
+		rest.t = ray->t - track.t;
+
+		return kernel_volume_integrate_heterogeneous_distance(kg, state, &rest, sd, L, throughput);
+	}
+
+	return VOLUME_PATH_ATTENUATED;
+}
+
 /* get the volume attenuation and emission over line segment defined by
  * ray, with the assumption that there are no surfaces blocking light
  * between the endpoints. distance sampling is used to decide if we will
@@ -662,8 +960,12 @@ ccl_device_noinline VolumeIntegrateResult kernel_volume_integrate(
 {
 	shader_setup_from_volume(kg, sd, ray);
 
-	if(heterogeneous)
-		return kernel_volume_integrate_heterogeneous_distance(kg, state, ray, sd, L, throughput);
+	if(heterogeneous) {
+		if(volume_stack_has_majorant(kg, state->volume_stack))
+			return kernel_volume_integrate_heterogeneous_tracking(kg, state, ray, sd, L, throughput);
+		else
+			return kernel_volume_integrate_heterogeneous_distance(kg, state, ray, sd, L, throughput);
+	}
 	else
 		return kernel_volume_integrate_homogeneous(kg, state, ray, sd, L, throughput, true);
 }
@@ -1083,6 +1385,10 @@ ccl_device bool kernel_volume_use_decoupled(KernelGlobals *kg, bool heterogeneou
 	if(sampling_method != 0)
 		return true;
 
+	/* delta tracking needs fewer shader evaluations than recording all steps */
+	if(heterogeneous && kernel_data.integrator.volume_delta_tracking)
+		return false;
+
 	/* for all light sampling use decoupled, reusing shader evaluations is
 	 * typically faster in that case */
 	if(direct)
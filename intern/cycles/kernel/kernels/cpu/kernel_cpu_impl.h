@@ -86,6 +86,39 @@ void KERNEL_FUNCTION_FULL_NAME(path_trace)(KernelGlobals *kg,
 	}
 }
 
+void KERNEL_FUNCTION_FULL_NAME(path_trace_stream)(KernelGlobals *kg,
+                                                  float *buffer,
+                                                  unsigned int *rng_state,
+                                                  int sample,
+                                                  int x, int y,
+                                                  int num_pixels,
+                                                  int offset,
+                                                  int stride)
+{
+#ifdef __RAY_STREAM__
+	if(!kernel_data.integrator.branched && scene_intersect_stream_supported(kg)) {
+		kernel_path_trace_stream(kg,
+		                         buffer,
+		                         rng_state,
+		                         sample,
+		                         x, y,
+		                         num_pixels,
+		                         offset,
+		                         stride);
+		return;
+	}
+#endif
+	for(int i = 0; i < num_pixels; i++) {
+		KERNEL_FUNCTION_FULL_NAME(path_trace)(kg,
+		                                      buffer,
+		                                      rng_state,
+		                                      sample,
+		                                      x + i, y,
+		                                      offset,
+		                                      stride);
+	}
+}
+
 /* Film */
 
 void KERNEL_FUNCTION_FULL_NAME(convert_to_byte)(KernelGlobals *kg,
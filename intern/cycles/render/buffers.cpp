@@ -237,6 +237,23 @@ bool RenderBuffers::get_denoising_pass_rect(string passname, float exposure, int
 	return true;
 }
 
+bool RenderBuffers::get_sample_count_rect(int components, float *pixels)
+{
+	if(!params.passes.adaptive_passes || components != 1) {
+		return false;
+	}
+
+	float *in = (float*)buffer.data_pointer + params.passes.get_adaptive_offset() + 3;
+	int pass_stride = params.passes.get_size();
+	int size = params.width*params.height;
+
+	for(int i = 0; i < size; i++, in += pass_stride, pixels++) {
+		pixels[0] = in[0];
+	}
+
+	return true;
+}
+
 bool RenderBuffers::get_aov_rect(ustring name, float exposure, int sample, int components, float *pixels)
 {
 	int aov_offset = 0;
@@ -419,15 +436,32 @@ bool RenderBuffers::get_pass_rect(PassType type, float exposure, int sample, int
 			}
 		}
 		else {
+			/* Pixels which stopped sampling early and were not adjusted yet
+			 * use their own number of samples. */
+			float *adaptive = NULL;
+			if(params.passes.adaptive_passes && pass->filter) {
+				adaptive = (float*)buffer.data_pointer + params.passes.get_adaptive_offset();
+			}
+
 			for(int i = 0; i < size; i++, in += pass_stride, pixels += 4) {
 				float4 f = make_float4(in[0], in[1], in[2], in[3]);
+				float pixel_scale = scale;
+				float pixel_scale_exposure = scale_exposure;
+
+				if(adaptive) {
+					if(adaptive[4] != 0.0f && adaptive[3] > 0.0f) {
+						pixel_scale = 1.0f/adaptive[3];
+						pixel_scale_exposure = (pass->exposure)? pixel_scale*exposure: pixel_scale;
+					}
+					adaptive += pass_stride;
+				}
 				
-				pixels[0] = f.x*scale_exposure;
-				pixels[1] = f.y*scale_exposure;
-				pixels[2] = f.z*scale_exposure;
+				pixels[0] = f.x*pixel_scale_exposure;
+				pixels[1] = f.y*pixel_scale_exposure;
+				pixels[2] = f.z*pixel_scale_exposure;
 				
 				/* clamp since alpha might be > 1.0 due to russian roulette */
-				pixels[3] = saturate(f.w*scale);
+				pixels[3] = saturate(f.w*pixel_scale);
 			}
 		}
 	}
@@ -82,6 +82,7 @@ public:
 	bool get_denoising_pass_rect(string passname, float exposure, int sample, int components, float *pixels);
 	bool get_pass_rect(PassType type, float exposure, int sample, int components, float *pixels);
 	bool get_aov_rect(ustring name, float exposure, int sample, int components, float *pixels);
+	bool get_sample_count_rect(int components, float *pixels);
 
 protected:
 	void device_free();
@@ -43,6 +43,7 @@ PassSettings::PassSettings()
 {
 	add(PASS_COMBINED);
 	denoising_passes = false;
+	adaptive_passes = false;
 }
 
 void PassSettings::add(AOV aov)
@@ -209,7 +210,8 @@ bool PassSettings::contains(PassType type) const
 bool PassSettings::modified(const PassSettings& other) const
 {
 	if(aovs.size() != other.aovs.size()
-	   || passes.size() != other.passes.size()) {
+	   || passes.size() != other.passes.size()
+	   || adaptive_passes != other.adaptive_passes) {
 		return true;
 	}
 
@@ -245,7 +247,7 @@ int PassSettings::get_denoising_offset() const
 	return size;
 }
 
-int PassSettings::get_size() const
+int PassSettings::get_adaptive_offset() const
 {
 	int size = get_denoising_offset();
 
@@ -253,6 +255,17 @@ int PassSettings::get_size() const
 		size += 26;
 	}
 
+	return size;
+}
+
+int PassSettings::get_size() const
+{
+	int size = get_adaptive_offset();
+
+	if(adaptive_passes) {
+		size += 5;
+	}
+
 	return align_up(size, 4);
 }
 
@@ -404,6 +417,11 @@ NODE_DEFINE(Film)
 	SOCKET_BOOLEAN(use_sample_clamp, "Use Sample Clamp", false);
 
 	SOCKET_INT(object_id_slots, "Object ID Slots", 0);
+
+	SOCKET_BOOLEAN(use_denoising, "Use Denoising", false);
+	SOCKET_INT(denoising_radius, "Denoising Radius", 8);
+	SOCKET_FLOAT(denoising_strength, "Denoising Strength", 0.5f);
+	SOCKET_FLOAT(denoising_feature_strength, "Denoising Feature Strength", 0.5f);
 	
 	return type;
 }
@@ -589,6 +607,14 @@ void Film::device_update(Device *device, DeviceScene *dscene, Scene *scene)
 		kfilm->pass_denoising = 0;
 	}
 
+	if(passes.adaptive_passes) {
+		kfilm->pass_adaptive = kfilm->pass_stride;
+		kfilm->pass_stride += 5;
+	}
+	else {
+		kfilm->pass_adaptive = 0;
+	}
+
 	kfilm->pass_stride = align_up(kfilm->pass_stride, 4);
 	kfilm->pass_alpha_threshold = pass_alpha_threshold;
 
@@ -604,6 +630,11 @@ void Film::device_update(Device *device, DeviceScene *dscene, Scene *scene)
 	kfilm->mist_falloff = mist_falloff;
 
 	kfilm->use_cryptomatte = use_cryptomatte;
+
+	const bool denoise = use_denoising && passes.denoising_passes;
+	kfilm->denoising_radius = denoise? denoising_radius: 0;
+	kfilm->denoising_strength = denoising_strength;
+	kfilm->denoising_feature_strength = denoising_feature_strength;
 	
 	need_update = false;
 }
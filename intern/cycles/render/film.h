@@ -87,6 +87,7 @@ public:
 	bool modified(const PassSettings& other) const;
 
 	int get_denoising_offset() const;
+	int get_adaptive_offset() const;
 	int get_size() const;
 	Pass* get_pass(PassType type, int &offset);
 	AOV* get_aov(ustring name, int &offset);
@@ -96,6 +97,8 @@ public:
 	void add(AOV aov);
 
 	bool denoising_passes;
+	/* Per pixel sample count and data for adaptive sampling. */
+	bool adaptive_passes;
 
 protected:
 	array<Pass> passes;
@@ -124,6 +127,12 @@ public:
 	bool use_sample_clamp;
 	int use_cryptomatte;
 
+	/* Denoise finished tiles, requires the denoising passes. */
+	bool use_denoising;
+	int denoising_radius;
+	float denoising_strength;
+	float denoising_feature_strength;
+
 	bool need_update;
 	
 	/* These options determine how many slots are allocated for storing ID information.
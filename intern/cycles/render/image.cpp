@@ -19,6 +19,7 @@
 #include "render/scene.h"
 
 #include "util/util_foreach.h"
+#include "util/util_hash.h"
 #include "util/util_logging.h"
 #include "util/util_path.h"
 #include "util/util_progress.h"
@@ -89,6 +90,77 @@ void ImageManager::set_oiio_texture_system(void *texture_system)
 	oiio_texture_system = texture_system;
 }
 
+/* Read a single statistics counter, OIIO stores them either as int or as
+ * long long depending on the counter and the library version. */
+static uint64_t texture_cache_stat(OIIO::TextureSystem *tex_sys, const char *name)
+{
+	long long value_long = 0;
+	if(tex_sys->getattribute(name, TypeDesc::LONGLONG, &value_long)) {
+		return (uint64_t)value_long;
+	}
+	int value_int = 0;
+	if(tex_sys->getattribute(name, TypeDesc::INT, &value_int)) {
+		return (uint64_t)value_int;
+	}
+	return 0;
+}
+
+ImageManager::TextureCacheStats::TextureCacheStats()
+: texture_queries(0),
+  tile_lookups(0),
+  tile_misses(0),
+  bytes_read(0),
+  memory_used(0),
+  files_size(0)
+{
+}
+
+string ImageManager::TextureCacheStats::full_report() const
+{
+	const uint64_t tile_hits = (tile_lookups > tile_misses)? tile_lookups - tile_misses: 0;
+	const double hit_rate = (tile_lookups > 0)? 100.0 * tile_hits / tile_lookups: 0.0;
+
+	string report = "";
+	report += string_printf("Texture queries:    %s\n",
+	                        string_human_readable_number(texture_queries).c_str());
+	report += string_printf("Tile lookups:       %s\n",
+	                        string_human_readable_number(tile_lookups).c_str());
+	report += string_printf("  Hits:             %s (%.2f%%)\n",
+	                        string_human_readable_number(tile_hits).c_str(), hit_rate);
+	report += string_printf("  Misses:           %s\n",
+	                        string_human_readable_number(tile_misses).c_str());
+	report += string_printf("Bytes read:         %s\n",
+	                        string_human_readable_size(bytes_read).c_str());
+	report += string_printf("Cache memory used:  %s\n",
+	                        string_human_readable_size(memory_used).c_str());
+	report += string_printf("Size of all files:  %s\n",
+	                        string_human_readable_size(files_size).c_str());
+	return report;
+}
+
+bool ImageManager::get_texture_cache_stats(TextureCacheStats *stats)
+{
+	if(!oiio_texture_system) {
+		return false;
+	}
+	OIIO::TextureSystem *tex_sys = (OIIO::TextureSystem*)oiio_texture_system;
+	stats->texture_queries = texture_cache_stat(tex_sys, "stat:texture_queries") +
+	                         texture_cache_stat(tex_sys, "stat:environment_queries");
+	stats->tile_lookups = texture_cache_stat(tex_sys, "stat:find_tile_calls");
+	stats->tile_misses = texture_cache_stat(tex_sys, "stat:find_tile_cache_misses");
+	stats->bytes_read = texture_cache_stat(tex_sys, "stat:bytes_read");
+	stats->memory_used = texture_cache_stat(tex_sys, "stat:cache_memory_used");
+	stats->files_size = texture_cache_stat(tex_sys, "stat:files_totalsize");
+	return true;
+}
+
+void ImageManager::reset_texture_cache_stats()
+{
+	if(oiio_texture_system) {
+		((OIIO::TextureSystem*)oiio_texture_system)->reset_stats();
+	}
+}
+
 bool ImageManager::set_animation_frame_update(int frame)
 {
 	if(frame != animation_frame) {
@@ -447,6 +519,7 @@ int ImageManager::add_image(const string& filename,
 	img->frame = frame;
 	img->interpolation = interpolation;
 	img->extension = extension;
+	img->content_hash = 0;
 	img->users = 1;
 	img->use_alpha = use_alpha;
 	img->srgb = srgb && (!is_linear);
@@ -750,6 +823,41 @@ bool ImageManager::file_load_image(Image *img,
 	return true;
 }
 
+/* Hash of everything the loaded pixels depend on, used to skip reloading of
+ * images which did not change. Returns zero when there is no cheap way to tell,
+ * which is the case for images provided by the host application.
+ */
+uint64_t ImageManager::image_content_hash(Image *img, int texture_limit)
+{
+	uint64_t hash;
+
+	if(img->generated_data) {
+		const InternalImageHeader *header = (const InternalImageHeader*)img->generated_data.get();
+		const size_t size = sizeof(InternalImageHeader) +
+		                    sizeof(float4) * (size_t)header->width * header->height;
+		hash = hash_data_64(img->generated_data.get(), size);
+	}
+	else if(img->builtin_data) {
+		return 0;
+	}
+	else {
+		const uint64_t modified_time = path_modified_time(img->filename);
+		if(modified_time == 0) {
+			return 0;
+		}
+		const uint64_t file_info[2] = {path_file_size(img->filename),
+		                               modified_time};
+		hash = hash_data_64(img->filename.c_str(), img->filename.size());
+		hash = hash_data_64(file_info, sizeof(file_info), hash);
+	}
+
+	const int options[3] = {texture_limit, img->use_alpha, img->srgb};
+	hash = hash_data_64(options, sizeof(options), hash);
+	hash = hash_data_64(&img->frame, sizeof(img->frame), hash);
+
+	return (hash != 0)? hash: 1;
+}
+
 void ImageManager::device_load_image(Device *device,
                                      DeviceScene *dscene,
                                      Scene *scene,
@@ -773,6 +881,7 @@ void ImageManager::device_load_image(Device *device,
 		/* When using OIIO directly from SVM, store the TextureHandle
 		 * in an array for quicker lookup at shading time */
 		OIIOGlobals *oiio = (OIIOGlobals*)device->oiio_memory();
+		bool use_texture_cache = false;
 		if(oiio) {
 			thread_scoped_lock lock(oiio->tex_paths_mutex);
 			int flat_slot = type_index_to_flattened_slot(slot, type);
@@ -812,12 +921,19 @@ void ImageManager::device_load_image(Device *device,
 						break;
 				}
 				oiio->textures[flat_slot].is_linear = have_mip;
+				use_texture_cache = true;
 			} else {
 				oiio->textures[flat_slot].handle = NULL;
 			}
 		}
-		img->need_load = false;
-		return;
+		if(use_texture_cache) {
+			img->need_load = false;
+			return;
+		}
+		/* Texture cache can not read this image, load it fully instead of
+		 * rendering with an empty slot. */
+		VLOG(1) << "Texture cache failed to open " << img->filename
+		        << ", loading it into device memory.";
 	}
 
 	string filename = path_filename(img->filename);
@@ -828,6 +944,18 @@ void ImageManager::device_load_image(Device *device,
 	/* Slot assignment */
 	int flat_slot = type_index_to_flattened_slot(slot, type);
 
+	/* Skip images which are already loaded and did not change since. */
+	const uint64_t content_hash = image_content_hash(img, texture_limit);
+	if(content_hash != 0 && content_hash == img->content_hash) {
+		device_memory *tex_img = image_memory(dscene, flat_slot);
+		if(tex_img && (tex_img->device_pointer || (pack_images && tex_img->data_size))) {
+			VLOG(1) << "Image " << filename << " did not change, skipping reload.";
+			img->need_load = false;
+			return;
+		}
+	}
+	img->content_hash = content_hash;
+
 	string name = string_printf("__tex_image_%s_%03d", name_from_type(type).c_str(), flat_slot);
 
 	if(type == IMAGE_DATA_TYPE_FLOAT4) {
@@ -846,6 +974,7 @@ void ImageManager::device_load_image(Device *device,
 		                                            tex_img))
 		{
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			float *pixels = (float*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R;
@@ -881,6 +1010,7 @@ void ImageManager::device_load_image(Device *device,
 		                                            tex_img))
 		{
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			float *pixels = (float*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R;
@@ -913,6 +1043,7 @@ void ImageManager::device_load_image(Device *device,
 		                                            tex_img))
 		{
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			uchar *pixels = (uchar*)tex_img.resize(1, 1);
 
 			pixels[0] = (TEX_IMAGE_MISSING_R * 255);
@@ -947,6 +1078,7 @@ void ImageManager::device_load_image(Device *device,
 		                                            texture_limit,
 		                                            tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			uchar *pixels = (uchar*)tex_img.resize(1, 1);
 
 			pixels[0] = (TEX_IMAGE_MISSING_R * 255);
@@ -978,6 +1110,7 @@ void ImageManager::device_load_image(Device *device,
 		                                          texture_limit,
 		                                          tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			half *pixels = (half*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R;
@@ -1012,6 +1145,7 @@ void ImageManager::device_load_image(Device *device,
 		                                          texture_limit,
 		                                          tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			half *pixels = (half*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R;
@@ -1043,6 +1177,7 @@ void ImageManager::device_load_image(Device *device,
 												  texture_limit,
 												  tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			ushort *pixels = (ushort*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R * 65535;
@@ -1077,6 +1212,7 @@ void ImageManager::device_load_image(Device *device,
 												  texture_limit,
 												  tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
+			img->content_hash = 0;
 			uint16_t *pixels = (uint16_t*)tex_img.resize(1, 1);
 
 			pixels[0] = TEX_IMAGE_MISSING_R * 65535;
@@ -77,6 +77,25 @@ public:
 	void device_free_builtin(Device *device, DeviceScene *dscene);
 
 	void set_oiio_texture_system(void *texture_system);
+
+	/* Activity of the OpenImageIO texture cache, used for images on the CPU
+	 * when texture caching is enabled. */
+	struct TextureCacheStats {
+		TextureCacheStats();
+
+		uint64_t texture_queries;
+		/* Tile lookups and how many of them had to read the tile from file. */
+		uint64_t tile_lookups;
+		uint64_t tile_misses;
+		uint64_t bytes_read;
+		uint64_t memory_used;
+		uint64_t files_size;
+
+		string full_report() const;
+	};
+
+	bool get_texture_cache_stats(TextureCacheStats *stats);
+	void reset_texture_cache_stats();
 	const string get_mip_map_path(const string& filename);
 	void set_pack_images(bool pack_images_);
 	bool set_animation_frame_update(int frame);
@@ -117,6 +136,9 @@ public:
 		InterpolationType interpolation;
 		ExtensionType extension;
 
+		/* Hash of the data the loaded pixels came from, zero when unknown. */
+		uint64_t content_hash;
+
 		int users;
 	};
 
@@ -156,6 +178,8 @@ private:
 
 	uint8_t pack_image_options(ImageDataType type, size_t slot);
 
+	uint64_t image_content_hash(Image *img, int texture_limit);
+
 	void device_load_image(Device *device,
 	                       DeviceScene *dscene,
 	                       Scene *scene,
@@ -47,6 +47,7 @@ NODE_DEFINE(Integrator)
 
 	SOCKET_INT(volume_max_steps, "Volume Max Steps", 1024);
 	SOCKET_FLOAT(volume_step_size, "Volume Step Size", 0.1f);
+	SOCKET_BOOLEAN(volume_delta_tracking, "Volume Delta Tracking", false);
 
 	SOCKET_BOOLEAN(caustics_reflective, "Reflective Caustics", true);
 	SOCKET_BOOLEAN(caustics_refractive, "Refractive Caustics", true);
@@ -66,9 +67,13 @@ NODE_DEFINE(Integrator)
 	SOCKET_INT(volume_samples, "Volume Samples", 1);
 	SOCKET_INT(start_sample, "Start Sample", 0);
 
+	SOCKET_FLOAT(adaptive_threshold, "Adaptive Threshold", 0.0f);
+	SOCKET_INT(adaptive_min_samples, "Adaptive Min Samples", 16);
+
 	SOCKET_BOOLEAN(sample_all_lights_direct, "Sample All Lights Direct", true);
 	SOCKET_BOOLEAN(sample_all_lights_indirect, "Sample All Lights Indirect", true);
 	SOCKET_FLOAT(light_sampling_threshold, "Light Sampling Threshold", 0.05f);
+	SOCKET_BOOLEAN(use_light_tree, "Use Light Tree", false);
 
 	static NodeEnum method_enum;
 	method_enum.insert("path", PATH);
@@ -141,6 +146,7 @@ void Integrator::device_update(Device *device, DeviceScene *dscene, Scene *scene
 
 	kintegrator->volume_max_steps = volume_max_steps;
 	kintegrator->volume_step_size = volume_step_size;
+	kintegrator->volume_delta_tracking = volume_delta_tracking;
 
 	kintegrator->caustics_reflective = caustics_reflective;
 	kintegrator->caustics_refractive = caustics_refractive;
@@ -164,6 +170,9 @@ void Integrator::device_update(Device *device, DeviceScene *dscene, Scene *scene
 	kintegrator->volume_samples = volume_samples;
 	kintegrator->start_sample = start_sample;
 
+	kintegrator->adaptive_threshold = adaptive_threshold;
+	kintegrator->adaptive_min_samples = max(adaptive_min_samples, 2);
+
 	if(method == BRANCHED_PATH) {
 		kintegrator->sample_all_lights_direct = sample_all_lights_direct;
 		kintegrator->sample_all_lights_indirect = sample_all_lights_indirect;
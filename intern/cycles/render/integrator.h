@@ -47,6 +47,9 @@ public:
 
 	int volume_max_steps;
 	float volume_step_size;
+	/* Track heterogeneous volumes with null collisions against majorant
+	 * grids built by the mesh manager, instead of ray marching. */
+	bool volume_delta_tracking;
 
 	bool caustics_reflective;
 	bool caustics_refractive;
@@ -68,10 +71,19 @@ public:
 	int volume_samples;
 	int start_sample;
 
+	/* Pixels stop sampling once their error estimate is below the
+	 * threshold, disabled when zero. Requires the adaptive film passes. */
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
 	bool sample_all_lights_direct;
 	bool sample_all_lights_indirect;
 	float light_sampling_threshold;
 
+	/* Pick lights with a hierarchy built by the light manager, based on
+	 * their distance and energy, instead of only area or count. */
+	bool use_light_tree;
+
 	enum Method {
 		BRANCHED_PATH = 0,
 		PATH = 1,
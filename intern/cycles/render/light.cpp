@@ -19,6 +19,7 @@
 #include "render/integrator.h"
 #include "render/film.h"
 #include "render/light.h"
+#include "render/light_tree.h"
 #include "render/mesh.h"
 #include "render/object.h"
 #include "render/scene.h"
@@ -228,6 +229,63 @@ void LightManager::disable_ineffective_light(Device *device, Scene *scene)
 	}
 }
 
+/* Light Tree */
+
+/* Average emission of a shader, negative when it is not known up front. */
+static float light_tree_shader_emission(Shader *shader)
+{
+	float3 emission;
+	if(shader->is_constant_emission(&emission)) {
+		return max(average(emission), 0.0f);
+	}
+	return -1.0f;
+}
+
+/* Set energy of the emitters from their size and emission. Emitters with
+ * unknown emission get the average of the others, so textured or otherwise
+ * varying emission is still sampled reasonably. */
+static void light_tree_set_energy(vector<LightTreeEmitter>& emitters,
+                                  const vector<float>& sizes,
+                                  const vector<float>& emission)
+{
+	float known_energy = 0.0f;
+	float known_size = 0.0f;
+
+	for(size_t i = 0; i < emitters.size(); i++) {
+		if(emission[i] >= 0.0f) {
+			known_energy += sizes[i]*emission[i];
+			known_size += sizes[i];
+		}
+	}
+
+	const float fallback = (known_energy > 0.0f)? known_energy/known_size: 1.0f;
+
+	for(size_t i = 0; i < emitters.size(); i++) {
+		emitters[i].energy = sizes[i]*((emission[i] >= 0.0f)? emission[i]: fallback);
+	}
+}
+
+static BoundBox light_tree_lamp_bounds(const Light *light)
+{
+	BoundBox bounds(light->co);
+
+	if(light->type == LIGHT_AREA) {
+		const float3 axisu = light->axisu*(light->sizeu*light->size);
+		const float3 axisv = light->axisv*(light->sizev*light->size);
+		bounds.grow(light->co - 0.5f*axisu - 0.5f*axisv);
+		bounds.grow(light->co - 0.5f*axisu + 0.5f*axisv);
+		bounds.grow(light->co + 0.5f*axisu - 0.5f*axisv);
+		bounds.grow(light->co + 0.5f*axisu + 0.5f*axisv);
+	}
+	else {
+		const float3 radius = make_float3(light->size, light->size, light->size);
+		bounds.grow(light->co - radius);
+		bounds.grow(light->co + radius);
+	}
+
+	return bounds;
+}
+
 bool LightManager::object_usable_as_light(Object *object) {
 	Mesh *mesh = object->mesh;
 	/* Skip objects with NaNs */
@@ -300,6 +358,20 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 	float4 *distribution = dscene->light_distribution.resize(num_distribution + 1);
 	float totarea = 0.0f;
 
+	/* Light tree emitters, along with their size and emission to compute
+	 * energy from. Triangle emitters are identified by their entry in the
+	 * leaf map, which starts with an offset and triangle offset per object. */
+	const bool use_light_tree = scene->integrator->use_light_tree;
+	vector<LightTreeEmitter> tree_triangles, tree_lamps;
+	vector<float> tree_triangle_area, tree_triangle_emission;
+	vector<float> tree_lamp_size, tree_lamp_emission;
+	vector<int> tree_infinite_lamps;
+	vector<uint> leaf_map;
+
+	if(use_light_tree) {
+		leaf_map.resize(scene->objects.size()*2, 0);
+	}
+
 	/* triangles */
 	size_t offset = 0;
 	int j = 0;
@@ -317,6 +389,13 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		Transform tfm = object->tfm;
 		int object_id = j;
 		int shader_flag = 0;
+		size_t leaf_map_offset = leaf_map.size();
+
+		if(use_light_tree) {
+			leaf_map[object_id*2 + 0] = leaf_map_offset;
+			leaf_map[object_id*2 + 1] = mesh->tri_offset;
+			leaf_map.resize(leaf_map_offset + mesh->num_triangles(), ~0u);
+		}
 
 		if(!(object->visibility & PATH_RAY_DIFFUSE)) {
 			shader_flag |= SHADER_EXCLUDE_DIFFUSE;
@@ -363,7 +442,17 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 					p3 = transform_point(&tfm, p3);
 				}
 
-				totarea += triangle_area(p1, p2, p3);
+				float area = triangle_area(p1, p2, p3);
+				totarea += area;
+
+				if(use_light_tree) {
+					BoundBox bounds(p1);
+					bounds.grow(p2);
+					bounds.grow(p3);
+					tree_triangles.push_back(LightTreeEmitter(bounds, 0.0f, offset - 1, leaf_map_offset + i));
+					tree_triangle_area.push_back(area);
+					tree_triangle_emission.push_back(light_tree_shader_emission(shader));
+				}
 			}
 		}
 
@@ -394,6 +483,18 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 			background_mis = light->use_mis;
 		}
 
+		if(use_light_tree) {
+			if(light->type == LIGHT_BACKGROUND || light->type == LIGHT_DISTANT) {
+				tree_infinite_lamps.push_back(offset);
+			}
+			else {
+				tree_lamps.push_back(LightTreeEmitter(light_tree_lamp_bounds(light), 0.0f, offset, light_index));
+				tree_lamp_size.push_back(1.0f);
+				Shader *shader = (light->shader) ? light->shader : scene->default_light;
+				tree_lamp_emission.push_back(light_tree_shader_emission(shader));
+			}
+		}
+
 		light_index++;
 		offset++;
 	}
@@ -458,6 +559,51 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		/* CDF */
 		device->tex_alloc("__light_distribution", dscene->light_distribution);
 
+		/* Light tree, sampled with the same probability for triangles, finite
+		 * lamps and infinite lamps as the distribution above. */
+		kintegrator->use_light_tree = use_light_tree &&
+		                              (!tree_triangles.empty() || !tree_lamps.empty());
+
+		if(kintegrator->use_light_tree) {
+			vector<float4> nodes;
+
+			if(!tree_triangles.empty()) {
+				light_tree_set_energy(tree_triangles, tree_triangle_area, tree_triangle_emission);
+				light_tree_build(tree_triangles, nodes);
+				foreach(const LightTreeEmitter& emitter, tree_triangles) {
+					leaf_map[emitter.id] = emitter.leaf;
+				}
+			}
+
+			kintegrator->light_tree_lamp_root = -1;
+			if(!tree_lamps.empty()) {
+				light_tree_set_energy(tree_lamps, tree_lamp_size, tree_lamp_emission);
+				kintegrator->light_tree_lamp_root = light_tree_build(tree_lamps, nodes);
+			}
+
+			/* Infinite lamps are stored as leaves after the trees. */
+			kintegrator->light_tree_infinite_offset = nodes.size()/2;
+			kintegrator->num_infinite_lights = tree_infinite_lamps.size();
+			foreach(int index, tree_infinite_lamps) {
+				nodes.push_back(make_float4(0.0f, 0.0f, 0.0f, 0.0f));
+				nodes.push_back(make_float4(0.0f, 0.0f, 0.0f, __int_as_float(~index)));
+			}
+
+			kintegrator->light_tree_pdf_triangles = kintegrator->pdf_triangles*trianglearea;
+			kintegrator->light_tree_pdf_lamps = kintegrator->pdf_lights*tree_lamps.size();
+
+			VLOG(1) << "Light tree with " << nodes.size()/2 << " nodes, "
+			        << tree_triangles.size() << " triangles and "
+			        << tree_lamps.size() << " lamps.";
+
+			dscene->light_tree_nodes.copy(&nodes[0], nodes.size());
+			device->tex_alloc("__light_tree_nodes", dscene->light_tree_nodes);
+			if(!leaf_map.empty()) {
+				dscene->light_tree_leaf_map.copy(&leaf_map[0], leaf_map.size());
+				device->tex_alloc("__light_tree_leaf_map", dscene->light_tree_leaf_map);
+			}
+		}
+
 		/* Portals */
 		if(num_portals > 0) {
 			kintegrator->portal_offset = light_index;
@@ -475,6 +621,7 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 
 		kintegrator->num_distribution = 0;
 		kintegrator->num_all_lights = 0;
+		kintegrator->use_light_tree = false;
 		kintegrator->pdf_triangles = 0.0f;
 		kintegrator->pdf_lights = 0.0f;
 		kintegrator->inv_pdf_lights = 0.0f;
@@ -875,11 +1022,15 @@ void LightManager::device_free(Device *device, DeviceScene *dscene)
 {
 	device->tex_free(dscene->light_distribution);
 	device->tex_free(dscene->light_data);
+	device->tex_free(dscene->light_tree_nodes);
+	device->tex_free(dscene->light_tree_leaf_map);
 	device->tex_free(dscene->light_background_marginal_cdf);
 	device->tex_free(dscene->light_background_conditional_cdf);
 
 	dscene->light_distribution.clear();
 	dscene->light_data.clear();
+	dscene->light_tree_nodes.clear();
+	dscene->light_tree_leaf_map.clear();
 	dscene->light_background_marginal_cdf.clear();
 	dscene->light_background_conditional_cdf.clear();
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "render/light_tree.h"
+
+#include "util/util_algorithm.h"
+
+CCL_NAMESPACE_BEGIN
+
+namespace {
+
+class EmitterCenterCompare {
+public:
+	explicit EmitterCenterCompare(int axis)
+	: axis(axis)
+	{
+	}
+
+	bool operator()(const LightTreeEmitter& a, const LightTreeEmitter& b) const
+	{
+		const float3 ca = a.bounds.center(), cb = b.bounds.center();
+		return (&ca.x)[axis] < (&cb.x)[axis];
+	}
+
+	int axis;
+};
+
+int light_tree_build_recursive(vector<LightTreeEmitter>& emitters,
+                               int start,
+                               int end,
+                               vector<float4>& nodes)
+{
+	const int index = nodes.size()/2;
+	nodes.resize(nodes.size() + 2);
+
+	BoundBox bounds = BoundBox::empty;
+	BoundBox centers = BoundBox::empty;
+	float energy = 0.0f;
+
+	for(int i = start; i < end; i++) {
+		bounds.grow(emitters[i].bounds);
+		centers.grow(emitters[i].bounds.center());
+		energy += emitters[i].energy;
+	}
+
+	int child;
+
+	if(end - start == 1) {
+		emitters[start].leaf = index;
+		child = ~emitters[start].distribution_index;
+	}
+	else {
+		/* Median split along the largest extent of the emitter centers, which
+		 * keeps the tree balanced no matter how the emitters are spread. */
+		const float3 extent = centers.size();
+		int axis = 0;
+		if(extent.y > extent.x) axis = 1;
+		if(extent.z > (&extent.x)[axis]) axis = 2;
+
+		const int mid = (start + end)/2;
+		std::nth_element(emitters.begin() + start,
+		                 emitters.begin() + mid,
+		                 emitters.begin() + end,
+		                 EmitterCenterCompare(axis));
+
+		light_tree_build_recursive(emitters, start, mid, nodes);
+		child = light_tree_build_recursive(emitters, mid, end, nodes);
+	}
+
+	nodes[index*2 + 0] = make_float4(bounds.min.x, bounds.min.y, bounds.min.z, energy);
+	nodes[index*2 + 1] = make_float4(bounds.max.x, bounds.max.y, bounds.max.z, __int_as_float(child));
+
+	return index;
+}
+
+}  /* namespace */
+
+int light_tree_build(vector<LightTreeEmitter>& emitters, vector<float4>& nodes)
+{
+	assert(!emitters.empty());
+	return light_tree_build_recursive(emitters, 0, emitters.size(), nodes);
+}
+
+CCL_NAMESPACE_END
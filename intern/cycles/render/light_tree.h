@@ -0,0 +1,67 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LIGHT_TREE_H__
+#define __LIGHT_TREE_H__
+
+#include "util/util_boundbox.h"
+#include "util/util_types.h"
+#include "util/util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Light Tree
+ *
+ * Binary hierarchy over emitters with a position, used to pick a light with
+ * probability proportional to its estimated contribution at the shading
+ * point rather than only to its area or count.
+ *
+ * Nodes are packed as two float4 in depth first order, so the left child of
+ * an inner node directly follows it:
+ *
+ *   (bounds min, energy)
+ *   (bounds max, right child index, or ~distribution index for leaves)
+ *
+ * Every leaf holds a single emitter. */
+
+class LightTreeEmitter {
+public:
+	LightTreeEmitter(const BoundBox& bounds, float energy, int distribution_index, int id)
+	: bounds(bounds),
+	  energy(energy),
+	  distribution_index(distribution_index),
+	  id(id),
+	  leaf(-1)
+	{
+	}
+
+	BoundBox bounds;
+	float energy;
+	/* Index into the light distribution. */
+	int distribution_index;
+	/* Caller defined index, to find the emitter after building. */
+	int id;
+	/* Node index of the leaf holding the emitter, set by the build. */
+	int leaf;
+};
+
+/* Build a tree over the emitters, appending its nodes. The emitters get
+ * reordered. Returns the index of the root node. */
+int light_tree_build(vector<LightTreeEmitter>& emitters, vector<float4>& nodes);
+
+CCL_NAMESPACE_END
+
+#endif /* __LIGHT_TREE_H__ */
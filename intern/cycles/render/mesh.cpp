@@ -27,6 +27,7 @@
 #include "render/nodes.h"
 #include "render/object.h"
 #include "render/scene.h"
+#include "render/stats.h"
 
 #include "kernel/osl/osl_globals.h"
 
@@ -37,6 +38,7 @@
 #include "util/util_logging.h"
 #include "util/util_progress.h"
 #include "util/util_set.h"
+#include "util/util_time.h"
 
 #ifdef WITH_EMBREE
 #	include "bvh/bvh_embree.h"
@@ -466,6 +468,7 @@ Mesh::Mesh()
 	subd_params = NULL;
 
 	patch_table = NULL;
+	subd_dice_cache = NULL;
 }
 
 Mesh::~Mesh()
@@ -473,6 +476,7 @@ Mesh::~Mesh()
 	delete bvh;
 	delete patch_table;
 	delete subd_params;
+	delete subd_dice_cache;
 }
 
 void Mesh::resize_mesh(int numverts, int numtris)
@@ -1043,6 +1047,7 @@ void Mesh::pack_patches(uint *patch_data, uint vert_offset, uint face_offset, ui
 void Mesh::compute_bvh(DeviceScene *dscene,
                        SceneParams *params,
                        Progress *progress,
+                       SceneUpdateStats *update_stats,
                        int n,
                        int total)
 {
@@ -1058,6 +1063,8 @@ void Mesh::compute_bvh(DeviceScene *dscene,
 		else
 			msg += string_printf("%s %u/%u", name.c_str(), (uint)(n+1), (uint)total);
 
+		double start_time = time_dt();
+
 		Object object;
 		object.mesh = this;
 
@@ -1077,6 +1084,11 @@ void Mesh::compute_bvh(DeviceScene *dscene,
 			bparams.use_qbvh = params->use_qbvh;
 			bparams.use_unaligned_nodes = dscene->data.bvh.have_curves &&
 			                              params->use_bvh_unaligned_nodes;
+			/* Wide nodes have no oriented bounds, hair with unaligned nodes
+			 * stays on QBVH. */
+			bparams.use_obvh = params->use_obvh &&
+			                   !bparams.use_unaligned_nodes &&
+			                   !params->use_ray_stream;
 			bparams.num_motion_triangle_steps = params->num_bvh_time_steps;
 			bparams.num_motion_curve_steps = params->num_bvh_time_steps;
 			bparams.bvh_type = params->bvh_type;
@@ -1088,6 +1100,10 @@ void Mesh::compute_bvh(DeviceScene *dscene,
 			bvh = BVH::create(bparams, objects);
 			MEM_GUARDED_CALL(progress, bvh->build, *progress);
 		}
+
+		if(update_stats) {
+			update_stats->add_item("bvh", name.string(), time_dt() - start_time);
+		}
 	}
 
 	need_update = false;
@@ -1415,14 +1431,15 @@ static void update_attribute_element_size(Mesh *mesh,
 }
 
 static void update_attribute_element_offset(Mesh *mesh,
-                                            vector<float>& attr_float,
+                                            float *attr_float,
                                             size_t& attr_float_offset,
-                                            vector<float4>& attr_float3,
+                                            float4 *attr_float3,
                                             size_t& attr_float3_offset,
-                                            vector<uchar4>& attr_uchar4,
+                                            uchar4 *attr_uchar4,
                                             size_t& attr_uchar4_offset,
                                             Attribute *mattr,
                                             AttributePrimitive prim,
+                                            bool pack_data,
                                             TypeDesc& type,
                                             AttributeDescriptor& desc)
 {
@@ -1447,9 +1464,10 @@ static void update_attribute_element_offset(Mesh *mesh,
 			uchar4 *data = mattr->data_uchar4();
 			offset = attr_uchar4_offset;
 
-			assert(attr_uchar4.capacity() >= offset + size);
-			for(size_t k = 0; k < size; k++) {
-				attr_uchar4[offset+k] = data[k];
+			if(pack_data) {
+				for(size_t k = 0; k < size; k++) {
+					attr_uchar4[offset+k] = data[k];
+				}
 			}
 			attr_uchar4_offset += size;
 		}
@@ -1457,9 +1475,10 @@ static void update_attribute_element_offset(Mesh *mesh,
 			float *data = mattr->data_float();
 			offset = attr_float_offset;
 
-			assert(attr_float.capacity() >= offset + size);
-			for(size_t k = 0; k < size; k++) {
-				attr_float[offset+k] = data[k];
+			if(pack_data) {
+				for(size_t k = 0; k < size; k++) {
+					attr_float[offset+k] = data[k];
+				}
 			}
 			attr_float_offset += size;
 		}
@@ -1467,9 +1486,10 @@ static void update_attribute_element_offset(Mesh *mesh,
 			Transform *tfm = mattr->data_transform();
 			offset = attr_float3_offset;
 
-			assert(attr_float3.capacity() >= offset + size * 4);
-			for(size_t k = 0; k < size*4; k++) {
-				attr_float3[offset+k] = (&tfm->x)[k];
+			if(pack_data) {
+				for(size_t k = 0; k < size*4; k++) {
+					attr_float3[offset+k] = (&tfm->x)[k];
+				}
 			}
 			attr_float3_offset += size * 4;
 		}
@@ -1477,9 +1497,10 @@ static void update_attribute_element_offset(Mesh *mesh,
 			float4 *data = mattr->data_float4();
 			offset = attr_float3_offset;
 
-			assert(attr_float3.capacity() >= offset + size);
-			for(size_t k = 0; k < size; k++) {
-				attr_float3[offset+k] = data[k];
+			if(pack_data) {
+				for(size_t k = 0; k < size; k++) {
+					attr_float3[offset+k] = data[k];
+				}
 			}
 			attr_float3_offset += size;
 		}
@@ -1520,6 +1541,77 @@ static void update_attribute_element_offset(Mesh *mesh,
 	}
 }
 
+/* Fill in the attributes of a single mesh, starting at the given offsets of
+ * the arrays. Attribute descriptors are always updated, data is only copied
+ * when the mesh is not already packed at the same place. */
+static void mesh_pack_attributes(Mesh *mesh,
+                                 AttributeRequestSet *attributes,
+                                 float *attr_float,
+                                 size_t attr_float_offset,
+                                 float4 *attr_float3,
+                                 size_t attr_float3_offset,
+                                 uchar4 *attr_uchar4,
+                                 size_t attr_uchar4_offset,
+                                 bool pack_data)
+{
+	/* todo: we now store std and name attributes from requests even if
+	 * they actually refer to the same mesh attributes, optimize */
+	foreach(AttributeRequest& req, attributes->requests) {
+		Attribute *triangle_mattr = mesh->attributes.find(req);
+		Attribute *curve_mattr = mesh->curve_attributes.find(req);
+		Attribute *subd_mattr = mesh->subd_attributes.find(req);
+
+		update_attribute_element_offset(mesh,
+		                                attr_float, attr_float_offset,
+		                                attr_float3, attr_float3_offset,
+		                                attr_uchar4, attr_uchar4_offset,
+		                                triangle_mattr,
+		                                ATTR_PRIM_TRIANGLE,
+		                                pack_data,
+		                                req.triangle_type,
+		                                req.triangle_desc);
+
+		update_attribute_element_offset(mesh,
+		                                attr_float, attr_float_offset,
+		                                attr_float3, attr_float3_offset,
+		                                attr_uchar4, attr_uchar4_offset,
+		                                curve_mattr,
+		                                ATTR_PRIM_CURVE,
+		                                pack_data,
+		                                req.curve_type,
+		                                req.curve_desc);
+
+		update_attribute_element_offset(mesh,
+		                                attr_float, attr_float_offset,
+		                                attr_float3, attr_float3_offset,
+		                                attr_uchar4, attr_uchar4_offset,
+		                                subd_mattr,
+		                                ATTR_PRIM_SUBD,
+		                                pack_data,
+		                                req.subd_type,
+		                                req.subd_desc);
+	}
+}
+
+/* Same requests in the same order, so attributes end up at the same place. */
+static bool attribute_requests_equal(const AttributeRequestSet& a,
+                                     const AttributeRequestSet& b)
+{
+	if(a.requests.size() != b.requests.size()) {
+		return false;
+	}
+
+	for(size_t i = 0; i < a.requests.size(); i++) {
+		if(a.requests[i].name != b.requests[i].name ||
+		   a.requests[i].std != b.requests[i].std)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void MeshManager::device_update_attributes(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
 {
 	progress.set_status("Updating Mesh", "Computing attributes");
@@ -1553,9 +1645,15 @@ void MeshManager::device_update_attributes(Device *device, DeviceScene *dscene,
 	size_t attr_float_size = 0;
 	size_t attr_float3_size = 0;
 	size_t attr_uchar4_size = 0;
+	vector<size_t> attr_float_offset(scene->meshes.size());
+	vector<size_t> attr_float3_offset(scene->meshes.size());
+	vector<size_t> attr_uchar4_offset(scene->meshes.size());
 	for(size_t i = 0; i < scene->meshes.size(); i++) {
 		Mesh *mesh = scene->meshes[i];
 		AttributeRequestSet& attributes = mesh_attributes[i];
+		attr_float_offset[i] = attr_float_size;
+		attr_float3_offset[i] = attr_float3_size;
+		attr_uchar4_offset[i] = attr_uchar4_size;
 		foreach(AttributeRequest& req, attributes.requests) {
 			Attribute *triangle_mattr = mesh->attributes.find(req);
 			Attribute *curve_mattr = mesh->curve_attributes.find(req);
@@ -1582,57 +1680,57 @@ void MeshManager::device_update_attributes(Device *device, DeviceScene *dscene,
 		}
 	}
 
-	vector<float> attr_float(attr_float_size);
-	vector<float4> attr_float3(attr_float3_size);
-	vector<uchar4> attr_uchar4(attr_uchar4_size);
-
-	size_t attr_float_offset = 0;
-	size_t attr_float3_offset = 0;
-	size_t attr_uchar4_offset = 0;
+	/* Arrays keep their data from the previous update, see device_free(). */
+	float *attr_float = dscene->attributes_float.resize(attr_float_size);
+	float4 *attr_float3 = dscene->attributes_float3.resize(attr_float3_size);
+	uchar4 *attr_uchar4 = dscene->attributes_uchar4.resize(attr_uchar4_size);
 
-	/* Fill in attributes. */
+	/* Fill in attributes, meshes are stored in separate ranges of the arrays
+	 * so they are packed in parallel. */
+	size_t num_packed = 0;
+	TaskPool pool;
 	for(size_t i = 0; i < scene->meshes.size(); i++) {
 		Mesh *mesh = scene->meshes[i];
-		AttributeRequestSet& attributes = mesh_attributes[i];
-
-		/* todo: we now store std and name attributes from requests even if
-		 * they actually refer to the same mesh attributes, optimize */
-		foreach(AttributeRequest& req, attributes.requests) {
-			Attribute *triangle_mattr = mesh->attributes.find(req);
-			Attribute *curve_mattr = mesh->curve_attributes.find(req);
-			Attribute *subd_mattr = mesh->subd_attributes.find(req);
+		bool pack_data = true;
+		if(i < packed_attributes.size()) {
+			const PackedAttributes& packed = packed_attributes[i];
+			pack_data = !(packed.mesh == mesh &&
+			              packed.float_offset == attr_float_offset[i] &&
+			              packed.float3_offset == attr_float3_offset[i] &&
+			              packed.uchar4_offset == attr_uchar4_offset[i] &&
+			              attribute_requests_equal(packed.attributes, mesh_attributes[i]));
+		}
+		if(pack_data) {
+			num_packed++;
+		}
+		pool.push(function_bind(&mesh_pack_attributes,
+		                        mesh,
+		                        &mesh_attributes[i],
+		                        attr_float,
+		                        attr_float_offset[i],
+		                        attr_float3,
+		                        attr_float3_offset[i],
+		                        attr_uchar4,
+		                        attr_uchar4_offset[i],
+		                        pack_data));
+	}
+	pool.wait_work();
 
-			update_attribute_element_offset(mesh,
-			                                attr_float, attr_float_offset,
-			                                attr_float3, attr_float3_offset,
-			                                attr_uchar4, attr_uchar4_offset,
-			                                triangle_mattr,
-			                                ATTR_PRIM_TRIANGLE,
-			                                req.triangle_type,
-			                                req.triangle_desc);
-
-			update_attribute_element_offset(mesh,
-			                                attr_float, attr_float_offset,
-			                                attr_float3, attr_float3_offset,
-			                                attr_uchar4, attr_uchar4_offset,
-			                                curve_mattr,
-			                                ATTR_PRIM_CURVE,
-			                                req.curve_type,
-			                                req.curve_desc);
-
-			update_attribute_element_offset(mesh,
-			                                attr_float, attr_float_offset,
-			                                attr_float3, attr_float3_offset,
-			                                attr_uchar4, attr_uchar4_offset,
-			                                subd_mattr,
-			                                ATTR_PRIM_SUBD,
-			                                req.subd_type,
-			                                req.subd_desc);
+	VLOG(1) << "Packed attributes of " << num_packed << " of "
+	        << scene->meshes.size() << " meshes.";
 
-			if(progress.get_cancel()) return;
-		}
+	packed_attributes.resize(scene->meshes.size());
+	for(size_t i = 0; i < scene->meshes.size(); i++) {
+		PackedAttributes& packed = packed_attributes[i];
+		packed.mesh = scene->meshes[i];
+		packed.attributes = mesh_attributes[i];
+		packed.float_offset = attr_float_offset[i];
+		packed.float3_offset = attr_float3_offset[i];
+		packed.uchar4_offset = attr_uchar4_offset[i];
 	}
 
+	if(progress.get_cancel()) return;
+
 	/* create attribute lookup maps */
 	if(scene->shader_manager->use_osl())
 		update_osl_attributes(device, scene, mesh_attributes);
@@ -1644,20 +1742,33 @@ void MeshManager::device_update_attributes(Device *device, DeviceScene *dscene,
 	/* copy to device */
 	progress.set_status("Updating Mesh", "Copying Attributes to device");
 
-	if(attr_float.size()) {
-		dscene->attributes_float.copy(&attr_float[0], attr_float.size());
+	if(attr_float_size) {
 		device->tex_alloc("__attributes_float", dscene->attributes_float);
 	}
-	if(attr_float3.size()) {
-		dscene->attributes_float3.copy(&attr_float3[0], attr_float3.size());
+	if(attr_float3_size) {
 		device->tex_alloc("__attributes_float3", dscene->attributes_float3);
 	}
-	if(attr_uchar4.size()) {
-		dscene->attributes_uchar4.copy(&attr_uchar4[0], attr_uchar4.size());
+	if(attr_uchar4_size) {
 		device->tex_alloc("__attributes_uchar4", dscene->attributes_uchar4);
 	}
 }
 
+void MeshManager::tag_packed_meshes_modified(Scene *scene, bool geometry, bool attributes)
+{
+	for(size_t i = 0; i < scene->meshes.size(); i++) {
+		Mesh *mesh = scene->meshes[i];
+		if(!mesh->need_update) {
+			continue;
+		}
+		if(geometry && i < packed_geometry.size()) {
+			packed_geometry[i].mesh = NULL;
+		}
+		if(attributes && i < packed_attributes.size()) {
+			packed_attributes[i].mesh = NULL;
+		}
+	}
+}
+
 void MeshManager::mesh_calc_offset(Scene *scene)
 {
 	size_t vert_size = 0;
@@ -1702,6 +1813,67 @@ void MeshManager::mesh_calc_offset(Scene *scene)
 	}
 }
 
+/* Pack the data of a single mesh into the scene arrays. Meshes are stored in
+ * separate ranges of the arrays, so they are packed in parallel. */
+static void mesh_pack_geometry(Scene *scene,
+                               DeviceScene *dscene,
+                               Mesh *mesh,
+                               const vector<uint> *tri_prim_index,
+                               bool pack_all,
+                               bool for_displacement,
+                               Progress *progress)
+{
+	if(progress->get_cancel())
+		return;
+
+	if(dscene->tri_vindex.size() != 0) {
+		if(pack_all) {
+			mesh->pack_shaders(scene,
+			                   dscene->tri_shader.get_data() + mesh->tri_offset);
+			mesh->pack_normals(scene,
+			                   dscene->tri_vnormal.get_data() + mesh->vert_offset);
+		}
+		mesh->pack_verts(*tri_prim_index,
+		                 dscene->tri_vindex.get_data() + mesh->tri_offset,
+		                 dscene->tri_patch.get_data() + mesh->tri_offset,
+		                 dscene->tri_patch_uv.get_data() + mesh->vert_offset,
+		                 mesh->vert_offset,
+		                 mesh->tri_offset);
+	}
+
+	if(pack_all && dscene->curves.size() != 0) {
+		mesh->pack_curves(scene,
+		                  dscene->curve_keys.get_data() + mesh->curvekey_offset,
+		                  dscene->curves.get_data() + mesh->curve_offset,
+		                  mesh->curvekey_offset);
+	}
+
+	if(pack_all && dscene->patches.size() != 0) {
+		uint *patch_data = dscene->patches.get_data();
+
+		mesh->pack_patches(&patch_data[mesh->patch_offset],
+		                   mesh->vert_offset,
+		                   mesh->face_offset,
+		                   mesh->corner_offset);
+
+		if(mesh->patch_table) {
+			mesh->patch_table->copy_adjusting_offsets(&patch_data[mesh->patch_table_offset],
+			                                          mesh->patch_table_offset);
+		}
+	}
+
+	if(for_displacement && mesh->num_triangles()) {
+		float4 *prim_tri_verts = dscene->prim_tri_verts.get_data();
+		for(size_t i = 0; i < mesh->num_triangles(); ++i) {
+			Mesh::Triangle t = mesh->get_triangle(i);
+			size_t offset = 3 * (i + mesh->tri_offset);
+			prim_tri_verts[offset + 0] = float3_to_float4(mesh->verts[t.v[0]]);
+			prim_tri_verts[offset + 1] = float3_to_float4(mesh->verts[t.v[1]]);
+			prim_tri_verts[offset + 2] = float3_to_float4(mesh->verts[t.v[2]]);
+		}
+	}
+}
+
 void MeshManager::device_update_mesh(Device *device,
                                      DeviceScene *dscene,
                                      Scene *scene,
@@ -1759,32 +1931,85 @@ void MeshManager::device_update_mesh(Device *device,
 		}
 	}
 
-	/* Fill in all the arrays. */
+	/* Fill in all the arrays. They keep their data from the previous update,
+	 * meshes which did not change and are stored at the same place only need
+	 * their triangle vertex indices updated, as those refer to the scene BVH.
+	 */
 	if(tri_size != 0) {
-		/* normals */
-		progress.set_status("Updating Mesh", "Computing normals");
+		dscene->tri_shader.resize(tri_size);
+		dscene->tri_vnormal.resize(vert_size);
+		dscene->tri_vindex.resize(tri_size);
+		dscene->tri_patch.resize(tri_size);
+		dscene->tri_patch_uv.resize(vert_size);
+	}
+	if(curve_size != 0) {
+		dscene->curve_keys.resize(curve_key_size);
+		dscene->curves.resize(curve_size);
+	}
+	if(patch_size != 0) {
+		dscene->patches.resize(patch_size);
+	}
+	if(for_displacement) {
+		dscene->prim_tri_verts.resize(tri_size * 3);
+	}
 
-		uint *tri_shader = dscene->tri_shader.resize(tri_size);
-		float4 *vnormal = dscene->tri_vnormal.resize(vert_size);
-		uint4 *tri_vindex = dscene->tri_vindex.resize(tri_size);
-		uint *tri_patch = dscene->tri_patch.resize(tri_size);
-		float2 *tri_patch_uv = dscene->tri_patch_uv.resize(vert_size);
+	progress.set_status("Updating Mesh", "Packing meshes");
 
-		foreach(Mesh *mesh, scene->meshes) {
-			mesh->pack_shaders(scene,
-			                   &tri_shader[mesh->tri_offset]);
-			mesh->pack_normals(scene,
-			                   &vnormal[mesh->vert_offset]);
-			mesh->pack_verts(tri_prim_index,
-			                 &tri_vindex[mesh->tri_offset],
-			                 &tri_patch[mesh->tri_offset],
-			                 &tri_patch_uv[mesh->vert_offset],
-			                 mesh->vert_offset,
-			                 mesh->tri_offset);
-			if(progress.get_cancel()) return;
+	/* Shader IDs are stored in triangles and curves. */
+	bool shaders_modified = (packed_shaders != scene->shaders);
+
+	size_t num_packed = 0;
+	TaskPool pool;
+	for(size_t i = 0; i < scene->meshes.size(); i++) {
+		Mesh *mesh = scene->meshes[i];
+		bool pack_all = true;
+		if(!shaders_modified && i < packed_geometry.size()) {
+			const PackedGeometry& packed = packed_geometry[i];
+			pack_all = !(packed.mesh == mesh &&
+			             packed.vert_offset == mesh->vert_offset &&
+			             packed.tri_offset == mesh->tri_offset &&
+			             packed.curvekey_offset == mesh->curvekey_offset &&
+			             packed.curve_offset == mesh->curve_offset &&
+			             packed.patch_offset == mesh->patch_offset);
+		}
+		if(pack_all) {
+			num_packed++;
 		}
+		pool.push(function_bind(&mesh_pack_geometry,
+		                        scene,
+		                        dscene,
+		                        mesh,
+		                        &tri_prim_index,
+		                        pack_all,
+		                        for_displacement,
+		                        &progress));
+	}
+	pool.wait_work();
+
+	if(progress.get_cancel()) return;
+
+	VLOG(1) << "Packed " << num_packed << " of "
+	        << scene->meshes.size() << " meshes.";
+
+	/* Data packed for displacement is replaced once the displacement is
+	 * done, so only remember the final layout. */
+	if(!for_displacement) {
+		packed_geometry.resize(scene->meshes.size());
+		for(size_t i = 0; i < scene->meshes.size(); i++) {
+			Mesh *mesh = scene->meshes[i];
+			PackedGeometry& packed = packed_geometry[i];
+			packed.mesh = mesh;
+			packed.vert_offset = mesh->vert_offset;
+			packed.tri_offset = mesh->tri_offset;
+			packed.curvekey_offset = mesh->curvekey_offset;
+			packed.curve_offset = mesh->curve_offset;
+			packed.patch_offset = mesh->patch_offset;
+		}
+		packed_shaders = scene->shaders;
+	}
 
-		/* vertex coordinates */
+	/* Copy to device. */
+	if(tri_size != 0) {
 		progress.set_status("Updating Mesh", "Copying Mesh to device");
 
 		device->tex_alloc("__tri_shader", dscene->tri_shader);
@@ -1797,14 +2022,6 @@ void MeshManager::device_update_mesh(Device *device,
 	if(curve_size != 0) {
 		progress.set_status("Updating Mesh", "Copying Strands to device");
 
-		float4 *curve_keys = dscene->curve_keys.resize(curve_key_size);
-		float4 *curves = dscene->curves.resize(curve_size);
-
-		foreach(Mesh *mesh, scene->meshes) {
-			mesh->pack_curves(scene, &curve_keys[mesh->curvekey_offset], &curves[mesh->curve_offset], mesh->curvekey_offset);
-			if(progress.get_cancel()) return;
-		}
-
 		device->tex_alloc("__curve_keys", dscene->curve_keys);
 		device->tex_alloc("__curves", dscene->curves);
 	}
@@ -1812,32 +2029,10 @@ void MeshManager::device_update_mesh(Device *device,
 	if(patch_size != 0) {
 		progress.set_status("Updating Mesh", "Copying Patches to device");
 
-		uint *patch_data = dscene->patches.resize(patch_size);
-
-		foreach(Mesh *mesh, scene->meshes) {
-			mesh->pack_patches(&patch_data[mesh->patch_offset], mesh->vert_offset, mesh->face_offset, mesh->corner_offset);
-
-			if(mesh->patch_table) {
-				mesh->patch_table->copy_adjusting_offsets(&patch_data[mesh->patch_table_offset], mesh->patch_table_offset);
-			}
-
-			if(progress.get_cancel()) return;
-		}
-
 		device->tex_alloc("__patches", dscene->patches);
 	}
 
 	if(for_displacement) {
-		float4 *prim_tri_verts = dscene->prim_tri_verts.resize(tri_size * 3);
-		foreach(Mesh *mesh, scene->meshes) {
-			for(size_t i = 0; i < mesh->num_triangles(); ++i) {
-				Mesh::Triangle t = mesh->get_triangle(i);
-				size_t offset = 3 * (i + mesh->tri_offset);
-				prim_tri_verts[offset + 0] = float3_to_float4(mesh->verts[t.v[0]]);
-				prim_tri_verts[offset + 1] = float3_to_float4(mesh->verts[t.v[1]]);
-				prim_tri_verts[offset + 2] = float3_to_float4(mesh->verts[t.v[2]]);
-			}
-		}
 		device->tex_alloc("__prim_tri_verts", dscene->prim_tri_verts);
 	}
 }
@@ -1847,15 +2042,16 @@ void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *
 	/* bvh build */
 	progress.set_status("Updating Scene BVH", "Building");
 
-	VLOG(1) << (scene->params.use_qbvh ? "Using QBVH optimization structure"
-	                                   : "Using regular BVH optimization structure");
-
 	BVHParams bparams;
 	bparams.top_level = true;
 	bparams.use_qbvh = scene->params.use_qbvh;
 	bparams.use_spatial_split = scene->params.use_bvh_spatial_split;
 	bparams.use_unaligned_nodes = dscene->data.bvh.have_curves &&
 	                              scene->params.use_bvh_unaligned_nodes;
+	/* Ray streams traverse QBVH, so don't switch to OBVH for them. */
+	bparams.use_obvh = scene->params.use_obvh &&
+	                   !bparams.use_unaligned_nodes &&
+	                   !scene->params.use_ray_stream;
 	bparams.num_motion_triangle_steps = scene->params.num_bvh_time_steps;
 	bparams.num_motion_curve_steps = scene->params.num_bvh_time_steps;
 	bparams.bvh_type = scene->params.bvh_type;
@@ -1863,10 +2059,19 @@ void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *
 	bparams.curve_flags = dscene->data.curve.curveflags;
 	bparams.curve_subdivisions = dscene->data.curve.subdivisions;
 
+	VLOG(1) << (bparams.use_obvh ? "Using OBVH optimization structure"
+	            : (bparams.use_qbvh ? "Using QBVH optimization structure"
+	                                : "Using regular BVH optimization structure"));
+
+	double start_time = time_dt();
+
 	delete bvh;
 	bvh = BVH::create(bparams, scene->objects);
 	bvh->build(progress, &device->stats);
 
+	VLOG(1) << "Scene BVH built for " << scene->objects.size()
+	        << " objects in " << time_dt() - start_time << " seconds.";
+
 	if(progress.get_cancel()) return;
 
 	/* copy to device */
@@ -1917,6 +2122,9 @@ void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *
 
 	dscene->data.bvh.root = pack.root_index;
 	dscene->data.bvh.use_qbvh = scene->params.use_qbvh;
+	dscene->data.bvh.use_obvh = bparams.use_obvh;
+	dscene->data.bvh.use_ray_stream = scene->params.use_ray_stream &&
+	                                  !bparams.use_bvh_embree;
 	dscene->data.bvh.use_bvh_steps = (scene->params.num_bvh_time_steps != 0);
 
 #ifdef WITH_EMBREE
@@ -2097,6 +2305,8 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 		}
 	}
 
+	tag_packed_meshes_modified(scene, true, true);
+
 	/* Tessellate meshes that are using subdivision */
 	size_t total_tess_needed = 0;
 	foreach(Mesh *mesh, scene->meshes) {
@@ -2124,8 +2334,16 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 
 			progress.set_status("Updating Mesh", msg);
 
+			double start_time = time_dt();
+
 			DiagSplit dsplit(*mesh->subd_params);
-			mesh->tessellate(&dsplit);
+			mesh->tessellate(&dsplit, scene->params.persistent_data);
+
+			if(scene->update_stats) {
+				scene->update_stats->add_item("tessellation",
+				                              mesh->name.string(),
+				                              time_dt() - start_time);
+			}
 
 			i++;
 
@@ -2156,7 +2374,7 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	}
 
 	/* Device update. */
-	device_free(device, dscene);
+	device_free(device, dscene, true);
 
 	mesh_calc_offset(scene);
 	if(true_displacement_used) {
@@ -2173,12 +2391,9 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 
 	/* Update displacement. */
 	bool displacement_done = false;
-	foreach(Mesh *mesh, scene->meshes) {
-		if(mesh->need_update &&
-		   displace(device, dscene, scene, mesh, progress))
-		{
-			displacement_done = true;
-		}
+	{
+		scoped_update_step step(scene->update_stats, device, "meshes_displacement");
+		displacement_done = displace(device, dscene, scene, progress);
 	}
 
 	/* TODO: properly handle cancel halfway displacement */
@@ -2186,20 +2401,26 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 
 	/* Device re-update after displacement. */
 	if(displacement_done) {
-		device_free(device, dscene);
+		tag_packed_meshes_modified(scene, false, true);
+		device_free(device, dscene, true);
 
 		device_update_attributes(device, dscene, scene, progress);
 		if(progress.get_cancel()) return;
 	}
 
 	/* Update bvh. */
-	size_t num_bvh = 0;
+	size_t num_bvh = 0, num_bvh_refit = 0;
 	foreach(Mesh *mesh, scene->meshes) {
 		if(mesh->need_update && mesh->need_build_bvh()) {
 			num_bvh++;
+			if(mesh->bvh && !mesh->need_update_rebuild) {
+				num_bvh_refit++;
+			}
 		}
 	}
 
+	double bvh_start_time = time_dt();
+
 	TaskPool pool;
 
 	i = 0;
@@ -2210,6 +2431,7 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 			                        dscene,
 			                        &scene->params,
 			                        &progress,
+			                        scene->update_stats,
 			                        i,
 			                        num_bvh));
 			if(mesh->need_build_bvh()) {
@@ -2222,6 +2444,9 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	pool.wait_work(&summary);
 	VLOG(2) << "Objects BVH build pool statistics:\n"
 	        << summary.full_report();
+	VLOG(1) << "Objects BVH: built " << num_bvh - num_bvh_refit
+	        << ", refitted " << num_bvh_refit
+	        << " in " << time_dt() - bvh_start_time << " seconds.";
 
 	foreach(Shader *shader, scene->shaders) {
 		shader->need_update_attributes = false;
@@ -2242,7 +2467,16 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 
 	if(progress.get_cancel()) return;
 
-	device_update_bvh(device, dscene, scene, progress);
+	{
+		scoped_update_step step(scene->update_stats, device, "meshes_volume_majorants");
+		device_update_volume_majorants(device, dscene, scene, progress);
+	}
+	if(progress.get_cancel()) return;
+
+	{
+		scoped_update_step step(scene->update_stats, device, "meshes_scene_bvh");
+		device_update_bvh(device, dscene, scene, progress);
+	}
 	if(progress.get_cancel()) return;
 
 	device_update_mesh(device, dscene, scene, false, progress);
@@ -2261,7 +2495,7 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	}
 }
 
-void MeshManager::device_free(Device *device, DeviceScene *dscene)
+void MeshManager::device_free(Device *device, DeviceScene *dscene, bool keep_packed_data)
 {
 	device->tex_free(dscene->bvh_nodes);
 	device->tex_free(dscene->bvh_leaf_nodes);
@@ -2285,6 +2519,8 @@ void MeshManager::device_free(Device *device, DeviceScene *dscene)
 	device->tex_free(dscene->attributes_float);
 	device->tex_free(dscene->attributes_float3);
 	device->tex_free(dscene->attributes_uchar4);
+	device->tex_free(dscene->object_volume_majorant);
+	device->tex_free(dscene->volume_majorant);
 
 	dscene->bvh_nodes.clear();
 	dscene->object_node.clear();
@@ -2295,18 +2531,27 @@ void MeshManager::device_free(Device *device, DeviceScene *dscene)
 	dscene->prim_index.clear();
 	dscene->prim_object.clear();
 	dscene->prim_time.clear();
-	dscene->tri_shader.clear();
-	dscene->tri_vnormal.clear();
 	dscene->tri_vindex.clear();
 	dscene->tri_patch.clear();
-	dscene->tri_patch_uv.clear();
-	dscene->curves.clear();
-	dscene->curve_keys.clear();
-	dscene->patches.clear();
 	dscene->attributes_map.clear();
-	dscene->attributes_float.clear();
-	dscene->attributes_float3.clear();
-	dscene->attributes_uchar4.clear();
+	dscene->object_volume_majorant.clear();
+	dscene->volume_majorant.clear();
+
+	if(!keep_packed_data) {
+		dscene->tri_shader.clear();
+		dscene->tri_vnormal.clear();
+		dscene->tri_patch_uv.clear();
+		dscene->curves.clear();
+		dscene->curve_keys.clear();
+		dscene->patches.clear();
+		dscene->attributes_float.clear();
+		dscene->attributes_float3.clear();
+		dscene->attributes_uchar4.clear();
+
+		packed_geometry.clear();
+		packed_attributes.clear();
+		packed_shaders.clear();
+	}
 
 #ifdef WITH_OSL
 	OSLGlobals *og = (OSLGlobals*)device->osl_memory();
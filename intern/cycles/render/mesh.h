@@ -40,11 +40,33 @@ class Mesh;
 class Progress;
 class Scene;
 class SceneParams;
+class SceneUpdateStats;
 class AttributeRequest;
 struct SubdParams;
 class DiagSplit;
 struct PackedPatchTable;
 
+/* Subdivision Dicing Cache
+ *
+ * Diced vertices and triangles of a subdivision mesh, kept between updates
+ * so the mesh is not tessellated again when neither the control cage nor the
+ * dicing camera and rate changed. */
+
+struct SubdDiceCache {
+	uint64_t key;
+
+	array<float3> verts;
+	array<int> triangles;
+	array<int> shader;
+	array<bool> smooth;
+	array<int> triangle_patch;
+	array<float2> vert_patch_uv;
+
+	array<float3> vertex_normal;
+	array<float3> ptex_uv;
+	array<float> ptex_face_id;
+};
+
 /* Mesh */
 
 class Mesh : public Node {
@@ -253,6 +275,9 @@ public:
 
 	size_t num_subd_verts;
 
+	/* diced result of the last tessellation, not freed by clear() */
+	SubdDiceCache *subd_dice_cache;
+
 	/* Functions */
 	Mesh();
 	~Mesh();
@@ -291,6 +316,7 @@ public:
 	void compute_bvh(DeviceScene *dscene,
 	                 SceneParams *params,
 	                 Progress *progress,
+	                 SceneUpdateStats *update_stats,
 	                 int n,
 	                 int total);
 
@@ -315,7 +341,7 @@ public:
 	/* Check if the mesh should be treated as instanced. */
 	bool is_instanced() const;
 
-	void tessellate(DiagSplit *split);
+	void tessellate(DiagSplit *split, bool use_cache = false);
 };
 
 /* Mesh Manager */
@@ -330,7 +356,9 @@ public:
 	MeshManager();
 	~MeshManager();
 
-	bool displace(Device *device, DeviceScene *dscene, Scene *scene, Mesh *mesh, Progress& progress);
+	/* Displace all updated meshes with true displacement, returns true if
+	 * any mesh was changed. */
+	bool displace(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 
 	/* attributes */
 	void update_osl_attributes(Device *device, Scene *scene, vector<AttributeRequestSet>& mesh_attributes);
@@ -339,13 +367,44 @@ public:
 	void device_update_preprocess(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 	void device_update(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 
-	void device_free(Device *device, DeviceScene *dscene);
+	/* When keeping packed data, host copies of the mesh and attribute arrays
+	 * stay around so unchanged meshes don't need to be packed again. */
+	void device_free(Device *device, DeviceScene *dscene, bool keep_packed_data = false);
 
 	void tag_update(Scene *scene);
 
 	void create_volume_mesh(Scene *scene, DeviceScene *dscene, Mesh *mesh, Progress &progress);
 
 protected:
+	/* Where meshes were stored in the packed arrays by the previous update.
+	 * Meshes which did not change since and are stored at the same place are
+	 * not packed again. */
+	struct PackedGeometry {
+		Mesh *mesh;
+		size_t vert_offset;
+		size_t tri_offset;
+		size_t curvekey_offset;
+		size_t curve_offset;
+		size_t patch_offset;
+	};
+
+	struct PackedAttributes {
+		Mesh *mesh;
+		AttributeRequestSet attributes;
+		size_t float_offset;
+		size_t float3_offset;
+		size_t uchar4_offset;
+	};
+
+	vector<PackedGeometry> packed_geometry;
+	vector<PackedAttributes> packed_attributes;
+	/* Shader IDs are packed along with geometry. */
+	vector<Shader*> packed_shaders;
+
+	/* Forget where meshes tagged for update are packed, so they are packed
+	 * again even when they stay at the same place. */
+	void tag_packed_meshes_modified(Scene *scene, bool geometry, bool attributes);
+
 	/* Calculate verts/triangles/curves offsets in global arrays. */
 	void mesh_calc_offset(Scene *scene);
 
@@ -379,6 +438,12 @@ protected:
 	                                 DeviceScene *dscene,
 									 Scene *scene,
 									 Progress& progress);
+
+	/* Grids bounding the extinction of volume objects, for delta tracking. */
+	void device_update_volume_majorants(Device *device,
+	                                    DeviceScene *dscene,
+	                                    Scene *scene,
+	                                    Progress& progress);
 };
 
 CCL_NAMESPACE_END
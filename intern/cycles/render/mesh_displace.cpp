@@ -20,9 +20,13 @@
 #include "render/object.h"
 #include "render/scene.h"
 #include "render/shader.h"
+#include "render/stats.h"
 
 #include "util/util_foreach.h"
+#include "util/util_map.h"
 #include "util/util_progress.h"
+#include "util/util_task.h"
+#include "util/util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -41,44 +45,45 @@ static float3 compute_face_normal(const Mesh::Triangle& t, float3 *verts)
 	return norm / normlen;
 }
 
-bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Mesh *mesh, Progress& progress)
-{
-	/* verify if we have a displacement shader */
-	if(!mesh->has_true_displacement()) {
-		return false;
-	}
+/* Maximum number of vertices evaluated by a single device task, meshes are
+ * batched up to this size to keep memory usage bounded. */
+#define DISPLACE_MAX_BATCH_VERTS (16*1024*1024)
 
-	string msg = string_printf("Computing Displacement %s", mesh->name.c_str());
-	progress.set_status("Updating Mesh", msg);
+/* Displaced mesh and the range of shader evaluation inputs for its vertices. */
+struct DisplaceMesh {
+	Mesh *mesh;
+	int object_index;
+	size_t input_offset;
+	size_t input_size;
+};
 
-	/* find object index. todo: is arbitrary */
-	size_t object_index = OBJECT_NONE;
+static Shader *triangle_shader(Scene *scene, Mesh *mesh, size_t i)
+{
+	int shader_index = mesh->shader[i];
+	return (shader_index < mesh->used_shaders.size()) ?
+		mesh->used_shaders[shader_index] : scene->default_surface;
+}
 
-	for(size_t i = 0; i < scene->objects.size(); i++) {
-		if(scene->objects[i]->mesh == mesh) {
-			object_index = i;
-			break;
-		}
-	}
+static bool triangle_is_displaced(Scene *scene, Mesh *mesh, size_t i)
+{
+	Shader *shader = triangle_shader(scene, mesh, i);
+	return shader->has_displacement && shader->displacement_method != DISPLACE_BUMP;
+}
 
-	/* setup input for device task */
+static size_t displace_setup_input(Scene *scene, Mesh *mesh, int object_index, uint4 *d_input_data)
+{
 	const size_t num_verts = mesh->verts.size();
 	vector<bool> done(num_verts, false);
-	device_vector<uint4> d_input;
-	uint4 *d_input_data = d_input.resize(num_verts);
 	size_t d_input_size = 0;
 
 	size_t num_triangles = mesh->num_triangles();
 	for(size_t i = 0; i < num_triangles; i++) {
-		Mesh::Triangle t = mesh->get_triangle(i);
-		int shader_index = mesh->shader[i];
-		Shader *shader = (shader_index < mesh->used_shaders.size()) ?
-			mesh->used_shaders[shader_index] : scene->default_surface;
-
-		if(!shader->has_displacement || shader->displacement_method == DISPLACE_BUMP) {
+		if(!triangle_is_displaced(scene, mesh, i)) {
 			continue;
 		}
 
+		Mesh::Triangle t = mesh->get_triangle(i);
+
 		for(int j = 0; j < 3; j++) {
 			if(done[t.v[j]])
 				continue;
@@ -89,7 +94,7 @@ bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Me
 			int object = object_index;
 			int prim = mesh->tri_offset + i;
 			float u, v;
-			
+
 			switch(j) {
 				case 0:
 					u = 1.0f;
@@ -111,60 +116,30 @@ bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Me
 		}
 	}
 
-	if(d_input_size == 0)
-		return false;
-	
-	/* run device task */
-	device_vector<float4> d_output;
-	d_output.resize(d_input_size);
-
-	/* needs to be up to data for attribute access */
-	device->const_copy_to("__data", &dscene->data, sizeof(dscene->data));
-
-	device->mem_alloc("displace_input", d_input, MEM_READ_ONLY);
-	device->mem_copy_to(d_input);
-	device->mem_alloc("displace_output", d_output, MEM_WRITE_ONLY);
-
-	DeviceTask task(DeviceTask::SHADER);
-	task.shader_input = d_input.device_pointer;
-	task.shader_output = d_output.device_pointer;
-	task.shader_eval_type = SHADER_EVAL_DISPLACE;
-	task.shader_x = 0;
-	task.shader_w = d_output.size();
-	task.num_samples = 1;
-	task.get_cancel = function_bind(&Progress::get_cancel, &progress);
-
-	device->task_add(task);
-	device->task_wait();
+	return d_input_size;
+}
 
-	if(progress.get_cancel()) {
-		device->mem_free(d_input);
-		device->mem_free(d_output);
-		return false;
-	}
+/* Apply the evaluated offsets to the mesh and update its normals, meshes
+ * are independent so this runs for multiple meshes in parallel. */
+static void displace_apply(Scene *scene, Mesh *mesh, const float4 *offset)
+{
+	double start_time = time_dt();
 
-	device->mem_copy_from(d_output, 0, 1, d_output.size(), sizeof(float4));
-	device->mem_free(d_input);
-	device->mem_free(d_output);
+	const size_t num_verts = mesh->verts.size();
+	const size_t num_triangles = mesh->num_triangles();
 
 	/* read result */
-	done.clear();
-	done.resize(num_verts, false);
+	vector<bool> done(num_verts, false);
 	int k = 0;
 
-	float4 *offset = (float4*)d_output.data_pointer;
-
 	Attribute *attr_mP = mesh->attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
 	for(size_t i = 0; i < num_triangles; i++) {
-		Mesh::Triangle t = mesh->get_triangle(i);
-		int shader_index = mesh->shader[i];
-		Shader *shader = (shader_index < mesh->used_shaders.size()) ?
-			mesh->used_shaders[shader_index] : scene->default_surface;
-
-		if(!shader->has_displacement || shader->displacement_method == DISPLACE_BUMP) {
+		if(!triangle_is_displaced(scene, mesh, i)) {
 			continue;
 		}
 
+		Mesh::Triangle t = mesh->get_triangle(i);
+
 		for(int j = 0; j < 3; j++) {
 			if(!done[t.v[j]]) {
 				done[t.v[j]] = true;
@@ -201,10 +176,7 @@ bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Me
 		vector<bool> tri_has_true_disp(num_triangles, false);
 
 		for(size_t i = 0; i < num_triangles; i++) {
-			int shader_index = mesh->shader[i];
-			Shader *shader = (shader_index < mesh->used_shaders.size()) ?
-				mesh->used_shaders[shader_index] : scene->default_surface;
-
+			Shader *shader = triangle_shader(scene, mesh, i);
 			tri_has_true_disp[i] = shader->has_displacement && shader->displacement_method == DISPLACE_TRUE;
 		}
 
@@ -314,8 +286,159 @@ bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Me
 		}
 	}
 
+
+	if(scene->update_stats) {
+		scene->update_stats->add_item("displacement",
+		                              mesh->name.string(),
+		                              time_dt() - start_time);
+	}
+}
+
+static bool displace_batch(Device *device,
+                           Scene *scene,
+                           DisplaceMesh *meshes,
+                           size_t num_meshes,
+                           Progress& progress)
+{
+	/* setup input for device task */
+	size_t max_input_size = 0;
+	for(size_t i = 0; i < num_meshes; i++) {
+		max_input_size += meshes[i].mesh->verts.size();
+	}
+
+	device_vector<uint4> d_input;
+	uint4 *d_input_data = d_input.resize(max_input_size);
+	size_t d_input_size = 0;
+
+	for(size_t i = 0; i < num_meshes; i++) {
+		DisplaceMesh& dmesh = meshes[i];
+
+		dmesh.input_offset = d_input_size;
+		dmesh.input_size = displace_setup_input(scene,
+		                                        dmesh.mesh,
+		                                        dmesh.object_index,
+		                                        d_input_data + d_input_size);
+		d_input_size += dmesh.input_size;
+	}
+
+	if(d_input_size == 0)
+		return false;
+
+	/* run device task */
+	device_vector<float4> d_output;
+	d_output.resize(d_input_size);
+
+	device->mem_alloc("displace_input", d_input, MEM_READ_ONLY);
+	device->mem_copy_to(d_input);
+	device->mem_alloc("displace_output", d_output, MEM_WRITE_ONLY);
+
+	DeviceTask task(DeviceTask::SHADER);
+	task.shader_input = d_input.device_pointer;
+	task.shader_output = d_output.device_pointer;
+	task.shader_eval_type = SHADER_EVAL_DISPLACE;
+	task.shader_x = 0;
+	task.shader_w = d_output.size();
+	task.num_samples = 1;
+	task.get_cancel = function_bind(&Progress::get_cancel, &progress);
+
+	device->task_add(task);
+	device->task_wait();
+
+	if(progress.get_cancel()) {
+		device->mem_free(d_input);
+		device->mem_free(d_output);
+		return false;
+	}
+
+	device->mem_copy_from(d_output, 0, 1, d_output.size(), sizeof(float4));
+	device->mem_free(d_input);
+	device->mem_free(d_output);
+
+	/* apply result */
+	const float4 *offset = (float4*)d_output.data_pointer;
+	TaskPool pool;
+
+	for(size_t i = 0; i < num_meshes; i++) {
+		DisplaceMesh& dmesh = meshes[i];
+
+		if(dmesh.input_size == 0) {
+			continue;
+		}
+
+		pool.push(function_bind(&displace_apply,
+		                        scene,
+		                        dmesh.mesh,
+		                        offset + dmesh.input_offset));
+	}
+
+	pool.wait_work();
+
 	return true;
 }
 
-CCL_NAMESPACE_END
+bool MeshManager::displace(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
+{
+	/* find object index. todo: is arbitrary */
+	map<Mesh*, int> object_index;
+
+	for(size_t i = 0; i < scene->objects.size(); i++) {
+		object_index.insert(std::make_pair(scene->objects[i]->mesh, (int)i));
+	}
 
+	/* verify which meshes have a displacement shader */
+	vector<DisplaceMesh> meshes;
+
+	foreach(Mesh *mesh, scene->meshes) {
+		if(!mesh->need_update || !mesh->has_true_displacement()) {
+			continue;
+		}
+
+		map<Mesh*, int>::iterator it = object_index.find(mesh);
+
+		DisplaceMesh dmesh;
+		dmesh.mesh = mesh;
+		dmesh.object_index = (it != object_index.end())? it->second: OBJECT_NONE;
+		dmesh.input_offset = 0;
+		dmesh.input_size = 0;
+		meshes.push_back(dmesh);
+	}
+
+	if(meshes.size() == 0) {
+		return false;
+	}
+
+	progress.set_status("Updating Mesh", "Computing Displacement");
+
+	/* needs to be up to data for attribute access */
+	device->const_copy_to("__data", &dscene->data, sizeof(dscene->data));
+
+	/* evaluate all meshes with as few device tasks as possible */
+	bool displaced = false;
+	size_t first = 0;
+
+	while(first < meshes.size()) {
+		size_t last = first + 1;
+		size_t batch_verts = meshes[first].mesh->verts.size();
+
+		while(last < meshes.size() &&
+		      batch_verts + meshes[last].mesh->verts.size() <= DISPLACE_MAX_BATCH_VERTS)
+		{
+			batch_verts += meshes[last].mesh->verts.size();
+			last++;
+		}
+
+		if(displace_batch(device, scene, &meshes[first], last - first, progress)) {
+			displaced = true;
+		}
+
+		if(progress.get_cancel()) {
+			return false;
+		}
+
+		first = last;
+	}
+
+	return displaced;
+}
+
+CCL_NAMESPACE_END
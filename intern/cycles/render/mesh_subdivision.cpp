@@ -24,6 +24,7 @@
 
 #include "util/util_foreach.h"
 #include "util/util_algorithm.h"
+#include "util/util_hash.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -335,7 +336,151 @@ struct OsdPatch : Patch {
 
 #endif
 
-void Mesh::tessellate(DiagSplit *split)
+/* Subdivision Dicing Cache */
+
+static uint64_t hash_float3_array(const float3 *data, size_t size, uint64_t seed)
+{
+	/* hash components only, the padding of float3 is undefined */
+	seed = hash_data_64(&size, sizeof(size), seed);
+	for(size_t i = 0; i < size; i++) {
+		seed = hash_data_64(&data[i].x, sizeof(float)*3, seed);
+	}
+	return seed;
+}
+
+static uint64_t subd_dice_cache_key(Mesh *mesh, const SubdParams& params)
+{
+	uint64_t key = hash_float3_array(mesh->verts.data(), mesh->verts.size(), 0);
+
+	for(size_t i = 0; i < mesh->subd_faces.size(); i++) {
+		const Mesh::SubdFace& face = mesh->subd_faces[i];
+		int data[5] = {face.start_corner, face.num_corners, face.shader, face.smooth, face.ptex_offset};
+		key = hash_data_64(data, sizeof(data), key);
+	}
+
+	key = hash_data_64(mesh->subd_face_corners.data(),
+	                   sizeof(int)*mesh->subd_face_corners.size(),
+	                   key);
+	key = hash_data_64(mesh->subd_creases.data(),
+	                   sizeof(Mesh::SubdEdgeCrease)*mesh->subd_creases.size(),
+	                   key);
+
+	Attribute *attr_vN = mesh->subd_attributes.find(ATTR_STD_VERTEX_NORMAL);
+	if(attr_vN) {
+		key = hash_float3_array(attr_vN->data_float3(), mesh->verts.size(), key);
+	}
+
+	/* dicing settings */
+	int settings[6] = {mesh->subdivision_type,
+	                   params.ptex,
+	                   params.test_steps,
+	                   params.split_threshold,
+	                   params.max_level,
+	                   params.camera != NULL};
+	key = hash_data_64(settings, sizeof(settings), key);
+	key = hash_data_64(&params.dicing_rate, sizeof(params.dicing_rate), key);
+	key = hash_data_64(&params.objecttoworld, sizeof(Transform), key);
+
+	/* camera state used for the edge factors, see Camera::world_to_raster_size() */
+	if(params.camera) {
+		Camera *cam = params.camera;
+		int cam_settings[3] = {cam->type, cam->width, cam->height};
+
+		key = hash_data_64(cam_settings, sizeof(cam_settings), key);
+		key = hash_float3_array(&cam->full_dx, 1, key);
+		key = hash_float3_array(&cam->full_dy, 1, key);
+		key = hash_data_64(&cam->rastertocamera, sizeof(Transform), key);
+		key = hash_data_64(&cam->cameratoworld, sizeof(Transform), key);
+		key = hash_data_64(&cam->worldtocamera, sizeof(Transform), key);
+	}
+
+	return key;
+}
+
+template<typename T>
+static void subd_dice_cache_store(array<T>& to, const T *from, size_t size)
+{
+	to.resize(size);
+	if(size) {
+		memcpy(to.data(), from, sizeof(T)*size);
+	}
+}
+
+template<typename T>
+static void subd_dice_cache_restore(T *to, const array<T>& from)
+{
+	if(from.size()) {
+		memcpy(to, from.data(), sizeof(T)*from.size());
+	}
+}
+
+static void subd_dice_cache_write(Mesh *mesh,
+                                  SubdDiceCache *cache,
+                                  bool ptex,
+                                  size_t vert_start,
+                                  size_t tri_start)
+{
+	size_t num_verts = mesh->verts.size() - vert_start;
+	size_t num_triangles = mesh->num_triangles() - tri_start;
+
+	subd_dice_cache_store(cache->verts, mesh->verts.data() + vert_start, num_verts);
+	subd_dice_cache_store(cache->triangles, mesh->triangles.data() + tri_start*3, num_triangles*3);
+	subd_dice_cache_store(cache->shader, mesh->shader.data() + tri_start, num_triangles);
+	subd_dice_cache_store(cache->smooth, mesh->smooth.data() + tri_start, num_triangles);
+	subd_dice_cache_store(cache->triangle_patch, mesh->triangle_patch.data() + tri_start, num_triangles);
+	subd_dice_cache_store(cache->vert_patch_uv, mesh->vert_patch_uv.data() + vert_start, num_verts);
+
+	Attribute *attr_vN = mesh->attributes.find(ATTR_STD_VERTEX_NORMAL);
+	subd_dice_cache_store(cache->vertex_normal, attr_vN->data_float3() + vert_start, num_verts);
+
+	if(ptex) {
+		Attribute *attr_ptex_uv = mesh->attributes.find(ATTR_STD_PTEX_UV);
+		Attribute *attr_ptex_face_id = mesh->attributes.find(ATTR_STD_PTEX_FACE_ID);
+
+		subd_dice_cache_store(cache->ptex_uv, attr_ptex_uv->data_float3() + vert_start, num_verts);
+		subd_dice_cache_store(cache->ptex_face_id, attr_ptex_face_id->data_float() + tri_start, num_triangles);
+	}
+	else {
+		cache->ptex_uv.clear();
+		cache->ptex_face_id.clear();
+	}
+}
+
+static void subd_dice_cache_read(Mesh *mesh,
+                                 const SubdDiceCache *cache,
+                                 bool ptex,
+                                 size_t vert_start,
+                                 size_t tri_start)
+{
+	Attribute *attr_vN = mesh->attributes.add(ATTR_STD_VERTEX_NORMAL);
+	Attribute *attr_ptex_uv = NULL;
+	Attribute *attr_ptex_face_id = NULL;
+
+	if(ptex) {
+		attr_ptex_uv = mesh->attributes.add(ATTR_STD_PTEX_UV);
+		attr_ptex_face_id = mesh->attributes.add(ATTR_STD_PTEX_FACE_ID);
+	}
+
+	mesh->resize_mesh(vert_start + cache->verts.size(), tri_start + cache->shader.size());
+	mesh->num_subd_verts += cache->verts.size();
+
+	subd_dice_cache_restore(mesh->verts.data() + vert_start, cache->verts);
+	subd_dice_cache_restore(mesh->triangles.data() + tri_start*3, cache->triangles);
+	subd_dice_cache_restore(mesh->shader.data() + tri_start, cache->shader);
+	subd_dice_cache_restore(mesh->smooth.data() + tri_start, cache->smooth);
+	subd_dice_cache_restore(mesh->triangle_patch.data() + tri_start, cache->triangle_patch);
+	subd_dice_cache_restore(mesh->vert_patch_uv.data() + vert_start, cache->vert_patch_uv);
+	subd_dice_cache_restore(attr_vN->data_float3() + vert_start, cache->vertex_normal);
+
+	if(ptex) {
+		subd_dice_cache_restore(attr_ptex_uv->data_float3() + vert_start, cache->ptex_uv);
+		subd_dice_cache_restore(attr_ptex_face_id->data_float() + tri_start, cache->ptex_face_id);
+	}
+}
+
+/* Tessellation */
+
+void Mesh::tessellate(DiagSplit *split, bool use_cache)
 {
 #ifdef WITH_OPENSUBDIV
 	OsdData osd_data;
@@ -362,147 +507,217 @@ void Mesh::tessellate(DiagSplit *split)
 
 	int num_faces = subd_faces.size();
 
-	Attribute *attr_vN = subd_attributes.find(ATTR_STD_VERTEX_NORMAL);
-	float3* vN = attr_vN->data_float3();
+	/* reuse the diced mesh of the previous tessellation when possible */
+	const SubdParams& params = split->params;
+	size_t vert_start = verts.size();
+	size_t tri_start = num_triangles();
+	uint64_t cache_key = 0;
 
-	for(int f = 0; f < num_faces; f++) {
-		SubdFace& face = subd_faces[f];
+	use_cache = use_cache && num_faces;
 
-		if(face.is_quad()) {
-			/* quad */
-			QuadDice::SubPatch subpatch;
+	if(use_cache) {
+		cache_key = subd_dice_cache_key(this, params);
+	}
+	else {
+		delete subd_dice_cache;
+		subd_dice_cache = NULL;
+	}
 
-			LinearQuadPatch quad_patch;
-#ifdef WITH_OPENSUBDIV
-			OsdPatch osd_patch(&osd_data);
+	if(subd_dice_cache && subd_dice_cache->key == cache_key) {
+		subd_dice_cache_read(this, subd_dice_cache, params.ptex, vert_start, tri_start);
+	}
+	else {
+		Attribute *attr_vN = subd_attributes.find(ATTR_STD_VERTEX_NORMAL);
+		float3* vN = attr_vN->data_float3();
+
+		/* patches must stay in place while they are split and diced */
+		int num_patches = 0;
+		for(int f = 0; f < num_faces; f++) {
+			num_patches += subd_faces[f].num_ptex_faces();
+		}
 
-			if(subdivision_type == SUBDIVISION_CATMULL_CLARK) {
-				osd_patch.patch_index = face.ptex_offset;
+		vector<LinearQuadPatch> linear_patches;
+#ifdef WITH_OPENSUBDIV
+		vector<OsdPatch> osd_patches;
 
-				subpatch.patch = &osd_patch;
-			}
-			else
+		if(subdivision_type == SUBDIVISION_CATMULL_CLARK) {
+			osd_patches.reserve(num_patches);
+		}
+		else
 #endif
-			{
-				float3 *hull = quad_patch.hull;
-				float3 *normals = quad_patch.normals;
+		{
+			linear_patches.reserve(num_patches);
+		}
+
+		/* subpatches to split and dice, in the order they are added to the mesh */
+		vector<QuadDice::SubPatch> subpatches;
+		subpatches.reserve(num_patches*4);
 
-				quad_patch.patch_index = face.ptex_offset;
+		for(int f = 0; f < num_faces; f++) {
+			SubdFace& face = subd_faces[f];
+
+			if(face.is_quad()) {
+				/* quad */
+				Patch *patch;
+
+#ifdef WITH_OPENSUBDIV
+				if(subdivision_type == SUBDIVISION_CATMULL_CLARK) {
+					osd_patches.push_back(OsdPatch(&osd_data));
+					OsdPatch& osd_patch = osd_patches.back();
 
-				for(int i = 0; i < 4; i++) {
-					hull[i] = verts[subd_face_corners[face.start_corner+i]];
+					osd_patch.patch_index = face.ptex_offset;
+
+					patch = &osd_patch;
 				}
+				else
+#endif
+				{
+					linear_patches.push_back(LinearQuadPatch());
+					LinearQuadPatch& quad_patch = linear_patches.back();
+					float3 *hull = quad_patch.hull;
+					float3 *normals = quad_patch.normals;
+
+					quad_patch.patch_index = face.ptex_offset;
 
-				if(face.smooth) {
 					for(int i = 0; i < 4; i++) {
-						normals[i] = vN[subd_face_corners[face.start_corner+i]];
+						hull[i] = verts[subd_face_corners[face.start_corner+i]];
 					}
-				}
-				else {
-					float3 N = face.normal(this);
-					for(int i = 0; i < 4; i++) {
-						normals[i] = N;
+
+					if(face.smooth) {
+						for(int i = 0; i < 4; i++) {
+							normals[i] = vN[subd_face_corners[face.start_corner+i]];
+						}
 					}
-				}
+					else {
+						float3 N = face.normal(this);
+						for(int i = 0; i < 4; i++) {
+							normals[i] = N;
+						}
+					}
+
+					swap(hull[2], hull[3]);
+					swap(normals[2], normals[3]);
 
-				swap(hull[2], hull[3]);
-				swap(normals[2], normals[3]);
+					patch = &quad_patch;
+				}
 
-				subpatch.patch = &quad_patch;
+				patch->shader = face.shader;
+
+				/* Quad faces need to be split at least once to line up with split ngons, we do this
+				 * here in this manner because if we do it later edge factors may end up slightly off.
+				 */
+				QuadDice::SubPatch subpatch;
+				subpatch.patch = patch;
+
+				subpatch.P00 = make_float2(0.0f, 0.0f);
+				subpatch.P10 = make_float2(0.5f, 0.0f);
+				subpatch.P01 = make_float2(0.0f, 0.5f);
+				subpatch.P11 = make_float2(0.5f, 0.5f);
+				subpatches.push_back(subpatch);
+
+				subpatch.P00 = make_float2(0.5f, 0.0f);
+				subpatch.P10 = make_float2(1.0f, 0.0f);
+				subpatch.P01 = make_float2(0.5f, 0.5f);
+				subpatch.P11 = make_float2(1.0f, 0.5f);
+				subpatches.push_back(subpatch);
+
+				subpatch.P00 = make_float2(0.0f, 0.5f);
+				subpatch.P10 = make_float2(0.5f, 0.5f);
+				subpatch.P01 = make_float2(0.0f, 1.0f);
+				subpatch.P11 = make_float2(0.5f, 1.0f);
+				subpatches.push_back(subpatch);
+
+				subpatch.P00 = make_float2(0.5f, 0.5f);
+				subpatch.P10 = make_float2(1.0f, 0.5f);
+				subpatch.P01 = make_float2(0.5f, 1.0f);
+				subpatch.P11 = make_float2(1.0f, 1.0f);
+				subpatches.push_back(subpatch);
 			}
+			else {
+				/* ngon */
+				QuadDice::SubPatch subpatch;
 
-			subpatch.patch->shader = face.shader;
-
-			/* Quad faces need to be split at least once to line up with split ngons, we do this
-			 * here in this manner because if we do it later edge factors may end up slightly off.
-			 */
-			subpatch.P00 = make_float2(0.0f, 0.0f);
-			subpatch.P10 = make_float2(0.5f, 0.0f);
-			subpatch.P01 = make_float2(0.0f, 0.5f);
-			subpatch.P11 = make_float2(0.5f, 0.5f);
-			split->split_quad(subpatch.patch, &subpatch);
-
-			subpatch.P00 = make_float2(0.5f, 0.0f);
-			subpatch.P10 = make_float2(1.0f, 0.0f);
-			subpatch.P01 = make_float2(0.5f, 0.5f);
-			subpatch.P11 = make_float2(1.0f, 0.5f);
-			split->split_quad(subpatch.patch, &subpatch);
-
-			subpatch.P00 = make_float2(0.0f, 0.5f);
-			subpatch.P10 = make_float2(0.5f, 0.5f);
-			subpatch.P01 = make_float2(0.0f, 1.0f);
-			subpatch.P11 = make_float2(0.5f, 1.0f);
-			split->split_quad(subpatch.patch, &subpatch);
-
-			subpatch.P00 = make_float2(0.5f, 0.5f);
-			subpatch.P10 = make_float2(1.0f, 0.5f);
-			subpatch.P01 = make_float2(0.5f, 1.0f);
-			subpatch.P11 = make_float2(1.0f, 1.0f);
-			split->split_quad(subpatch.patch, &subpatch);
-		}
-		else {
-			/* ngon */
-#ifdef WITH_OPENSUBDIV
-			if(subdivision_type == SUBDIVISION_CATMULL_CLARK) {
-				OsdPatch patch(&osd_data);
+				subpatch.P00 = make_float2(0.0f, 0.0f);
+				subpatch.P10 = make_float2(1.0f, 0.0f);
+				subpatch.P01 = make_float2(0.0f, 1.0f);
+				subpatch.P11 = make_float2(1.0f, 1.0f);
 
-				patch.shader = face.shader;
+#ifdef WITH_OPENSUBDIV
+				if(subdivision_type == SUBDIVISION_CATMULL_CLARK) {
+					for(int corner = 0; corner < face.num_corners; corner++) {
+						osd_patches.push_back(OsdPatch(&osd_data));
+						OsdPatch& patch = osd_patches.back();
 
-				for(int corner = 0; corner < face.num_corners; corner++) {
-					patch.patch_index = face.ptex_offset + corner;
+						patch.shader = face.shader;
+						patch.patch_index = face.ptex_offset + corner;
 
-					split->split_quad(&patch);
+						subpatch.patch = &patch;
+						subpatches.push_back(subpatch);
+					}
 				}
-			}
-			else
+				else
 #endif
-			{
-				float3 center_vert = make_float3(0.0f, 0.0f, 0.0f);
-				float3 center_normal = make_float3(0.0f, 0.0f, 0.0f);
-
-				float inv_num_corners = 1.0f/float(face.num_corners);
-				for(int corner = 0; corner < face.num_corners; corner++) {
-					center_vert += verts[subd_face_corners[face.start_corner + corner]] * inv_num_corners;
-					center_normal += vN[subd_face_corners[face.start_corner + corner]] * inv_num_corners;
-				}
+				{
+					float3 center_vert = make_float3(0.0f, 0.0f, 0.0f);
+					float3 center_normal = make_float3(0.0f, 0.0f, 0.0f);
+
+					float inv_num_corners = 1.0f/float(face.num_corners);
+					for(int corner = 0; corner < face.num_corners; corner++) {
+						center_vert += verts[subd_face_corners[face.start_corner + corner]] * inv_num_corners;
+						center_normal += vN[subd_face_corners[face.start_corner + corner]] * inv_num_corners;
+					}
 
-				for(int corner = 0; corner < face.num_corners; corner++) {
-					LinearQuadPatch patch;
-					float3 *hull = patch.hull;
-					float3 *normals = patch.normals;
+					for(int corner = 0; corner < face.num_corners; corner++) {
+						linear_patches.push_back(LinearQuadPatch());
+						LinearQuadPatch& patch = linear_patches.back();
+						float3 *hull = patch.hull;
+						float3 *normals = patch.normals;
 
-					patch.patch_index = face.ptex_offset + corner;
+						patch.patch_index = face.ptex_offset + corner;
 
-					patch.shader = face.shader;
+						patch.shader = face.shader;
 
-					hull[0] = verts[subd_face_corners[face.start_corner + mod(corner + 0, face.num_corners)]];
-					hull[1] = verts[subd_face_corners[face.start_corner + mod(corner + 1, face.num_corners)]];
-					hull[2] = verts[subd_face_corners[face.start_corner + mod(corner - 1, face.num_corners)]];
-					hull[3] = center_vert;
+						hull[0] = verts[subd_face_corners[face.start_corner + mod(corner + 0, face.num_corners)]];
+						hull[1] = verts[subd_face_corners[face.start_corner + mod(corner + 1, face.num_corners)]];
+						hull[2] = verts[subd_face_corners[face.start_corner + mod(corner - 1, face.num_corners)]];
+						hull[3] = center_vert;
 
-					hull[1] = (hull[1] + hull[0]) * 0.5;
-					hull[2] = (hull[2] + hull[0]) * 0.5;
+						hull[1] = (hull[1] + hull[0]) * 0.5;
+						hull[2] = (hull[2] + hull[0]) * 0.5;
 
-					if(face.smooth) {
-						normals[0] = vN[subd_face_corners[face.start_corner + mod(corner + 0, face.num_corners)]];
-						normals[1] = vN[subd_face_corners[face.start_corner + mod(corner + 1, face.num_corners)]];
-						normals[2] = vN[subd_face_corners[face.start_corner + mod(corner - 1, face.num_corners)]];
-						normals[3] = center_normal;
+						if(face.smooth) {
+							normals[0] = vN[subd_face_corners[face.start_corner + mod(corner + 0, face.num_corners)]];
+							normals[1] = vN[subd_face_corners[face.start_corner + mod(corner + 1, face.num_corners)]];
+							normals[2] = vN[subd_face_corners[face.start_corner + mod(corner - 1, face.num_corners)]];
+							normals[3] = center_normal;
 
-						normals[1] = (normals[1] + normals[0]) * 0.5;
-						normals[2] = (normals[2] + normals[0]) * 0.5;
-					}
-					else {
-						float3 N = face.normal(this);
-						for(int i = 0; i < 4; i++) {
-							normals[i] = N;
+							normals[1] = (normals[1] + normals[0]) * 0.5;
+							normals[2] = (normals[2] + normals[0]) * 0.5;
+						}
+						else {
+							float3 N = face.normal(this);
+							for(int i = 0; i < 4; i++) {
+								normals[i] = N;
+							}
 						}
-					}
 
-					split->split_quad(&patch);
+						subpatch.patch = &patch;
+						subpatches.push_back(subpatch);
+					}
 				}
 			}
 		}
+
+		split->split_and_dice(subpatches);
+
+		if(use_cache) {
+			if(!subd_dice_cache) {
+				subd_dice_cache = new SubdDiceCache();
+			}
+
+			subd_dice_cache->key = cache_key;
+			subd_dice_cache_write(this, subd_dice_cache, params.ptex, vert_start, tri_start);
+		}
 	}
 
 	/* interpolate center points for attributes */
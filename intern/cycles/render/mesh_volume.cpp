@@ -14,13 +14,23 @@
  * limitations under the License.
  */
 
+#include "device/device.h"
+
 #include "render/mesh.h"
 #include "render/attribute.h"
+#include "render/graph.h"
+#include "render/image.h"
+#include "render/integrator.h"
+#include "render/nodes.h"
+#include "render/object.h"
 #include "render/scene.h"
+#include "render/shader.h"
 
 #include "util/util_foreach.h"
 #include "util/util_logging.h"
 #include "util/util_progress.h"
+#include "util/util_set.h"
+#include "util/util_task.h"
 #include "util/util_types.h"
 
 CCL_NAMESPACE_BEGIN
@@ -544,4 +554,306 @@ void MeshManager::create_volume_mesh(Scene *scene,
 			<< "Mb.";
 }
 
+/* Volume Majorants
+ *
+ * Coarse grids over the bounds of volume objects, storing an upper bound of
+ * the extinction in every cell for delta tracking in the kernel. The volume
+ * shaders are evaluated on a lattice of points, the maximum over the points
+ * of a cell and its neighbours is scaled by a margin to account for features
+ * between the points. Where the majorant is still too small but nonzero the
+ * kernel stays unbiased at the cost of some noise, cells with a zero majorant
+ * are skipped entirely, so images read by the volumes are loaded first. */
+
+/* Number of cells along every axis of the object bounds. */
+#define VOLUME_MAJORANT_RESOLUTION 16
+/* Number of shader evaluations along every axis of a cell, points on the
+ * cell boundaries are shared with neighbouring cells. */
+#define VOLUME_MAJORANT_SAMPLES 4
+#define VOLUME_MAJORANT_MARGIN 1.25f
+
+struct VolumeMajorantGrid {
+	int object;
+	int shader;
+	size_t offset;
+	BoundBox bounds;
+};
+
+/* Images are loaded after meshes, load the ones read by volumes now so the
+ * majorants do not miss density from unloaded textures. */
+static void volume_majorant_update_images(Device *device,
+                                          DeviceScene *dscene,
+                                          Scene *scene,
+                                          const set<Mesh*>& meshes,
+                                          const set<Shader*>& shaders,
+                                          Progress& progress)
+{
+	ImageManager *image_manager = scene->image_manager;
+	set<int> volume_images;
+
+	foreach(Shader *shader, shaders) {
+		foreach(ShaderNode *node, shader->graph->nodes) {
+			if(node->special_type != SHADER_SPECIAL_TYPE_IMAGE_SLOT) {
+				continue;
+			}
+			if(device->info.pack_images) {
+				/* If device requires packed images we need to update all
+				 * images now, even if they're not used by volumes.
+				 */
+				image_manager->device_update(device, dscene, scene, progress);
+				return;
+			}
+			ImageSlotTextureNode *image_node = static_cast<ImageSlotTextureNode*>(node);
+			if(image_node->slot != -1) {
+				volume_images.insert(image_node->slot);
+			}
+		}
+	}
+
+	foreach(Mesh *mesh, meshes) {
+		foreach(Attribute& attr, mesh->attributes.attributes) {
+			if(attr.element == ATTR_ELEMENT_VOXEL && attr.data_voxel()->slot != -1) {
+				volume_images.insert(attr.data_voxel()->slot);
+			}
+		}
+	}
+
+	if(volume_images.empty()) {
+		return;
+	}
+
+	progress.set_status("Updating Volume Images");
+
+	TaskPool pool;
+	image_manager->device_prepare_update(dscene);
+	foreach(int slot, volume_images) {
+		pool.push(function_bind(&ImageManager::device_update_slot,
+		                        image_manager,
+		                        device,
+		                        dscene,
+		                        scene,
+		                        slot,
+		                        &progress));
+	}
+	pool.wait_work();
+}
+
+void MeshManager::device_update_volume_majorants(Device *device,
+                                                 DeviceScene *dscene,
+                                                 Scene *scene,
+                                                 Progress& progress)
+{
+	device->tex_free(dscene->object_volume_majorant);
+	device->tex_free(dscene->volume_majorant);
+	dscene->object_volume_majorant.clear();
+	dscene->volume_majorant.clear();
+
+	if(!scene->integrator->volume_delta_tracking) {
+		return;
+	}
+
+	const int res = VOLUME_MAJORANT_RESOLUTION;
+	const int num_cells = res*res*res;
+	const int points_res = res*VOLUME_MAJORANT_SAMPLES + 1;
+	const size_t num_points = (size_t)points_res*points_res*points_res;
+
+	/* Grid per object, with the bounds padded by half a cell since shading
+	 * points on the boundary can be slightly outside. Objects with multiple
+	 * volume shaders get the maximum of all of them. */
+	vector<VolumeMajorantGrid> grids;
+	vector<BoundBox> object_bounds(scene->objects.size(), BoundBox::empty);
+	set<Mesh*> volume_meshes;
+	set<Shader*> volume_shaders;
+	size_t num_grid_cells = 0;
+
+	for(size_t i = 0; i < scene->objects.size(); i++) {
+		Object *object = scene->objects[i];
+		Mesh *mesh = object->mesh;
+
+		if(!mesh->has_volume || !object->bounds.valid()) {
+			continue;
+		}
+
+		float3 size = max(object->bounds.size(), make_float3(1e-5f, 1e-5f, 1e-5f));
+		BoundBox bounds(object->bounds.min - size*(0.5f/res),
+		                object->bounds.max + size*(0.5f/res));
+		bool has_grid = false;
+
+		foreach(Shader *shader, mesh->used_shaders) {
+			if(!shader->has_volume) {
+				continue;
+			}
+
+			VolumeMajorantGrid grid;
+			grid.object = i;
+			grid.shader = scene->shader_manager->get_shader_id(shader);
+			grid.offset = num_grid_cells;
+			grid.bounds = bounds;
+			grids.push_back(grid);
+			volume_shaders.insert(shader);
+			has_grid = true;
+		}
+
+		if(has_grid) {
+			object_bounds[i] = bounds;
+			volume_meshes.insert(mesh);
+			num_grid_cells += num_cells;
+		}
+	}
+
+	if(grids.empty()) {
+		return;
+	}
+
+	volume_majorant_update_images(device, dscene, scene, volume_meshes, volume_shaders, progress);
+	if(progress.get_cancel()) {
+		return;
+	}
+
+	progress.set_status("Updating Mesh", "Computing Volume Majorants");
+
+	/* Object flags are needed for shader evaluation, same as for
+	 * displacement they are updated again with valid bounds later. */
+	bool old_need_object_flags_update = scene->object_manager->need_flags_update;
+	scene->object_manager->device_update_flags(device, dscene, scene, progress, false);
+	scene->object_manager->need_flags_update = old_need_object_flags_update;
+
+	/* Setup input for device task, the volume and the position of every
+	 * point of the lattice. */
+	device_vector<uint4> d_input;
+	uint4 *d_input_data = d_input.resize(grids.size()*num_points*2);
+	size_t d_input_size = 0;
+
+	foreach(const VolumeMajorantGrid& grid, grids) {
+		float3 step = grid.bounds.size()/(float)(points_res - 1);
+
+		for(int z = 0; z < points_res; z++) {
+			for(int y = 0; y < points_res; y++) {
+				for(int x = 0; x < points_res; x++) {
+					float3 P = grid.bounds.min + make_float3((float)x, (float)y, (float)z)*step;
+
+					d_input_data[d_input_size++] = make_uint4(grid.object, grid.shader, 0, 0);
+					d_input_data[d_input_size++] = make_uint4(__float_as_uint(P.x),
+					                                          __float_as_uint(P.y),
+					                                          __float_as_uint(P.z),
+					                                          0);
+				}
+			}
+		}
+	}
+
+	/* Run device task. */
+	device_vector<float4> d_output;
+	d_output.resize(d_input_size/2);
+
+	/* needs to be up to data for attribute access */
+	device->const_copy_to("__data", &dscene->data, sizeof(dscene->data));
+
+	device->mem_alloc("volume_majorant_input", d_input, MEM_READ_ONLY);
+	device->mem_copy_to(d_input);
+	device->mem_alloc("volume_majorant_output", d_output, MEM_WRITE_ONLY);
+
+	DeviceTask task(DeviceTask::SHADER);
+	task.shader_input = d_input.device_pointer;
+	task.shader_output = d_output.device_pointer;
+	task.shader_eval_type = SHADER_EVAL_VOLUME;
+	task.shader_x = 0;
+	task.shader_w = d_output.size();
+	task.num_samples = 1;
+	task.get_cancel = function_bind(&Progress::get_cancel, &progress);
+
+	device->task_add(task);
+	device->task_wait();
+
+	if(progress.get_cancel()) {
+		device->mem_free(d_input);
+		device->mem_free(d_output);
+		return;
+	}
+
+	device->mem_copy_from(d_output, 0, 1, d_output.size(), sizeof(float4));
+	device->mem_free(d_input);
+	device->mem_free(d_output);
+
+	/* Maximum over the points of every cell, both extinction and emission
+	 * need collisions. */
+	const float4 *output = (float4*)d_output.data_pointer;
+	vector<float> cells(num_grid_cells, 0.0f);
+
+	for(size_t g = 0; g < grids.size(); g++) {
+		const float4 *points = output + g*num_points;
+		float *grid_cells = &cells[grids[g].offset];
+
+		for(int z = 0; z < res; z++) {
+			for(int y = 0; y < res; y++) {
+				for(int x = 0; x < res; x++) {
+					float majorant = grid_cells[x + res*(y + res*z)];
+
+					for(int pz = z*VOLUME_MAJORANT_SAMPLES; pz <= (z + 1)*VOLUME_MAJORANT_SAMPLES; pz++) {
+						for(int py = y*VOLUME_MAJORANT_SAMPLES; py <= (y + 1)*VOLUME_MAJORANT_SAMPLES; py++) {
+							for(int px = x*VOLUME_MAJORANT_SAMPLES; px <= (x + 1)*VOLUME_MAJORANT_SAMPLES; px++) {
+								float4 value = points[px + points_res*(py + points_res*pz)];
+								majorant = max(majorant, max(max(value.x, value.y), max(value.z, value.w)));
+							}
+						}
+					}
+
+					grid_cells[x + res*(y + res*z)] = majorant;
+				}
+			}
+		}
+	}
+
+	/* Dilate by one cell and apply the margin. */
+	float *majorants = dscene->volume_majorant.resize(num_grid_cells);
+
+	for(size_t offset = 0; offset < num_grid_cells; offset += num_cells) {
+		const float *grid_cells = &cells[offset];
+
+		for(int z = 0; z < res; z++) {
+			for(int y = 0; y < res; y++) {
+				for(int x = 0; x < res; x++) {
+					float majorant = 0.0f;
+
+					for(int nz = max(z - 1, 0); nz <= min(z + 1, res - 1); nz++) {
+						for(int ny = max(y - 1, 0); ny <= min(y + 1, res - 1); ny++) {
+							for(int nx = max(x - 1, 0); nx <= min(x + 1, res - 1); nx++) {
+								majorant = max(majorant, grid_cells[nx + res*(ny + res*nz)]);
+							}
+						}
+					}
+
+					majorants[offset + x + res*(y + res*z)] = majorant*VOLUME_MAJORANT_MARGIN;
+				}
+			}
+		}
+	}
+
+	/* Per object bounds and offset of the grid, a negative offset means no
+	 * grid and the kernel falls back to stepping. */
+	float4 *object_majorant = dscene->object_volume_majorant.resize(scene->objects.size()*2);
+	size_t offset = 0;
+
+	for(size_t i = 0; i < scene->objects.size(); i++) {
+		const BoundBox& bounds = object_bounds[i];
+
+		if(!bounds.valid()) {
+			object_majorant[i*2 + 0] = make_float4(0.0f, 0.0f, 0.0f, __int_as_float(-1));
+			object_majorant[i*2 + 1] = make_float4(0.0f, 0.0f, 0.0f, __int_as_float(0));
+			continue;
+		}
+
+		float3 inv_cell_size = make_float3((float)res, (float)res, (float)res)/bounds.size();
+
+		object_majorant[i*2 + 0] = make_float4(bounds.min.x, bounds.min.y, bounds.min.z, __int_as_float(offset));
+		object_majorant[i*2 + 1] = make_float4(inv_cell_size.x, inv_cell_size.y, inv_cell_size.z, __int_as_float(res));
+		offset += num_cells;
+	}
+
+	device->tex_alloc("__object_volume_majorant", dscene->object_volume_majorant);
+	device->tex_alloc("__volume_majorant", dscene->volume_majorant);
+
+	VLOG(1) << "Volume majorants computed for " << grids.size() << " volume shaders, "
+	        << (num_grid_cells*sizeof(float))/(1024.0*1024.0) << "Mb.";
+}
+
 CCL_NAMESPACE_END
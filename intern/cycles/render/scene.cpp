@@ -30,6 +30,7 @@
 #include "render/particles.h"
 #include "render/scene.h"
 #include "render/shader.h"
+#include "render/stats.h"
 #include "render/svm.h"
 #include "render/tables.h"
 
@@ -37,6 +38,7 @@
 #include "util/util_guarded_allocator.h"
 #include "util/util_logging.h"
 #include "util/util_progress.h"
+#include "util/util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -44,6 +46,7 @@ Scene::Scene(const SceneParams& params_, const DeviceInfo& device_info_)
 : params(params_)
 {
 	device = NULL;
+	update_stats = NULL;
 	memset(&dscene.data, 0, sizeof(dscene.data));
 
 	camera = new Camera();
@@ -73,22 +76,26 @@ Scene::~Scene()
 
 void Scene::free_memory(bool final)
 {
-	foreach(Shader *s, shaders)
-		delete s;
-	foreach(Mesh *m, meshes)
-		delete m;
-	foreach(Object *o, objects)
-		delete o;
-	foreach(Light *l, lights)
-		delete l;
-	foreach(ParticleSystem *p, particle_systems)
-		delete p;
-
-	shaders.clear();
-	meshes.clear();
-	objects.clear();
-	lights.clear();
-	particle_systems.clear();
+	/* with persistent BVH the nodes are kept along with the object BVHs,
+	 * so the next render can sync into them and refit instead of build */
+	if(final || !params.persistent_bvh) {
+		foreach(Shader *s, shaders)
+			delete s;
+		foreach(Mesh *m, meshes)
+			delete m;
+		foreach(Object *o, objects)
+			delete o;
+		foreach(Light *l, lights)
+			delete l;
+		foreach(ParticleSystem *p, particle_systems)
+			delete p;
+
+		shaders.clear();
+		meshes.clear();
+		objects.clear();
+		lights.clear();
+		particle_systems.clear();
+	}
 
 	if(device) {
 		camera->device_free(device, &dscene, this);
@@ -128,6 +135,7 @@ void Scene::free_memory(bool final)
 		delete curve_system_manager;
 		delete image_manager;
 		delete bake_manager;
+		delete update_stats;
 	}
 }
 
@@ -137,6 +145,7 @@ void Scene::device_update(Device *device_, Progress& progress)
 		device = device_;
 
 	bool print_stats = need_data_update();
+	double start_time = time_dt();
 
 	/* The order of updates is important, because there's dependencies between
 	 * the different managers, using data computed by previous managers.
@@ -152,76 +161,121 @@ void Scene::device_update(Device *device_, Progress& progress)
 	image_manager->set_pack_images(device->info.pack_images);
 
 	progress.set_status("Updating Shaders");
-	shader_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "shaders");
+		shader_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Background");
-	background->device_update(device, &dscene, this);
+	{
+		scoped_update_step step(update_stats, device, "background");
+		background->device_update(device, &dscene, this);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Camera");
-	camera->device_update(device, &dscene, this);
+	{
+		scoped_update_step step(update_stats, device, "camera");
+		camera->device_update(device, &dscene, this);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
-	mesh_manager->device_update_preprocess(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "meshes_preprocess");
+		mesh_manager->device_update_preprocess(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Objects");
-	object_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "objects");
+		object_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 	
 	progress.set_status("Updating Hair Systems");
-	curve_system_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "hair_systems");
+		curve_system_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Meshes");
-	mesh_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "meshes");
+		mesh_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Objects Flags");
-	object_manager->device_update_flags(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "object_flags");
+		object_manager->device_update_flags(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Images");
-	image_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "images");
+		image_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Camera Volume");
-	camera->device_update_volume(device, &dscene, this);
+	{
+		scoped_update_step step(update_stats, device, "camera_volume");
+		camera->device_update_volume(device, &dscene, this);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 	
 	progress.set_status("Updating Lookup Tables");
-	lookup_tables->device_update(device, &dscene);
+	{
+		scoped_update_step step(update_stats, device, "lookup_tables");
+		lookup_tables->device_update(device, &dscene);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Lights");
-	light_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "lights");
+		light_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Particle Systems");
-	particle_system_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "particle_systems");
+		particle_system_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Integrator");
-	integrator->device_update(device, &dscene, this);
+	{
+		scoped_update_step step(update_stats, device, "integrator");
+		integrator->device_update(device, &dscene, this);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Film");
-	film->device_update(device, &dscene, this);
+	{
+		scoped_update_step step(update_stats, device, "film");
+		film->device_update(device, &dscene, this);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
@@ -231,7 +285,10 @@ void Scene::device_update(Device *device_, Progress& progress)
 	if(progress.get_cancel() || device->have_error()) return;
 
 	progress.set_status("Updating Baking");
-	bake_manager->device_update(device, &dscene, this, progress);
+	{
+		scoped_update_step step(update_stats, device, "baking");
+		bake_manager->device_update(device, &dscene, this, progress);
+	}
 
 	if(progress.get_cancel() || device->have_error()) return;
 
@@ -240,6 +297,12 @@ void Scene::device_update(Device *device_, Progress& progress)
 		device->const_copy_to("__data", &dscene.data, sizeof(dscene.data));
 	}
 
+	if(update_stats) {
+		update_stats->add_update(time_dt() - start_time);
+		VLOG(1) << "Scene update statistics:\n"
+		        << update_stats->full_report();
+	}
+
 	if(print_stats) {
 		size_t mem_used = util_guarded_get_mem_used();
 		size_t mem_peak = util_guarded_get_mem_peak();
@@ -252,6 +315,13 @@ void Scene::device_update(Device *device_, Progress& progress)
 	}
 }
 
+void Scene::enable_update_stats()
+{
+	if(!update_stats) {
+		update_stats = new SceneUpdateStats();
+	}
+}
+
 Scene::MotionType Scene::need_motion(bool advanced_shading)
 {
 	if(integrator->motion_blur)
@@ -317,10 +387,14 @@ bool Scene::need_reset()
 
 void Scene::reset()
 {
-	shader_manager->reset(this);
-	shader_manager->add_default(this);
+	/* default shaders still exist if nodes were kept */
+	if(shaders.empty()) {
+		shader_manager->reset(this);
+		shader_manager->add_default(this);
+	}
 
 	/* ensure all objects are updated */
+	shader_manager->need_update = true;
 	camera->tag_update();
 	film->tag_update(this);
 	background->tag_update(this);
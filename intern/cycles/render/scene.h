@@ -53,6 +53,7 @@ class Shader;
 class ShaderManager;
 class Progress;
 class BakeManager;
+class SceneUpdateStats;
 class BakeData;
 
 /* Scene Device Data */
@@ -93,11 +94,17 @@ public:
 	device_vector<float4> attributes_float3;
 	device_vector<uchar4> attributes_uchar4;
 
+	/* volumes */
+	device_vector<float4> object_volume_majorant;
+	device_vector<float> volume_majorant;
+
 	/* lights */
 	device_vector<float4> light_distribution;
 	device_vector<float4> light_data;
 	device_vector<float2> light_background_marginal_cdf;
 	device_vector<float2> light_background_conditional_cdf;
+	device_vector<float4> light_tree_nodes;
+	device_vector<uint> light_tree_leaf_map;
 
 	/* particles */
 	device_vector<float4> particles;
@@ -179,8 +186,13 @@ public:
 	bool use_bvh_unaligned_nodes;
 	int num_bvh_time_steps;
 	bool use_qbvh;
+	bool use_obvh;
 	bool use_bvh_embree;
+	/* Trace camera rays in packets, CPU only. */
+	bool use_ray_stream;
 	bool persistent_data;
+	/* Keep synced nodes and object BVHs between renders, only refitting them. */
+	bool persistent_bvh;
 	int texture_limit;
 	TextureCacheParams texture;
 
@@ -192,8 +204,11 @@ public:
 		use_bvh_unaligned_nodes = true;
 		num_bvh_time_steps = 0;
 		use_qbvh = false;
+		use_obvh = false;
 		use_bvh_embree = false;
+		use_ray_stream = false;
 		persistent_data = false;
+		persistent_bvh = false;
 		texture_limit = 0;
 	}
 
@@ -204,9 +219,12 @@ public:
 		&& use_bvh_unaligned_nodes == params.use_bvh_unaligned_nodes
 		&& num_bvh_time_steps == params.num_bvh_time_steps
 		&& use_qbvh == params.use_qbvh
+		&& use_obvh == params.use_obvh
 		&& persistent_data == params.persistent_data
+		&& persistent_bvh == params.persistent_bvh
 		&& texture_limit == params.texture_limit
 		&& use_bvh_embree == params.use_bvh_embree
+		&& use_ray_stream == params.use_ray_stream
 		&& texture_limit == params.texture_limit)
 		&& !texture.modified(params.texture); }
 };
@@ -252,6 +270,9 @@ public:
 	/* parameters */
 	SceneParams params;
 
+	/* timing and memory of device updates, NULL unless enabled */
+	SceneUpdateStats *update_stats;
+
 	/* mutex must be locked manually by callers */
 	thread_mutex mutex;
 
@@ -260,6 +281,8 @@ public:
 
 	void device_update(Device *device, Progress& progress);
 
+	void enable_update_stats();
+
 	bool need_global_attribute(AttributeStandard std);
 	void need_global_attributes(AttributeRequestSet& attributes);
 
@@ -55,6 +55,23 @@ Session::Session(const SessionParams& params_)
 
 	device = Device::create(params.device, stats, params.background);
 
+	/* CPU devices take a tile per thread, other devices one tile each. */
+	int num_workers = 0;
+	if(params.device.multi_devices.empty()) {
+		num_workers = (params.device.type == DEVICE_CPU)? TaskScheduler::num_threads(): 1;
+	}
+	else {
+		foreach(const DeviceInfo& info, params.device.multi_devices) {
+			num_workers += (info.type == DEVICE_CPU)? TaskScheduler::num_threads(): 1;
+		}
+	}
+	/* With save buffers every tile result has to match one of the render parts
+	 * on the Blender side, so the last tiles can't be split between workers. */
+	if(params.use_save_buffers) {
+		num_workers = 1;
+	}
+	tile_manager.set_num_workers(max(num_workers, 1));
+
 	if(params.background && params.output_path.empty()) {
 		buffers = NULL;
 		display = NULL;
@@ -692,10 +709,19 @@ void Session::run()
 		/* reset number of rendered samples */
 		progress.reset_sample();
 
+		/* only report texture cache activity of this render */
+		scene->image_manager->reset_texture_cache_stats();
+
 		if(device_use_gl)
 			run_gpu();
 		else
 			run_cpu();
+
+		ImageManager::TextureCacheStats texture_cache_stats;
+		if(scene->image_manager->get_texture_cache_stats(&texture_cache_stats)) {
+			VLOG(1) << "Texture cache statistics:\n"
+			        << texture_cache_stats.full_report();
+		}
 	}
 
 	/* progress update */
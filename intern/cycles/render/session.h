@@ -45,6 +45,7 @@ public:
 	DeviceInfo device;
 	bool background;
 	bool progressive_refine;
+	bool use_save_buffers;
 	string output_path;
 
 	bool progressive;
@@ -68,6 +69,7 @@ public:
 	{
 		background = false;
 		progressive_refine = false;
+		use_save_buffers = false;
 		output_path = "";
 
 		progressive = false;
@@ -92,6 +94,7 @@ public:
 	{ return !(device == params.device
 		&& background == params.background
 		&& progressive_refine == params.progressive_refine
+		&& use_save_buffers == params.use_save_buffers
 		&& output_path == params.output_path
 		/* && samples == params.samples */
 		&& progressive == params.progressive
@@ -313,6 +313,11 @@ void Shader::tag_update(Scene *scene)
 		scene->mesh_manager->need_flags_update = true;
 		scene->object_manager->need_flags_update = true;
 	}
+
+	/* volume majorants are computed from the shader by the mesh manager */
+	if(has_volume && scene->integrator->volume_delta_tracking) {
+		scene->mesh_manager->need_update = true;
+	}
 }
 
 void Shader::tag_used(Scene *scene)
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "device/device.h"
+#include "render/stats.h"
+
+#include "util/util_algorithm.h"
+#include "util/util_foreach.h"
+#include "util/util_guarded_allocator.h"
+#include "util/util_path.h"
+#include "util/util_time.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Number of slowest per mesh entries listed in the human readable report. */
+#define STATS_REPORT_MAX_ITEMS 10
+
+static string json_escape(const string& str)
+{
+	string result;
+	result.reserve(str.size());
+
+	foreach(char c, str) {
+		switch(c) {
+			case '"': result += "\\\""; break;
+			case '\\': result += "\\\\"; break;
+			case '\n': result += "\\n"; break;
+			case '\r': result += "\\r"; break;
+			case '\t': result += "\\t"; break;
+			default:
+				if((unsigned char)c < 0x20)
+					result += string_printf("\\u%04x", (unsigned char)c);
+				else
+					result += c;
+				break;
+		}
+	}
+
+	return result;
+}
+
+static bool entry_time_greater(const SceneUpdateStats::Entry *a,
+                               const SceneUpdateStats::Entry *b)
+{
+	return a->time > b->time;
+}
+
+/* Scene Update Statistics */
+
+SceneUpdateStats::Entry::Entry(const string& name, const string& item)
+: name(name),
+  item(item),
+  num_updates(0),
+  time(0.0),
+  device_mem(0),
+  host_mem(0),
+  device_mem_grow(0),
+  host_mem_grow(0)
+{
+}
+
+SceneUpdateStats::SceneUpdateStats()
+{
+	clear();
+}
+
+void SceneUpdateStats::clear()
+{
+	thread_scoped_lock lock(mutex);
+	num_updates = 0;
+	total_time = 0.0;
+	steps.clear();
+	items.clear();
+}
+
+SceneUpdateStats::Entry& SceneUpdateStats::find_step(const string& name)
+{
+	/* Few steps, kept in order of first use for the report. */
+	foreach(Entry& entry, steps) {
+		if(entry.name == name) {
+			return entry;
+		}
+	}
+	steps.push_back(Entry(name, ""));
+	return steps.back();
+}
+
+void SceneUpdateStats::add_update(double time)
+{
+	thread_scoped_lock lock(mutex);
+	num_updates++;
+	total_time += time;
+}
+
+void SceneUpdateStats::add_step(const string& name,
+                                double time,
+                                size_t device_mem_before,
+                                size_t device_mem_after,
+                                size_t host_mem_before,
+                                size_t host_mem_after)
+{
+	thread_scoped_lock lock(mutex);
+	Entry& entry = find_step(name);
+	entry.num_updates++;
+	entry.time += time;
+	entry.device_mem = device_mem_after;
+	entry.host_mem = host_mem_after;
+	if(device_mem_after > device_mem_before) {
+		entry.device_mem_grow = max(entry.device_mem_grow,
+		                            device_mem_after - device_mem_before);
+	}
+	if(host_mem_after > host_mem_before) {
+		entry.host_mem_grow = max(entry.host_mem_grow,
+		                          host_mem_after - host_mem_before);
+	}
+}
+
+void SceneUpdateStats::add_item(const string& name, const string& item, double time)
+{
+	thread_scoped_lock lock(mutex);
+	ItemMap::iterator it = items.find(std::make_pair(name, item));
+	if(it == items.end()) {
+		it = items.insert(std::make_pair(std::make_pair(name, item), Entry(name, item))).first;
+	}
+
+	Entry& entry = it->second;
+	entry.num_updates++;
+	entry.time += time;
+}
+
+string SceneUpdateStats::full_report() const
+{
+	thread_scoped_lock lock(mutex);
+
+	string report = "";
+	report += string_printf("Scene updates: %d\n", num_updates);
+	report += string_printf("Total time:    %f\n", total_time);
+
+	foreach(const Entry& entry, steps) {
+		report += string_printf("  %-24s %f s, device %s (+%s), host %s (+%s)\n",
+		                        entry.name.c_str(),
+		                        entry.time,
+		                        string_human_readable_size(entry.device_mem).c_str(),
+		                        string_human_readable_size(entry.device_mem_grow).c_str(),
+		                        string_human_readable_size(entry.host_mem).c_str(),
+		                        string_human_readable_size(entry.host_mem_grow).c_str());
+	}
+
+	if(!items.empty()) {
+		vector<const Entry*> sorted_items;
+		for(ItemMap::const_iterator it = items.begin(); it != items.end(); it++) {
+			sorted_items.push_back(&it->second);
+		}
+		sort(sorted_items.begin(), sorted_items.end(), entry_time_greater);
+		if(sorted_items.size() > STATS_REPORT_MAX_ITEMS) {
+			sorted_items.resize(STATS_REPORT_MAX_ITEMS);
+		}
+
+		report += "Slowest meshes:\n";
+		foreach(const Entry *entry, sorted_items) {
+			report += string_printf("  %-24s %-24s %f s\n",
+			                        entry->name.c_str(),
+			                        entry->item.c_str(),
+			                        entry->time);
+		}
+	}
+
+	return report;
+}
+
+string SceneUpdateStats::json_report() const
+{
+	thread_scoped_lock lock(mutex);
+
+	string report = "{\n";
+	report += string_printf("  \"num_updates\": %d,\n", num_updates);
+	report += string_printf("  \"total_time\": %f,\n", total_time);
+
+	report += "  \"steps\": [";
+	for(size_t i = 0; i < steps.size(); i++) {
+		const Entry& entry = steps[i];
+		report += (i == 0)? "\n": ",\n";
+		report += string_printf("    {\"name\": \"%s\", \"num_updates\": %d, \"time\": %f, "
+		                        "\"device_memory\": %llu, \"device_memory_grow\": %llu, "
+		                        "\"host_memory\": %llu, \"host_memory_grow\": %llu}",
+		                        json_escape(entry.name).c_str(),
+		                        entry.num_updates,
+		                        entry.time,
+		                        (unsigned long long)entry.device_mem,
+		                        (unsigned long long)entry.device_mem_grow,
+		                        (unsigned long long)entry.host_mem,
+		                        (unsigned long long)entry.host_mem_grow);
+	}
+	report += "\n  ],\n";
+
+	report += "  \"meshes\": [";
+	for(ItemMap::const_iterator it = items.begin(); it != items.end(); it++) {
+		const Entry& entry = it->second;
+		report += (it == items.begin())? "\n": ",\n";
+		report += string_printf("    {\"step\": \"%s\", \"name\": \"%s\", "
+		                        "\"num_updates\": %d, \"time\": %f}",
+		                        json_escape(entry.name).c_str(),
+		                        json_escape(entry.item).c_str(),
+		                        entry.num_updates,
+		                        entry.time);
+	}
+	report += "\n  ]\n";
+
+	report += "}\n";
+	return report;
+}
+
+bool SceneUpdateStats::write_json(const string& filepath) const
+{
+	string report = json_report();
+	return path_write_text(filepath, report);
+}
+
+/* Scoped Update Step */
+
+scoped_update_step::scoped_update_step(SceneUpdateStats *stats,
+                                       Device *device,
+                                       const char *name)
+: stats_(stats),
+  device_(device),
+  name_(name),
+  time_start_(0.0),
+  device_mem_start_(0),
+  host_mem_start_(0)
+{
+	if(stats_ != NULL) {
+		device_mem_start_ = device_->stats.mem_used;
+		host_mem_start_ = util_guarded_get_mem_used();
+		time_start_ = time_dt();
+	}
+}
+
+scoped_update_step::~scoped_update_step()
+{
+	if(stats_ != NULL) {
+		stats_->add_step(name_,
+		                 time_dt() - time_start_,
+		                 device_mem_start_,
+		                 device_->stats.mem_used,
+		                 host_mem_start_,
+		                 util_guarded_get_mem_used());
+	}
+}
+
+CCL_NAMESPACE_END
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2011-2017 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RENDER_STATS_H__
+#define __RENDER_STATS_H__
+
+#include "util/util_map.h"
+#include "util/util_string.h"
+#include "util/util_thread.h"
+#include "util/util_types.h"
+#include "util/util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+class Device;
+
+/* Scene Update Statistics
+ *
+ * Wall time and memory usage of the steps of Scene::device_update(), and of
+ * the per mesh work done by the mesh manager. Values are accumulated over all
+ * updates of the scene, so interactive sessions report the total time spent
+ * in each step.
+ */
+class SceneUpdateStats {
+public:
+	struct Entry {
+		Entry(const string& name, const string& item);
+
+		string name;
+		/* Name of the mesh for per mesh entries, empty otherwise. */
+		string item;
+
+		int num_updates;
+		double time;
+		/* Memory in use after the last update, and largest growth during
+		 * a single update. */
+		size_t device_mem;
+		size_t host_mem;
+		size_t device_mem_grow;
+		size_t host_mem_grow;
+	};
+
+	SceneUpdateStats();
+
+	void clear();
+
+	/* Record a full update of the scene, thread safe. */
+	void add_update(double time);
+	/* Record a step of the update, thread safe. */
+	void add_step(const string& name,
+	              double time,
+	              size_t device_mem_before,
+	              size_t device_mem_after,
+	              size_t host_mem_before,
+	              size_t host_mem_after);
+	/* Record per mesh work done within a step, thread safe. */
+	void add_item(const string& name, const string& item, double time);
+
+	string full_report() const;
+	string json_report() const;
+	bool write_json(const string& filepath) const;
+
+	/* Per mesh entries, keyed by step name and mesh name. */
+	typedef map<std::pair<string, string>, Entry> ItemMap;
+
+	int num_updates;
+	double total_time;
+	vector<Entry> steps;
+	ItemMap items;
+
+protected:
+	Entry& find_step(const string& name);
+
+	mutable thread_mutex mutex;
+};
+
+/* Record time and memory usage of the enclosing scope as an update step,
+ * does nothing when stats are NULL. */
+class scoped_update_step {
+public:
+	scoped_update_step(SceneUpdateStats *stats, Device *device, const char *name);
+	~scoped_update_step();
+
+protected:
+	SceneUpdateStats *stats_;
+	Device *device_;
+	const char *name_;
+	double time_start_;
+	size_t device_mem_start_;
+	size_t host_mem_start_;
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __RENDER_STATS_H__ */
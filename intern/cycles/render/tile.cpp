@@ -21,13 +21,29 @@
 
 CCL_NAMESPACE_BEGIN
 
+/* Tiles are not split below this size when sharing the last tiles of a
+ * frame between workers. */
+#define TILE_SPLIT_MIN_SIZE 16
+
 namespace {
 
+/* Interleave the bits of x and y, giving the position along a Z-order curve. */
+inline uint64_t morton_code(uint x, uint y)
+{
+	uint64_t code = 0;
+	for(int i = 0; i < 32; i++) {
+		code |= (uint64_t)((x >> i) & 1) << (2*i);
+		code |= (uint64_t)((y >> i) & 1) << (2*i + 1);
+	}
+	return code;
+}
+
 class TileComparator {
 public:
-	TileComparator(TileOrder order, int2 center)
+	TileComparator(TileOrder order, int2 center, int2 tile_size)
 	 :  order_(order),
-	    center_(center)
+	    center_(center),
+	    tile_size_(tile_size)
 	{}
 
 	bool operator()(Tile &a, Tile &b)
@@ -47,6 +63,9 @@ public:
 				return (a.x == b.x)? (a.y < b.y): (a.x > b.x);
 			case TILE_TOP_TO_BOTTOM:
 				return (a.y == b.y)? (a.x < b.x): (a.y > b.y);
+			case TILE_MORTON:
+				return morton_code(a.x/tile_size_.x, a.y/tile_size_.y) <
+				       morton_code(b.x/tile_size_.x, b.y/tile_size_.y);
 			case TILE_BOTTOM_TO_TOP:
 			default:
 				return (a.y == b.y)? (a.x < b.x): (a.y < b.y);
@@ -56,6 +75,7 @@ public:
 protected:
 	TileOrder order_;
 	int2 center_;
+	int2 tile_size_;
 };
 
 inline int2 hilbert_index_to_pos(int n, int d)
@@ -94,6 +114,7 @@ TileManager::TileManager(bool progressive_, int num_samples_, int2 tile_size_, i
 	start_resolution = start_resolution_;
 	num_samples = num_samples_;
 	num_devices = num_devices_;
+	num_workers = 1;
 	preserve_tile_device = preserve_tile_device_;
 	background = background_;
 
@@ -299,7 +320,7 @@ int TileManager::gen_tiles(bool sliced)
 					if(cur_tiles == tiles_per_device) {
 						/* Tiles are already generated in Bottom-to-Top order, so no sort is necessary in that case. */
 						if(tile_order != TILE_BOTTOM_TO_TOP) {
-							tile_list->sort(TileComparator(tile_order, center));
+							tile_list->sort(TileComparator(tile_order, center, tile_size));
 						}
 						tile_list++;
 						cur_tiles = 0;
@@ -333,6 +354,40 @@ void TileManager::set_tiles()
 	state.buffer.full_height = max(1, params.full_height/resolution);
 }
 
+bool TileManager::split_largest_tile(list<Tile>& tiles)
+{
+	list<Tile>::iterator largest = tiles.end();
+
+	for(list<Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+		if(max(it->w, it->h) < 2*TILE_SPLIT_MIN_SIZE)
+			continue;
+		if(largest == tiles.end() || it->w*it->h > largest->w*largest->h)
+			largest = it;
+	}
+
+	if(largest == tiles.end())
+		return false;
+
+	/* Split along the longer side, the second half follows the first one so
+	 * the tile order is kept. */
+	Tile second = *largest;
+	second.index = state.num_tiles++;
+
+	if(largest->w >= largest->h) {
+		largest->w /= 2;
+		second.x += largest->w;
+		second.w -= largest->w;
+	}
+	else {
+		largest->h /= 2;
+		second.y += largest->h;
+		second.h -= largest->h;
+	}
+
+	tiles.insert(++largest, second);
+	return true;
+}
+
 bool TileManager::next_tile(Tile& tile, int device)
 {
 	int logical_device = preserve_tile_device? device: 0;
@@ -340,8 +395,17 @@ bool TileManager::next_tile(Tile& tile, int device)
 	if((logical_device >= state.tiles.size()) || state.tiles[logical_device].empty())
 		return false;
 
-	tile = Tile(state.tiles[logical_device].front());
-	state.tiles[logical_device].pop_front();
+	list<Tile>& tiles = state.tiles[logical_device];
+
+	/* With fewer tiles left than workers some of them would be idle until the
+	 * frame is done, so split the remaining tiles to share the work. Only for
+	 * final renders, where tiles are not tied to buffers of a device. */
+	if(background && !preserve_tile_device) {
+		while(tiles.size() < num_workers && split_largest_tile(tiles));
+	}
+
+	tile = Tile(tiles.front());
+	tiles.pop_front();
 	return true;
 }
 
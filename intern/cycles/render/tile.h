@@ -49,6 +49,7 @@ enum TileOrder {
 	TILE_TOP_TO_BOTTOM = 3,
 	TILE_BOTTOM_TO_TOP = 4,
 	TILE_HILBERT_SPIRAL = 5,
+	TILE_MORTON = 6,
 };
 
 /* Tile Manager */
@@ -86,6 +87,11 @@ public:
 
 	void set_tile_order(TileOrder tile_order_) { tile_order = tile_order_; }
 
+	/* Number of threads or devices taking tiles at the same time. For final
+	 * renders, the last tiles are split so these all get a share of the work
+	 * at the end of the frame. A single worker disables splitting. */
+	void set_num_workers(int num_workers_) { num_workers = num_workers_; }
+
 	/* ** Sample range rendering. ** */
 
 	/* Start sample in the range. */
@@ -105,6 +111,7 @@ protected:
 	TileOrder tile_order;
 	int start_resolution;
 	int num_devices;
+	int num_workers;
 
 	/* in some cases it is important that the same tile will be returned for the same
 	 * device it was originally generated for (i.e. viewport rendering when buffer is
@@ -127,6 +134,10 @@ protected:
 
 	/* Generate tile list, return number of tiles. */
 	int gen_tiles(bool sliced);
+
+	/* Split the largest tile of the list in two, returns false when all
+	 * tiles are too small to be split. */
+	bool split_largest_tile(list<Tile>& tiles);
 };
 
 CCL_NAMESPACE_END
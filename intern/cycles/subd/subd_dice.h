@@ -63,12 +63,17 @@ public:
 	SubdParams params;
 	float3 *mesh_P;
 	float3 *mesh_N;
+	float3 *mesh_ptex_uv;
+	float *mesh_ptex_face_id;
 	size_t vert_offset;
 	size_t tri_offset;
 
 	explicit EdgeDice(const SubdParams& params);
 
-	void reserve(int num_verts);
+	/* Set where the following vertices and triangles are written, the mesh
+	 * must already be resized to hold them. Dicers writing to different
+	 * ranges of the same mesh can run in parallel. */
+	void set_offsets(size_t vert_offset, size_t tri_offset);
 
 	int add_vert(Patch *patch, float2 uv);
 	void add_triangle(Patch *patch, int v0, int v1, int v2);
@@ -109,7 +114,11 @@ public:
 
 	explicit QuadDice(const SubdParams& params);
 
-	void reserve(EdgeFactors& ef, int Mu, int Mv);
+	/* Size of the inner grid, and number of vertices and triangles added
+	 * by dice(), so space can be allocated in advance. */
+	static void grid_size(const EdgeFactors& ef, int *Mu, int *Mv);
+	static void dice_size(const EdgeFactors& ef, int *num_verts, int *num_triangles);
+
 	float3 eval_projected(SubPatch& sub, float u, float v);
 
 	float2 map_uv(SubPatch& sub, float u, float v);
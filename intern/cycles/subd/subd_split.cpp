@@ -22,7 +22,9 @@
 #include "subd/subd_split.h"
 
 #include "util/util_debug.h"
+#include "util/util_foreach.h"
 #include "util/util_math.h"
+#include "util/util_task.h"
 #include "util/util_types.h"
 
 CCL_NAMESPACE_BEGIN
@@ -239,11 +241,77 @@ void DiagSplit::split_quad(Patch *patch, QuadDice::SubPatch *subpatch)
 	limit_edge_factors(sub_split, ef_split, 1 << params.max_level);
 
 	split(sub_split, ef_split);
+}
 
-	QuadDice dice(params);
+void DiagSplit::split_patches(const QuadDice::SubPatch *patches, size_t num_patches)
+{
+	for(size_t i = 0; i < num_patches; i++) {
+		QuadDice::SubPatch sub = patches[i];
+		split_quad(sub.patch, &sub);
+	}
+}
+
+void DiagSplit::dice_subpatches(QuadDice dice,
+                                const size_t *vert_offsets,
+                                const size_t *tri_offsets,
+                                size_t start,
+                                size_t end)
+{
+	for(size_t i = start; i < end; i++) {
+		dice.set_offsets(vert_offsets[i], tri_offsets[i]);
+		dice.dice(subpatches_quad[i], edgefactors_quad[i]);
+
+		assert(dice.vert_offset == vert_offsets[i+1]);
+		assert(dice.tri_offset == tri_offsets[i+1]);
+	}
+}
+
+void DiagSplit::split_and_dice(const vector<QuadDice::SubPatch>& patches)
+{
+	if(patches.size() == 0) {
+		return;
+	}
+
+	TaskPool pool;
+
+	/* split, every task fills the subpatch list of its own splitter */
+	size_t num_tasks = divide_up(patches.size(), DSPLIT_PATCHES_PER_TASK);
+	vector<DiagSplit> splits(num_tasks, DiagSplit(params));
+
+	for(size_t i = 0; i < num_tasks; i++) {
+		size_t start = i*DSPLIT_PATCHES_PER_TASK;
+		size_t end = start + DSPLIT_PATCHES_PER_TASK;
+		if(end > patches.size()) {
+			end = patches.size();
+		}
 
-	for(size_t i = 0; i < subpatches_quad.size(); i++) {
-		QuadDice::SubPatch& sub = subpatches_quad[i];
+		pool.push(function_bind(&DiagSplit::split_patches, &splits[i], &patches[start], end - start));
+	}
+
+	pool.wait_work();
+
+	/* join subpatches in order of the patches they came from */
+	foreach(DiagSplit& dsplit, splits) {
+		subpatches_quad.insert(subpatches_quad.end(),
+		                       dsplit.subpatches_quad.begin(),
+		                       dsplit.subpatches_quad.end());
+		edgefactors_quad.insert(edgefactors_quad.end(),
+		                        dsplit.edgefactors_quad.begin(),
+		                        dsplit.edgefactors_quad.end());
+	}
+
+	splits.clear();
+
+	/* compute where the vertices and triangles of every subpatch go */
+	Mesh *mesh = params.mesh;
+	size_t num_subpatches = subpatches_quad.size();
+	vector<size_t> vert_offsets(num_subpatches + 1);
+	vector<size_t> tri_offsets(num_subpatches + 1);
+
+	vert_offsets[0] = mesh->verts.size();
+	tri_offsets[0] = mesh->num_triangles();
+
+	for(size_t i = 0; i < num_subpatches; i++) {
 		QuadDice::EdgeFactors& ef = edgefactors_quad[i];
 
 		ef.tu0 = max(ef.tu0, 1);
@@ -251,9 +319,32 @@ void DiagSplit::split_quad(Patch *patch, QuadDice::SubPatch *subpatch)
 		ef.tv0 = max(ef.tv0, 1);
 		ef.tv1 = max(ef.tv1, 1);
 
-		dice.dice(sub, ef);
+		int num_verts, num_triangles;
+		QuadDice::dice_size(ef, &num_verts, &num_triangles);
+
+		vert_offsets[i+1] = vert_offsets[i] + num_verts;
+		tri_offsets[i+1] = tri_offsets[i] + num_triangles;
 	}
 
+	/* allocate the mesh once, the dicer adds the attributes it writes */
+	QuadDice dice(params);
+
+	mesh->resize_mesh(vert_offsets[num_subpatches], tri_offsets[num_subpatches]);
+	mesh->num_subd_verts += vert_offsets[num_subpatches] - vert_offsets[0];
+
+	/* dice, tasks write to separate ranges of the mesh */
+	for(size_t start = 0; start < num_subpatches; start += DSPLIT_PATCHES_PER_TASK) {
+		size_t end = start + DSPLIT_PATCHES_PER_TASK;
+		if(end > num_subpatches) {
+			end = num_subpatches;
+		}
+
+		pool.push(function_bind(&DiagSplit::dice_subpatches, this,
+		                        dice, &vert_offsets[0], &tri_offsets[0], start, end));
+	}
+
+	pool.wait_work();
+
 	subpatches_quad.clear();
 	edgefactors_quad.clear();
 }
@@ -34,6 +34,9 @@ class Patch;
 
 #define DSPLIT_NON_UNIFORM -1
 
+/* Number of patches split or diced by a single task. */
+#define DSPLIT_PATCHES_PER_TASK 64
+
 class DiagSplit {
 public:
 	vector<QuadDice::SubPatch> subpatches_quad;
@@ -52,6 +55,19 @@ public:
 	void split(QuadDice::SubPatch& sub, QuadDice::EdgeFactors& ef, int depth=0);
 
 	void split_quad(Patch *patch, QuadDice::SubPatch *subpatch=NULL);
+
+	/* Split and dice all patches into the mesh, using multiple threads.
+	 * Vertices and triangles are added in the order of the patches, so the
+	 * result is the same as splitting and dicing them one after another. */
+	void split_and_dice(const vector<QuadDice::SubPatch>& patches);
+
+protected:
+	void split_patches(const QuadDice::SubPatch *patches, size_t num_patches);
+	void dice_subpatches(QuadDice dice,
+	                     const size_t *vert_offsets,
+	                     const size_t *tri_offsets,
+	                     size_t start,
+	                     size_t end);
 };
 
 CCL_NAMESPACE_END
@@ -47,6 +47,9 @@ public:
 		/* Whether QBVH usage is allowed or not. */
 		bool qbvh;
 
+		/* Whether OBVH usage is allowed or not. */
+		bool obvh;
+
 		/* Whether split kernel is used */
 		bool split_kernel;
 	};
@@ -19,6 +19,10 @@
 
 #include "util/util_types.h"
 
+#ifndef __KERNEL_GPU__
+#  include <string.h>
+#endif
+
 CCL_NAMESPACE_BEGIN
 
 ccl_device_inline uint hash_int_2d(uint kx, uint ky)
@@ -60,7 +64,43 @@ static inline uint hash_string(const char *str)
 	return i;
 }
 
-
+/* 64 bit hash of a block of memory, based on MurmurHash64A. Used to detect
+ * changes in larger data, the seed allows hashing several blocks in a row. */
+static inline uint64_t hash_data_64(const void *data, size_t size, uint64_t seed = 0)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+
+	const uint8_t *p = (const uint8_t*)data;
+	const uint8_t *end = p + (size & ~(size_t)7);
+	uint64_t h = seed ^ (size * m);
+
+	for(; p != end; p += 8) {
+		uint64_t k;
+		memcpy(&k, p, sizeof(k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	const size_t tail = size & 7;
+	if(tail) {
+		uint64_t k = 0;
+		memcpy(&k, p, tail);
+		h ^= k;
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
 
 #endif
 
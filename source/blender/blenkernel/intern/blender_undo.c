@@ -73,6 +73,9 @@
 
 #define UNDO_DISK   0
 
+/* Compress steps which are not next to the current one, see: BLO_memfile_compress. */
+#define UNDO_COMPRESS_COLD   1
+
 typedef struct UndoElem {
 	struct UndoElem *next, *prev;
 	char str[FILE_MAX];
@@ -107,10 +110,13 @@ static int read_undosave(bContext *C, UndoElem *uel)
 	fileflags = G.fileflags;
 	G.fileflags |= G_FILE_NO_UI;
 
-	if (UNDO_DISK)
+	if (UNDO_DISK) {
 		success = (BKE_blendfile_read(C, uel->str, NULL, 0) != BKE_BLENDFILE_READ_FAIL);
-	else
+	}
+	else {
+		uel->undosize += BLO_memfile_uncompress(&uel->memfile);
 		success = BKE_blendfile_read_from_memfile(C, &uel->memfile, NULL, 0);
+	}
 
 	/* restore */
 	BLI_strncpy(G.main->name, mainstr, sizeof(G.main->name)); /* restore */
@@ -124,6 +130,25 @@ static int read_undosave(bContext *C, UndoElem *uel)
 	return success;
 }
 
+/**
+ * Keep the current step and its neighbors uncompressed, since they are read on undo/redo
+ * and compared against when writing the next step. Compress all others.
+ */
+static void undo_compress_cold(void)
+{
+	UndoElem *uel;
+
+	for (uel = undobase.first; uel; uel = uel->next) {
+		if ((uel == curundo) || (curundo && ((uel == curundo->prev) || (uel == curundo->next)))) {
+			uel->undosize += BLO_memfile_uncompress(&uel->memfile);
+		}
+		else {
+			const size_t size_saved = BLO_memfile_compress(&uel->memfile);
+			uel->undosize -= MIN2(uel->undosize, size_saved);
+		}
+	}
+}
+
 /* name can be a dynamic string */
 void BKE_undo_write(bContext *C, const char *name)
 {
@@ -197,6 +222,10 @@ void BKE_undo_write(bContext *C, const char *name)
 		memused = MEM_get_memory_in_use();
 		/* success = */ /* UNUSED */ BLO_write_file_mem(CTX_data_main(C), prevfile, &curundo->memfile, G.fileflags);
 		curundo->undosize = MEM_get_memory_in_use() - memused;
+
+		if (UNDO_COMPRESS_COLD) {
+			undo_compress_cold();
+		}
 	}
 
 	if (U.undomemory != 0) {
@@ -257,6 +286,10 @@ void BKE_undo_step(bContext *C, int step)
 			if (G.debug & G_DEBUG) printf("redo %s\n", curundo->name);
 		}
 	}
+
+	if (!UNDO_DISK && UNDO_COMPRESS_COLD) {
+		undo_compress_cold();
+	}
 }
 
 void BKE_undo_reset(void)
@@ -369,8 +402,10 @@ bool BKE_undo_save_file(const char *filename)
 		return false;
 	}
 
+	uel->undosize += BLO_memfile_uncompress(&uel->memfile);
+
 	for (chunk = uel->memfile.chunks.first; chunk; chunk = chunk->next) {
-		if (write(file, chunk->buf, chunk->size) != chunk->size) {
+		if (write(file, chunk->buffer->buf, chunk->size) != chunk->size) {
 			break;
 		}
 	}
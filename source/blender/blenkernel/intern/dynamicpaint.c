@@ -620,15 +620,15 @@ static void grid_bound_insert_cb_ex(void *userdata, void *userdata_chunk, const
 	boundInsert(grid_bound, bData->realCoord[bData->s_pos[i]].v);
 }
 
-static void grid_bound_insert_finalize(void *userdata, void *userdata_chunk)
+static void grid_bound_insert_reduce(void *UNUSED(userdata), void *chunk_join, const void *chunk)
 {
-	PaintBakeData *bData = userdata;
-	VolumeGrid *grid = bData->grid;
+	Bounds3D *join = chunk_join;
+	const Bounds3D *grid_bound = chunk;
 
-	Bounds3D *grid_bound = userdata_chunk;
-
-	boundInsert(&grid->grid_bounds, grid_bound->min);
-	boundInsert(&grid->grid_bounds, grid_bound->max);
+	if (grid_bound->valid) {
+		boundInsert(join, (float *)grid_bound->min);
+		boundInsert(join, (float *)grid_bound->max);
+	}
 }
 
 static void grid_cell_points_cb_ex(void *userdata, void *userdata_chunk, const int i, const int UNUSED(thread_id))
@@ -709,9 +709,9 @@ static void surfaceGenerateGrid(struct DynamicPaintSurface *surface)
 		/* calculate canvas dimensions */
 		/* Important to init correctly our ref grid_bound... */
 		boundInsert(&grid->grid_bounds, bData->realCoord[bData->s_pos[0]].v);
-		BLI_task_parallel_range_finalize(
+		BLI_task_parallel_range_reduce(
 		            0, sData->total_points, bData, &grid->grid_bounds, sizeof(grid->grid_bounds),
-		            grid_bound_insert_cb_ex, grid_bound_insert_finalize, sData->total_points > 1000, false);
+		            grid_bound_insert_cb_ex, grid_bound_insert_reduce, sData->total_points > 1000);
 
 		/* get dimensions */
 		sub_v3_v3v3(dim, grid->grid_bounds.max, grid->grid_bounds.min);
@@ -113,6 +113,8 @@ static void fill_treehash(void *treehash, BLI_mempool *treestore)
 void *BKE_outliner_treehash_create_from_treestore(BLI_mempool *treestore)
 {
 	GHash *treehash = BLI_ghash_new_ex(tse_hash, tse_cmp, "treehash", BLI_mempool_count(treestore));
+	/* Stored hashes avoid dereferencing tree-store elements in #tse_cmp while probing. */
+	BLI_ghash_flag_set(treehash, GHASH_FLAG_OPEN_ADDRESSING);
 	fill_treehash(treehash, treestore);
 	return treehash;
 }
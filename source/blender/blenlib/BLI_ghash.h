@@ -72,6 +72,9 @@ typedef struct GHashIterState {
 enum {
 	GHASH_FLAG_ALLOW_DUPES  = (1 << 0),  /* Only checked for in debug mode */
 	GHASH_FLAG_ALLOW_SHRINK = (1 << 1),  /* Allow to shrink buckets' size. */
+	/* Store entries in an open-addressing (Robin Hood) table instead of bucket chains,
+	 * lookups then only probe a contiguous array of hashes. Can be toggled at any time. */
+	GHASH_FLAG_OPEN_ADDRESSING = (1 << 2),
 
 #ifdef GHASH_INTERNAL_API
 	/* Internal usage only */
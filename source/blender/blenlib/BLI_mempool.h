@@ -82,6 +82,12 @@ enum {
 	 * \note order of iteration is only assured to be the order of allocation when no chunks have been freed.
 	 */
 	BLI_MEMPOOL_ALLOW_ITER = (1 << 0),
+	/** allow allocating and freeing elements from multiple threads at once.
+	 *
+	 * \note each thread keeps its own free elements, so there is no global lock on alloc/free.
+	 * \note other functions (iteration, clearing, counting...) must not run while other threads use the pool.
+	 */
+	BLI_MEMPOOL_THREADSAFE = (1 << 1),
 };
 
 void  BLI_mempool_iternew(BLI_mempool *pool, BLI_mempool_iter *iter) ATTR_NONNULL();
@@ -37,8 +37,10 @@ extern "C" {
 
 /* Task Scheduler
  * 
- * Central scheduler that holds running threads ready to execute tasks. A single
- * queue holds the task from all pools.
+ * Central scheduler that holds running threads ready to execute tasks. Each
+ * thread has its own queue of tasks it pushed, idle threads steal tasks from
+ * queues of other threads. Tasks pushed from threads which are not managed by
+ * the scheduler go to a shared queue.
  *
  * Init/exit must be called before/after any task pools are created/freed, and
  * must be called from the main threads. All other scheduler and pool functions
@@ -56,6 +58,29 @@ void BLI_task_scheduler_free(TaskScheduler *scheduler);
 
 int BLI_task_scheduler_num_threads(TaskScheduler *scheduler);
 
+/* Scheduling statistics, summed over all scheduler threads. */
+typedef struct TaskSchedulerStats {
+	/* Tasks taken from the thread's own queue. */
+	uint64_t num_local;
+	/* Tasks stolen from queues of other threads. */
+	uint64_t num_stolen;
+	/* Tasks taken from the shared queue. */
+	uint64_t num_shared;
+	/* Tasks taken from the affinity queue of a thread. */
+	uint64_t num_affinity;
+	/* Steal attempts which lost a race against another thread. */
+	uint64_t num_steal_contended;
+	/* Accesses to the shared queue which had to wait for its lock. */
+	uint64_t num_shared_contended;
+	/* Tasks which did not fit into the thread's own queue. */
+	uint64_t num_overflow;
+	/* Times a thread went to sleep because there was no work for it. */
+	uint64_t num_sleep;
+} TaskSchedulerStats;
+
+void BLI_task_scheduler_stats_get(TaskScheduler *scheduler, TaskSchedulerStats *r_stats);
+void BLI_task_scheduler_stats_reset(TaskScheduler *scheduler);
+
 /* Task Pool
  *
  * Pool of tasks that will be executed by the central TaskScheduler. For each
@@ -67,7 +92,8 @@ int BLI_task_scheduler_num_threads(TaskScheduler *scheduler);
  * Pools may be nested, i.e. a thread running a task can create another task
  * pool with smaller tasks. When other threads are busy they will continue
  * working on their own tasks, if not they will join in, no new threads will
- * be launched.
+ * be launched. A thread waiting for a pool can opt in to run pending tasks of
+ * pools nested in it instead of blocking, see BLI_task_pool_work_and_wait_ex().
  */
 
 typedef enum TaskPriority {
@@ -75,6 +101,9 @@ typedef enum TaskPriority {
 	TASK_PRIORITY_HIGH
 } TaskPriority;
 
+/* No affinity hint for the task. */
+#define TASK_AFFINITY_NONE -1
+
 typedef struct TaskPool TaskPool;
 typedef void (*TaskRunFunction)(TaskPool *__restrict pool, void *taskdata, int threadid);
 typedef void (*TaskFreeFunction)(TaskPool *__restrict pool, void *taskdata, int threadid);
@@ -86,7 +115,7 @@ void BLI_task_pool_free(TaskPool *pool);
 
 void BLI_task_pool_push_ex(
         TaskPool *pool, TaskRunFunction run, void *taskdata,
-        bool free_taskdata, TaskFreeFunction freedata, TaskPriority priority);
+        bool free_taskdata, TaskFreeFunction freedata, TaskPriority priority, int affinity);
 void BLI_task_pool_push(TaskPool *pool, TaskRunFunction run,
         void *taskdata, bool free_taskdata, TaskPriority priority);
 void BLI_task_pool_push_from_thread(TaskPool *pool, TaskRunFunction run,
@@ -94,6 +123,12 @@ void BLI_task_pool_push_from_thread(TaskPool *pool, TaskRunFunction run,
 
 /* work and wait until all tasks are done */
 void BLI_task_pool_work_and_wait(TaskPool *pool);
+/* same, optionally helping with pending tasks of pools created from tasks of this
+ * pool while there is nothing left to do for the pool itself */
+void BLI_task_pool_work_and_wait_ex(TaskPool *pool, const bool help_nested_pools);
+/* run function without helping other pools from nested work_and_wait_ex() calls */
+typedef void (*TaskIsolateFunction)(void *userdata);
+void BLI_task_isolate(TaskScheduler *scheduler, TaskIsolateFunction func, void *userdata);
 /* cancel all tasks, keep worker threads running */
 void BLI_task_pool_cancel(TaskPool *pool);
 
@@ -134,6 +169,26 @@ void BLI_task_parallel_range_finalize(
         const bool use_threading,
         const bool use_dynamic_scheduling);
 
+typedef void (*TaskParallelReduceFunc)(void *userdata, void *__restrict chunk_join, const void *__restrict chunk);
+typedef void (*TaskParallelScanFunc)(void *userdata, const void *__restrict prefix_chunk, const int iter);
+void BLI_task_parallel_range_reduce(
+        int start, int stop,
+        void *userdata,
+        void *userdata_chunk,
+        const size_t userdata_chunk_size,
+        TaskParallelRangeFuncEx func_ex,
+        TaskParallelReduceFunc func_reduce,
+        const bool use_threading);
+void BLI_task_parallel_range_scan(
+        int start, int stop,
+        void *userdata,
+        void *userdata_chunk,
+        const size_t userdata_chunk_size,
+        TaskParallelRangeFuncEx func_ex,
+        TaskParallelReduceFunc func_reduce,
+        TaskParallelScanFunc func_scan,
+        const bool use_threading);
+
 typedef void (*TaskParallelListbaseFunc)(void *userdata,
                                          struct Link *iter,
                                          int index);
@@ -31,6 +31,12 @@
  * A general (pointer -> pointer) chaining hash table
  * for 'Abstract Data Types' (known as an ADT Hash Table).
  *
+ * With #GHASH_FLAG_OPEN_ADDRESSING, entries are instead referenced from an open-addressing
+ * table using Robin Hood hashing, storing the full hash next to each entry pointer,
+ * so probing doesn't touch the entries themselves until a hash matches.
+ * Entries still live in the mempool in both cases, so pointers returned by lookups stay valid
+ * across insertions, and the iterator and entry layout are shared.
+ *
  * \note edgehash.c is based on this, make sure they stay in sync.
  */
 
@@ -62,6 +68,8 @@ const unsigned int hashsizes[] = {
 
 #ifdef GHASH_USE_MODULO_BUCKETS
 #  define GHASH_MAX_SIZE 27
+/* Open addressing needs power of two sizes, 1 << (cursize + GHASH_SLOT_BIT_OFFSET) slots. */
+#  define GHASH_SLOT_BIT_OFFSET 3
 #else
 #  define GHASH_BUCKET_BIT_MIN 2
 #  define GHASH_BUCKET_BIT_MAX 28  /* About 268M of buckets... */
@@ -97,11 +105,19 @@ typedef Entry GSetEntry;
 #define GHASH_ENTRY_SIZE(_is_gset) \
 	((_is_gset) ? sizeof(GSetEntry) : sizeof(GHashEntry))
 
+/* Open addressing slot, empty when 'e' is NULL. */
+typedef struct GHashSlot {
+	Entry *e;
+	unsigned int hash;
+} GHashSlot;
+
 struct GHash {
 	GHashHashFP hashfp;
 	GHashCmpFP cmpfp;
 
 	Entry **buckets;
+	GHashSlot *slots;  /* Used instead of buckets with GHASH_FLAG_OPEN_ADDRESSING. */
+	unsigned int slot_shift;
 	struct BLI_mempool *entrypool;
 	unsigned int nbuckets;
 	unsigned int limit_grow, limit_shrink;
@@ -166,6 +182,55 @@ BLI_INLINE unsigned int ghash_bucket_index(GHash *gh, const unsigned int hash)
 #endif
 }
 
+/**
+ * Get the preferred slot for an already-computed full hash (open addressing).
+ * Uses the high bits of a multiplicative (fibonacci) hash,
+ * since simple hashes like #BLI_ghashutil_ptrhash leave the low bits mostly unused.
+ */
+BLI_INLINE unsigned int ghash_slot_index(GHash *gh, const unsigned int hash)
+{
+	return (hash * 2654435769u) >> gh->slot_shift;
+}
+
+/**
+ * Get the distance of an entry stored in \a slot_index to its preferred slot.
+ */
+BLI_INLINE unsigned int ghash_slot_dist(GHash *gh, const unsigned int slot_index, const unsigned int hash)
+{
+	return (slot_index - ghash_slot_index(gh, hash)) & (gh->nbuckets - 1);
+}
+
+#ifdef GHASH_USE_MODULO_BUCKETS
+/**
+ * Get the number of buckets (or slots) for given size.
+ */
+BLI_INLINE unsigned int ghash_buckets_num(GHash *gh, const unsigned int size)
+{
+	return (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) ? (1u << (size + GHASH_SLOT_BIT_OFFSET)) : hashsizes[size];
+}
+#endif
+
+BLI_INLINE bool ghash_buckets_is_alloc(GHash *gh)
+{
+	return (gh->buckets || gh->slots);
+}
+
+/**
+ * Get the first entry of a bucket (or the entry of a slot).
+ */
+BLI_INLINE Entry *ghash_bucket_first(GHash *gh, const unsigned int bucket_index)
+{
+	return (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) ? gh->slots[bucket_index].e : gh->buckets[bucket_index];
+}
+
+/**
+ * Get the next entry in the same bucket, slots only ever hold one entry.
+ */
+BLI_INLINE Entry *ghash_bucket_next(GHash *gh, Entry *e)
+{
+	return (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) ? NULL : e->next;
+}
+
 /**
  * Find the index of next used bucket, starting from \a curr_bucket (\a gh is assumed non-empty).
  */
@@ -174,16 +239,16 @@ BLI_INLINE unsigned int ghash_find_next_bucket_index(GHash *gh, unsigned int cur
 	if (curr_bucket >= gh->nbuckets) {
 		curr_bucket = 0;
 	}
-	if (gh->buckets[curr_bucket]) {
+	if (ghash_bucket_first(gh, curr_bucket)) {
 		return curr_bucket;
 	}
 	for (; curr_bucket < gh->nbuckets; curr_bucket++) {
-		if (gh->buckets[curr_bucket]) {
+		if (ghash_bucket_first(gh, curr_bucket)) {
 			return curr_bucket;
 		}
 	}
 	for (curr_bucket = 0; curr_bucket < gh->nbuckets; curr_bucket++) {
-		if (gh->buckets[curr_bucket]) {
+		if (ghash_bucket_first(gh, curr_bucket)) {
 			return curr_bucket;
 		}
 	}
@@ -191,6 +256,113 @@ BLI_INLINE unsigned int ghash_find_next_bucket_index(GHash *gh, unsigned int cur
 	return 0;
 }
 
+/**
+ * Insert \a e in the slots (open addressing), there must be at least one free slot.
+ *
+ * Robin Hood hashing: entries further away from their preferred slot take over the place
+ * of entries closer to theirs, keeping probe sequences short and allowing lookups to stop early.
+ */
+static void ghash_slots_insert(GHash *gh, Entry *e, unsigned int hash)
+{
+	const unsigned int slot_mask = gh->nbuckets - 1;
+	unsigned int slot_index = ghash_slot_index(gh, hash);
+	unsigned int dist = 0;
+
+	for (;; slot_index = (slot_index + 1) & slot_mask, dist++) {
+		GHashSlot *slot = &gh->slots[slot_index];
+		unsigned int slot_dist;
+
+		if (slot->e == NULL) {
+			slot->e = e;
+			slot->hash = hash;
+			return;
+		}
+
+		slot_dist = ghash_slot_dist(gh, slot_index, slot->hash);
+		if (slot_dist < dist) {
+			SWAP(Entry *, slot->e, e);
+			SWAP(unsigned int, slot->hash, hash);
+			dist = slot_dist;
+		}
+	}
+}
+
+/**
+ * Internal lookup function (open addressing).
+ * \return the slot index of \a key, or -1 when not found.
+ */
+BLI_INLINE int ghash_slots_lookup(GHash *gh, const void *key, const unsigned int hash)
+{
+	const unsigned int slot_mask = gh->nbuckets - 1;
+	unsigned int slot_index = ghash_slot_index(gh, hash);
+	unsigned int dist = 0;
+
+	for (;; slot_index = (slot_index + 1) & slot_mask, dist++) {
+		const GHashSlot *slot = &gh->slots[slot_index];
+
+		/* The key would have taken over any slot with an entry closer to its preferred slot. */
+		if ((slot->e == NULL) || (ghash_slot_dist(gh, slot_index, slot->hash) < dist)) {
+			return -1;
+		}
+		if ((slot->hash == hash) && UNLIKELY(gh->cmpfp(key, slot->e->key) == false)) {
+			return (int)slot_index;
+		}
+	}
+}
+
+/**
+ * Empty \a slot_index (open addressing),
+ * moving back the following entries so lookups don't need tombstones.
+ */
+static void ghash_slots_remove(GHash *gh, unsigned int slot_index)
+{
+	const unsigned int slot_mask = gh->nbuckets - 1;
+	GHashSlot *slots = gh->slots;
+
+	for (;;) {
+		const unsigned int slot_next = (slot_index + 1) & slot_mask;
+		if ((slots[slot_next].e == NULL) || (ghash_slot_dist(gh, slot_next, slots[slot_next].hash) == 0)) {
+			break;
+		}
+		slots[slot_index] = slots[slot_next];
+		slot_index = slot_next;
+	}
+	slots[slot_index].e = NULL;
+}
+
+/**
+ * Resize the slots (open addressing), \a nslots must be a power of two.
+ * Stored hashes are reused, so unlike buckets this never calls the hash callback.
+ */
+static void ghash_slots_resize(GHash *gh, const unsigned int nslots)
+{
+	GHashSlot *slots_old = gh->slots;
+	const unsigned int nslots_old = gh->nbuckets;
+	unsigned int i;
+
+	BLI_assert((nslots & (nslots - 1)) == 0);
+
+	gh->nbuckets = nslots;
+	gh->slot_shift = 32;
+	for (i = nslots; i > 1; i >>= 1) {
+		gh->slot_shift--;
+	}
+#ifndef GHASH_USE_MODULO_BUCKETS
+	gh->bucket_mask = nslots - 1;
+#endif
+
+	gh->slots = MEM_callocN(sizeof(*gh->slots) * nslots, __func__);
+
+	if (slots_old) {
+		for (i = 0; i < nslots_old; i++) {
+			if (slots_old[i].e) {
+				ghash_slots_insert(gh, slots_old[i].e, slots_old[i].hash);
+			}
+		}
+		MEM_freeN(slots_old);
+	}
+}
+
 /**
  * Expand buckets to the next size up or down.
  */
@@ -201,6 +373,11 @@ static void ghash_buckets_resize(GHash *gh, const unsigned int nbuckets)
 	const unsigned int nbuckets_old = gh->nbuckets;
 	unsigned int i;
 
+	if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+		ghash_slots_resize(gh, nbuckets);
+		return;
+	}
+
 	BLI_assert((gh->nbuckets != nbuckets) || !gh->buckets);
 //	printf("%s: %d -> %d\n", __func__, nbuckets_old, nbuckets);
 
@@ -265,7 +442,7 @@ static void ghash_buckets_expand(
 {
 	unsigned int new_nbuckets;
 
-	if (LIKELY(gh->buckets && (nentries < gh->limit_grow))) {
+	if (LIKELY(ghash_buckets_is_alloc(gh) && (nentries < gh->limit_grow))) {
 		return;
 	}
 
@@ -275,7 +452,7 @@ static void ghash_buckets_expand(
 	while ((nentries    > gh->limit_grow) &&
 	       (gh->cursize < GHASH_MAX_SIZE - 1))
 	{
-		new_nbuckets = hashsizes[++gh->cursize];
+		new_nbuckets = ghash_buckets_num(gh, ++gh->cursize);
 		gh->limit_grow = GHASH_LIMIT_GROW(new_nbuckets);
 	}
 #else
@@ -295,7 +472,7 @@ static void ghash_buckets_expand(
 #endif
 	}
 
-	if ((new_nbuckets == gh->nbuckets) && gh->buckets) {
+	if ((new_nbuckets == gh->nbuckets) && ghash_buckets_is_alloc(gh)) {
 		return;
 	}
 
@@ -313,7 +490,7 @@ static void ghash_buckets_contract(
 		return;
 	}
 
-	if (LIKELY(gh->buckets && (nentries > gh->limit_shrink))) {
+	if (LIKELY(ghash_buckets_is_alloc(gh) && (nentries > gh->limit_shrink))) {
 		return;
 	}
 
@@ -323,7 +500,7 @@ static void ghash_buckets_contract(
 	while ((nentries    < gh->limit_shrink) &&
 	       (gh->cursize > gh->size_min))
 	{
-		new_nbuckets = hashsizes[--gh->cursize];
+		new_nbuckets = ghash_buckets_num(gh, --gh->cursize);
 		gh->limit_shrink = GHASH_LIMIT_SHRINK(new_nbuckets);
 	}
 #else
@@ -343,7 +520,7 @@ static void ghash_buckets_contract(
 #endif
 	}
 
-	if ((new_nbuckets == gh->nbuckets) && gh->buckets) {
+	if ((new_nbuckets == gh->nbuckets) && ghash_buckets_is_alloc(gh)) {
 		return;
 	}
 
@@ -358,11 +535,12 @@ static void ghash_buckets_contract(
 BLI_INLINE void ghash_buckets_reset(GHash *gh, const unsigned int nentries)
 {
 	MEM_SAFE_FREE(gh->buckets);
+	MEM_SAFE_FREE(gh->slots);
 
 #ifdef GHASH_USE_MODULO_BUCKETS
 	gh->cursize = 0;
 	gh->size_min = 0;
-	gh->nbuckets = hashsizes[gh->cursize];
+	gh->nbuckets = ghash_buckets_num(gh, gh->cursize);
 #else
 	gh->bucket_bit = GHASH_BUCKET_BIT_MIN;
 	gh->bucket_bit_min = GHASH_BUCKET_BIT_MIN;
@@ -380,15 +558,21 @@ BLI_INLINE void ghash_buckets_reset(GHash *gh, const unsigned int nentries)
 
 /**
  * Internal lookup function.
- * Takes hash and bucket_index arguments to avoid calling #ghash_keyhash and #ghash_bucket_index multiple times.
+ * Takes hash argument to avoid calling #ghash_keyhash multiple times.
  */
 BLI_INLINE Entry *ghash_lookup_entry_ex(
-        GHash *gh, const void *key, const unsigned int bucket_index)
+        GHash *gh, const void *key, const unsigned int hash)
 {
 	Entry *e;
+
+	if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+		const int slot_index = ghash_slots_lookup(gh, key, hash);
+		return (slot_index != -1) ? gh->slots[slot_index].e : NULL;
+	}
+
 	/* If we do not store GHash, not worth computing it for each entry here!
 	 * Typically, comparison function will be quicker, and since it's needed in the end anyway... */
-	for (e = gh->buckets[bucket_index]; e; e = e->next) {
+	for (e = gh->buckets[ghash_bucket_index(gh, hash)]; e; e = e->next) {
 		if (UNLIKELY(gh->cmpfp(key, e->key) == false)) {
 			return e;
 		}
@@ -425,8 +609,7 @@ BLI_INLINE Entry *ghash_lookup_entry_prev_ex(
 BLI_INLINE Entry *ghash_lookup_entry(GHash *gh, const void *key)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	return ghash_lookup_entry_ex(gh, key, bucket_index);
+	return ghash_lookup_entry_ex(gh, key, hash);
 }
 
 static GHash *ghash_new(GHashHashFP hashfp, GHashCmpFP cmpfp, const char *info,
@@ -438,6 +621,8 @@ static GHash *ghash_new(GHashHashFP hashfp, GHashCmpFP cmpfp, const char *info,
 	gh->cmpfp = cmpfp;
 
 	gh->buckets = NULL;
+	gh->slots = NULL;
+	gh->slot_shift = 0;
 	gh->flag = flag;
 
 	ghash_buckets_reset(gh, nentries_reserve);
@@ -446,22 +631,36 @@ static GHash *ghash_new(GHashHashFP hashfp, GHashCmpFP cmpfp, const char *info,
 	return gh;
 }
 
+/**
+ * Link an entry into its bucket (or slot).
+ */
+BLI_INLINE void ghash_entry_link(GHash *gh, Entry *e, const unsigned int hash)
+{
+	if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+		ghash_slots_insert(gh, e, hash);
+	}
+	else {
+		const unsigned int bucket_index = ghash_bucket_index(gh, hash);
+		e->next = gh->buckets[bucket_index];
+		gh->buckets[bucket_index] = e;
+	}
+}
+
 /**
  * Internal insert function.
- * Takes hash and bucket_index arguments to avoid calling #ghash_keyhash and #ghash_bucket_index multiple times.
+ * Takes hash argument to avoid calling #ghash_keyhash multiple times.
  */
 BLI_INLINE void ghash_insert_ex(
-        GHash *gh, void *key, void *val, const unsigned int bucket_index)
+        GHash *gh, void *key, void *val, const unsigned int hash)
 {
 	GHashEntry *e = BLI_mempool_alloc(gh->entrypool);
 
 	BLI_assert((gh->flag & GHASH_FLAG_ALLOW_DUPES) || (BLI_ghash_haskey(gh, key) == 0));
 	BLI_assert(!(gh->flag & GHASH_FLAG_IS_GSET));
 
-	e->e.next = gh->buckets[bucket_index];
 	e->e.key = key;
 	e->val = val;
-	gh->buckets[bucket_index] = (Entry *)e;
+	ghash_entry_link(gh, (Entry *)e, hash);
 
 	ghash_buckets_expand(gh, ++gh->nentries, false);
 }
@@ -470,14 +669,13 @@ BLI_INLINE void ghash_insert_ex(
  * Insert function that takes a pre-allocated entry.
  */
 BLI_INLINE void ghash_insert_ex_keyonly_entry(
-        GHash *gh, void *key, const unsigned int bucket_index,
+        GHash *gh, void *key, const unsigned int hash,
         Entry *e)
 {
 	BLI_assert((gh->flag & GHASH_FLAG_ALLOW_DUPES) || (BLI_ghash_haskey(gh, key) == 0));
 
-	e->next = gh->buckets[bucket_index];
 	e->key = key;
-	gh->buckets[bucket_index] = e;
+	ghash_entry_link(gh, e, hash);
 
 	ghash_buckets_expand(gh, ++gh->nentries, false);
 }
@@ -486,16 +684,15 @@ BLI_INLINE void ghash_insert_ex_keyonly_entry(
  * Insert function that doesn't set the value (use for GSet)
  */
 BLI_INLINE void ghash_insert_ex_keyonly(
-        GHash *gh, void *key, const unsigned int bucket_index)
+        GHash *gh, void *key, const unsigned int hash)
 {
 	Entry *e = BLI_mempool_alloc(gh->entrypool);
 
 	BLI_assert((gh->flag & GHASH_FLAG_ALLOW_DUPES) || (BLI_ghash_haskey(gh, key) == 0));
 	BLI_assert((gh->flag & GHASH_FLAG_IS_GSET) != 0);
 
-	e->next = gh->buckets[bucket_index];
 	e->key = key;
-	gh->buckets[bucket_index] = e;
+	ghash_entry_link(gh, e, hash);
 
 	ghash_buckets_expand(gh, ++gh->nentries, false);
 }
@@ -503,9 +700,8 @@ BLI_INLINE void ghash_insert_ex_keyonly(
 BLI_INLINE void ghash_insert(GHash *gh, void *key, void *val)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
 
-	ghash_insert_ex(gh, key, val, bucket_index);
+	ghash_insert_ex(gh, key, val, hash);
 }
 
 BLI_INLINE bool ghash_insert_safe(
@@ -513,8 +709,7 @@ BLI_INLINE bool ghash_insert_safe(
         GHashKeyFreeFP keyfreefp, GHashValFreeFP valfreefp)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, bucket_index);
+	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, hash);
 
 	BLI_assert(!(gh->flag & GHASH_FLAG_IS_GSET));
 
@@ -532,7 +727,7 @@ BLI_INLINE bool ghash_insert_safe(
 		return false;
 	}
 	else {
-		ghash_insert_ex(gh, key, val, bucket_index);
+		ghash_insert_ex(gh, key, val, hash);
 		return true;
 	}
 }
@@ -542,8 +737,7 @@ BLI_INLINE bool ghash_insert_safe_keyonly(
         GHashKeyFreeFP keyfreefp)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	Entry *e = ghash_lookup_entry_ex(gh, key, bucket_index);
+	Entry *e = ghash_lookup_entry_ex(gh, key, hash);
 
 	BLI_assert((gh->flag & GHASH_FLAG_IS_GSET) != 0);
 
@@ -557,7 +751,7 @@ BLI_INLINE bool ghash_insert_safe_keyonly(
 		return false;
 	}
 	else {
-		ghash_insert_ex_keyonly(gh, key, bucket_index);
+		ghash_insert_ex_keyonly(gh, key, hash);
 		return true;
 	}
 }
@@ -568,13 +762,34 @@ BLI_INLINE bool ghash_insert_safe_keyonly(
 static Entry *ghash_remove_ex(
         GHash *gh, const void *key,
         GHashKeyFreeFP keyfreefp, GHashValFreeFP valfreefp,
-        const unsigned int bucket_index)
+        const unsigned int hash)
 {
-	Entry *e_prev;
-	Entry *e = ghash_lookup_entry_prev_ex(gh, key, &e_prev, bucket_index);
+	Entry *e;
 
 	BLI_assert(!valfreefp || !(gh->flag & GHASH_FLAG_IS_GSET));
 
+	if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+		const int slot_index = ghash_slots_lookup(gh, key, hash);
+		e = NULL;
+		if (slot_index != -1) {
+			e = gh->slots[slot_index].e;
+			ghash_slots_remove(gh, (unsigned int)slot_index);
+		}
+	}
+	else {
+		const unsigned int bucket_index = ghash_bucket_index(gh, hash);
+		Entry *e_prev;
+		e = ghash_lookup_entry_prev_ex(gh, key, &e_prev, bucket_index);
+		if (e) {
+			if (e_prev) {
+				e_prev->next = e->next;
+			}
+			else {
+				gh->buckets[bucket_index] = e->next;
+			}
+		}
+	}
+
 	if (e) {
 		if (keyfreefp) {
 			keyfreefp(e->key);
@@ -583,13 +798,6 @@ static Entry *ghash_remove_ex(
 			valfreefp(((GHashEntry *)e)->val);
 		}
 
-		if (e_prev) {
-			e_prev->next = e->next;
-		}
-		else {
-			gh->buckets[bucket_index] = e->next;
-		}
-
 		ghash_buckets_contract(gh, --gh->nentries, false, false);
 	}
 
@@ -610,10 +818,18 @@ static Entry *ghash_pop(GHash *gh, GHashIterState *state)
 	 *       in case we are popping from a large ghash with few items in it... */
 	curr_bucket = ghash_find_next_bucket_index(gh, curr_bucket);
 
-	Entry *e = gh->buckets[curr_bucket];
+	Entry *e = ghash_bucket_first(gh, curr_bucket);
 	BLI_assert(e);
 
-	ghash_remove_ex(gh, e->key, NULL, NULL, curr_bucket);
+	/* The entry is first in its bucket, unlink it directly instead of looking up its key again. */
+	if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+		ghash_slots_remove(gh, curr_bucket);
+	}
+	else {
+		gh->buckets[curr_bucket] = e->next;
+	}
+
+	ghash_buckets_contract(gh, --gh->nentries, false, false);
 
 	state->curr_bucket = curr_bucket;
 	return e;
@@ -634,7 +850,7 @@ static void ghash_free_cb(
 	for (i = 0; i < gh->nbuckets; i++) {
 		Entry *e;
 
-		for (e = gh->buckets[i]; e; e = e->next) {
+		for (e = ghash_bucket_first(gh, i); e; e = ghash_bucket_next(gh, e)) {
 			if (keyfreefp) {
 				keyfreefp(e->key);
 			}
@@ -645,6 +861,54 @@ static void ghash_free_cb(
 	}
 }
 
+/**
+ * Move all entries to buckets or slots, after #GHASH_FLAG_OPEN_ADDRESSING has been toggled.
+ */
+static void ghash_buckets_relink(GHash *gh, const unsigned int flag_prev)
+{
+	Entry **buckets_old = gh->buckets;
+	GHashSlot *slots_old = gh->slots;
+	const unsigned int nbuckets_old = gh->nbuckets;
+	unsigned int new_nbuckets;
+	unsigned int i;
+
+	if (((gh->flag ^ flag_prev) & GHASH_FLAG_OPEN_ADDRESSING) == 0) {
+		return;
+	}
+
+#ifdef GHASH_USE_MODULO_BUCKETS
+	new_nbuckets = ghash_buckets_num(gh, gh->cursize);
+#else
+	new_nbuckets = gh->nbuckets;
+#endif
+
+	gh->buckets = NULL;
+	gh->slots = NULL;
+	gh->limit_grow   = GHASH_LIMIT_GROW(new_nbuckets);
+	gh->limit_shrink = GHASH_LIMIT_SHRINK(new_nbuckets);
+	ghash_buckets_resize(gh, new_nbuckets);
+
+	for (i = 0; i < nbuckets_old; i++) {
+		if (slots_old) {
+			if (slots_old[i].e) {
+				ghash_entry_link(gh, slots_old[i].e, slots_old[i].hash);
+			}
+		}
+		else {
+			for (Entry *e = buckets_old[i], *e_next; e; e = e_next) {
+				e_next = e->next;
+				ghash_entry_link(gh, e, ghash_entryhash(gh, e));
+			}
+		}
+	}
+
+	MEM_SAFE_FREE(buckets_old);
+	MEM_SAFE_FREE(slots_old);
+
+	/* Sizes differ between both layouts. */
+	ghash_buckets_expand(gh, gh->nentries, false);
+}
+
 /**
  * Copy the GHash.
  */
@@ -665,10 +929,17 @@ static GHash *ghash_copy(GHash *gh, GHashKeyCopyFP keycopyfp, GHashValCopyFP val
 	for (i = 0; i < gh->nbuckets; i++) {
 		Entry *e;
 
-		for (e = gh->buckets[i]; e; e = e->next) {
+		for (e = ghash_bucket_first(gh, i); e; e = ghash_bucket_next(gh, e)) {
 			Entry *e_new = BLI_mempool_alloc(gh_new->entrypool);
 			ghash_entry_copy(gh_new, e_new, gh, e, keycopyfp, valcopyfp);
 
+			if (gh->flag & GHASH_FLAG_OPEN_ADDRESSING) {
+				/* Same number of slots, so the same layout is valid for gh_new. */
+				gh_new->slots[i].e = e_new;
+				gh_new->slots[i].hash = gh->slots[i].hash;
+				continue;
+			}
+
 			/* Warning!
 			 * This means entries in buckets in new copy will be in reversed order!
 			 * This shall not be an issue though, since order should never be assumed in ghash. */
@@ -822,13 +1093,12 @@ void **BLI_ghash_lookup_p(GHash *gh, const void *key)
 bool BLI_ghash_ensure_p(GHash *gh, void *key, void ***r_val)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, bucket_index);
+	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, hash);
 	const bool haskey = (e != NULL);
 
 	if (!haskey) {
 		e = BLI_mempool_alloc(gh->entrypool);
-		ghash_insert_ex_keyonly_entry(gh, key, bucket_index, (Entry *)e);
+		ghash_insert_ex_keyonly_entry(gh, key, hash, (Entry *)e);
 	}
 
 	*r_val = &e->val;
@@ -845,14 +1115,13 @@ bool BLI_ghash_ensure_p_ex(
         GHash *gh, const void *key, void ***r_key, void ***r_val)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, bucket_index);
+	GHashEntry *e = (GHashEntry *)ghash_lookup_entry_ex(gh, key, hash);
 	const bool haskey = (e != NULL);
 
 	if (!haskey) {
 		/* pass 'key' incase we resize */
 		e = BLI_mempool_alloc(gh->entrypool);
-		ghash_insert_ex_keyonly_entry(gh, (void *)key, bucket_index, (Entry *)e);
+		ghash_insert_ex_keyonly_entry(gh, (void *)key, hash, (Entry *)e);
 		e->e.key = NULL;  /* caller must re-assign */
 	}
 
@@ -872,8 +1141,7 @@ bool BLI_ghash_ensure_p_ex(
 bool BLI_ghash_remove(GHash *gh, const void *key, GHashKeyFreeFP keyfreefp, GHashValFreeFP valfreefp)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	Entry *e = ghash_remove_ex(gh, key, keyfreefp, valfreefp, bucket_index);
+	Entry *e = ghash_remove_ex(gh, key, keyfreefp, valfreefp, hash);
 	if (e) {
 		BLI_mempool_free(gh->entrypool, e);
 		return true;
@@ -895,8 +1163,7 @@ bool BLI_ghash_remove(GHash *gh, const void *key, GHashKeyFreeFP keyfreefp, GHas
 void *BLI_ghash_popkey(GHash *gh, const void *key, GHashKeyFreeFP keyfreefp)
 {
 	const unsigned int hash = ghash_keyhash(gh, key);
-	const unsigned int bucket_index = ghash_bucket_index(gh, hash);
-	GHashEntry *e = (GHashEntry *)ghash_remove_ex(gh, key, keyfreefp, NULL, bucket_index);
+	GHashEntry *e = (GHashEntry *)ghash_remove_ex(gh, key, keyfreefp, NULL, hash);
 	BLI_assert(!(gh->flag & GHASH_FLAG_IS_GSET));
 	if (e) {
 		void *val = e->val;
@@ -983,7 +1250,8 @@ void BLI_ghash_free(GHash *gh, GHashKeyFreeFP keyfreefp, GHashValFreeFP valfreef
 	if (keyfreefp || valfreefp)
 		ghash_free_cb(gh, keyfreefp, valfreefp);
 
-	MEM_freeN(gh->buckets);
+	MEM_SAFE_FREE(gh->buckets);
+	MEM_SAFE_FREE(gh->slots);
 	BLI_mempool_destroy(gh->entrypool);
 	MEM_freeN(gh);
 }
@@ -993,7 +1261,9 @@ void BLI_ghash_free(GHash *gh, GHashKeyFreeFP keyfreefp, GHashValFreeFP valfreef
  */
 void BLI_ghash_flag_set(GHash *gh, unsigned int flag)
 {
+	const unsigned int flag_prev = gh->flag;
 	gh->flag |= flag;
+	ghash_buckets_relink(gh, flag_prev);
 }
 
 /**
@@ -1001,7 +1271,9 @@ void BLI_ghash_flag_set(GHash *gh, unsigned int flag)
  */
 void BLI_ghash_flag_clear(GHash *gh, unsigned int flag)
 {
+	const unsigned int flag_prev = gh->flag;
 	gh->flag &= ~flag;
+	ghash_buckets_relink(gh, flag_prev);
 }
 
 /** \} */
@@ -1046,7 +1318,7 @@ void BLI_ghashIterator_init(GHashIterator *ghi, GHash *gh)
 			ghi->curBucket++;
 			if (UNLIKELY(ghi->curBucket == ghi->gh->nbuckets))
 				break;
-			ghi->curEntry = ghi->gh->buckets[ghi->curBucket];
+			ghi->curEntry = ghash_bucket_first(ghi->gh, ghi->curBucket);
 		} while (!ghi->curEntry);
 	}
 }
@@ -1059,12 +1331,12 @@ void BLI_ghashIterator_init(GHashIterator *ghi, GHash *gh)
 void BLI_ghashIterator_step(GHashIterator *ghi)
 {
 	if (ghi->curEntry) {
-		ghi->curEntry = ghi->curEntry->next;
+		ghi->curEntry = ghash_bucket_next(ghi->gh, ghi->curEntry);
 		while (!ghi->curEntry) {
 			ghi->curBucket++;
 			if (ghi->curBucket == ghi->gh->nbuckets)
 				break;
-			ghi->curEntry = ghi->gh->buckets[ghi->curBucket];
+			ghi->curEntry = ghash_bucket_first(ghi->gh, ghi->curBucket);
 		}
 	}
 }
@@ -1379,8 +1651,7 @@ unsigned int BLI_gset_size(GSet *gs)
 void BLI_gset_insert(GSet *gs, void *key)
 {
 	const unsigned int hash = ghash_keyhash((GHash *)gs, key);
-	const unsigned int bucket_index = ghash_bucket_index((GHash *)gs, hash);
-	ghash_insert_ex_keyonly((GHash *)gs, key, bucket_index);
+	ghash_insert_ex_keyonly((GHash *)gs, key, hash);
 }
 
 /**
@@ -1403,14 +1674,13 @@ bool BLI_gset_add(GSet *gs, void *key)
 bool BLI_gset_ensure_p_ex(GSet *gs, const void *key, void ***r_key)
 {
 	const unsigned int hash = ghash_keyhash((GHash *)gs, key);
-	const unsigned int bucket_index = ghash_bucket_index((GHash *)gs, hash);
-	GSetEntry *e = (GSetEntry *)ghash_lookup_entry_ex((GHash *)gs, key, bucket_index);
+	GSetEntry *e = (GSetEntry *)ghash_lookup_entry_ex((GHash *)gs, key, hash);
 	const bool haskey = (e != NULL);
 
 	if (!haskey) {
 		/* pass 'key' incase we resize */
 		e = BLI_mempool_alloc(((GHash *)gs)->entrypool);
-		ghash_insert_ex_keyonly_entry((GHash *)gs, (void *)key, bucket_index, (Entry *)e);
+		ghash_insert_ex_keyonly_entry((GHash *)gs, (void *)key, hash, (Entry *)e);
 		e->key = NULL;  /* caller must re-assign */
 	}
 
@@ -1484,12 +1754,12 @@ void BLI_gset_free(GSet *gs, GSetKeyFreeFP keyfreefp)
 
 void BLI_gset_flag_set(GSet *gs, unsigned int flag)
 {
-	((GHash *)gs)->flag |= flag;
+	BLI_ghash_flag_set((GHash *)gs, flag);
 }
 
 void BLI_gset_flag_clear(GSet *gs, unsigned int flag)
 {
-	((GHash *)gs)->flag &= ~flag;
+	BLI_ghash_flag_clear((GHash *)gs, flag);
 }
 
 /** \} */
@@ -1594,7 +1864,7 @@ double BLI_ghash_calc_quality_ex(
 		for (i = 0; i < gh->nbuckets; i++) {
 			int count = 0;
 			Entry *e;
-			for (e = gh->buckets[i]; e; e = e->next) {
+			for (e = ghash_bucket_first(gh, i); e; e = ghash_bucket_next(gh, e)) {
 				count++;
 			}
 			sum += ((double)count - mean) * ((double)count - mean);
@@ -1611,7 +1881,7 @@ double BLI_ghash_calc_quality_ex(
 		for (i = 0; i < gh->nbuckets; i++) {
 			uint64_t count = 0;
 			Entry *e;
-			for (e = gh->buckets[i]; e; e = e->next) {
+			for (e = ghash_bucket_first(gh, i); e; e = ghash_bucket_next(gh, e)) {
 				count++;
 			}
 			if (r_biggest_bucket) {
@@ -36,17 +36,23 @@
  * - Freeing chunks.
  * - Iterating over allocated chunks
  *   (optionally when using the #BLI_MEMPOOL_ALLOW_ITER flag).
+ * - Allocating and freeing from multiple threads
+ *   (optionally when using the #BLI_MEMPOOL_THREADSAFE flag).
  */
 
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "BLI_utildefines.h"
+#include "BLI_threads.h"
 
 #include "BLI_mempool.h" /* own include */
 
 #include "MEM_guardedalloc.h"
 
+#include "atomic_ops.h"
+
 #include "BLI_strict_flags.h"  /* keep last */
 
 #ifdef WITH_MEM_VALGRIND
@@ -118,6 +124,31 @@ typedef struct BLI_mempool_chunk {
 #endif
 } BLI_mempool_chunk;
 
+/**
+ * Free list of a thread in a #BLI_MEMPOOL_THREADSAFE pool, only accessed by that thread.
+ */
+typedef struct BLI_mempool_thread {
+	BLI_freenode *free;
+	/* Number of known elements at the head of \a free (elements taken from the shared list aren't counted). */
+	unsigned int totfree;
+	/* Allocations minus frees done by this thread, negative when freeing elements of other threads. */
+	int totused;
+} BLI_mempool_thread;
+
+/**
+ * Number of threads which get their own free list, others share a locked one.
+ */
+#define MEMPOOL_THREAD_SLOTS BLENDER_MAX_THREADS
+
+/**
+ * Threading data of a #BLI_MEMPOOL_THREADSAFE pool.
+ */
+typedef struct BLI_mempool_threads {
+	uint32_t chunk_lock;      /* Appending to the chunk list. */
+	uint32_t slot_lock;       /* For the last slot, used by threads without a slot of their own. */
+	BLI_mempool_thread *slots[MEMPOOL_THREAD_SLOTS + 1];
+} BLI_mempool_threads;
+
 /**
  * The mempool, stores and tracks memory \a chunks and elements within those chunks \a free.
  */
@@ -133,12 +164,14 @@ struct BLI_mempool {
 	unsigned int flag;
 	/* keeps aligned to 16 bits */
 
-	BLI_freenode *free;         /* free element list. Interleaved into chunk datas. */
+	BLI_freenode *free;         /* free element list. Interleaved into chunk datas.
+	                             * With BLI_MEMPOOL_THREADSAFE, elements shared between threads (atomic access). */
 	unsigned int maxchunks;     /* use to know how many chunks to keep for BLI_mempool_clear */
 	unsigned int totused;       /* number of elements currently in use */
 #ifdef USE_TOTALLOC
 	unsigned int totalloc;          /* number of elements allocated in total */
 #endif
+	BLI_mempool_threads *threads;  /* only with BLI_MEMPOOL_THREADSAFE */
 };
 
 #define MEMPOOL_ELEM_SIZE_MIN (sizeof(void *) * 2)
@@ -206,22 +239,10 @@ static BLI_mempool_chunk *mempool_chunk_alloc(BLI_mempool *pool)
 }
 
 /**
- * Initialize a chunk and add into \a pool->chunks
- *
- * \param pool  The pool to add the chunk into.
- * \param mpchunk  The new uninitialized chunk (can be malloc'd)
- * \param lasttail  The last element of the previous chunk
- * (used when building free chunks initially)
- * \return The last chunk,
+ * Append \a mpchunk to \a pool->chunks.
  */
-static BLI_freenode *mempool_chunk_add(BLI_mempool *pool, BLI_mempool_chunk *mpchunk,
-                                       BLI_freenode *lasttail)
+static void mempool_chunk_append(BLI_mempool *pool, BLI_mempool_chunk *mpchunk)
 {
-	const unsigned int esize = pool->esize;
-	BLI_freenode *curnode = CHUNK_DATA(mpchunk);
-	unsigned int j;
-
-	/* append */
 	if (pool->chunk_tail) {
 		pool->chunk_tail->next = mpchunk;
 	}
@@ -232,10 +253,18 @@ static BLI_freenode *mempool_chunk_add(BLI_mempool *pool, BLI_mempool_chunk *mpc
 
 	mpchunk->next = NULL;
 	pool->chunk_tail = mpchunk;
+}
 
-	if (UNLIKELY(pool->free == NULL)) {
-		pool->free = curnode;
-	}
+/**
+ * Link all elements of \a mpchunk as free.
+ *
+ * \return The last element of the chunk, its next pointer is NULL.
+ */
+static BLI_freenode *mempool_chunk_init_free(BLI_mempool *pool, BLI_mempool_chunk *mpchunk)
+{
+	const unsigned int esize = pool->esize;
+	BLI_freenode *curnode = CHUNK_DATA(mpchunk);
+	unsigned int j;
 
 	/* loop through the allocated data, building the pointer structures */
 	j = pool->pchunk;
@@ -262,6 +291,32 @@ static BLI_freenode *mempool_chunk_add(BLI_mempool *pool, BLI_mempool_chunk *mpc
 	pool->totalloc += pool->pchunk;
 #endif
 
+	return curnode;
+}
+
+/**
+ * Initialize a chunk and add into \a pool->chunks
+ *
+ * \param pool  The pool to add the chunk into.
+ * \param mpchunk  The new uninitialized chunk (can be malloc'd)
+ * \param lasttail  The last element of the previous chunk
+ * (used when building free chunks initially)
+ * \return The last chunk,
+ */
+static BLI_freenode *mempool_chunk_add(BLI_mempool *pool, BLI_mempool_chunk *mpchunk,
+                                       BLI_freenode *lasttail)
+{
+	BLI_freenode *curnode;
+
+	/* append */
+	mempool_chunk_append(pool, mpchunk);
+
+	if (UNLIKELY(pool->free == NULL)) {
+		pool->free = CHUNK_DATA(mpchunk);
+	}
+
+	curnode = mempool_chunk_init_free(pool, mpchunk);
+
 	/* final pointer in the previously allocated chunk is wrong */
 	if (lasttail) {
 		lasttail->next = CHUNK_DATA(mpchunk);
@@ -289,6 +344,245 @@ static void mempool_chunk_free_all(BLI_mempool_chunk *mpchunk)
 	}
 }
 
+/* -------------------------------------------------------------------- */
+/** \name Thread-safe pools
+ *
+ * Each thread allocates from and frees to its own free list, without atomics or locks.
+ * To avoid memory piling up in threads freeing more than they allocate,
+ * batches of free elements move to the pool's shared free list, using lock-free pushes.
+ * Threads running out of free elements take the whole shared list at once (avoiding ABA issues),
+ * only adding new chunks (under a spin lock) when it's empty too.
+ *
+ * Threads get a slot, used as index into the free lists of all pools, which is released on thread exit.
+ * \{ */
+
+/* Own spin lock rather than BLI_spin_*, this file is also built into makesdna/makesrna without threads.c. */
+BLI_INLINE void mempool_lock(uint32_t *lock)
+{
+	while (atomic_cas_uint32(lock, 0, 1) != 0) {
+		/* pass */
+	}
+}
+
+BLI_INLINE void mempool_unlock(uint32_t *lock)
+{
+	atomic_cas_uint32(lock, 1, 0);
+}
+
+static pthread_key_t mempool_thread_key;
+static pthread_once_t mempool_thread_key_once = PTHREAD_ONCE_INIT;
+static uint32_t mempool_thread_slots_used[MEMPOOL_THREAD_SLOTS / 32];
+
+static void mempool_thread_slot_release(void *value)
+{
+	const unsigned int slot = GET_UINT_FROM_POINTER(value) - 1;
+	atomic_fetch_and_and_uint32(&mempool_thread_slots_used[slot / 32], ~(1u << (slot % 32)));
+}
+
+static void mempool_thread_key_create(void)
+{
+	pthread_key_create(&mempool_thread_key, mempool_thread_slot_release);
+}
+
+/**
+ * \return the slot of the calling thread, #MEMPOOL_THREAD_SLOTS when all slots are in use.
+ */
+static unsigned int mempool_thread_slot(void)
+{
+	void *value = pthread_getspecific(mempool_thread_key);
+	unsigned int i, j;
+
+	if (LIKELY(value)) {
+		return GET_UINT_FROM_POINTER(value) - 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mempool_thread_slots_used); i++) {
+		for (j = 0; j < 32; j++) {
+			const uint32_t bit = 1u << j;
+			if ((mempool_thread_slots_used[i] & bit) == 0 &&
+			    (atomic_fetch_and_or_uint32(&mempool_thread_slots_used[i], bit) & bit) == 0)
+			{
+				const unsigned int slot = i * 32 + j;
+				pthread_setspecific(mempool_thread_key, SET_UINT_IN_POINTER(slot + 1));
+				return slot;
+			}
+		}
+	}
+
+	return MEMPOOL_THREAD_SLOTS;
+}
+
+/**
+ * Get the free list of the calling thread, must be followed by #mempool_thread_end.
+ */
+BLI_INLINE BLI_mempool_thread *mempool_thread_begin(BLI_mempool *pool, unsigned int *r_slot)
+{
+	const unsigned int slot = mempool_thread_slot();
+	BLI_mempool_thread *thread;
+
+	if (UNLIKELY(slot == MEMPOOL_THREAD_SLOTS)) {
+		mempool_lock(&pool->threads->slot_lock);
+	}
+
+	thread = pool->threads->slots[slot];
+	if (UNLIKELY(thread == NULL)) {
+		/* Own cache line, threads write to it all the time. */
+		thread = MEM_mallocN_aligned(sizeof(*thread), 64, "BLI_Mempool Thread");
+		memset(thread, 0, sizeof(*thread));
+		pool->threads->slots[slot] = thread;
+	}
+
+	*r_slot = slot;
+	return thread;
+}
+
+BLI_INLINE void mempool_thread_end(BLI_mempool *pool, const unsigned int slot)
+{
+	if (UNLIKELY(slot == MEMPOOL_THREAD_SLOTS)) {
+		mempool_unlock(&pool->threads->slot_lock);
+	}
+}
+
+static void mempool_threads_create(BLI_mempool *pool)
+{
+	pthread_once(&mempool_thread_key_once, mempool_thread_key_create);
+
+	pool->threads = MEM_callocN(sizeof(*pool->threads), "BLI_Mempool Threads");
+}
+
+/**
+ * Forget about all thread free lists, when all elements are freed.
+ */
+static void mempool_threads_reset(BLI_mempool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(pool->threads->slots); i++) {
+		BLI_mempool_thread *thread = pool->threads->slots[i];
+		if (thread) {
+			memset(thread, 0, sizeof(*thread));
+		}
+	}
+}
+
+static void mempool_threads_free(BLI_mempool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(pool->threads->slots); i++) {
+		if (pool->threads->slots[i]) {
+			MEM_freeN(pool->threads->slots[i]);
+		}
+	}
+
+	MEM_freeN(pool->threads);
+	pool->threads = NULL;
+}
+
+/**
+ * Push the list from \a head to \a tail on the shared free list.
+ */
+static void mempool_shared_push(BLI_mempool *pool, BLI_freenode *head, BLI_freenode *tail)
+{
+	BLI_freenode *free_old;
+
+	do {
+		free_old = pool->free;
+		tail->next = free_old;
+	} while (atomic_cas_z((size_t *)&pool->free, (size_t)free_old, (size_t)head) != (size_t)free_old);
+}
+
+/**
+ * Take the whole shared free list.
+ */
+static BLI_freenode *mempool_shared_pop_all(BLI_mempool *pool)
+{
+	BLI_freenode *free_old;
+
+	do {
+		free_old = pool->free;
+		if (free_old == NULL) {
+			return NULL;
+		}
+	} while (atomic_cas_z((size_t *)&pool->free, (size_t)free_old, 0) != (size_t)free_old);
+
+	return free_old;
+}
+
+static void *mempool_alloc_threaded(BLI_mempool *pool)
+{
+	unsigned int slot;
+	BLI_mempool_thread *thread = mempool_thread_begin(pool, &slot);
+	BLI_freenode *free_pop;
+
+	if (UNLIKELY(thread->free == NULL)) {
+		thread->free = mempool_shared_pop_all(pool);
+		thread->totfree = 0;
+
+		if (thread->free == NULL) {
+			/* need to allocate a new chunk */
+			BLI_mempool_chunk *mpchunk = mempool_chunk_alloc(pool);
+
+			mempool_lock(&pool->threads->chunk_lock);
+			mempool_chunk_append(pool, mpchunk);
+			mempool_unlock(&pool->threads->chunk_lock);
+
+			mempool_chunk_init_free(pool, mpchunk);
+			thread->free = CHUNK_DATA(mpchunk);
+			thread->totfree = pool->pchunk;
+		}
+	}
+
+	free_pop = thread->free;
+
+	if (pool->flag & BLI_MEMPOOL_ALLOW_ITER) {
+		free_pop->freeword = USEDWORD;
+	}
+
+	thread->free = free_pop->next;
+	if (thread->totfree) {
+		thread->totfree--;
+	}
+	thread->totused++;
+
+	mempool_thread_end(pool, slot);
+
+#ifdef WITH_MEM_VALGRIND
+	VALGRIND_MEMPOOL_ALLOC(pool, free_pop, pool->esize);
+#endif
+
+	return (void *)free_pop;
+}
+
+static void mempool_free_threaded(BLI_mempool *pool, BLI_freenode *newhead)
+{
+	unsigned int slot;
+	BLI_mempool_thread *thread = mempool_thread_begin(pool, &slot);
+
+	newhead->next = thread->free;
+	thread->free = newhead;
+	thread->totfree++;
+	thread->totused--;
+
+	/* Keep at most two chunks worth of free elements, share the others. */
+	if (UNLIKELY(thread->totfree > pool->pchunk * 2)) {
+		BLI_freenode *head = thread->free, *tail = head;
+		unsigned int i;
+
+		for (i = 1; i < pool->pchunk; i++) {
+			tail = tail->next;
+		}
+		thread->free = tail->next;
+		thread->totfree -= pool->pchunk;
+
+		mempool_shared_push(pool, head, tail);
+	}
+
+	mempool_thread_end(pool, slot);
+}
+
+/** \} */
+
 BLI_mempool *BLI_mempool_create(unsigned int esize, unsigned int totelem,
                                 unsigned int pchunk, unsigned int flag)
 {
@@ -334,6 +628,11 @@ BLI_mempool *BLI_mempool_create(unsigned int esize, unsigned int totelem,
 	pool->totalloc = 0;
 #endif
 	pool->totused = 0;
+	pool->threads = NULL;
+
+	if (flag & BLI_MEMPOOL_THREADSAFE) {
+		mempool_threads_create(pool);
+	}
 
 	if (totelem) {
 		/* allocate the actual chunks */
@@ -354,6 +653,10 @@ void *BLI_mempool_alloc(BLI_mempool *pool)
 {
 	BLI_freenode *free_pop;
 
+	if (pool->flag & BLI_MEMPOOL_THREADSAFE) {
+		return mempool_alloc_threaded(pool);
+	}
+
 	if (UNLIKELY(pool->free == NULL)) {
 		/* need to allocate a new chunk */
 		BLI_mempool_chunk *mpchunk = mempool_chunk_alloc(pool);
@@ -398,12 +701,18 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
 	{
 		BLI_mempool_chunk *chunk;
 		bool found = false;
+		if (pool->threads) {
+			mempool_lock(&pool->threads->chunk_lock);
+		}
 		for (chunk = pool->chunks; chunk; chunk = chunk->next) {
 			if (ARRAY_HAS_ITEM((char *)addr, (char *)CHUNK_DATA(chunk), pool->csize)) {
 				found = true;
 				break;
 			}
 		}
+		if (pool->threads) {
+			mempool_unlock(&pool->threads->chunk_lock);
+		}
 		if (!found) {
 			BLI_assert(!"Attempt to free data which is not in pool.\n");
 		}
@@ -423,6 +732,14 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
 		newhead->freeword = FREEWORD;
 	}
 
+	if (pool->flag & BLI_MEMPOOL_THREADSAFE) {
+		mempool_free_threaded(pool, newhead);
+#ifdef WITH_MEM_VALGRIND
+		VALGRIND_MEMPOOL_FREE(pool, addr);
+#endif
+		return;
+	}
+
 	newhead->next = pool->free;
 	pool->free = newhead;
 
@@ -472,8 +789,22 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
 	}
 }
 
+/**
+ * \note For #BLI_MEMPOOL_THREADSAFE pools, this is only exact when no other thread is using the pool.
+ */
 int BLI_mempool_count(BLI_mempool *pool)
 {
+	if (pool->threads) {
+		int totused = 0;
+		unsigned int i;
+		for (i = 0; i < ARRAY_SIZE(pool->threads->slots); i++) {
+			if (pool->threads->slots[i]) {
+				totused += pool->threads->slots[i]->totused;
+			}
+		}
+		return totused;
+	}
+
 	return (int)pool->totused;
 }
 
@@ -481,7 +812,7 @@ void *BLI_mempool_findelem(BLI_mempool *pool, unsigned int index)
 {
 	BLI_assert(pool->flag & BLI_MEMPOOL_ALLOW_ITER);
 
-	if (index < pool->totused) {
+	if (index < (unsigned int)BLI_mempool_count(pool)) {
 		/* we could have some faster mem chunk stepping code inline */
 		BLI_mempool_iter iter;
 		void *elem;
@@ -512,7 +843,7 @@ void BLI_mempool_as_table(BLI_mempool *pool, void **data)
 	while ((elem = BLI_mempool_iterstep(&iter))) {
 		*p++ = elem;
 	}
-	BLI_assert((unsigned int)(p - data) == pool->totused);
+	BLI_assert((int)(p - data) == BLI_mempool_count(pool));
 }
 
 /**
@@ -520,7 +851,7 @@ void BLI_mempool_as_table(BLI_mempool *pool, void **data)
  */
 void **BLI_mempool_as_tableN(BLI_mempool *pool, const char *allocstr)
 {
-	void **data = MEM_mallocN((size_t)pool->totused * sizeof(void *), allocstr);
+	void **data = MEM_mallocN((size_t)BLI_mempool_count(pool) * sizeof(void *), allocstr);
 	BLI_mempool_as_table(pool, data);
 	return data;
 }
@@ -539,7 +870,7 @@ void BLI_mempool_as_array(BLI_mempool *pool, void *data)
 		memcpy(p, elem, (size_t)esize);
 		p = NODE_STEP_NEXT(p);
 	}
-	BLI_assert((unsigned int)(p - (char *)data) == pool->totused * esize);
+	BLI_assert((unsigned int)(p - (char *)data) == (unsigned int)BLI_mempool_count(pool) * esize);
 }
 
 /**
@@ -547,7 +878,7 @@ void BLI_mempool_as_array(BLI_mempool *pool, void *data)
  */
 void *BLI_mempool_as_arrayN(BLI_mempool *pool, const char *allocstr)
 {
-	char *data = MEM_mallocN((size_t)(pool->totused * pool->esize), allocstr);
+	char *data = MEM_mallocN((size_t)BLI_mempool_count(pool) * pool->esize, allocstr);
 	BLI_mempool_as_array(pool, data);
 	return data;
 }
@@ -677,6 +1008,9 @@ void BLI_mempool_clear_ex(BLI_mempool *pool, const int totelem_reserve)
 	/* re-initialize */
 	pool->free = NULL;
 	pool->totused = 0;
+	if (pool->threads) {
+		mempool_threads_reset(pool);
+	}
 #ifdef USE_TOTALLOC
 	pool->totalloc = 0;
 #endif
@@ -706,6 +1040,10 @@ void BLI_mempool_destroy(BLI_mempool *pool)
 {
 	mempool_chunk_free_all(pool->chunks);
 
+	if (pool->threads) {
+		mempool_threads_free(pool);
+	}
+
 #ifdef WITH_MEM_VALGRIND
 	VALGRIND_DESTROY_MEMPOOL(pool);
 #endif
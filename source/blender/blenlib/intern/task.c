@@ -48,11 +48,28 @@
  */
 #define MEMPOOL_SIZE 256
 
-/* Number of tasks which are pushed directly to local thread queue.
+/* Number of tasks which fit into per-thread work-stealing queue.
  *
- * This allows thread to fetch next task without locking the whole queue.
+ * Must be a power of two. Tasks which do not fit into the queue are pushed
+ * to the scheduler's shared queue instead.
  */
-#define LOCALQUEUE_SIZE 1
+#define TASK_QUEUE_SIZE 1024
+#define TASK_QUEUE_MASK (TASK_QUEUE_SIZE - 1)
+
+/* Used to keep atomics which are modified by different threads on separate
+ * cache lines.
+ */
+#define CACHELINE_SIZE 64
+
+/* Maximum nesting of tasks from other pools which a thread runs while waiting
+ * for its own pool. Keeps stack usage bounded when waits are nested.
+ */
+#define MAX_HELP_DEPTH 8
+
+/* Number of enclosing pools a pool remembers, nested work deeper than this is
+ * only handled by threads waiting for one of the inner pools.
+ */
+#define MAX_POOL_NESTING 8
 
 #ifndef NDEBUG
 #  define ASSERT_THREAD_ID(scheduler, thread_id)                              \
@@ -130,22 +147,65 @@ typedef struct TaskMemPoolStats {
 
 typedef struct TaskThreadLocalStorage {
 	TaskMemPool task_mempool;
-	int num_local_queue;
-	Task *local_queue[LOCALQUEUE_SIZE];
+	/* State of the random generator used to pick a victim to steal from. */
+	uint32_t steal_seed;
+	/* Scheduling counters, only modified by the thread which owns the storage. */
+	TaskSchedulerStats stats;
+	/* Number of tasks from other pools the thread is currently running from
+	 * work_and_wait(), and number of active BLI_task_isolate() calls.
+	 */
+	int help_depth;
+	int isolation;
+	/* Pool of the task the thread is running, pools created from it are nested in it. */
+	TaskPool *running_pool;
 } TaskThreadLocalStorage;
 
+/* Slot of the work-stealing queue.
+ *
+ * The pool is stored next to the task, so thieves which are only interested in
+ * tasks of a specific pool can check it without accessing the task itself, which
+ * might have been taken and freed by another thread already.
+ */
+typedef struct TaskQueueSlot {
+	Task *task;
+	TaskPool *pool;
+} TaskQueueSlot;
+
+/* Per-thread work-stealing double-ended queue (Chase-Lev).
+ *
+ * Only the thread which owns the queue pushes and pops tasks at the bottom end,
+ * so it works in a LIFO manner and keeps caches warm. Other threads steal the
+ * oldest tasks from the top end. The only synchronization point is an atomic
+ * compare-and-swap of top when thieves compete with each other or with the
+ * owner for the same task, no locks are involved.
+ *
+ * Indices are only incremented and are allowed to wrap around, so they must be
+ * compared using signed difference.
+ */
+typedef struct TaskQueue {
+	volatile uint32_t top;
+	char pad_top[CACHELINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t bottom;
+	char pad_bottom[CACHELINE_SIZE - sizeof(uint32_t)];
+	TaskQueueSlot slots[TASK_QUEUE_SIZE];
+} TaskQueue;
+
 struct TaskPool {
 	TaskScheduler *scheduler;
 
 	volatile size_t num;
 	ThreadMutex num_mutex;
 	ThreadCondition num_cond;
+	/* Number of threads sleeping in work_and_wait() for this pool, and counter
+	 * of pushed tasks used by them to detect new work without locking.
+	 */
+	volatile unsigned int num_waiters;
+	volatile unsigned int push_generation;
 
 	void *userdata;
 	ThreadMutex user_mutex;
 
 	volatile bool do_cancel;
-	volatile bool do_work;
 
 	volatile bool is_suspended;
 	ListBase suspended_queue;
@@ -157,6 +217,13 @@ struct TaskPool {
 	 */
 	bool run_in_background;
 
+	/* Pools of the tasks this pool was created from, innermost first. Threads
+	 * waiting for one of those may help with tasks of this pool. Only pointers
+	 * are compared, the pools might have been freed already.
+	 */
+	TaskPool *ancestors[MAX_POOL_NESTING];
+	int num_ancestors;
+
 	/* This is a task scheduler's ID of a thread at which pool was constructed.
 	 * It will be used to access task TLS.
 	 */
@@ -168,9 +235,7 @@ struct TaskPool {
 	 */
 	bool use_local_tls;
 	TaskThreadLocalStorage local_tls;
-#ifndef NDEBUG
 	pthread_t creator_thread_id;
-#endif
 
 #ifdef DEBUG_STATS
 	TaskMemPoolStats *mempool_stats;
@@ -183,9 +248,17 @@ struct TaskScheduler {
 	int num_threads;
 	bool background_thread_only;
 
+	/* Shared queue, used for tasks pushed from threads which are not known to
+	 * the scheduler, background pools and overflow of per-thread queues.
+	 */
 	ListBase queue;
 	ThreadMutex queue_mutex;
 	ThreadCondition queue_cond;
+	/* Number of tasks in the shared queue, only modified with queue_mutex locked. */
+	volatile int num_queued;
+
+	/* Number of worker threads waiting on queue_cond for new tasks. */
+	volatile unsigned int num_sleeping;
 
 	volatile bool do_exit;
 
@@ -197,6 +270,15 @@ typedef struct TaskThread {
 	TaskScheduler *scheduler;
 	int id;
 	TaskThreadLocalStorage tls;
+
+	/* Tasks pushed with an affinity hint for this thread. Those are not stolen by
+	 * other worker threads.
+	 */
+	ListBase affinity_queue;
+	SpinLock affinity_lock;
+	volatile int num_affinity;
+
+	TaskQueue queue;
 } TaskThread;
 
 /* Helper */
@@ -212,9 +294,11 @@ BLI_INLINE void task_data_free(Task *task, const int thread_id)
 	}
 }
 
-BLI_INLINE void initialize_task_tls(TaskThreadLocalStorage *tls)
+BLI_INLINE void initialize_task_tls(TaskThreadLocalStorage *tls, const int thread_id)
 {
 	memset(tls, 0, sizeof(TaskThreadLocalStorage));
+	/* Any non-zero seed will do, just make sure threads pick different victims. */
+	tls->steal_seed = 0x9e3779b9u * (uint32_t)(thread_id + 1);
 }
 
 BLI_INLINE TaskThreadLocalStorage *get_task_tls(TaskPool *pool,
@@ -223,15 +307,17 @@ BLI_INLINE TaskThreadLocalStorage *get_task_tls(TaskPool *pool,
 	TaskScheduler *scheduler = pool->scheduler;
 	BLI_assert(thread_id >= 0);
 	BLI_assert(thread_id <= scheduler->num_threads);
-	if (pool->use_local_tls && thread_id == 0) {
-		BLI_assert(pool->thread_id == 0);
-		BLI_assert(!BLI_thread_is_main());
-		BLI_assert(pthread_equal(pthread_self(), pool->creator_thread_id));
-		return &pool->local_tls;
-	}
 	if (thread_id == 0) {
+		/* Main thread can also handle tasks of pools created by other threads
+		 * while it is waiting, so check who we are rather than who owns the pool.
+		 */
+		if (pool->use_local_tls && pthread_equal(pthread_self(), pool->creator_thread_id)) {
+			BLI_assert(pool->thread_id == 0);
+			BLI_assert(!BLI_thread_is_main());
+			return &pool->local_tls;
+		}
 		BLI_assert(BLI_thread_is_main());
-		return &scheduler->task_threads[pool->thread_id].tls;
+		return &scheduler->task_threads[0].tls;
 	}
 	return &scheduler->task_threads[thread_id].tls;
 }
@@ -299,130 +385,441 @@ static void task_free(TaskPool *pool, Task *task, const int thread_id)
 	}
 }
 
+/* Task Queue */
+
+BLI_INLINE bool task_queue_is_empty(const TaskQueue *queue)
+{
+	return (int32_t)(queue->bottom - queue->top) <= 0;
+}
+
+/* Push task to the bottom of the queue, must only be called by the owner.
+ * Returns false if the queue is full.
+ */
+static bool task_queue_push(TaskQueue *queue, Task *task)
+{
+	const uint32_t bottom = queue->bottom;
+	if ((int32_t)(bottom - queue->top) >= TASK_QUEUE_SIZE) {
+		return false;
+	}
+	TaskQueueSlot *slot = &queue->slots[bottom & TASK_QUEUE_MASK];
+	slot->task = task;
+	slot->pool = task->pool;
+	/* Publish the slot. Atomic increment also acts as a full memory barrier,
+	 * which is required by task_scheduler_wake_one().
+	 */
+	atomic_add_and_fetch_uint32((uint32_t *)&queue->bottom, 1);
+	return true;
+}
+
+/* Pop most recently pushed task, must only be called by the owner. */
+static Task *task_queue_pop(TaskQueue *queue)
+{
+	/* Reserve the bottom slot before looking at top, thieves will not go past it. */
+	const uint32_t bottom = atomic_sub_and_fetch_uint32((uint32_t *)&queue->bottom, 1);
+	const uint32_t top = queue->top;
+	const int32_t size = (int32_t)(bottom - top);
+	Task *task;
+
+	if (size < 0) {
+		/* Queue was empty, restore bottom. */
+		queue->bottom = top;
+		return NULL;
+	}
+
+	task = queue->slots[bottom & TASK_QUEUE_MASK].task;
+	if (size == 0) {
+		/* This is the last task, race thieves for it. */
+		if (atomic_cas_uint32((uint32_t *)&queue->top, top, top + 1) != top) {
+			task = NULL;
+		}
+		queue->bottom = top + 1;
+	}
+	return task;
+}
+
+/* Steal the oldest task from the queue, can be called from any thread.
+ *
+ * If pool is not NULL only the task belonging to that pool is taken.
+ * r_contended is set when we lost a race against another thread.
+ */
+static Task *task_queue_steal(TaskQueue *queue, TaskPool *pool, bool *r_contended)
+{
+	/* Read top with a full memory barrier, so it's never newer than bottom. */
+	const uint32_t top = atomic_add_and_fetch_uint32((uint32_t *)&queue->top, 0);
+	const uint32_t bottom = queue->bottom;
+	TaskQueueSlot *slot;
+	Task *task;
+
+	if ((int32_t)(bottom - top) <= 0) {
+		return NULL;
+	}
+
+	slot = &queue->slots[top & TASK_QUEUE_MASK];
+	task = slot->task;
+	if (pool != NULL && slot->pool != pool) {
+		return NULL;
+	}
+	if (atomic_cas_uint32((uint32_t *)&queue->top, top, top + 1) != top) {
+		*r_contended = true;
+		return NULL;
+	}
+	return task;
+}
+
 /* Task Scheduler */
 
 static void task_pool_num_decrease(TaskPool *pool, size_t done)
 {
+	size_t num = pool->num;
+
+	/* Fast path: pool does not become empty, nobody is to be notified. */
+	while (num > done) {
+		const size_t prev = atomic_cas_z((size_t *)&pool->num, num, num - done);
+		if (prev == num) {
+			return;
+		}
+		num = prev;
+	}
+
+	/* Last tasks of the pool are done. This happens under the mutex, so the
+	 * waiting thread can not free the pool while we are still notifying it.
+	 */
 	BLI_mutex_lock(&pool->num_mutex);
 
 	BLI_assert(pool->num >= done);
 
-	pool->num -= done;
-
-	if (pool->num == 0)
-		BLI_condition_notify_all(&pool->num_cond);
+	atomic_sub_and_fetch_z((size_t *)&pool->num, done);
+	BLI_condition_notify_all(&pool->num_cond);
 
 	BLI_mutex_unlock(&pool->num_mutex);
 }
 
+/* Must be called before the tasks become visible to other threads. */
 static void task_pool_num_increase(TaskPool *pool, size_t new)
 {
-	BLI_mutex_lock(&pool->num_mutex);
+	atomic_add_and_fetch_z((size_t *)&pool->num, new);
+}
 
-	pool->num += new;
-	BLI_condition_notify_all(&pool->num_cond);
+/* Must be called after new tasks are visible to other threads. */
+static void task_pool_notify_push(TaskPool *pool)
+{
+	/* Atomic increment is a full memory barrier, so either the waiter sees new
+	 * generation or we see the waiter.
+	 */
+	atomic_add_and_fetch_u((unsigned int *)&pool->push_generation, 1);
+	if (pool->num_waiters != 0) {
+		BLI_mutex_lock(&pool->num_mutex);
+		BLI_condition_notify_all(&pool->num_cond);
+		BLI_mutex_unlock(&pool->num_mutex);
+	}
+}
 
-	BLI_mutex_unlock(&pool->num_mutex);
+/* Wake up a sleeping worker thread after pushing to a per-thread queue.
+ *
+ * Pushing is followed by a full memory barrier, so either we see sleeping
+ * thread here or it sees the new task before going to sleep.
+ */
+BLI_INLINE void task_scheduler_wake_one(TaskScheduler *scheduler)
+{
+	if (scheduler->num_sleeping != 0) {
+		BLI_mutex_lock(&scheduler->queue_mutex);
+		BLI_condition_notify_one(&scheduler->queue_cond);
+		BLI_mutex_unlock(&scheduler->queue_mutex);
+	}
 }
 
-static bool task_scheduler_thread_wait_pop(TaskScheduler *scheduler, Task **task)
+BLI_INLINE bool task_scheduler_task_allowed(TaskScheduler *scheduler, Task *task)
+{
+	return !scheduler->background_thread_only || task->pool->run_in_background;
+}
+
+static void task_scheduler_push_shared(TaskScheduler *scheduler, Task *task, TaskPriority priority)
 {
-	bool found_task = false;
 	BLI_mutex_lock(&scheduler->queue_mutex);
 
-	while (!scheduler->queue.first && !scheduler->do_exit)
-		BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
+	if (priority == TASK_PRIORITY_HIGH)
+		BLI_addhead(&scheduler->queue, task);
+	else
+		BLI_addtail(&scheduler->queue, task);
+	scheduler->num_queued++;
 
-	do {
-		Task *current_task;
+	BLI_condition_notify_one(&scheduler->queue_cond);
+	BLI_mutex_unlock(&scheduler->queue_mutex);
+}
 
-		/* Assuming we can only have a void queue in 'exit' case here seems logical (we should only be here after
-		 * our worker thread has been woken up from a condition_wait(), which only happens after a new task was
-		 * added to the queue), but it is wrong.
-		 * Waiting on condition may wake up the thread even if condition is not signaled (spurious wake-ups), and some
-		 * race condition may also empty the queue **after** condition has been signaled, but **before** awoken thread
-		 * reaches this point...
-		 * See http://stackoverflow.com/questions/8594591
-		 *
-		 * So we only abort here if do_exit is set.
-		 */
-		if (scheduler->do_exit) {
-			BLI_mutex_unlock(&scheduler->queue_mutex);
-			return false;
+/* Whether thread waiting for \a pool may run tasks of \a task_pool.
+ *
+ * Only tasks of the pool itself and of pools created from its tasks qualify.
+ * Those are part of the work the waiting thread is waiting for anyway, so they
+ * can't need a lock it holds without deadlocking regardless of who runs them.
+ * Background pools never have ancestors, they might be running long jobs which
+ * the waiting thread should not get stuck with.
+ */
+BLI_INLINE bool task_pool_is_nested(TaskPool *task_pool, TaskPool *pool)
+{
+	if (task_pool == pool) {
+		return true;
+	}
+	for (int i = 0; i < task_pool->num_ancestors; i++) {
+		if (task_pool->ancestors[i] == pool) {
+			return true;
 		}
+	}
+	return false;
+}
+
+/* Pop task from the shared queue.
+ *
+ * If pool is not NULL, only tasks from that pool are considered, or when helping
+ * also tasks of pools nested in it. Otherwise only tasks which the worker threads
+ * are allowed to handle.
+ */
+static Task *task_scheduler_pop_shared(TaskScheduler *scheduler,
+                                       TaskPool *pool,
+                                       const bool is_helping,
+                                       TaskSchedulerStats *stats)
+{
+	Task *task;
 
-		for (current_task = scheduler->queue.first;
-		     current_task != NULL;
-		     current_task = current_task->next)
-		{
-			TaskPool *pool = current_task->pool;
+	if (scheduler->num_queued == 0) {
+		return NULL;
+	}
 
-			if (scheduler->background_thread_only && !pool->run_in_background) {
-				continue;
-			}
+	if (!BLI_mutex_trylock(&scheduler->queue_mutex)) {
+		stats->num_shared_contended++;
+		BLI_mutex_lock(&scheduler->queue_mutex);
+	}
 
-			*task = current_task;
-			found_task = true;
-			BLI_remlink(&scheduler->queue, *task);
+	for (task = scheduler->queue.first; task; task = task->next) {
+		const bool match = (pool != NULL) ?
+		                   (is_helping ? task_pool_is_nested(task->pool, pool) : (task->pool == pool)) :
+		                   task_scheduler_task_allowed(scheduler, task);
+		if (match) {
+			BLI_remlink(&scheduler->queue, task);
+			scheduler->num_queued--;
+			stats->num_shared++;
 			break;
 		}
-		if (!found_task)
-			BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
-	} while (!found_task);
+	}
 
 	BLI_mutex_unlock(&scheduler->queue_mutex);
 
-	return true;
+	return task;
 }
 
-BLI_INLINE void handle_local_queue(TaskThreadLocalStorage *tls,
-                                   const int thread_id)
+static void task_scheduler_push_affinity(TaskScheduler *scheduler, TaskThread *thread, Task *task)
 {
-	while (tls->num_local_queue > 0) {
-		/* We pop task from queue before handling it so handler of the task can
-		 * push next job to the local queue.
-		 */
-		tls->num_local_queue--;
-		Task *local_task = tls->local_queue[tls->num_local_queue];
-		/* TODO(sergey): Double-check work_and_wait() doesn't handle other's
-		 * pool tasks.
-		 */
-		TaskPool *local_pool = local_task->pool;
-		local_task->run(local_pool, local_task->taskdata, thread_id);
-		task_free(local_pool, local_task, thread_id);
+	BLI_spin_lock(&thread->affinity_lock);
+	BLI_addtail(&thread->affinity_queue, task);
+	thread->num_affinity++;
+	BLI_spin_unlock(&thread->affinity_lock);
+
+	/* Only the given thread can pick the task up, so wake everyone. Read the
+	 * counter atomically to get a full memory barrier after publishing the task.
+	 */
+	if (atomic_add_and_fetch_u((unsigned int *)&scheduler->num_sleeping, 0) != 0) {
+		BLI_mutex_lock(&scheduler->queue_mutex);
+		BLI_condition_notify_all(&scheduler->queue_cond);
+		BLI_mutex_unlock(&scheduler->queue_mutex);
+	}
+}
+
+/* Pop task from the affinity queue of the thread, with the same pool matching
+ * as task_scheduler_pop_shared().
+ */
+static Task *task_scheduler_pop_affinity(TaskThread *thread,
+                                         TaskPool *pool,
+                                         const bool is_helping,
+                                         TaskSchedulerStats *stats)
+{
+	Task *task;
+
+	if (thread->num_affinity == 0) {
+		return NULL;
+	}
+
+	BLI_spin_lock(&thread->affinity_lock);
+	for (task = thread->affinity_queue.first; task; task = task->next) {
+		const bool match = (pool == NULL) ||
+		                   (is_helping ? task_pool_is_nested(task->pool, pool) : (task->pool == pool));
+		if (match) {
+			BLI_remlink(&thread->affinity_queue, task);
+			thread->num_affinity--;
+			stats->num_affinity++;
+			break;
+		}
+	}
+	BLI_spin_unlock(&thread->affinity_lock);
+
+	return task;
+}
+
+/* Steal a task from other threads' queues, starting from a random victim.
+ *
+ * thread_id is the thread which does the stealing, or -1 if it is not a
+ * scheduler thread.
+ */
+static Task *task_scheduler_steal(TaskScheduler *scheduler,
+                                  const int thread_id,
+                                  TaskPool *pool,
+                                  TaskThreadLocalStorage *tls)
+{
+	const int num_queues = scheduler->num_threads + 1;
+	uint32_t seed = tls->steal_seed;
+	int i, start;
+
+	/* Xorshift, good enough to spread thieves across victims. */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	tls->steal_seed = seed;
+	start = (int)(seed % (uint32_t)num_queues);
+
+	for (i = 0; i < num_queues; i++) {
+		const int victim = (start + i) % num_queues;
+		bool contended = false;
+		Task *task;
+
+		if (victim == thread_id) {
+			continue;
+		}
+
+		task = task_queue_steal(&scheduler->task_threads[victim].queue, pool, &contended);
+		if (task != NULL) {
+			tls->stats.num_stolen++;
+			return task;
+		}
+		if (contended) {
+			tls->stats.num_steal_contended++;
+		}
+	}
+
+	return NULL;
+}
+
+/* Run the task, unless its pool was canceled, and free it. */
+static void task_scheduler_run_task(Task *task, const int thread_id)
+{
+	TaskPool *pool = task->pool;
+
+	if (!pool->do_cancel) {
+		task->run(pool, task->taskdata, thread_id);
+	}
+
+	task_free(pool, task, thread_id);
+
+	/* notify pool task was done */
+	task_pool_num_decrease(pool, 1);
+}
+
+static Task *task_scheduler_thread_next_task(TaskThread *thread)
+{
+	TaskScheduler *scheduler = thread->scheduler;
+	TaskThreadLocalStorage *tls = &thread->tls;
+	Task *task;
+
+	/* Own queue first, tasks there are most likely to have data in cache. */
+	if ((task = task_queue_pop(&thread->queue)) != NULL) {
+		tls->stats.num_local++;
+		return task;
+	}
+	if ((task = task_scheduler_pop_affinity(thread, NULL, false, &tls->stats)) != NULL) {
+		return task;
+	}
+	if ((task = task_scheduler_pop_shared(scheduler, NULL, false, &tls->stats)) != NULL) {
+		return task;
+	}
+	/* Background-only thread must not pick up regular tasks, those are only
+	 * handled by the threads waiting for their pools.
+	 */
+	if (!scheduler->background_thread_only) {
+		return task_scheduler_steal(scheduler, thread->id, NULL, tls);
+	}
+	return NULL;
+}
+
+/* Check whether there is any work the thread could do, queue_mutex must be locked. */
+static bool task_scheduler_thread_has_work(TaskThread *thread)
+{
+	TaskScheduler *scheduler = thread->scheduler;
+	Task *task;
+
+	if (!task_queue_is_empty(&thread->queue) || thread->num_affinity != 0) {
+		return true;
 	}
+	for (task = scheduler->queue.first; task; task = task->next) {
+		if (task_scheduler_task_allowed(scheduler, task)) {
+			return true;
+		}
+	}
+	if (!scheduler->background_thread_only) {
+		for (int i = 0; i < scheduler->num_threads + 1; i++) {
+			if (!task_queue_is_empty(&scheduler->task_threads[i].queue)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void task_scheduler_thread_sleep(TaskThread *thread)
+{
+	TaskScheduler *scheduler = thread->scheduler;
+
+	BLI_mutex_lock(&scheduler->queue_mutex);
+
+	/* Announce ourselves before checking for work, so threads which push tasks
+	 * after the check know they have to wake us up.
+	 */
+	atomic_add_and_fetch_u((unsigned int *)&scheduler->num_sleeping, 1);
+
+	/* Spurious wake-ups are fine, the thread will look for work again. */
+	if (!scheduler->do_exit && !task_scheduler_thread_has_work(thread)) {
+		thread->tls.stats.num_sleep++;
+		BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
+	}
+
+	atomic_sub_and_fetch_u((unsigned int *)&scheduler->num_sleeping, 1);
+
+	BLI_mutex_unlock(&scheduler->queue_mutex);
 }
 
 static void *task_scheduler_thread_run(void *thread_p)
 {
 	TaskThread *thread = (TaskThread *) thread_p;
-	TaskThreadLocalStorage *tls = &thread->tls;
 	TaskScheduler *scheduler = thread->scheduler;
 	int thread_id = thread->id;
-	Task *task;
 
 	pthread_setspecific(scheduler->tls_id_key, thread);
 
 	/* keep popping off tasks */
-	while (task_scheduler_thread_wait_pop(scheduler, &task)) {
-		TaskPool *pool = task->pool;
-
-		/* run task */
-		task->run(pool, task->taskdata, thread_id);
-
-		/* delete task */
-		task_free(pool, task, thread_id);
+	while (!scheduler->do_exit) {
+		Task *task = task_scheduler_thread_next_task(thread);
 
-		/* Handle all tasks from local queue. */
-		handle_local_queue(tls, thread_id);
+		if (task == NULL) {
+			task_scheduler_thread_sleep(thread);
+			continue;
+		}
 
-		/* notify pool task was done */
-		task_pool_num_decrease(pool, 1);
+		thread->tls.running_pool = task->pool;
+		task_scheduler_run_task(task, thread_id);
+		thread->tls.running_pool = NULL;
 	}
 
 	return NULL;
 }
 
+BLI_INLINE void initialize_task_thread(TaskScheduler *scheduler, TaskThread *thread, const int thread_id)
+{
+	thread->scheduler = scheduler;
+	thread->id = thread_id;
+	initialize_task_tls(&thread->tls, thread_id);
+	BLI_listbase_clear(&thread->affinity_queue);
+	BLI_spin_init(&thread->affinity_lock);
+	thread->num_affinity = 0;
+	thread->queue.top = thread->queue.bottom = 0;
+}
+
 TaskScheduler *BLI_task_scheduler_create(int num_threads)
 {
 	TaskScheduler *scheduler = MEM_callocN(sizeof(TaskScheduler), "TaskScheduler");
@@ -452,8 +849,8 @@ TaskScheduler *BLI_task_scheduler_create(int num_threads)
 	scheduler->task_threads = MEM_mallocN(sizeof(TaskThread) * (num_threads + 1),
 	                                      "TaskScheduler task threads");
 
-	/* Initialize TLS for main thread. */
-	initialize_task_tls(&scheduler->task_threads[0].tls);
+	/* Initialize queue and TLS for main thread. */
+	initialize_task_thread(scheduler, &scheduler->task_threads[0], 0);
 
 	pthread_key_create(&scheduler->tls_id_key, NULL);
 
@@ -464,12 +861,13 @@ TaskScheduler *BLI_task_scheduler_create(int num_threads)
 		scheduler->num_threads = num_threads;
 		scheduler->threads = MEM_callocN(sizeof(pthread_t) * num_threads, "TaskScheduler threads");
 
+		/* All threads must be initialized before any of them starts stealing. */
 		for (i = 0; i < num_threads; i++) {
-			TaskThread *thread = &scheduler->task_threads[i + 1];
-			thread->scheduler = scheduler;
-			thread->id = i + 1;
-			initialize_task_tls(&thread->tls);
+			initialize_task_thread(scheduler, &scheduler->task_threads[i + 1], i + 1);
+		}
 
+		for (i = 0; i < num_threads; i++) {
+			TaskThread *thread = &scheduler->task_threads[i + 1];
 			if (pthread_create(&scheduler->threads[i], NULL, task_scheduler_thread_run, thread) != 0) {
 				fprintf(stderr, "TaskScheduler failed to launch thread %d/%d\n", i, num_threads);
 			}
@@ -506,8 +904,21 @@ void BLI_task_scheduler_free(TaskScheduler *scheduler)
 	/* Delete task thread data */
 	if (scheduler->task_threads) {
 		for (int i = 0; i < scheduler->num_threads + 1; ++i) {
-			TaskThreadLocalStorage *tls = &scheduler->task_threads[i].tls;
-			free_task_tls(tls);
+			TaskThread *thread = &scheduler->task_threads[i];
+			bool contended = false;
+
+			/* delete leftover tasks */
+			while ((task = task_queue_steal(&thread->queue, NULL, &contended)) != NULL) {
+				task_data_free(task, 0);
+				MEM_freeN(task);
+			}
+			for (task = thread->affinity_queue.first; task; task = task->next) {
+				task_data_free(task, 0);
+			}
+			BLI_freelistN(&thread->affinity_queue);
+			BLI_spin_end(&thread->affinity_lock);
+
+			free_task_tls(&thread->tls);
 		}
 
 		MEM_freeN(scheduler->task_threads);
@@ -531,24 +942,49 @@ int BLI_task_scheduler_num_threads(TaskScheduler *scheduler)
 	return scheduler->num_threads + 1;
 }
 
-static void task_scheduler_push(TaskScheduler *scheduler, Task *task, TaskPriority priority)
+/**
+ * Get scheduling statistics accumulated over all scheduler threads since the
+ * scheduler was created or stats were last reset.
+ *
+ * \note Counters are updated without synchronization, so the result is only
+ * approximate while tasks are running. Work done from threads which are not
+ * known to the scheduler is not counted.
+ */
+void BLI_task_scheduler_stats_get(TaskScheduler *scheduler, TaskSchedulerStats *r_stats)
 {
-	task_pool_num_increase(task->pool, 1);
-
-	/* add task to queue */
-	BLI_mutex_lock(&scheduler->queue_mutex);
+	memset(r_stats, 0, sizeof(*r_stats));
+	for (int i = 0; i < scheduler->num_threads + 1; i++) {
+		const TaskSchedulerStats *stats = &scheduler->task_threads[i].tls.stats;
+		r_stats->num_local += stats->num_local;
+		r_stats->num_stolen += stats->num_stolen;
+		r_stats->num_shared += stats->num_shared;
+		r_stats->num_affinity += stats->num_affinity;
+		r_stats->num_steal_contended += stats->num_steal_contended;
+		r_stats->num_shared_contended += stats->num_shared_contended;
+		r_stats->num_overflow += stats->num_overflow;
+		r_stats->num_sleep += stats->num_sleep;
+	}
+}
 
-	if (priority == TASK_PRIORITY_HIGH)
-		BLI_addhead(&scheduler->queue, task);
-	else
-		BLI_addtail(&scheduler->queue, task);
+void BLI_task_scheduler_stats_reset(TaskScheduler *scheduler)
+{
+	for (int i = 0; i < scheduler->num_threads + 1; i++) {
+		memset(&scheduler->task_threads[i].tls.stats, 0, sizeof(TaskSchedulerStats));
+	}
+}
 
-	BLI_condition_notify_one(&scheduler->queue_cond);
-	BLI_mutex_unlock(&scheduler->queue_mutex);
+/* Get scheduler thread the caller is running on, NULL if it's not known to the scheduler. */
+static TaskThread *task_scheduler_current_thread(TaskScheduler *scheduler)
+{
+	if (BLI_thread_is_main()) {
+		return &scheduler->task_threads[0];
+	}
+	return pthread_getspecific(scheduler->tls_id_key);
 }
 
 static void task_scheduler_clear(TaskScheduler *scheduler, TaskPool *pool)
 {
+	TaskThread *current_thread = task_scheduler_current_thread(scheduler);
 	Task *task, *nexttask;
 	size_t done = 0;
 
@@ -561,6 +997,7 @@ static void task_scheduler_clear(TaskScheduler *scheduler, TaskPool *pool)
 		if (task->pool == pool) {
 			task_data_free(task, pool->thread_id);
 			BLI_freelinkN(&scheduler->queue, task);
+			scheduler->num_queued--;
 
 			done++;
 		}
@@ -568,8 +1005,61 @@ static void task_scheduler_clear(TaskScheduler *scheduler, TaskPool *pool)
 
 	BLI_mutex_unlock(&scheduler->queue_mutex);
 
+	for (int i = 0; i < scheduler->num_threads + 1; i++) {
+		TaskThread *thread = &scheduler->task_threads[i];
+		bool contended = false;
+
+		BLI_spin_lock(&thread->affinity_lock);
+		for (task = thread->affinity_queue.first; task; task = nexttask) {
+			nexttask = task->next;
+
+			if (task->pool == pool) {
+				task_data_free(task, pool->thread_id);
+				BLI_freelinkN(&thread->affinity_queue, task);
+				thread->num_affinity--;
+
+				done++;
+			}
+		}
+		BLI_spin_unlock(&thread->affinity_lock);
+
+		if (thread == current_thread) {
+			/* We own this queue, so we can go through all of it and put tasks
+			 * of other pools back in their original order.
+			 */
+			ListBase other_tasks = {NULL, NULL};
+			while ((task = task_queue_pop(&thread->queue)) != NULL) {
+				if (task->pool == pool) {
+					task_data_free(task, pool->thread_id);
+					MEM_freeN(task);
+					done++;
+				}
+				else {
+					BLI_addhead(&other_tasks, task);
+				}
+			}
+			while ((task = BLI_pophead(&other_tasks)) != NULL) {
+				if (!task_queue_push(&thread->queue, task)) {
+					task_scheduler_push_shared(scheduler, task, TASK_PRIORITY_HIGH);
+				}
+			}
+		}
+		else {
+			/* Tasks of this pool hidden below tasks of other pools will be
+			 * skipped by whoever pops them, since the pool is canceled.
+			 */
+			while ((task = task_queue_steal(&thread->queue, pool, &contended)) != NULL) {
+				task_data_free(task, pool->thread_id);
+				MEM_freeN(task);
+				done++;
+			}
+		}
+	}
+
 	/* notify done */
-	task_pool_num_decrease(pool, done);
+	if (done != 0) {
+		task_pool_num_decrease(pool, done);
+	}
 }
 
 /* Task Pool */
@@ -595,12 +1085,14 @@ static TaskPool *task_pool_create_ex(TaskScheduler *scheduler,
 
 	pool->scheduler = scheduler;
 	pool->num = 0;
+	pool->num_waiters = 0;
+	pool->push_generation = 0;
 	pool->do_cancel = false;
-	pool->do_work = false;
 	pool->is_suspended = is_suspended;
 	pool->num_suspended = 0;
 	pool->suspended_queue.first = pool->suspended_queue.last = NULL;
 	pool->run_in_background = is_background;
+	pool->num_ancestors = 0;
 	pool->use_local_tls = false;
 
 	BLI_mutex_init(&pool->num_mutex);
@@ -622,16 +1114,26 @@ static TaskPool *task_pool_create_ex(TaskScheduler *scheduler,
 			 */
 			pool->thread_id = 0;
 			pool->use_local_tls = true;
-#ifndef NDEBUG
 			pool->creator_thread_id = pthread_self();
-#endif
-			initialize_task_tls(&pool->local_tls);
+			initialize_task_tls(&pool->local_tls, 0);
 		}
 		else {
 			pool->thread_id = thread->id;
 		}
 	}
 
+	/* Remember enclosing pools, so threads waiting for them can help with ours.
+	 * The running pool is alive since one of its tasks is creating us.
+	 */
+	if (!is_background && !pool->use_local_tls) {
+		TaskPool *parent = scheduler->task_threads[pool->thread_id].tls.running_pool;
+		if (parent != NULL) {
+			pool->ancestors[0] = parent;
+			pool->num_ancestors = min_ii(parent->num_ancestors + 1, MAX_POOL_NESTING);
+			memcpy(&pool->ancestors[1], parent->ancestors, sizeof(*pool->ancestors) * (pool->num_ancestors - 1));
+		}
+	}
+
 #ifdef DEBUG_STATS
 	pool->mempool_stats =
 	        MEM_callocN(sizeof(*pool->mempool_stats) * (scheduler->num_threads + 1),
@@ -717,8 +1219,9 @@ void BLI_task_pool_free(TaskPool *pool)
 static void task_pool_push(
         TaskPool *pool, TaskRunFunction run, void *taskdata,
         bool free_taskdata, TaskFreeFunction freedata, TaskPriority priority,
-        int thread_id)
+        int thread_id, int affinity)
 {
+	TaskScheduler *scheduler = pool->scheduler;
 	Task *task = task_alloc(pool, thread_id);
 
 	task->run = run;
@@ -733,45 +1236,157 @@ static void task_pool_push(
 		return;
 	}
 
-	if (thread_id != -1 &&
-	    (thread_id != pool->thread_id || pool->do_work))
+	task_pool_num_increase(pool, 1);
+
+	if (affinity != TASK_AFFINITY_NONE &&
+	    (!scheduler->background_thread_only || pool->run_in_background))
 	{
-		ASSERT_THREAD_ID(pool->scheduler, thread_id);
+		/* Main thread does not run a scheduling loop, so hints only map to worker threads. */
+		BLI_assert(affinity >= 0);
+		TaskThread *thread = &scheduler->task_threads[1 + affinity % scheduler->num_threads];
+		task_scheduler_push_affinity(scheduler, thread, task);
+	}
+	else if (thread_id != -1 &&
+	         !pool->run_in_background &&
+	         !(thread_id == 0 && pool->use_local_tls))
+	{
+		/* Pushing from a scheduler thread, keep the task in its own queue. Background
+		 * pools always go to the shared queue, since those must be handled by the
+		 * background-only thread when there are no regular worker threads.
+		 */
+		ASSERT_THREAD_ID(scheduler, thread_id);
 
-		TaskThreadLocalStorage *tls = get_task_tls(pool, thread_id);
-		if (tls->num_local_queue < LOCALQUEUE_SIZE) {
-			tls->local_queue[tls->num_local_queue] = task;
-			tls->num_local_queue++;
-			return;
+		TaskThread *thread = &scheduler->task_threads[thread_id];
+		if (task_queue_push(&thread->queue, task)) {
+			task_scheduler_wake_one(scheduler);
+		}
+		else {
+			thread->tls.stats.num_overflow++;
+			task_scheduler_push_shared(scheduler, task, priority);
 		}
 	}
+	else {
+		task_scheduler_push_shared(scheduler, task, priority);
+	}
 
-	task_scheduler_push(pool->scheduler, task, priority);
+	task_pool_notify_push(pool);
 }
 
+/**
+ * Push a task to the pool.
+ *
+ * \param affinity Optional hint, tasks pushed with the same non-negative affinity are
+ * handled by the same worker thread (as long as the pool is not waited for from
+ * another thread), which helps keeping caches warm when tasks operate on the same
+ * data. Use #TASK_AFFINITY_NONE to let the scheduler decide.
+ */
 void BLI_task_pool_push_ex(
         TaskPool *pool, TaskRunFunction run, void *taskdata,
-        bool free_taskdata, TaskFreeFunction freedata, TaskPriority priority)
+        bool free_taskdata, TaskFreeFunction freedata, TaskPriority priority, int affinity)
 {
-	task_pool_push(pool, run, taskdata, free_taskdata, freedata, priority, -1);
+	task_pool_push(pool, run, taskdata, free_taskdata, freedata, priority, -1, affinity);
 }
 
 void BLI_task_pool_push(
         TaskPool *pool, TaskRunFunction run, void *taskdata, bool free_taskdata, TaskPriority priority)
 {
-	BLI_task_pool_push_ex(pool, run, taskdata, free_taskdata, NULL, priority);
+	BLI_task_pool_push_ex(pool, run, taskdata, free_taskdata, NULL, priority, TASK_AFFINITY_NONE);
 }
 
 void BLI_task_pool_push_from_thread(TaskPool *pool, TaskRunFunction run,
         void *taskdata, bool free_taskdata, TaskPriority priority, int thread_id)
 {
-	task_pool_push(pool, run, taskdata, free_taskdata, NULL, priority, thread_id);
+	task_pool_push(pool, run, taskdata, free_taskdata, NULL, priority, thread_id, TASK_AFFINITY_NONE);
 }
 
-void BLI_task_pool_work_and_wait(TaskPool *pool)
+/* Find a task for the thread which is waiting for the given pool.
+ *
+ * Tasks of the pool itself are preferred. When there are none and \a help_nested_pools
+ * is set, scheduler threads help with pending tasks of pools nested in it instead of
+ * idling, so nested parallel loops don't leave cores unused. Threads which are not
+ * known to the scheduler only run tasks of their own pool.
+ */
+static Task *task_pool_find_task(TaskPool *pool, TaskThread *thread, TaskThreadLocalStorage *tls,
+                                 const bool help_nested_pools)
+{
+	TaskScheduler *scheduler = pool->scheduler;
+	const bool can_help = help_nested_pools &&
+	                      (thread != NULL) &&
+	                      (tls->isolation == 0) &&
+	                      (tls->help_depth < MAX_HELP_DEPTH);
+	Task *task;
+
+	if (thread != NULL) {
+		/* Tasks in our own queue were pushed by this thread, handle them as well
+		 * as long as we are allowed to.
+		 */
+		while ((task = task_queue_pop(&thread->queue)) != NULL) {
+			if (task->pool == pool) {
+				tls->stats.num_local++;
+				return task;
+			}
+			if (can_help && task_pool_is_nested(task->pool, pool)) {
+				tls->stats.num_local++;
+				return task;
+			}
+			/* Running a task from another pool could get us into deadlock, so
+			 * hand it over to the other threads via the shared queue.
+			 */
+			task_scheduler_push_shared(scheduler, task, TASK_PRIORITY_HIGH);
+		}
+		if ((task = task_scheduler_pop_affinity(thread, pool, can_help, &tls->stats)) != NULL) {
+			return task;
+		}
+	}
+
+	if ((task = task_scheduler_pop_shared(scheduler, pool, false, &tls->stats)) != NULL) {
+		return task;
+	}
+	if ((task = task_scheduler_steal(scheduler, thread ? thread->id : -1, pool, tls)) != NULL) {
+		return task;
+	}
+
+	/* Affinity is only a hint, don't wait for a busy thread to get to it. */
+	for (int i = 1; i < scheduler->num_threads + 1; i++) {
+		if ((task = task_scheduler_pop_affinity(&scheduler->task_threads[i], pool, false, &tls->stats)) != NULL) {
+			return task;
+		}
+	}
+
+	/* Nothing to do for our pool, help with nested work. In single-threaded case
+	 * other pools are only handled by threads waiting for them.
+	 */
+	if (can_help && !scheduler->background_thread_only) {
+		if ((task = task_scheduler_pop_shared(scheduler, pool, true, &tls->stats)) != NULL) {
+			return task;
+		}
+		/* Pool of a task can only be checked once it's ours, the queue slot might
+		 * be stale. Tasks which are not nested go to the shared queue.
+		 */
+		if ((task = task_scheduler_steal(scheduler, thread->id, NULL, tls)) != NULL) {
+			if (task_pool_is_nested(task->pool, pool)) {
+				return task;
+			}
+			task_scheduler_push_shared(scheduler, task, TASK_PRIORITY_HIGH);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Work and wait until all tasks of \a pool are done.
+ *
+ * With \a help_nested_pools the waiting thread also runs pending tasks of pools which
+ * were created from tasks of this one, while there is nothing left to do for the pool
+ * itself. Tasks of unrelated pools are never run, so this is safe while holding locks.
+ * Nested waits inside of #BLI_task_isolate never help other pools.
+ */
+void BLI_task_pool_work_and_wait_ex(TaskPool *pool, const bool help_nested_pools)
 {
 	TaskThreadLocalStorage *tls = get_task_tls(pool, pool->thread_id);
 	TaskScheduler *scheduler = pool->scheduler;
+	TaskThread *thread = pool->use_local_tls ? NULL : &scheduler->task_threads[pool->thread_id];
 
 	if (atomic_fetch_and_and_uint8((uint8_t *)&pool->is_suspended, 0)) {
 		if (pool->num_suspended) {
@@ -779,66 +1394,79 @@ void BLI_task_pool_work_and_wait(TaskPool *pool)
 			BLI_mutex_lock(&scheduler->queue_mutex);
 
 			BLI_movelisttolist(&scheduler->queue, &pool->suspended_queue);
+			scheduler->num_queued += (int)pool->num_suspended;
 
 			BLI_condition_notify_all(&scheduler->queue_cond);
 			BLI_mutex_unlock(&scheduler->queue_mutex);
 		}
 	}
 
-	pool->do_work = true;
-
 	ASSERT_THREAD_ID(pool->scheduler, pool->thread_id);
 
-	BLI_mutex_lock(&pool->num_mutex);
-
 	while (pool->num != 0) {
-		Task *task, *work_task = NULL;
-		bool found_task = false;
-
-		BLI_mutex_unlock(&pool->num_mutex);
-
-		BLI_mutex_lock(&scheduler->queue_mutex);
-
-		/* find task from this pool. if we get a task from another pool,
-		 * we can get into deadlock */
+		/* Remember generation before looking for work, so we don't miss tasks
+		 * which are pushed while we are looking.
+		 */
+		const unsigned int push_generation = pool->push_generation;
+		Task *task = task_pool_find_task(pool, thread, tls, help_nested_pools);
 
-		for (task = scheduler->queue.first; task; task = task->next) {
+		/* if found task, do it, otherwise wait until other tasks are done */
+		if (task != NULL) {
+			TaskPool *running_pool = tls->running_pool;
+			tls->running_pool = task->pool;
 			if (task->pool == pool) {
-				work_task = task;
-				found_task = true;
-				BLI_remlink(&scheduler->queue, task);
-				break;
+				task_scheduler_run_task(task, pool->thread_id);
 			}
+			else {
+				tls->help_depth++;
+				task_scheduler_run_task(task, pool->thread_id);
+				tls->help_depth--;
+			}
+			tls->running_pool = running_pool;
+			continue;
 		}
 
-		BLI_mutex_unlock(&scheduler->queue_mutex);
-
-		/* if found task, do it, otherwise wait until other tasks are done */
-		if (found_task) {
-			/* run task */
-			work_task->run(pool, work_task->taskdata, pool->thread_id);
-
-			/* delete task */
-			task_free(pool, task, pool->thread_id);
+		BLI_mutex_lock(&pool->num_mutex);
+		atomic_add_and_fetch_u((unsigned int *)&pool->num_waiters, 1);
+		if (pool->num != 0 && pool->push_generation == push_generation) {
+			tls->stats.num_sleep++;
+			BLI_condition_wait(&pool->num_cond, &pool->num_mutex);
+		}
+		atomic_sub_and_fetch_u((unsigned int *)&pool->num_waiters, 1);
+		BLI_mutex_unlock(&pool->num_mutex);
+	}
 
-			/* Handle all tasks from local queue. */
-			handle_local_queue(tls, pool->thread_id);
+	/* Make sure thread which finished last task is done with the pool. */
+	BLI_mutex_lock(&pool->num_mutex);
+	BLI_mutex_unlock(&pool->num_mutex);
+}
 
-			/* notify pool task was done */
-			task_pool_num_decrease(pool, 1);
-		}
+void BLI_task_pool_work_and_wait(TaskPool *pool)
+{
+	BLI_task_pool_work_and_wait_ex(pool, false);
+}
 
-		BLI_mutex_lock(&pool->num_mutex);
-		if (pool->num == 0)
-			break;
+/**
+ * Run \a func so that threads waiting for task pools inside of it only handle
+ * tasks of those pools, even when waiting with #BLI_task_pool_work_and_wait_ex.
+ *
+ * Use this to keep the waiting thread from getting stuck with long running nested
+ * tasks, e.g. while it holds a lock which other threads are waiting for.
+ */
+void BLI_task_isolate(TaskScheduler *scheduler, TaskIsolateFunction func, void *userdata)
+{
+	TaskThread *thread = task_scheduler_current_thread(scheduler);
 
-		if (!found_task)
-			BLI_condition_wait(&pool->num_cond, &pool->num_mutex);
+	/* Threads which are not known to the scheduler never help other pools. */
+	if (thread != NULL) {
+		thread->tls.isolation++;
 	}
 
-	BLI_mutex_unlock(&pool->num_mutex);
+	func(userdata);
 
-	handle_local_queue(tls, pool->thread_id);
+	if (thread != NULL) {
+		thread->tls.isolation--;
+	}
 }
 
 void BLI_task_pool_cancel(TaskPool *pool)
@@ -871,12 +1499,14 @@ ThreadMutex *BLI_task_pool_user_mutex(TaskPool *pool)
 	return &pool->user_mutex;
 }
 
+
 /* Parallel range routines */
 
 /**
  *
  * Main functions:
  * - #BLI_task_parallel_range
+ * - #BLI_task_parallel_range_reduce, #BLI_task_parallel_range_scan (deterministic reductions)
  * - #BLI_task_parallel_listbase (#ListBase - double linked list)
  *
  * TODO:
@@ -1045,7 +1675,7 @@ static void task_parallel_range_ex(
 		                               task_pool->thread_id);
 	}
 
-	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_work_and_wait_ex(task_pool, true);
 	BLI_task_pool_free(task_pool);
 
 	if (use_userdata_chunk) {
@@ -1141,6 +1771,248 @@ void BLI_task_parallel_range_finalize(
 	            use_threading, use_dynamic_scheduling);
 }
 
+/* Parallel reduce and scan routines.
+ *
+ * The range is split into chunks which only depend on the range itself, never on the
+ * number of threads, and every chunk accumulates into its own copy of the userdata
+ * chunk. Chunks are then combined in order on the calling thread, so results are the
+ * same whether threading is used or not, even for non-associative operations like
+ * floating point additions.
+ */
+
+/* Maximum number of chunks a range is split into, and minimum number of iterations in a chunk. */
+#define PARALLEL_REDUCE_MAX_CHUNKS 256
+#define PARALLEL_REDUCE_MIN_CHUNK_SIZE 32
+
+typedef struct ParallelReduceState {
+	int start, stop;
+	void *userdata;
+
+	TaskParallelRangeFuncEx func_ex;
+	/* Only set for the second pass of the scan. */
+	TaskParallelScanFunc func_scan;
+
+	/* Per-chunk copies of the userdata chunk. */
+	char *chunks;
+	size_t userdata_chunk_size;
+
+	int chunk_size;
+	int num_chunks;
+	int next_chunk;
+} ParallelReduceState;
+
+static void parallel_reduce_state_init(
+        ParallelReduceState *state,
+        int start, int stop,
+        void *userdata,
+        const size_t userdata_chunk_size,
+        TaskParallelRangeFuncEx func_ex)
+{
+	const int range = stop - start;
+
+	state->start = start;
+	state->stop = stop;
+	state->userdata = userdata;
+	state->func_ex = func_ex;
+	state->func_scan = NULL;
+	state->userdata_chunk_size = userdata_chunk_size;
+	state->chunk_size = max_ii(PARALLEL_REDUCE_MIN_CHUNK_SIZE,
+	                           (range + PARALLEL_REDUCE_MAX_CHUNKS - 1) / PARALLEL_REDUCE_MAX_CHUNKS);
+	state->num_chunks = (range + state->chunk_size - 1) / state->chunk_size;
+	state->next_chunk = 0;
+}
+
+BLI_INLINE void *parallel_reduce_chunk_get(ParallelReduceState *state, const int chunk)
+{
+	return state->chunks + state->userdata_chunk_size * (size_t)chunk;
+}
+
+static void parallel_reduce_process_chunks(ParallelReduceState *__restrict state, const int threadid)
+{
+	int chunk;
+
+	while ((chunk = (int)atomic_fetch_and_add_uint32((uint32_t *)&state->next_chunk, 1)) < state->num_chunks) {
+		void *userdata_chunk = parallel_reduce_chunk_get(state, chunk);
+		const int iter_start = state->start + chunk * state->chunk_size;
+		const int iter_stop = min_ii(iter_start + state->chunk_size, state->stop);
+		int i;
+
+		if (state->func_scan) {
+			for (i = iter_start; i < iter_stop; i++) {
+				state->func_scan(state->userdata, userdata_chunk, i);
+				state->func_ex(state->userdata, userdata_chunk, i, threadid);
+			}
+		}
+		else {
+			for (i = iter_start; i < iter_stop; i++) {
+				state->func_ex(state->userdata, userdata_chunk, i, threadid);
+			}
+		}
+	}
+}
+
+static void parallel_reduce_func(
+        TaskPool * __restrict pool,
+        void *UNUSED(taskdata),
+        int threadid)
+{
+	ParallelReduceState * __restrict state = BLI_task_pool_userdata(pool);
+	parallel_reduce_process_chunks(state, threadid);
+}
+
+/* Run func_ex (and func_scan if set) over all chunks of the range. */
+static void parallel_reduce_run(ParallelReduceState *state, const bool use_threading)
+{
+	TaskScheduler *task_scheduler;
+	TaskPool *task_pool;
+	int i, num_tasks;
+
+	state->next_chunk = 0;
+
+	if (!use_threading || state->num_chunks == 1) {
+		parallel_reduce_process_chunks(state, 0);
+		return;
+	}
+
+	task_scheduler = BLI_task_scheduler_get();
+	task_pool = BLI_task_pool_create(task_scheduler, state);
+	num_tasks = min_ii(BLI_task_scheduler_num_threads(task_scheduler) * 2, state->num_chunks);
+
+	for (i = 0; i < num_tasks; i++) {
+		/* Use this pool's pre-allocated tasks. */
+		BLI_task_pool_push_from_thread(task_pool,
+		                               parallel_reduce_func,
+		                               NULL, false,
+		                               TASK_PRIORITY_HIGH,
+		                               task_pool->thread_id);
+	}
+
+	BLI_task_pool_work_and_wait_ex(task_pool, true);
+	BLI_task_pool_free(task_pool);
+}
+
+/**
+ * This function allows to parallelize reductions over a range (sums, bounds, statistics...),
+ * with results which do not depend on the number of threads.
+ *
+ * \param start First index to process.
+ * \param stop Index to stop looping (excluded).
+ * \param userdata Common userdata passed to all instances of \a func_ex and \a func_reduce.
+ * \param userdata_chunk Identity value of the reduction (e.g. zero for a sum), each chunk of
+ *                       the range accumulates into its own copy of it. Receives the result.
+ * \param userdata_chunk_size Memory size of \a userdata_chunk.
+ * \param func_ex Callback function accumulating given iteration into the chunk.
+ * \param func_reduce Callback function combining two chunks, always called from calling thread,
+ *                    in order of the chunks.
+ * \param use_threading If \a true, actually split-execute loop in threads, else just do a sequential forloop
+ *                      (allows caller to use any kind of test to switch on parallelization or not).
+ */
+void BLI_task_parallel_range_reduce(
+        int start, int stop,
+        void *userdata,
+        void *userdata_chunk,
+        const size_t userdata_chunk_size,
+        TaskParallelRangeFuncEx func_ex,
+        TaskParallelReduceFunc func_reduce,
+        const bool use_threading)
+{
+	ParallelReduceState state;
+	size_t chunks_size;
+	int i;
+
+	BLI_assert(start <= stop);
+	BLI_assert(userdata_chunk != NULL && userdata_chunk_size != 0);
+
+	if (start >= stop) {
+		return;
+	}
+
+	parallel_reduce_state_init(&state, start, stop, userdata, userdata_chunk_size, func_ex);
+
+	chunks_size = userdata_chunk_size * (size_t)state.num_chunks;
+	state.chunks = MALLOCA(chunks_size);
+	for (i = 0; i < state.num_chunks; i++) {
+		memcpy(parallel_reduce_chunk_get(&state, i), userdata_chunk, userdata_chunk_size);
+	}
+
+	parallel_reduce_run(&state, use_threading);
+
+	for (i = 0; i < state.num_chunks; i++) {
+		func_reduce(userdata, userdata_chunk, parallel_reduce_chunk_get(&state, i));
+	}
+
+	MALLOCA_FREE(state.chunks, chunks_size);
+}
+
+/**
+ * This function allows to parallelize exclusive prefix scans over a range (offsets into packed
+ * arrays and such), with results which do not depend on the number of threads.
+ *
+ * It runs two passes over the range: first one reduces every chunk of the range like
+ * #BLI_task_parallel_range_reduce does, second one calls \a func_scan for every iteration with
+ * the reduction of all preceding iterations, and accumulates the iteration on top of it.
+ *
+ * \param userdata_chunk Identity value of the reduction, receives reduction of the whole range.
+ * \param func_ex Callback function accumulating given iteration into the chunk.
+ * \param func_reduce Callback function combining two chunks, always called from calling thread.
+ * \param func_scan Callback function getting exclusive prefix for given iteration, it must not
+ *                  modify the prefix.
+ *
+ * See #BLI_task_parallel_range_reduce for description of the other parameters.
+ */
+void BLI_task_parallel_range_scan(
+        int start, int stop,
+        void *userdata,
+        void *userdata_chunk,
+        const size_t userdata_chunk_size,
+        TaskParallelRangeFuncEx func_ex,
+        TaskParallelReduceFunc func_reduce,
+        TaskParallelScanFunc func_scan,
+        const bool use_threading)
+{
+	ParallelReduceState state;
+	size_t chunks_size;
+	void *chunk_total;
+	int i;
+
+	BLI_assert(start <= stop);
+	BLI_assert(userdata_chunk != NULL && userdata_chunk_size != 0);
+
+	if (start >= stop) {
+		return;
+	}
+
+	parallel_reduce_state_init(&state, start, stop, userdata, userdata_chunk_size, func_ex);
+
+	/* One extra chunk at the end to temporarily hold totals while turning them into prefixes. */
+	chunks_size = userdata_chunk_size * (size_t)(state.num_chunks + 1);
+	state.chunks = MALLOCA(chunks_size);
+	chunk_total = parallel_reduce_chunk_get(&state, state.num_chunks);
+	for (i = 0; i < state.num_chunks; i++) {
+		memcpy(parallel_reduce_chunk_get(&state, i), userdata_chunk, userdata_chunk_size);
+	}
+
+	/* Reduce every chunk. */
+	parallel_reduce_run(&state, use_threading);
+
+	/* Replace chunk totals with exclusive prefixes, userdata_chunk ends up with the grand total. */
+	for (i = 0; i < state.num_chunks; i++) {
+		void *chunk = parallel_reduce_chunk_get(&state, i);
+		memcpy(chunk_total, chunk, userdata_chunk_size);
+		memcpy(chunk, userdata_chunk, userdata_chunk_size);
+		func_reduce(userdata, userdata_chunk, chunk_total);
+	}
+
+	/* Scan every chunk starting from its prefix. */
+	state.func_scan = func_scan;
+	parallel_reduce_run(&state, use_threading);
+
+	MALLOCA_FREE(state.chunks, chunks_size);
+}
+
+#undef PARALLEL_REDUCE_MAX_CHUNKS
+#undef PARALLEL_REDUCE_MIN_CHUNK_SIZE
+
 #undef MALLOCA
 #undef MALLOCA_FREE
 
@@ -1252,7 +2124,7 @@ void BLI_task_parallel_listbase(
 		                               task_pool->thread_id);
 	}
 
-	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_work_and_wait_ex(task_pool, true);
 	BLI_task_pool_free(task_pool);
 
 	BLI_spin_end(&state.lock);
@@ -33,17 +33,34 @@
  *  \ingroup blenloader
  */
 
+/* Chunk contents, shared by all chunks (in any MemFile) with identical data. */
+typedef struct MemFileBuffer {
+	struct MemFileBuffer *hash_next;
+
+	/* NULL while compressed. */
+	char *buf;
+	char *buf_compressed;
+	unsigned int size, size_compressed;
+	unsigned int hash;
+
+	/* Number of chunks using this buffer, and how many of those are in uncompressed MemFiles. */
+	unsigned int users, users_uncompressed;
+} MemFileBuffer;
+
 typedef struct {
 	void *next, *prev;
 	
-	char *buf;
-	unsigned int ident, size;
+	MemFileBuffer *buffer;
+	unsigned int size;
 	
 } MemFileChunk;
 
 typedef struct MemFile {
 	ListBase chunks;
 	unsigned int size;
+	/* Buffers only used by compressed MemFiles are compressed too,
+	 * see: BLO_memfile_compress, BLO_memfile_uncompress. */
+	bool is_compressed;
 } MemFile;
 
 /* actually only used writefile.c */
@@ -52,6 +69,8 @@ extern void memfile_chunk_add(MemFile *compare, MemFile *current, const char *bu
 /* exports */
 extern void BLO_memfile_free(MemFile *memfile);
 extern void BLO_memfile_merge(MemFile *first, MemFile *second);
+extern size_t BLO_memfile_compress(MemFile *memfile);
+extern size_t BLO_memfile_uncompress(MemFile *memfile);
 
 #endif
 
@@ -0,0 +1,222 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Contributor(s): none yet.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ * map from file (old) to memory (new) addresses, used when relinking pointers
+ */
+
+/** \file blender/blenloader/intern/oldnewmap.c
+ *  \ingroup blenloader
+ *
+ * Data is written in-order, so most lookups are for the entry following the previous one
+ * ('lasthit'), the hash is only a fall-back for the others.
+ * Without it, linking big scenes degrades badly, since every miss used to be a linear search.
+ */
+
+#include <string.h>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_utildefines.h"
+
+#include "oldnewmap.h"  /* own include */
+
+#define OLDNEWMAP_ENTRIES_SIZE_DEFAULT 1024
+/* Small, since the data map is cleared after reading each ID, see: oldnewmap_clear. */
+#define OLDNEWMAP_MAP_SIZE_EXP_DEFAULT 8
+
+#define OLDNEWMAP_SLOT_EMPTY -1
+
+/* Fibonacci hashing, file addresses are aligned so the lower bits carry little information. */
+BLI_INLINE unsigned int oldnewmap_hash(const void *addr, const int map_size_exp)
+{
+	const uint64_t key = (uint64_t)(uintptr_t)addr;
+	return (unsigned int)((key * (uint64_t)0x9E3779B97F4A7C15) >> (64 - map_size_exp));
+}
+
+static void oldnewmap_map_clear(OldNewMap *onm)
+{
+	/* All bytes set gives OLDNEWMAP_SLOT_EMPTY. */
+	memset(onm->map, 0xff, sizeof(*onm->map) * ((size_t)1 << onm->map_size_exp));
+}
+
+/* Insert entry 'index', replacing an entry with the same address so the last insertion wins. */
+static void oldnewmap_map_insert(OldNewMap *onm, const int index)
+{
+	const unsigned int mask = (1u << onm->map_size_exp) - 1;
+	const void *addr = onm->entries[index].old;
+	unsigned int slot = oldnewmap_hash(addr, onm->map_size_exp);
+
+	while (true) {
+		const int i = onm->map[slot];
+		if (i == OLDNEWMAP_SLOT_EMPTY || onm->entries[i].old == addr) {
+			onm->map[slot] = index;
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void oldnewmap_map_alloc(OldNewMap *onm, const int map_size_exp)
+{
+	if (onm->map) {
+		MEM_freeN(onm->map);
+	}
+	onm->map_size_exp = map_size_exp;
+	onm->map = MEM_mallocN(sizeof(*onm->map) * ((size_t)1 << map_size_exp), "OldNewMap.map");
+	oldnewmap_map_clear(onm);
+}
+
+static void oldnewmap_map_grow(OldNewMap *onm)
+{
+	int i;
+
+	oldnewmap_map_alloc(onm, onm->map_size_exp + 1);
+
+	for (i = 0; i < onm->nentries; i++) {
+		oldnewmap_map_insert(onm, i);
+	}
+}
+
+OldNewMap *oldnewmap_new(void)
+{
+	OldNewMap *onm = MEM_callocN(sizeof(*onm), "OldNewMap");
+
+	onm->entriessize = OLDNEWMAP_ENTRIES_SIZE_DEFAULT;
+	onm->entries = MEM_mallocN(sizeof(*onm->entries) * onm->entriessize, "OldNewMap.entries");
+
+	oldnewmap_map_alloc(onm, OLDNEWMAP_MAP_SIZE_EXP_DEFAULT);
+
+	return onm;
+}
+
+/* nr is zero for data, and ID code for libdata */
+void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr)
+{
+	OldNew *entry;
+
+	if (oldaddr == NULL || newaddr == NULL) return;
+
+	if (UNLIKELY(onm->nentries == onm->entriessize)) {
+		onm->entriessize *= 2;
+		onm->entries = MEM_reallocN(onm->entries, sizeof(*onm->entries) * onm->entriessize);
+	}
+
+	entry = &onm->entries[onm->nentries];
+	entry->old = oldaddr;
+	entry->newp = newaddr;
+	entry->nr = nr;
+
+	/* Keep the load factor at most 1/2, short probe sequences matter more than memory here. */
+	if (UNLIKELY(((onm->nentries + 1) << 1) > (1 << onm->map_size_exp))) {
+		onm->nentries++;
+		oldnewmap_map_grow(onm);
+	}
+	else {
+		oldnewmap_map_insert(onm, onm->nentries++);
+	}
+}
+
+/**
+ * \return the index of the last entry inserted for \a addr, or -1 when not found.
+ */
+int oldnewmap_lookup_index(const OldNewMap *onm, const void *addr)
+{
+	const unsigned int mask = (1u << onm->map_size_exp) - 1;
+	unsigned int slot = oldnewmap_hash(addr, onm->map_size_exp);
+
+	while (true) {
+		const int i = onm->map[slot];
+		if (i == OLDNEWMAP_SLOT_EMPTY) {
+			return -1;
+		}
+		else if (onm->entries[i].old == addr) {
+			return i;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+void *oldnewmap_lookup_and_inc(OldNewMap *onm, const void *addr, bool increase_users)
+{
+	int i;
+
+	if (addr == NULL) return NULL;
+
+	if (onm->lasthit < onm->nentries - 1) {
+		OldNew *entry = &onm->entries[++onm->lasthit];
+
+		if (entry->old == addr) {
+			if (increase_users)
+				entry->nr++;
+			return entry->newp;
+		}
+	}
+
+	i = oldnewmap_lookup_index(onm, addr);
+	if (i != -1) {
+		OldNew *entry = &onm->entries[i];
+		BLI_assert(entry->old == addr);
+		onm->lasthit = i;
+		if (increase_users)
+			entry->nr++;
+		return entry->newp;
+	}
+
+	return NULL;
+}
+
+void oldnewmap_free_unused(OldNewMap *onm)
+{
+	int i;
+
+	for (i = 0; i < onm->nentries; i++) {
+		OldNew *entry = &onm->entries[i];
+		if (entry->nr == 0) {
+			MEM_freeN(entry->newp);
+			entry->newp = NULL;
+		}
+	}
+}
+
+void oldnewmap_clear(OldNewMap *onm)
+{
+	onm->nentries = 0;
+	onm->lasthit = 0;
+
+	/* Clearing is done often, don't keep paying for the largest size used so far. */
+	if (onm->map_size_exp != OLDNEWMAP_MAP_SIZE_EXP_DEFAULT) {
+		oldnewmap_map_alloc(onm, OLDNEWMAP_MAP_SIZE_EXP_DEFAULT);
+	}
+	else {
+		oldnewmap_map_clear(onm);
+	}
+}
+
+void oldnewmap_free(OldNewMap *onm)
+{
+	MEM_freeN(onm->entries);
+	MEM_freeN(onm->map);
+	MEM_freeN(onm);
+}
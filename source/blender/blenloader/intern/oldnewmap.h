@@ -0,0 +1,62 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Contributor(s): none yet.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ * map from file (old) to memory (new) addresses, used when relinking pointers
+ */
+
+/** \file blender/blenloader/intern/oldnewmap.h
+ *  \ingroup blenloader
+ */
+
+#ifndef __OLDNEWMAP_H__
+#define __OLDNEWMAP_H__
+
+typedef struct OldNew {
+	const void *old;
+	void *newp;
+	int nr;
+} OldNew;
+
+typedef struct OldNewMap {
+	/* In insertion order, which is also the order most lookups happen in. */
+	OldNew *entries;
+	int nentries, entriessize;
+	int lasthit;
+
+	/* Open addressing hash of indices into 'entries' (-1 for empty slots),
+	 * used when lookups are not in order. Size is (1 << map_size_exp). */
+	int *map;
+	int map_size_exp;
+} OldNewMap;
+
+OldNewMap *oldnewmap_new(void);
+void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr);
+int oldnewmap_lookup_index(const OldNewMap *onm, const void *addr);
+void *oldnewmap_lookup_and_inc(OldNewMap *onm, const void *addr, bool increase_users);
+void oldnewmap_free_unused(OldNewMap *onm);
+void oldnewmap_clear(OldNewMap *onm);
+void oldnewmap_free(OldNewMap *onm);
+
+#endif  /* __OLDNEWMAP_H__ */
@@ -45,6 +45,8 @@
 #include "BLI_utildefines.h"
 #ifndef WIN32
 #  include <unistd.h> // for read close
+#  include <sys/mman.h> // for mmap
+#  include <signal.h> // for sigaction
 #else
 #  include <io.h> // for open close read
 #  include "winsock2.h"
@@ -109,6 +111,7 @@
 #include "BLI_math.h"
 #include "BLI_threads.h"
 #include "BLI_mempool.h"
+#include "BLI_task.h"
 
 #include "BLT_translation.h"
 
@@ -159,6 +162,7 @@
 #include "RE_engine.h"
 
 #include "readfile.h"
+#include "oldnewmap.h"
 
 
 #include <errno.h>
@@ -219,21 +223,16 @@
 /* Use GHash for restoring pointers by name */
 #define USE_GHASH_RESTORE_POINTER
 
-/***/
-
-typedef struct OldNew {
-	const void *old;
-	void *newp;
-	int nr;
-} OldNew;
+/* Map uncompressed files into memory and leave DATA blocks there until they are needed,
+ * so blocks which are skipped (linking, skip flags) are never read at all,
+ * and the others are copied once, straight into their final allocation. */
+#ifndef WIN32
+#  define USE_BHEAD_READ_ON_DEMAND
+#endif
 
-typedef struct OldNewMap {
-	OldNew *entries;
-	int nentries, entriessize;
-	bool sorted;
-	int lasthit;
-} OldNewMap;
+#define BHEADN_FROM_BHEAD(bh) ((BHeadN *)POINTER_OFFSET(bh, -offsetof(BHeadN, bhead)))
 
+/***/
 
 /* local prototypes */
 static void *read_struct(FileData *fd, BHead *bh, const char *blockname);
@@ -274,195 +273,33 @@ static const char *library_parent_filepath(Library *lib)
 	return lib->parent ? lib->parent->filepath : "<direct>";
 }
 
-static OldNewMap *oldnewmap_new(void) 
-{
-	OldNewMap *onm= MEM_callocN(sizeof(*onm), "OldNewMap");
-	
-	onm->entriessize = 1024;
-	onm->entries = MEM_mallocN(sizeof(*onm->entries)*onm->entriessize, "OldNewMap.entries");
-	
-	return onm;
-}
-
-static int verg_oldnewmap(const void *v1, const void *v2)
-{
-	const struct OldNew *x1=v1, *x2=v2;
-	
-	if (x1->old > x2->old) return 1;
-	else if (x1->old < x2->old) return -1;
-	return 0;
-}
-
-
-static void oldnewmap_sort(FileData *fd) 
-{
-	BLI_assert(fd->libmap->sorted == false);
-	qsort(fd->libmap->entries, fd->libmap->nentries, sizeof(OldNew), verg_oldnewmap);
-	fd->libmap->sorted = 1;
-}
-
-/* nr is zero for data, and ID code for libdata */
-static void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr)
-{
-	OldNew *entry;
-	
-	if (oldaddr==NULL || newaddr==NULL) return;
-	
-	if (UNLIKELY(onm->nentries == onm->entriessize)) {
-		onm->entriessize *= 2;
-		onm->entries = MEM_reallocN(onm->entries, sizeof(*onm->entries) * onm->entriessize);
-	}
-
-	entry = &onm->entries[onm->nentries++];
-	entry->old = oldaddr;
-	entry->newp = newaddr;
-	entry->nr = nr;
-}
-
 void blo_do_versions_oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr)
 {
 	oldnewmap_insert(onm, oldaddr, newaddr, nr);
 }
 
-/**
- * Do a full search (no state).
- *
- * \param lasthit: Use as a reference position to avoid a full search
- * from either end of the array, giving more efficient lookups.
- *
- * \note This would seem an ideal case for hash or btree lookups.
- * However the data is written in-order, using the \a lasthit will normally avoid calling this function.
- * Creating a btree/hash structure adds overhead for the common-case to optimize the corner-case
- * (since most entries will never be retrieved).
- * So just keep full lookups as a fall-back.
- */
-static int oldnewmap_lookup_entry_full(const OldNewMap *onm, const void *addr, int lasthit)
+/* for libdata, nr has ID code, no increment */
+static void *oldnewmap_liblookup(OldNewMap *onm, const void *addr, const void *lib)
 {
-	const int nentries = onm->nentries;
-	const OldNew *entries = onm->entries;
 	int i;
 
-	/* search relative to lasthit where possible */
-	if (lasthit >= 0 && lasthit < nentries) {
-
-		/* search forwards */
-		i = lasthit;
-		while (++i != nentries) {
-			if (entries[i].old == addr) {
-				return i;
-			}
-		}
-
-		/* search backwards */
-		i = lasthit + 1;
-		while (i--) {
-			if (entries[i].old == addr) {
-				return i;
-			}
-		}
-	}
-	else {
-		/* search backwards (full) */
-		i = nentries;
-		while (i--) {
-			if (entries[i].old == addr) {
-				return i;
-			}
-		}
+	if (addr == NULL) {
+		return NULL;
 	}
 
-	return -1;
-}
-
-static void *oldnewmap_lookup_and_inc(OldNewMap *onm, const void *addr, bool increase_users)
-{
-	int i;
-	
-	if (addr == NULL) return NULL;
-	
-	if (onm->lasthit < onm->nentries-1) {
-		OldNew *entry = &onm->entries[++onm->lasthit];
-		
-		if (entry->old == addr) {
-			if (increase_users)
-				entry->nr++;
-			return entry->newp;
-		}
-	}
-	
-	i = oldnewmap_lookup_entry_full(onm, addr, onm->lasthit);
+	i = oldnewmap_lookup_index(onm, addr);
 	if (i != -1) {
 		OldNew *entry = &onm->entries[i];
+		ID *id = entry->newp;
 		BLI_assert(entry->old == addr);
-		onm->lasthit = i;
-		if (increase_users)
-			entry->nr++;
-		return entry->newp;
-	}
-	
-	return NULL;
-}
-
-/* for libdata, nr has ID code, no increment */
-static void *oldnewmap_liblookup(OldNewMap *onm, const void *addr, const void *lib)
-{
-	if (addr == NULL) {
-		return NULL;
-	}
-
-	/* lasthit works fine for non-libdata, linking there is done in same sequence as writing */
-	if (onm->sorted) {
-		const OldNew entry_s = {.old = addr};
-		OldNew *entry = bsearch(&entry_s, onm->entries, onm->nentries, sizeof(OldNew), verg_oldnewmap);
-		if (entry) {
-			ID *id = entry->newp;
-
-			if (id && (!lib || id->lib)) {
-				return id;
-			}
-		}
-	}
-	else {
-		/* note, this can be a bottle neck when loading some files */
-		const int i = oldnewmap_lookup_entry_full(onm, addr, -1);
-		if (i != -1) {
-			OldNew *entry = &onm->entries[i];
-			ID *id = entry->newp;
-			BLI_assert(entry->old == addr);
-			if (id && (!lib || id->lib)) {
-				return id;
-			}
+		if (id && (!lib || id->lib)) {
+			return id;
 		}
 	}
 
 	return NULL;
 }
 
-static void oldnewmap_free_unused(OldNewMap *onm) 
-{
-	int i;
-
-	for (i = 0; i < onm->nentries; i++) {
-		OldNew *entry = &onm->entries[i];
-		if (entry->nr == 0) {
-			MEM_freeN(entry->newp);
-			entry->newp = NULL;
-		}
-	}
-}
-
-static void oldnewmap_clear(OldNewMap *onm) 
-{
-	onm->nentries = 0;
-	onm->lasthit = 0;
-}
-
-static void oldnewmap_free(OldNewMap *onm) 
-{
-	MEM_freeN(onm->entries);
-	MEM_freeN(onm);
-}
-
 /***/
 
 static void read_libraries(FileData *basefd, ListBase *mainlist);
@@ -787,10 +624,33 @@ static BHeadN *get_bhead(FileData *fd)
 			/* bhead now contains the (converted) bhead structure. Now read
 			 * the associated data and put everything in a BHeadN (creative naming !)
 			 */
-			if (!fd->eof) {
+			if (fd->eof) {
+				/* pass */
+			}
+#ifdef USE_BHEAD_READ_ON_DEMAND
+			else if ((fd->flags & FD_FLAGS_USE_MMAP) &&
+			         !(fd->flags & FD_FLAGS_SWITCH_ENDIAN) &&
+			         (bhead.code == DATA))
+			{
+				/* Mapped data is read-only, endian switching needs a copy. */
+				if (bhead.len <= fd->buffersize - fd->seek) {
+					new_bhead = MEM_mallocN(sizeof(BHeadN), "new_bhead");
+					new_bhead->next = new_bhead->prev = NULL;
+					new_bhead->data = fd->buffer + fd->seek;
+					new_bhead->bhead = bhead;
+
+					fd->seek += bhead.len;
+				}
+				else {
+					fd->eof = 1;
+				}
+			}
+#endif
+			else {
 				new_bhead = MEM_mallocN(sizeof(BHeadN) + bhead.len, "new_bhead");
 				if (new_bhead) {
 					new_bhead->next = new_bhead->prev = NULL;
+					new_bhead->data = NULL;
 					new_bhead->bhead = bhead;
 					
 					readsize = fd->read(fd, new_bhead + 1, bhead.len);
@@ -840,7 +700,7 @@ BHead *blo_firstbhead(FileData *fd)
 
 BHead *blo_prevbhead(FileData *UNUSED(fd), BHead *thisblock)
 {
-	BHeadN *bheadn = (BHeadN *)POINTER_OFFSET(thisblock, -offsetof(BHeadN, bhead));
+	BHeadN *bheadn = BHEADN_FROM_BHEAD(thisblock);
 	BHeadN *prev = bheadn->prev;
 	
 	return (prev) ? &prev->bhead : NULL;
@@ -854,7 +714,7 @@ BHead *blo_nextbhead(FileData *fd, BHead *thisblock)
 	if (thisblock) {
 		/* bhead is actually a sub part of BHeadN
 		 * We calculate the BHeadN pointer from the BHead pointer below */
-		new_bhead = (BHeadN *)POINTER_OFFSET(thisblock, -offsetof(BHeadN, bhead));
+		new_bhead = BHEADN_FROM_BHEAD(thisblock);
 		
 		/* get the next BHeadN. If it doesn't exist we read in the next one */
 		new_bhead = new_bhead->next;
@@ -872,6 +732,17 @@ BHead *blo_nextbhead(FileData *fd, BHead *thisblock)
 	return(bhead);
 }
 
+/**
+ * Data following \a bhead in the file. May point into the mapped file, so it must not be modified
+ * and is only valid as long as the #FileData is open.
+ */
+const void *blo_bhead_data(const BHead *bhead)
+{
+	const BHeadN *bheadn = (const BHeadN *)POINTER_OFFSET(bhead, -offsetof(BHeadN, bhead));
+
+	return bheadn->data ? bheadn->data : (const void *)(bhead + 1);
+}
+
 /* Warning! Caller's responsability to ensure given bhead **is** and ID one! */
 const char *bhead_id_name(const FileData *fd, const BHead *bhead)
 {
@@ -1071,7 +942,7 @@ static int fd_read_from_memfile(FileData *filedata, void *buffer, unsigned int s
 			if (chunkoffset+readsize > chunk->size)
 				readsize= chunk->size-chunkoffset;
 			
-			memcpy(POINTER_OFFSET(buffer, totread), chunk->buf + chunkoffset, readsize);
+			memcpy(POINTER_OFFSET(buffer, totread), chunk->buffer->buf + chunkoffset, readsize);
 			totread += readsize;
 			filedata->seek += readsize;
 			seek += readsize;
@@ -1122,11 +993,195 @@ static FileData *blo_decode_and_check(FileData *fd, ReportList *reports)
 	return fd;
 }
 
+#ifdef USE_BHEAD_READ_ON_DEMAND
+
+/* Reading from a mapped file raises SIGBUS when the file can't be read anymore, e.g. when it was
+ * truncated or replaced on a network share. The handler replaces the mapping with zeroes so the
+ * read can continue, and flags the file, so the error is reported instead of crashing.
+ * Files beyond the maximum are read as a stream. */
+#define MMAP_MAX_FILES 64
+
+static FileData *volatile mmap_files[MMAP_MAX_FILES];
+static ThreadMutex mmap_files_lock = BLI_MUTEX_INITIALIZER;
+static struct sigaction mmap_sigbus_prev;
+static bool mmap_sigbus_installed = false;
+
+static void mmap_sigbus_handler(int sig, siginfo_t *siginfo, void *context)
+{
+	const char *error_addr = siginfo->si_addr;
+
+	for (int i = 0; i < MMAP_MAX_FILES; i++) {
+		FileData *fd = mmap_files[i];
+
+		if (fd && error_addr >= fd->buffer && error_addr < fd->buffer + fd->buffersize) {
+			fd->mmap_io_error = true;
+
+			if (mmap((void *)fd->buffer, (size_t)fd->buffersize, PROT_READ,
+			         MAP_FIXED | MAP_PRIVATE | MAP_ANON, -1, 0) != MAP_FAILED)
+			{
+				return;
+			}
+			break;
+		}
+	}
+
+	/* Not one of our files, let the previous handler deal with it. */
+	if (mmap_sigbus_prev.sa_flags & SA_SIGINFO) {
+		mmap_sigbus_prev.sa_sigaction(sig, siginfo, context);
+	}
+	else if (mmap_sigbus_prev.sa_handler != SIG_DFL && mmap_sigbus_prev.sa_handler != SIG_IGN) {
+		mmap_sigbus_prev.sa_handler(sig);
+	}
+	else {
+		signal(SIGBUS, SIG_DFL);
+		raise(SIGBUS);
+	}
+}
+
+static bool mmap_file_register(FileData *fd)
+{
+	bool registered = false;
+
+	BLI_mutex_lock(&mmap_files_lock);
+
+	if (!mmap_sigbus_installed) {
+		struct sigaction action = {{0}};
+		action.sa_sigaction = mmap_sigbus_handler;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		mmap_sigbus_installed = (sigaction(SIGBUS, &action, &mmap_sigbus_prev) == 0);
+	}
+
+	if (mmap_sigbus_installed) {
+		for (int i = 0; i < MMAP_MAX_FILES; i++) {
+			if (mmap_files[i] == NULL) {
+				mmap_files[i] = fd;
+				registered = true;
+				break;
+			}
+		}
+	}
+
+	BLI_mutex_unlock(&mmap_files_lock);
+
+	return registered;
+}
+
+static void mmap_file_unregister(FileData *fd)
+{
+	BLI_mutex_lock(&mmap_files_lock);
+
+	for (int i = 0; i < MMAP_MAX_FILES; i++) {
+		if (mmap_files[i] == fd) {
+			mmap_files[i] = NULL;
+			break;
+		}
+	}
+
+	BLI_mutex_unlock(&mmap_files_lock);
+}
+
+/**
+ * Report when reading the mapped file failed, only once per file.
+ * Not thread safe, only call from the thread driving the reading.
+ */
+static bool blo_mmap_check_io_error(FileData *fd)
+{
+	if (LIKELY(!fd->mmap_io_error)) {
+		return false;
+	}
+	if (!(fd->flags & FD_FLAGS_MMAP_ERROR_REPORTED)) {
+		fd->flags |= FD_FLAGS_MMAP_ERROR_REPORTED;
+		blo_reportf_wrap(fd->reports, RPT_ERROR,
+		                 TIP_("Failed to read blend file '%s', the file was changed or became unavailable while reading"),
+		                 fd->relabase);
+	}
+	return true;
+}
+
+static int fd_read_from_mmap(FileData *filedata, void *buffer, unsigned int size)
+{
+	int readsize = fd_read_from_memory(filedata, buffer, size);
+
+	/* A failed read returns zeroes, stop reading the file then. */
+	if (blo_mmap_check_io_error(filedata)) {
+		return 0;
+	}
+
+	return readsize;
+}
+
+/**
+ * Map uncompressed files into memory, see: USE_BHEAD_READ_ON_DEMAND.
+ * Returns NULL for compressed files or when the file can't be mapped,
+ * these are read as a stream instead.
+ */
+static FileData *blo_openblenderfile_mmap(const char *filepath)
+{
+	FileData *fd;
+	unsigned char header[2];
+	size_t size;
+	void *mem;
+	int file;
+
+	file = BLI_open(filepath, O_BINARY | O_RDONLY, 0);
+	if (file == -1) {
+		return NULL;
+	}
+
+	/* 'FileData.seek' is an int, larger files are streamed. */
+	size = BLI_file_descriptor_size(file);
+	if ((size == (size_t)-1) || (size < SIZEOFBLENDERHEADER) || (size > INT_MAX) ||
+	    (read(file, header, sizeof(header)) != sizeof(header)) ||
+	    (header[0] == 0x1f && header[1] == 0x8b))
+	{
+		close(file);
+		return NULL;
+	}
+
+	/* The mapping stays valid after closing the file. */
+	mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (mem == MAP_FAILED) {
+		return NULL;
+	}
+
+	fd = filedata_new();
+	fd->buffer = mem;
+	fd->buffersize = (int)size;
+	fd->read = fd_read_from_mmap;
+	fd->flags |= FD_FLAGS_USE_MMAP;
+
+	if (!mmap_file_register(fd)) {
+		munmap(mem, size);
+		fd->buffer = NULL;
+		blo_freefiledata(fd);
+		return NULL;
+	}
+
+	return fd;
+}
+#endif
+
 /* cannot be called with relative paths anymore! */
 /* on each new library added, it now checks for the current FileData and expands relativeness */
 FileData *blo_openblenderfile(const char *filepath, ReportList *reports)
 {
 	gzFile gzfile;
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+	{
+		FileData *fd = blo_openblenderfile_mmap(filepath);
+		if (fd) {
+			/* needed for library_append and read_libraries */
+			BLI_strncpy(fd->relabase, filepath, sizeof(fd->relabase));
+
+			return blo_decode_and_check(fd, reports);
+		}
+	}
+#endif
+
 	errno = 0;
 	gzfile = BLI_gzopen(filepath, "rb");
 	
@@ -1278,6 +1333,14 @@ void blo_freefiledata(FileData *fd)
 			}
 		}
 		
+#ifdef USE_BHEAD_READ_ON_DEMAND
+		if ((fd->flags & FD_FLAGS_USE_MMAP) && fd->buffer) {
+			mmap_file_unregister(fd);
+			munmap((void *)fd->buffer, (size_t)fd->buffersize);
+			fd->buffer = NULL;
+		}
+#endif
+
 		if (fd->buffer && !(fd->flags & FD_FLAGS_NOT_MY_BUFFER)) {
 			MEM_freeN((void *)fd->buffer);
 			fd->buffer = NULL;
@@ -1541,9 +1604,6 @@ static void change_idid_adr_fd(FileData *fd, const void *old, void *new)
 {
 	int i;
 	
-	/* use a binary search if we have a sorted libmap, for now it's not needed. */
-	BLI_assert(fd->libmap->sorted == false);
-
 	for (i = 0; i < fd->libmap->nentries; i++) {
 		OldNew *entry = &fd->libmap->entries[i];
 		
@@ -1863,6 +1923,8 @@ static void switch_endian_structs(const struct SDNA *filesdna, BHead *bhead)
 	int blocksize, nblocks;
 	char *data;
 	
+	/* Blocks are only read on demand without endian switching. */
+	BLI_assert(BHEADN_FROM_BHEAD(bhead)->data == NULL);
 	data = (char *)(bhead+1);
 	blocksize = filesdna->typelens[ filesdna->structs[bhead->SDNAnr][0] ];
 	
@@ -1879,20 +1941,42 @@ static void *read_struct(FileData *fd, BHead *bh, const char *blockname)
 	void *temp = NULL;
 	
 	if (bh->len) {
+		const void *data = blo_bhead_data(bh);
+
 		/* switch is based on file dna */
 		if (bh->SDNAnr && (fd->flags & FD_FLAGS_SWITCH_ENDIAN))
 			switch_endian_structs(fd->filesdna, bh);
 		
 		if (fd->compflags[bh->SDNAnr] != SDNA_CMP_REMOVED) {
 			if (fd->compflags[bh->SDNAnr] == SDNA_CMP_NOT_EQUAL) {
-				temp = DNA_struct_reconstruct(fd->memsdna, fd->filesdna, fd->compflags, bh->SDNAnr, bh->nr, (bh+1));
+				void *data_aligned = NULL;
+
+				/* Data in the mapped file is only 4 byte aligned, reconstruct from an aligned copy. */
+				if (UNLIKELY((uintptr_t)data & 7)) {
+					data = data_aligned = MEM_mallocN(bh->len, __func__);
+					memcpy(data_aligned, blo_bhead_data(bh), bh->len);
+				}
+
+				temp = DNA_struct_reconstruct(fd->memsdna, fd->filesdna, fd->compflags, bh->SDNAnr, bh->nr, data);
+
+				if (data_aligned) {
+					MEM_freeN(data_aligned);
+				}
 			}
 			else {
 				/* SDNA_CMP_EQUAL */
 				temp = MEM_mallocN(bh->len, blockname);
-				memcpy(temp, (bh+1), bh->len);
+				memcpy(temp, data, bh->len);
 			}
 		}
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+		/* Data read from a mapping which failed is zeroed, don't use it. */
+		if (UNLIKELY(fd->mmap_io_error) && temp && BHEADN_FROM_BHEAD(bh)->data) {
+			MEM_freeN(temp);
+			temp = NULL;
+		}
+#endif
 	}
 
 	return temp;
@@ -8097,10 +8181,82 @@ static const char *dataname(short id_code)
 	
 }
 
+/* Reconstruct data blocks of an ID on worker threads once they are larger than this in total. */
+#define READ_DATA_PARALLEL_MIN_SIZE (1 << 18)  /* 256kb */
+
+typedef struct ReadDataParallelData {
+	FileData *fd;
+	BHead **bheads;
+	void **data;
+	const char *allocname;
+} ReadDataParallelData;
+
+static void read_data_parallel_cb(void *userdata, const int i)
+{
+	ReadDataParallelData *data = userdata;
+
+	/* Only reads the file DNA and the block itself (endian switching is per block),
+	 * so blocks are independent. */
+	data->data[i] = read_struct(data->fd, data->bheads[i], data->allocname);
+}
+
+/**
+ * Reconstruct all blocks first and fill the old-new map afterwards, in file order,
+ * so lookups behave exactly as when reading one block at a time.
+ * Returns false when the blocks are too small to be worth threading.
+ */
+static bool read_data_into_oldnewmap_parallel(FileData *fd, BHead *bhead_first, const char *allocname)
+{
+	ReadDataParallelData data;
+	BHead *bhead;
+	size_t size = 0;
+	int tot = 0, i;
+
+	/* Reading the file is sequential, this also loads all blocks of the ID when streaming. */
+	for (bhead = bhead_first; bhead && bhead->code == DATA; bhead = blo_nextbhead(fd, bhead)) {
+		size += (size_t)bhead->len;
+		tot++;
+	}
+
+	if (tot < 2 || size < READ_DATA_PARALLEL_MIN_SIZE) {
+		return false;
+	}
+
+	data.fd = fd;
+	data.bheads = MEM_mallocN(sizeof(*data.bheads) * tot, __func__);
+	data.data = MEM_mallocN(sizeof(*data.data) * tot, __func__);
+	data.allocname = allocname;
+
+	for (bhead = bhead_first, i = 0; i < tot; bhead = blo_nextbhead(fd, bhead), i++) {
+		data.bheads[i] = bhead;
+	}
+
+	BLI_task_parallel_range(0, tot, &data, read_data_parallel_cb, true);
+
+	for (i = 0; i < tot; i++) {
+		if (data.data[i]) {
+			oldnewmap_insert(fd->datamap, data.bheads[i]->old, data.data[i], 0);
+		}
+	}
+
+	MEM_freeN(data.bheads);
+	MEM_freeN(data.data);
+
+	return true;
+}
+
 static BHead *read_data_into_oldnewmap(FileData *fd, BHead *bhead, const char *allocname)
 {
 	bhead = blo_nextbhead(fd, bhead);
 	
+	if (bhead && read_data_into_oldnewmap_parallel(fd, bhead, allocname)) {
+		/* All blocks have been read, skip to the next non-data block. */
+		while (bhead && bhead->code == DATA) {
+			bhead = blo_nextbhead(fd, bhead);
+		}
+		return bhead;
+	}
+	
 	while (bhead && bhead->code==DATA) {
 		void *data;
 #if 0
@@ -8505,8 +8661,6 @@ static void do_versions_after_linking(Main *main)
 
 static void lib_link_all(FileData *fd, Main *main)
 {
-	oldnewmap_sort(fd);
-	
 	/* No load UI for undo memfiles */
 	if (fd->memfile == NULL) {
 		lib_link_windowmanager(fd, main);
@@ -8733,6 +8887,10 @@ BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
 	fix_relpaths_library(fd->relabase, bfd->main); /* make all relative paths, relative to the open blend file */
 	
 	link_global(fd, bfd);	/* as last */
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+	blo_mmap_check_io_error(fd);
+#endif
 	
 	fd->mainlist = NULL;  /* Safety, this is local variable, shall not be used afterward. */
 
@@ -10584,6 +10742,12 @@ static void read_libraries(FileData *basefd, ListBase *mainlist)
 					}
 				}
 				BLO_expand_main(fd, mainptr);
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+				if (fd) {
+					blo_mmap_check_io_error(fd);
+				}
+#endif
 			}
 			
 			mainptr = mainptr->next;
@@ -55,6 +55,8 @@ typedef struct FileData {
 
 	// variables needed for reading from memory / stream
 	const char *buffer;
+	/* Set by the SIGBUS handler when the mapped file couldn't be read, see: USE_BHEAD_READ_ON_DEMAND. */
+	volatile int mmap_io_error;
 	// variables needed for reading from memfile (undo)
 	struct MemFile *memfile;
 
@@ -109,6 +111,9 @@ typedef struct FileData {
 
 typedef struct BHeadN {
 	struct BHeadN *next, *prev;
+	/* When set, block data was not copied and lives in the mapped file,
+	 * otherwise it directly follows the BHeadN, see: blo_bhead_data(). */
+	const void *data;
 	struct BHead bhead;
 } BHeadN;
 
@@ -120,6 +125,8 @@ enum {
 	FD_FLAGS_FILE_OK               = 1 << 3,
 	FD_FLAGS_NOT_MY_BUFFER         = 1 << 4,
 	FD_FLAGS_NOT_MY_LIBMAP         = 1 << 5,  /* XXX Unused in practice (checked once but never set). */
+	FD_FLAGS_USE_MMAP              = 1 << 6,  /* buffer is the mapped file, see: USE_BHEAD_READ_ON_DEMAND */
+	FD_FLAGS_MMAP_ERROR_REPORTED   = 1 << 7,
 };
 
 #define SIZEOFBLENDERHEADER 12
@@ -153,6 +160,7 @@ BHead *blo_nextbhead(FileData *fd, BHead *thisblock);
 BHead *blo_prevbhead(FileData *fd, BHead *thisblock);
 
 const char *bhead_id_name(const FileData *fd, const BHead *bhead);
+const void *blo_bhead_data(const BHead *bhead);
 
 /* do versions stuff */
 
@@ -35,59 +35,295 @@
 #include <stdio.h>
 #include <math.h>
 
+#include "zlib.h"
+
 #include "MEM_guardedalloc.h"
 
 #include "DNA_listBase.h"
 
+#include "BLI_utildefines.h"
 #include "BLI_blenlib.h"
+#include "BLI_ghash.h"
+#include "BLI_hash_mm2a.h"
+#include "BLI_task.h"
 
 #include "BLO_undofile.h"
 
 /* **************** support for memory-write, for undo buffers *************** */
 
+/* Buffers of all MemFiles by content hash, so identical chunks are stored once for the whole
+ * undo stack, not only when they are at the same position in the previous step.
+ * Compressed buffers are not shared with new steps, see: memfile_buffer_find.
+ * Values are lists of buffers with the same hash, linked by MemFileBuffer.hash_next. */
+static GHash *memfile_buffer_hash = NULL;
+
+/* Buffers smaller than this are not worth compressing. */
+#define MEMFILE_BUFFER_COMPRESS_MIN_SIZE 256
+
+static MemFileBuffer *memfile_buffer_new(const char *buf, unsigned int size, unsigned int hash)
+{
+	MemFileBuffer *buffer = MEM_callocN(sizeof(MemFileBuffer), "MemFileBuffer");
+	void **val_p;
+
+	buffer->buf = MEM_mallocN(size, "Chunk buffer");
+	memcpy(buffer->buf, buf, size);
+	buffer->size = size;
+	buffer->hash = hash;
+
+	if (memfile_buffer_hash == NULL) {
+		memfile_buffer_hash = BLI_ghash_int_new(__func__);
+	}
+	if (!BLI_ghash_ensure_p(memfile_buffer_hash, SET_UINT_IN_POINTER(hash), &val_p)) {
+		*val_p = NULL;
+	}
+	buffer->hash_next = *val_p;
+	*val_p = buffer;
+
+	return buffer;
+}
+
+static void memfile_buffer_free(MemFileBuffer *buffer)
+{
+	void **val_p = BLI_ghash_lookup_p(memfile_buffer_hash, SET_UINT_IN_POINTER(buffer->hash));
+	MemFileBuffer **buffer_p = (MemFileBuffer **)val_p;
+
+	while (*buffer_p != buffer) {
+		buffer_p = &(*buffer_p)->hash_next;
+	}
+	*buffer_p = buffer->hash_next;
+
+	if (*val_p == NULL) {
+		BLI_ghash_remove(memfile_buffer_hash, SET_UINT_IN_POINTER(buffer->hash), NULL, NULL);
+		if (BLI_ghash_size(memfile_buffer_hash) == 0) {
+			BLI_ghash_free(memfile_buffer_hash, NULL, NULL);
+			memfile_buffer_hash = NULL;
+		}
+	}
+
+	MEM_SAFE_FREE(buffer->buf);
+	MEM_SAFE_FREE(buffer->buf_compressed);
+	MEM_freeN(buffer);
+}
+
+static void memfile_buffer_compress(MemFileBuffer *buffer)
+{
+	uLongf size_compressed = compressBound(buffer->size);
+	char *buf_compressed = MEM_mallocN(size_compressed, "Chunk buffer compressed");
+
+	/* Keep incompressible data as is. */
+	if ((compress2((Bytef *)buf_compressed, &size_compressed,
+	               (const Bytef *)buffer->buf, buffer->size, 1) != Z_OK) ||
+	    (size_compressed >= buffer->size))
+	{
+		MEM_freeN(buf_compressed);
+		return;
+	}
+
+	buffer->buf_compressed = MEM_reallocN(buf_compressed, size_compressed);
+	buffer->size_compressed = (unsigned int)size_compressed;
+	MEM_freeN(buffer->buf);
+	buffer->buf = NULL;
+}
+
+static char *memfile_buffer_uncompress_data(const MemFileBuffer *buffer)
+{
+	char *buf = MEM_mallocN(buffer->size, "Chunk buffer");
+	uLongf size = buffer->size;
+	const int ok = uncompress((Bytef *)buf, &size, (const Bytef *)buffer->buf_compressed, buffer->size_compressed);
+
+	BLI_assert(ok == Z_OK && size == buffer->size);
+	UNUSED_VARS_NDEBUG(ok);
+
+	return buf;
+}
+
+static void memfile_buffer_uncompress(MemFileBuffer *buffer)
+{
+	buffer->buf = memfile_buffer_uncompress_data(buffer);
+	MEM_freeN(buffer->buf_compressed);
+	buffer->buf_compressed = NULL;
+	buffer->size_compressed = 0;
+}
+
+static MemFileBuffer *memfile_buffer_find(const char *buf, unsigned int size, unsigned int hash)
+{
+	MemFileBuffer *buffer;
+
+	if (memfile_buffer_hash == NULL) {
+		return NULL;
+	}
+
+	for (buffer = BLI_ghash_lookup(memfile_buffer_hash, SET_UINT_IN_POINTER(hash));
+	     buffer;
+	     buffer = buffer->hash_next)
+	{
+		/* Buffers only used by compressed steps are left alone, uncompressing them here would
+		 * grow the steps which own them without their undo size knowing about it.
+		 * The current step gets its own copy instead. */
+		if ((buffer->size != size) || (buffer->buf == NULL)) {
+			continue;
+		}
+		if (memcmp(buffer->buf, buf, size) == 0) {
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+static void memfile_buffer_compress_cb(void *userdata, const int i)
+{
+	MemFileBuffer **buffers = userdata;
+	memfile_buffer_compress(buffers[i]);
+}
+
+static void memfile_buffer_uncompress_cb(void *userdata, const int i)
+{
+	MemFileBuffer **buffers = userdata;
+	memfile_buffer_uncompress(buffers[i]);
+}
+
+/* Returns true when the buffer is only used by compressed memfiles anymore. */
+static bool memfile_buffer_user_remove_uncompressed(MemFileBuffer *buffer)
+{
+	return ((--buffer->users_uncompressed == 0) &&
+	        (buffer->buf != NULL) &&
+	        (buffer->size >= MEMFILE_BUFFER_COMPRESS_MIN_SIZE));
+}
+
+/* Compress buffers collected by memfile_buffer_user_remove_uncompressed, returns the bytes saved. */
+static size_t memfile_buffers_compress(MemFileBuffer **buffers, const int tot)
+{
+	size_t size_saved = 0;
+	int i;
+
+	BLI_task_parallel_range(0, tot, buffers, memfile_buffer_compress_cb, tot > 1);
+
+	for (i = 0; i < tot; i++) {
+		if (buffers[i]->buf == NULL) {
+			size_saved += buffers[i]->size - buffers[i]->size_compressed;
+		}
+	}
+
+	return size_saved;
+}
+
 /* not memfile itself */
 void BLO_memfile_free(MemFile *memfile)
 {
 	MemFileChunk *chunk;
+	MemFileBuffer **buffers = NULL;
+	int tot = 0;
+
+	if (!memfile->is_compressed) {
+		/* Buffers still used by compressed memfiles only, compress them now. */
+		buffers = MEM_mallocN(sizeof(*buffers) * BLI_listbase_count(&memfile->chunks), __func__);
+	}
 	
 	while ((chunk = BLI_pophead(&memfile->chunks))) {
-		if (chunk->ident == 0)
-			MEM_freeN(chunk->buf);
+		MemFileBuffer *buffer = chunk->buffer;
+		if (buffers && memfile_buffer_user_remove_uncompressed(buffer) && (buffer->users > 1)) {
+			buffers[tot++] = buffer;
+		}
+		if (--buffer->users == 0) {
+			memfile_buffer_free(buffer);
+		}
 		MEM_freeN(chunk);
 	}
+
+	if (buffers) {
+		memfile_buffers_compress(buffers, tot);
+		MEM_freeN(buffers);
+	}
+
 	memfile->size = 0;
+	memfile->is_compressed = false;
 }
 
 /* to keep list of memfiles consistent, 'first' is always first in list */
 /* result is that 'first' is being freed */
-void BLO_memfile_merge(MemFile *first, MemFile *second)
+void BLO_memfile_merge(MemFile *first, MemFile *UNUSED(second))
 {
-	MemFileChunk *fc, *sc;
-	
-	fc = first->chunks.first;
-	sc = second->chunks.first;
-	while (fc || sc) {
-		if (fc && sc) {
-			if (sc->ident) {
-				sc->ident = 0;
-				fc->ident = 1;
-			}
+	/* Buffers are reference counted, nothing to hand over to 'second'. */
+	BLO_memfile_free(first);
+}
+
+/**
+ * Compress all buffers of \a memfile which are not used by any uncompressed memfile,
+ * meant for undo steps which are unlikely to be read soon.
+ *
+ * \return the number of bytes saved.
+ */
+size_t BLO_memfile_compress(MemFile *memfile)
+{
+	MemFileChunk *chunk;
+	MemFileBuffer **buffers;
+	size_t size_saved;
+	int tot = 0;
+
+	if (memfile->is_compressed) {
+		return 0;
+	}
+	memfile->is_compressed = true;
+
+	buffers = MEM_mallocN(sizeof(*buffers) * BLI_listbase_count(&memfile->chunks), __func__);
+
+	for (chunk = memfile->chunks.first; chunk; chunk = chunk->next) {
+		if (memfile_buffer_user_remove_uncompressed(chunk->buffer)) {
+			buffers[tot++] = chunk->buffer;
 		}
-		if (fc) fc = fc->next;
-		if (sc) sc = sc->next;
 	}
-	
-	BLO_memfile_free(first);
+
+	size_saved = memfile_buffers_compress(buffers, tot);
+
+	MEM_freeN(buffers);
+
+	return size_saved;
+}
+
+/**
+ * Uncompress \a memfile, this must be done before reading it.
+ *
+ * \return the number of bytes restored, the counterpart of #BLO_memfile_compress.
+ */
+size_t BLO_memfile_uncompress(MemFile *memfile)
+{
+	MemFileChunk *chunk;
+	MemFileBuffer **buffers;
+	size_t size_restored = 0;
+	int tot = 0;
+
+	if (!memfile->is_compressed) {
+		return 0;
+	}
+	memfile->is_compressed = false;
+
+	buffers = MEM_mallocN(sizeof(*buffers) * BLI_listbase_count(&memfile->chunks), __func__);
+
+	for (chunk = memfile->chunks.first; chunk; chunk = chunk->next) {
+		MemFileBuffer *buffer = chunk->buffer;
+		if ((buffer->users_uncompressed++ == 0) && (buffer->buf == NULL)) {
+			size_restored += buffer->size - buffer->size_compressed;
+			buffers[tot++] = buffer;
+		}
+	}
+
+	BLI_task_parallel_range(0, tot, buffers, memfile_buffer_uncompress_cb, tot > 1);
+
+	MEM_freeN(buffers);
+
+	return size_restored;
 }
 
 void memfile_chunk_add(MemFile *compare, MemFile *current, const char *buf, unsigned int size)
 {
 	static MemFileChunk *compchunk = NULL;
 	MemFileChunk *curchunk;
+	MemFileBuffer *buffer = NULL;
 	
 	/* this function inits when compare != NULL or when current == NULL  */
 	if (compare) {
-		compchunk = compare->chunks.first;
+		compchunk = compare->is_compressed ? NULL : compare->chunks.first;
 		return;
 	}
 	if (current == NULL) {
@@ -95,28 +331,33 @@ void memfile_chunk_add(MemFile *compare, MemFile *current, const char *buf, unsi
 		return;
 	}
 	
+	BLI_assert(!current->is_compressed);
+
 	curchunk = MEM_mallocN(sizeof(MemFileChunk), "MemFileChunk");
 	curchunk->size = size;
-	curchunk->buf = NULL;
-	curchunk->ident = 0;
 	BLI_addtail(&current->chunks, curchunk);
 	
-	/* we compare compchunk with buf */
+	/* we compare compchunk with buf, which avoids hashing when nothing changed */
 	if (compchunk) {
-		if (compchunk->size == curchunk->size) {
-			if (memcmp(compchunk->buf, buf, size) == 0) {
-				curchunk->buf = compchunk->buf;
-				curchunk->ident = 1;
+		if (compchunk->size == size) {
+			if (memcmp(compchunk->buffer->buf, buf, size) == 0) {
+				buffer = compchunk->buffer;
 			}
 		}
 		compchunk = compchunk->next;
 	}
 	
-	/* not equal... */
-	if (curchunk->buf == NULL) {
-		curchunk->buf = MEM_mallocN(size, "Chunk buffer");
-		memcpy(curchunk->buf, buf, size);
-		current->size += size;
+	/* not equal, look for the same data anywhere in the undo stack */
+	if (buffer == NULL) {
+		const unsigned int hash = BLI_hash_mm2((const unsigned char *)buf, size, 0);
+		buffer = memfile_buffer_find(buf, size, hash);
+		if (buffer == NULL) {
+			buffer = memfile_buffer_new(buf, size, hash);
+			current->size += size;
+		}
 	}
-}
 
+	buffer->users++;
+	buffer->users_uncompressed++;
+	curchunk->buffer = buffer;
+}
@@ -154,6 +154,7 @@
 #include "BLI_blenlib.h"
 #include "BLI_linklist.h"
 #include "BLI_mempool.h"
+#include "BLI_task.h"
 
 #include "BKE_action.h"
 #include "BKE_blender_version.h"
@@ -203,6 +204,7 @@
 typedef enum {
 	WW_WRAP_NONE = 1,
 	WW_WRAP_ZLIB,
+	WW_WRAP_ZLIB_THREADED,
 } eWriteWrapType;
 
 typedef struct WriteWrap WriteWrap;
@@ -216,6 +218,7 @@ struct WriteWrap {
 	union {
 		int file_handle;
 		gzFile gz_handle;
+		struct ZlibThreaded *zlib_threaded;
 	} _user_data;
 };
 
@@ -275,6 +278,252 @@ static size_t ww_write_zlib(WriteWrap *ww, const char *buf, size_t buf_len)
 }
 #undef FILE_HANDLE
 
+/* zlib, threaded
+ *
+ * Data is split into blocks which are compressed on worker threads as separate
+ * gzip members, and written out in order. A sequence of gzip members is a valid
+ * gzip stream, so the file reads back through gzread() like a regular
+ * compressed file. */
+
+#define WW_ZLIB_BLOCK_SIZE (1 << 20)  /* 1mb */
+
+typedef enum eZlibBlockState {
+	ZLIB_BLOCK_PENDING = 0,
+	ZLIB_BLOCK_RUNNING,
+	ZLIB_BLOCK_DONE,
+} eZlibBlockState;
+
+typedef struct ZlibBlock {
+	struct ZlibBlock *next, *prev;
+
+	char *in;
+	size_t in_len;
+	char *out;
+	size_t out_len;
+
+	/* Protected by ZlibThreaded.mutex. */
+	eZlibBlockState state;
+	bool error;
+} ZlibBlock;
+
+typedef struct ZlibThreaded {
+	int file_handle;
+	TaskPool *task_pool;
+
+	/* Block being filled. */
+	ZlibBlock *current;
+	/* Blocks pushed for compression, in file order. */
+	ListBase blocks;
+	int num_blocks, max_blocks;
+	/* Blocks already written, kept until the pool finished since tasks still reference them. */
+	ListBase blocks_written;
+
+	ThreadMutex mutex;
+	ThreadCondition cond;
+
+	bool error;
+} ZlibThreaded;
+
+#define ZLIB_THREADED(ww) \
+	(ww)->_user_data.zlib_threaded
+
+static void ww_zlib_block_compress(ZlibBlock *block)
+{
+	z_stream strm = {NULL};
+
+	/* Adding 16 to the window bits writes a gzip header and trailer,
+	 * use level 1 to match 'ww_open_zlib'. */
+	if (deflateInit2(&strm, 1, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		block->error = true;
+		return;
+	}
+
+	const size_t out_size = deflateBound(&strm, (uLong)block->in_len);
+	block->out = MEM_mallocN(out_size, __func__);
+
+	strm.next_in = (Bytef *)block->in;
+	strm.avail_in = (uInt)block->in_len;
+	strm.next_out = (Bytef *)block->out;
+	strm.avail_out = (uInt)out_size;
+
+	if (deflate(&strm, Z_FINISH) == Z_STREAM_END) {
+		block->out_len = strm.total_out;
+	}
+	else {
+		block->error = true;
+	}
+	deflateEnd(&strm);
+
+	MEM_freeN(block->in);
+	block->in = NULL;
+}
+
+static void ww_zlib_block_compress_task(TaskPool *__restrict pool, void *taskdata, int UNUSED(threadid))
+{
+	ZlibThreaded *zt = BLI_task_pool_userdata(pool);
+	ZlibBlock *block = taskdata;
+	bool claimed = false;
+
+	BLI_mutex_lock(&zt->mutex);
+	if (block->state == ZLIB_BLOCK_PENDING) {
+		block->state = ZLIB_BLOCK_RUNNING;
+		claimed = true;
+	}
+	BLI_mutex_unlock(&zt->mutex);
+
+	/* Writing thread may have compressed the block itself already. */
+	if (!claimed) {
+		return;
+	}
+
+	ww_zlib_block_compress(block);
+
+	BLI_mutex_lock(&zt->mutex);
+	block->state = ZLIB_BLOCK_DONE;
+	BLI_condition_notify_all(&zt->cond);
+	BLI_mutex_unlock(&zt->mutex);
+}
+
+/* Write out compressed blocks in order. Unless 'wait_all' is set only finished
+ * blocks are written, waiting just as long as too many blocks are in flight. */
+static void ww_zlib_threaded_write_blocks(ZlibThreaded *zt, const bool wait_all)
+{
+	ZlibBlock *block;
+
+	while ((block = zt->blocks.first) != NULL) {
+		const bool wait = wait_all || (zt->num_blocks > zt->max_blocks);
+		bool compress = false, done;
+
+		BLI_mutex_lock(&zt->mutex);
+		if (wait) {
+			if (block->state == ZLIB_BLOCK_PENDING) {
+				/* Not picked up yet, compress it here rather than waiting for a worker. */
+				block->state = ZLIB_BLOCK_RUNNING;
+				compress = true;
+			}
+			else {
+				while (block->state != ZLIB_BLOCK_DONE) {
+					BLI_condition_wait(&zt->cond, &zt->mutex);
+				}
+			}
+		}
+		done = (block->state == ZLIB_BLOCK_DONE);
+		BLI_mutex_unlock(&zt->mutex);
+
+		if (compress) {
+			ww_zlib_block_compress(block);
+		}
+		else if (!done) {
+			break;
+		}
+
+		if (block->error) {
+			zt->error = true;
+		}
+		else if (!zt->error) {
+			if (write(zt->file_handle, block->out, block->out_len) != (ssize_t)block->out_len) {
+				zt->error = true;
+			}
+		}
+
+		MEM_SAFE_FREE(block->in);
+		MEM_SAFE_FREE(block->out);
+
+		BLI_remlink(&zt->blocks, block);
+		BLI_addtail(&zt->blocks_written, block);
+		zt->num_blocks--;
+	}
+}
+
+static void ww_zlib_threaded_push_block(ZlibThreaded *zt)
+{
+	ZlibBlock *block = zt->current;
+
+	zt->current = NULL;
+	BLI_addtail(&zt->blocks, block);
+	zt->num_blocks++;
+
+	BLI_task_pool_push(zt->task_pool, ww_zlib_block_compress_task, block, false, TASK_PRIORITY_HIGH);
+
+	ww_zlib_threaded_write_blocks(zt, false);
+}
+
+static bool ww_open_zlib_threaded(WriteWrap *ww, const char *filepath)
+{
+	TaskScheduler *scheduler = BLI_task_scheduler_get();
+	ZlibThreaded *zt;
+	int file;
+
+	file = BLI_open(filepath, O_BINARY + O_WRONLY + O_CREAT + O_TRUNC, 0666);
+
+	if (file == -1) {
+		return false;
+	}
+
+	zt = MEM_callocN(sizeof(*zt), __func__);
+	zt->file_handle = file;
+	zt->task_pool = BLI_task_pool_create(scheduler, zt);
+	/* Bound memory use, while keeping all threads busy. */
+	zt->max_blocks = 2 * BLI_task_scheduler_num_threads(scheduler);
+	BLI_mutex_init(&zt->mutex);
+	BLI_condition_init(&zt->cond);
+
+	ZLIB_THREADED(ww) = zt;
+	return true;
+}
+static bool ww_close_zlib_threaded(WriteWrap *ww)
+{
+	ZlibThreaded *zt = ZLIB_THREADED(ww);
+	bool ok;
+
+	if (zt->current) {
+		ww_zlib_threaded_push_block(zt);
+	}
+	ww_zlib_threaded_write_blocks(zt, true);
+
+	BLI_task_pool_work_and_wait(zt->task_pool);
+	BLI_task_pool_free(zt->task_pool);
+	BLI_freelistN(&zt->blocks_written);
+
+	BLI_condition_end(&zt->cond);
+	BLI_mutex_end(&zt->mutex);
+
+	ok = (close(zt->file_handle) != -1) && !zt->error;
+
+	MEM_freeN(zt);
+	ZLIB_THREADED(ww) = NULL;
+
+	return ok;
+}
+static size_t ww_write_zlib_threaded(WriteWrap *ww, const char *buf, size_t buf_len)
+{
+	ZlibThreaded *zt = ZLIB_THREADED(ww);
+	size_t written = 0;
+
+	while (written < buf_len) {
+		ZlibBlock *block = zt->current;
+		size_t len;
+
+		if (block == NULL) {
+			block = zt->current = MEM_callocN(sizeof(*block), __func__);
+			block->in = MEM_mallocN(WW_ZLIB_BLOCK_SIZE, __func__);
+		}
+
+		len = MIN2(buf_len - written, WW_ZLIB_BLOCK_SIZE - block->in_len);
+		memcpy(block->in + block->in_len, buf + written, len);
+		block->in_len += len;
+		written += len;
+
+		if (block->in_len == WW_ZLIB_BLOCK_SIZE) {
+			ww_zlib_threaded_push_block(zt);
+		}
+	}
+
+	/* Report errors from earlier blocks as a short write. */
+	return zt->error ? 0 : buf_len;
+}
+#undef ZLIB_THREADED
+
 /* --- end compression types --- */
 
 static void ww_handle_init(eWriteWrapType ww_type, WriteWrap *r_ww)
@@ -289,6 +538,13 @@ static void ww_handle_init(eWriteWrapType ww_type, WriteWrap *r_ww)
 			r_ww->write = ww_write_zlib;
 			break;
 		}
+		case WW_WRAP_ZLIB_THREADED:
+		{
+			r_ww->open  = ww_open_zlib_threaded;
+			r_ww->close = ww_close_zlib_threaded;
+			r_ww->write = ww_write_zlib_threaded;
+			break;
+		}
 		default:
 		{
 			r_ww->open  = ww_open_none;
@@ -4064,7 +4320,13 @@ bool BLO_write_file(
 	BLI_snprintf(tempname, sizeof(tempname), "%s@", filepath);
 
 	if (write_flags & G_FILE_COMPRESS) {
-		ww_type = WW_WRAP_ZLIB;
+		/* Compress on worker threads when there are any, single stream otherwise. */
+		if (BLI_task_scheduler_num_threads(BLI_task_scheduler_get()) > 1) {
+			ww_type = WW_WRAP_ZLIB_THREADED;
+		}
+		else {
+			ww_type = WW_WRAP_ZLIB;
+		}
 	}
 	else {
 		ww_type = WW_WRAP_NONE;
@@ -4113,9 +4375,12 @@ bool BLO_write_file(
 	}
 
 	/* actual file writing */
-	const bool err = write_file_handle(mainvar, &ww, NULL, NULL, write_flags, thumb);
+	bool err = write_file_handle(mainvar, &ww, NULL, NULL, write_flags, thumb);
 
-	ww.close(&ww);
+	/* Threaded compression may only detect write errors when closing. */
+	if (ww.close(&ww) == false) {
+		err = true;
+	}
 
 	if (UNLIKELY(path_list_backup)) {
 		BKE_bpath_list_restore(mainvar, path_list_flag, path_list_backup);
@@ -690,6 +690,7 @@ void draw_smoke_volume(SmokeDomainSettings *sds, Object *ob,
 
 		float start_co[3];
 
+#ifdef WITH_SMOKE
 		switch (sds->vdb->numeric_display) {
 			case MOD_OVDB_NUM_DENSITY:
 				field[0] = smoke_get_density(sds->fluid);
@@ -708,6 +709,7 @@ void draw_smoke_volume(SmokeDomainSettings *sds, Object *ob,
 			default:
 				break;
 		}
+#endif
 
 		if (field[0]) {
 			for (int i = 0; i < 3; i++) {
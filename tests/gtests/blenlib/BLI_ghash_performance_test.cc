@@ -534,3 +534,119 @@ TEST(ghash, MultiRandIntMurmur2a200000)
 
 	multi_small_ghash_tests(ghash, "MultiSmall RandIntGHash - Murmur2a - 200000", 200000);
 }
+
+
+/* Chaining vs. open addressing: pointer keys (as most GHash usages), random access. */
+
+static void layout_ghash_tests(GHash *ghash, const char *id, const unsigned int nbr)
+{
+	printf("\n========== STARTING %s ==========\n", id);
+
+	RNG *rng = BLI_rng_new(0);
+	uintptr_t *keys = (uintptr_t *)MEM_mallocN(sizeof(*keys) * nbr, __func__);
+	uintptr_t key = 0x10000000;
+
+	/* Aligned, increasing addresses, with varying strides like allocated data-blocks. */
+	for (unsigned int i = 0; i < nbr; i++) {
+		keys[i] = key;
+		key += 16 * (1 + BLI_rng_get_uint(rng) % 64);
+	}
+	BLI_array_randomize(keys, sizeof(*keys), nbr, 1);
+
+	{
+		TIMEIT_START(layout_insert);
+
+		for (unsigned int i = 0; i < nbr; i++) {
+			BLI_ghash_insert(ghash, (void *)keys[i], SET_UINT_IN_POINTER(i));
+		}
+
+		TIMEIT_END(layout_insert);
+	}
+
+	PRINTF_GHASH_STATS(ghash);
+
+	{
+		TIMEIT_START(layout_lookup);
+
+		for (unsigned int i = nbr; i--; ) {
+			void *v = BLI_ghash_lookup(ghash, (void *)keys[i]);
+			EXPECT_EQ(GET_UINT_FROM_POINTER(v), i);
+		}
+
+		TIMEIT_END(layout_lookup);
+	}
+
+	{
+		TIMEIT_START(layout_lookup_miss);
+
+		for (unsigned int i = nbr; i--; ) {
+			EXPECT_FALSE(BLI_ghash_haskey(ghash, (void *)(keys[i] + 8)));
+		}
+
+		TIMEIT_END(layout_lookup_miss);
+	}
+
+	{
+		GHashIterator gh_iter;
+		uint64_t sum = 0;
+
+		TIMEIT_START(layout_iterate);
+
+		GHASH_ITER (gh_iter, ghash) {
+			sum += GET_UINT_FROM_POINTER(BLI_ghashIterator_getValue(&gh_iter));
+		}
+
+		TIMEIT_END(layout_iterate);
+
+		EXPECT_EQ(sum, (uint64_t)nbr * (nbr - 1) / 2);
+	}
+
+	{
+		TIMEIT_START(layout_remove);
+
+		for (unsigned int i = nbr; i--; ) {
+			EXPECT_TRUE(BLI_ghash_remove(ghash, (void *)keys[i], NULL, NULL));
+		}
+
+		TIMEIT_END(layout_remove);
+	}
+	EXPECT_EQ(BLI_ghash_size(ghash), 0);
+
+	BLI_ghash_free(ghash, NULL, NULL);
+	MEM_freeN(keys);
+	BLI_rng_free(rng);
+
+	printf("========== ENDED %s ==========\n\n", id);
+}
+
+TEST(ghash, LayoutChaining1000000)
+{
+	GHash *ghash = BLI_ghash_ptr_new(__func__);
+
+	layout_ghash_tests(ghash, "Layout PtrGHash - Chaining - 1000000", 1000000);
+}
+
+TEST(ghash, LayoutOpenAddressing1000000)
+{
+	GHash *ghash = BLI_ghash_ptr_new(__func__);
+	BLI_ghash_flag_set(ghash, GHASH_FLAG_OPEN_ADDRESSING);
+
+	layout_ghash_tests(ghash, "Layout PtrGHash - Open Addressing - 1000000", 1000000);
+}
+
+#ifdef GHASH_RUN_BIG
+TEST(ghash, LayoutChaining20000000)
+{
+	GHash *ghash = BLI_ghash_ptr_new(__func__);
+
+	layout_ghash_tests(ghash, "Layout PtrGHash - Chaining - 20000000", 20000000);
+}
+
+TEST(ghash, LayoutOpenAddressing20000000)
+{
+	GHash *ghash = BLI_ghash_ptr_new(__func__);
+	BLI_ghash_flag_set(ghash, GHASH_FLAG_OPEN_ADDRESSING);
+
+	layout_ghash_tests(ghash, "Layout PtrGHash - Open Addressing - 20000000", 20000000);
+}
+#endif
@@ -198,3 +198,69 @@ TEST(ghash, Pop)
 
 	BLI_ghash_free(ghash, NULL, NULL);
 }
+
+/* Open addressing: same checks as above, with interleaved removals and layout changes. */
+TEST(ghash, OpenAddressing)
+{
+	GHash *ghash = BLI_ghash_new(BLI_ghashutil_inthash_p, BLI_ghashutil_intcmp, __func__);
+	GHash *ghash_copy;
+	GHashIterator gh_iter;
+	unsigned int keys[TESTCASE_SIZE], *k;
+	int i, bkt_size;
+
+	BLI_ghash_flag_set(ghash, GHASH_FLAG_OPEN_ADDRESSING | GHASH_FLAG_ALLOW_SHRINK);
+	init_keys(keys, 40);
+
+	for (i = TESTCASE_SIZE, k = keys; i--; k++) {
+		BLI_ghash_insert(ghash, SET_UINT_IN_POINTER(*k), SET_UINT_IN_POINTER(*k));
+	}
+	EXPECT_EQ(BLI_ghash_size(ghash), TESTCASE_SIZE);
+	bkt_size = BLI_ghash_buckets_size(ghash);
+
+	/* Remove every other key, removals shift entries back in their probe sequence. */
+	for (i = 0; i < TESTCASE_SIZE; i += 2) {
+		EXPECT_TRUE(BLI_ghash_remove(ghash, SET_UINT_IN_POINTER(keys[i]), NULL, NULL));
+	}
+	for (i = 0; i < TESTCASE_SIZE; i++) {
+		EXPECT_EQ(BLI_ghash_haskey(ghash, SET_UINT_IN_POINTER(keys[i])), (i % 2) != 0);
+	}
+
+	/* Both layouts must keep the same content when switching. */
+	BLI_ghash_flag_clear(ghash, GHASH_FLAG_OPEN_ADDRESSING);
+	EXPECT_EQ(BLI_ghash_size(ghash), TESTCASE_SIZE / 2);
+	for (i = 1; i < TESTCASE_SIZE; i += 2) {
+		EXPECT_EQ(GET_UINT_FROM_POINTER(BLI_ghash_lookup(ghash, SET_UINT_IN_POINTER(keys[i]))), keys[i]);
+	}
+	BLI_ghash_flag_set(ghash, GHASH_FLAG_OPEN_ADDRESSING);
+
+	i = 0;
+	GHASH_ITER (gh_iter, ghash) {
+		EXPECT_EQ(BLI_ghashIterator_getKey(&gh_iter), BLI_ghashIterator_getValue(&gh_iter));
+		i++;
+	}
+	EXPECT_EQ(i, TESTCASE_SIZE / 2);
+
+	ghash_copy = BLI_ghash_copy(ghash, NULL, NULL);
+	EXPECT_EQ(BLI_ghash_buckets_size(ghash_copy), BLI_ghash_buckets_size(ghash));
+
+	for (i = 1; i < TESTCASE_SIZE; i += 2) {
+		void *v = BLI_ghash_popkey(ghash_copy, SET_UINT_IN_POINTER(keys[i]), NULL);
+		EXPECT_EQ(GET_UINT_FROM_POINTER(v), keys[i]);
+	}
+	EXPECT_EQ(BLI_ghash_size(ghash_copy), 0);
+	EXPECT_LT(BLI_ghash_buckets_size(ghash_copy), bkt_size);
+
+	{
+		GHashIterState pop_state = {0};
+		void *k, *v;
+		i = 0;
+		while (BLI_ghash_pop(ghash, &pop_state, &k, &v)) {
+			EXPECT_EQ(k, v);
+			i++;
+		}
+		EXPECT_EQ(i, TESTCASE_SIZE / 2);
+	}
+
+	BLI_ghash_free(ghash, NULL, NULL);
+	BLI_ghash_free(ghash_copy, NULL, NULL);
+}
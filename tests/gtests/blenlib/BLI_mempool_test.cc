@@ -0,0 +1,105 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <algorithm>
+#include <string.h>
+
+extern "C" {
+#include "BLI_utildefines.h"
+#include "BLI_mempool.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
+
+#include "MEM_guardedalloc.h"
+};
+
+#define NUM_THREADS 4
+#define NUM_ELEMS 100000
+
+typedef struct MempoolTestElem {
+	int index;
+	int pad;
+} MempoolTestElem;
+
+typedef struct MempoolTestData {
+	BLI_mempool *pool;
+	MempoolTestElem **elems;
+} MempoolTestData;
+
+static void mempool_test_alloc_func(void *userdata, const int iter)
+{
+	MempoolTestData *data = (MempoolTestData *)userdata;
+	MempoolTestElem *elem = (MempoolTestElem *)BLI_mempool_alloc(data->pool);
+	elem->index = iter;
+	data->elems[iter] = elem;
+}
+
+static void mempool_test_free_func(void *userdata, const int iter)
+{
+	/* Free in reverse order, so most elements are freed by another thread than the one allocating them. */
+	MempoolTestData *data = (MempoolTestData *)userdata;
+	MempoolTestElem *elem = data->elems[NUM_ELEMS - 1 - iter];
+	EXPECT_EQ(NUM_ELEMS - 1 - iter, elem->index);
+	BLI_mempool_free(data->pool, elem);
+}
+
+TEST(mempool, ThreadsafeIter)
+{
+	BLI_mempool *pool = BLI_mempool_create(sizeof(MempoolTestElem), 0, 512,
+	                                       BLI_MEMPOOL_THREADSAFE | BLI_MEMPOOL_ALLOW_ITER);
+	MempoolTestElem *elems[1000];
+	BLI_mempool_iter iter;
+	MempoolTestElem *elem;
+	int tot = 0;
+
+	for (int i = 0; i < 1000; i++) {
+		elems[i] = (MempoolTestElem *)BLI_mempool_alloc(pool);
+		elems[i]->index = i;
+	}
+	for (int i = 0; i < 1000; i += 2) {
+		BLI_mempool_free(pool, elems[i]);
+	}
+	EXPECT_EQ(500, BLI_mempool_count(pool));
+
+	BLI_mempool_iternew(pool, &iter);
+	while ((elem = (MempoolTestElem *)BLI_mempool_iterstep(&iter))) {
+		EXPECT_EQ(1, elem->index % 2);
+		tot++;
+	}
+	EXPECT_EQ(500, tot);
+
+	BLI_mempool_clear(pool);
+	EXPECT_EQ(0, BLI_mempool_count(pool));
+
+	BLI_mempool_destroy(pool);
+}
+
+TEST(mempool, ThreadsafeParallel)
+{
+	MempoolTestData data;
+
+	BLI_threadapi_init();
+	BLI_system_num_threads_override_set(NUM_THREADS);
+
+	data.pool = BLI_mempool_create(sizeof(MempoolTestElem), 0, 512, BLI_MEMPOOL_THREADSAFE);
+	data.elems = (MempoolTestElem **)MEM_mallocN(sizeof(*data.elems) * NUM_ELEMS, __func__);
+	MempoolTestElem **elems_sorted = (MempoolTestElem **)MEM_mallocN(sizeof(*data.elems) * NUM_ELEMS, __func__);
+
+	for (int pass = 0; pass < 3; pass++) {
+		BLI_task_parallel_range(0, NUM_ELEMS, &data, mempool_test_alloc_func, true);
+		EXPECT_EQ(NUM_ELEMS, BLI_mempool_count(data.pool));
+
+		/* No element may have been handed out twice. */
+		memcpy(elems_sorted, data.elems, sizeof(*data.elems) * NUM_ELEMS);
+		std::sort(elems_sorted, elems_sorted + NUM_ELEMS);
+		EXPECT_TRUE(std::adjacent_find(elems_sorted, elems_sorted + NUM_ELEMS) == elems_sorted + NUM_ELEMS);
+
+		BLI_task_parallel_range(0, NUM_ELEMS, &data, mempool_test_free_func, true);
+		EXPECT_EQ(0, BLI_mempool_count(data.pool));
+	}
+
+	MEM_freeN(data.elems);
+	MEM_freeN(elems_sorted);
+	BLI_mempool_destroy(data.pool);
+}
@@ -0,0 +1,283 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include "atomic_ops.h"
+
+extern "C" {
+#include "BLI_utildefines.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
+
+#include "MEM_guardedalloc.h"
+};
+
+#define NUM_THREADS 4
+#define NUM_TASKS 10000
+
+static void task_count_func(TaskPool *__restrict pool, void *taskdata, int UNUSED(threadid))
+{
+	unsigned int *counter = (unsigned int *)BLI_task_pool_userdata(pool);
+	atomic_add_and_fetch_u(counter, GET_UINT_FROM_POINTER(taskdata));
+}
+
+static void task_spawn_func(TaskPool *__restrict pool, void *taskdata, int threadid)
+{
+	/* Push children from the worker thread, they go to its own queue. */
+	const unsigned int depth = GET_UINT_FROM_POINTER(taskdata);
+	task_count_func(pool, SET_UINT_IN_POINTER(1), threadid);
+	if (depth > 0) {
+		for (int i = 0; i < 2; i++) {
+			BLI_task_pool_push_from_thread(pool, task_spawn_func, SET_UINT_IN_POINTER(depth - 1),
+			                               false, TASK_PRIORITY_HIGH, threadid);
+		}
+	}
+}
+
+static TaskScheduler *task_test_scheduler_create(void)
+{
+	BLI_threadapi_init();
+	return BLI_task_scheduler_create(NUM_THREADS);
+}
+
+/* Global scheduler, used by parallel range routines. */
+static TaskScheduler *task_test_scheduler_get(void)
+{
+	BLI_threadapi_init();
+	BLI_system_num_threads_override_set(NUM_THREADS);
+	return BLI_task_scheduler_get();
+}
+
+TEST(task, PoolPush)
+{
+	TaskScheduler *scheduler = task_test_scheduler_create();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push(pool, task_count_func, SET_UINT_IN_POINTER(1), false, TASK_PRIORITY_LOW);
+	}
+	BLI_task_pool_work_and_wait(pool);
+	EXPECT_EQ(NUM_TASKS, counter);
+
+	BLI_task_pool_free(pool);
+	BLI_task_scheduler_free(scheduler);
+}
+
+TEST(task, PoolPushFromThread)
+{
+	TaskScheduler *scheduler = task_test_scheduler_create();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+	TaskSchedulerStats stats;
+
+	/* Binary tree of tasks, deeper than the per-thread queue is large. */
+	BLI_task_pool_push_from_thread(pool, task_spawn_func, SET_UINT_IN_POINTER(12),
+	                               false, TASK_PRIORITY_HIGH, 0);
+	BLI_task_pool_work_and_wait(pool);
+	EXPECT_EQ((1u << 13) - 1, counter);
+
+	BLI_task_scheduler_stats_get(scheduler, &stats);
+	EXPECT_EQ((uint64_t)(1u << 13) - 1,
+	          stats.num_local + stats.num_stolen + stats.num_shared + stats.num_affinity);
+
+	BLI_task_scheduler_stats_reset(scheduler);
+	BLI_task_scheduler_stats_get(scheduler, &stats);
+	EXPECT_EQ(0, stats.num_local + stats.num_stolen + stats.num_shared);
+
+	BLI_task_pool_free(pool);
+	BLI_task_scheduler_free(scheduler);
+}
+
+TEST(task, PoolPushAffinity)
+{
+	TaskScheduler *scheduler = task_test_scheduler_create();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push_ex(pool, task_count_func, SET_UINT_IN_POINTER(1), false, NULL,
+		                      TASK_PRIORITY_LOW, i % 7);
+	}
+	BLI_task_pool_work_and_wait(pool);
+	EXPECT_EQ(NUM_TASKS, counter);
+
+	BLI_task_pool_free(pool);
+	BLI_task_scheduler_free(scheduler);
+}
+
+TEST(task, PoolCancel)
+{
+	TaskScheduler *scheduler = task_test_scheduler_create();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create_suspended(scheduler, &counter);
+
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push(pool, task_count_func, SET_UINT_IN_POINTER(1), false, TASK_PRIORITY_LOW);
+	}
+	/* Suspended tasks are never scheduled, so nothing must have run. */
+	BLI_task_pool_free(pool);
+	EXPECT_EQ(0, counter);
+
+	pool = BLI_task_pool_create(scheduler, &counter);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push_from_thread(pool, task_count_func, SET_UINT_IN_POINTER(1),
+		                               false, TASK_PRIORITY_HIGH, 0);
+	}
+	BLI_task_pool_cancel(pool);
+	EXPECT_LE(counter, NUM_TASKS);
+
+	/* Pool must be usable after cancel. */
+	counter = 0;
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push_from_thread(pool, task_count_func, SET_UINT_IN_POINTER(1),
+		                               false, TASK_PRIORITY_HIGH, 0);
+	}
+	BLI_task_pool_work_and_wait(pool);
+	EXPECT_EQ(NUM_TASKS, counter);
+
+	BLI_task_pool_free(pool);
+	BLI_task_scheduler_free(scheduler);
+}
+
+TEST(task, SingleThread)
+{
+	BLI_threadapi_init();
+	TaskScheduler *scheduler = BLI_task_scheduler_create(TASK_SCHEDULER_SINGLE_THREAD);
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+
+	BLI_task_pool_push_from_thread(pool, task_spawn_func, SET_UINT_IN_POINTER(10),
+	                               false, TASK_PRIORITY_HIGH, 0);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push(pool, task_count_func, SET_UINT_IN_POINTER(1), false, TASK_PRIORITY_LOW);
+	}
+	BLI_task_pool_work_and_wait(pool);
+	EXPECT_EQ((1u << 11) - 1 + NUM_TASKS, counter);
+
+	BLI_task_pool_free(pool);
+	BLI_task_scheduler_free(scheduler);
+}
+
+static void task_range_count_func(void *userdata, const int UNUSED(iter))
+{
+	atomic_add_and_fetch_u((unsigned int *)userdata, 1);
+}
+
+static void task_nested_range_func(TaskPool *__restrict pool, void *UNUSED(taskdata), int UNUSED(threadid))
+{
+	/* Nested parallel loop, waiting thread must not deadlock or idle. */
+	BLI_task_parallel_range(0, 100, BLI_task_pool_userdata(pool), task_range_count_func, true);
+}
+
+TEST(task, NestedParallelRange)
+{
+	TaskScheduler *scheduler = task_test_scheduler_get();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+
+	for (int i = 0; i < 100; i++) {
+		BLI_task_pool_push(pool, task_nested_range_func, NULL, false, TASK_PRIORITY_LOW);
+	}
+	BLI_task_pool_work_and_wait_ex(pool, true);
+	EXPECT_EQ(100 * 100, counter);
+
+	BLI_task_pool_free(pool);
+}
+
+static void task_isolated_func(void *userdata)
+{
+	TaskPool *pool = (TaskPool *)userdata;
+	BLI_task_pool_work_and_wait_ex(pool, true);
+}
+
+TEST(task, Isolate)
+{
+	TaskScheduler *scheduler = task_test_scheduler_get();
+	unsigned int counter = 0;
+	TaskPool *pool = BLI_task_pool_create(scheduler, &counter);
+
+	for (int i = 0; i < NUM_TASKS; i++) {
+		BLI_task_pool_push_from_thread(pool, task_count_func, SET_UINT_IN_POINTER(1),
+		                               false, TASK_PRIORITY_HIGH, 0);
+	}
+	BLI_task_isolate(scheduler, task_isolated_func, pool);
+	EXPECT_EQ(NUM_TASKS, counter);
+
+	BLI_task_pool_free(pool);
+}
+
+#define REDUCE_SIZE 100003
+
+static void task_reduce_sum_func(void *userdata, void *userdata_chunk, const int iter, const int UNUSED(thread_id))
+{
+	const float *values = (const float *)userdata;
+	*(float *)userdata_chunk += values[iter];
+}
+
+static void task_reduce_sum_join(void *UNUSED(userdata), void *chunk_join, const void *chunk)
+{
+	*(float *)chunk_join += *(const float *)chunk;
+}
+
+TEST(task, ParallelRangeReduce)
+{
+	task_test_scheduler_get();
+	float *values = (float *)MEM_mallocN(sizeof(float) * REDUCE_SIZE, __func__);
+	float sum_threaded = 0.0f, sum_serial = 0.0f;
+
+	for (int i = 0; i < REDUCE_SIZE; i++) {
+		values[i] = 1.0f / (float)(i + 1);
+	}
+
+	BLI_task_parallel_range_reduce(0, REDUCE_SIZE, values, &sum_threaded, sizeof(float),
+	                               task_reduce_sum_func, task_reduce_sum_join, true);
+	BLI_task_parallel_range_reduce(0, REDUCE_SIZE, values, &sum_serial, sizeof(float),
+	                               task_reduce_sum_func, task_reduce_sum_join, false);
+
+	/* Float sums must match bit for bit, regardless of threading. */
+	EXPECT_EQ(sum_serial, sum_threaded);
+	EXPECT_NEAR(12.09, sum_threaded, 1e-2);
+
+	MEM_freeN(values);
+}
+
+static void task_scan_count_func(void *userdata, void *userdata_chunk, const int iter, const int UNUSED(thread_id))
+{
+	const int *counts = (const int *)userdata;
+	*(int *)userdata_chunk += counts[iter];
+}
+
+static void task_scan_count_join(void *UNUSED(userdata), void *chunk_join, const void *chunk)
+{
+	*(int *)chunk_join += *(const int *)chunk;
+}
+
+static void task_scan_offset_func(void *userdata, const void *prefix_chunk, const int iter)
+{
+	int *offsets = (int *)userdata + REDUCE_SIZE;
+	offsets[iter] = *(const int *)prefix_chunk;
+}
+
+TEST(task, ParallelRangeScan)
+{
+	task_test_scheduler_get();
+	/* Counts followed by offsets. */
+	int *data = (int *)MEM_mallocN(sizeof(int) * REDUCE_SIZE * 2, __func__);
+	int total = 0, expected_offset = 0;
+
+	for (int i = 0; i < REDUCE_SIZE; i++) {
+		data[i] = i % 5;
+	}
+
+	BLI_task_parallel_range_scan(0, REDUCE_SIZE, data, &total, sizeof(int),
+	                             task_scan_count_func, task_scan_count_join, task_scan_offset_func, true);
+
+	for (int i = 0; i < REDUCE_SIZE; i++) {
+		EXPECT_EQ(expected_offset, data[REDUCE_SIZE + i]);
+		expected_offset += data[i];
+	}
+	EXPECT_EQ(expected_offset, total);
+
+	MEM_freeN(data);
+}
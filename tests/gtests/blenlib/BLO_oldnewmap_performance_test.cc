@@ -0,0 +1,106 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+extern "C" {
+#include "MEM_guardedalloc.h"
+#include "BLI_utildefines.h"
+#include "BLI_rand.h"
+#include "PIL_time.h"
+
+#include "oldnewmap.h"
+}
+
+/* Number of lookups timed for each map size. */
+#define LOOKUPS_TOT 1000000
+
+/* Addresses as written in a file: increasing, aligned, with varying block sizes. */
+static void oldnewmap_test_addresses(uintptr_t *addrs, const int tot, RNG *rng)
+{
+	uintptr_t addr = 0x10000000;
+
+	for (int i = 0; i < tot; i++) {
+		addrs[i] = addr;
+		addr += 8 * (1 + BLI_rng_get_uint(rng) % 512);
+	}
+}
+
+static void oldnewmap_lookup_test(const int tot)
+{
+	RNG *rng = BLI_rng_new(tot);
+	uintptr_t *addrs = (uintptr_t *)MEM_mallocN(sizeof(*addrs) * tot, __func__);
+	int *order = (int *)MEM_mallocN(sizeof(*order) * LOOKUPS_TOT, __func__);
+	OldNewMap *onm = oldnewmap_new();
+	double time_start, time_insert, time_in_order, time_random;
+	int found = 0;
+
+	oldnewmap_test_addresses(addrs, tot, rng);
+	for (int i = 0; i < LOOKUPS_TOT; i++) {
+		order[i] = (int)(BLI_rng_get_uint(rng) % (unsigned int)tot);
+	}
+
+	time_start = PIL_check_seconds_timer();
+	for (int i = 0; i < tot; i++) {
+		oldnewmap_insert(onm, (void *)addrs[i], SET_INT_IN_POINTER(i + 1), 0);
+	}
+	time_insert = PIL_check_seconds_timer() - time_start;
+
+	/* Order of writing, as when linking direct data. */
+	time_start = PIL_check_seconds_timer();
+	for (int i = 0; i < LOOKUPS_TOT; i++) {
+		const int index = i % tot;
+		if (index == 0) {
+			onm->lasthit = -1;
+		}
+		found += (oldnewmap_lookup_and_inc(onm, (void *)addrs[index], false) == SET_INT_IN_POINTER(index + 1));
+	}
+	time_in_order = PIL_check_seconds_timer() - time_start;
+	EXPECT_EQ(LOOKUPS_TOT, found);
+
+	/* Random order, as when linking library data or pointers between data-blocks. */
+	found = 0;
+	time_start = PIL_check_seconds_timer();
+	for (int i = 0; i < LOOKUPS_TOT; i++) {
+		found += (oldnewmap_lookup_and_inc(onm, (void *)addrs[order[i]], false) == SET_INT_IN_POINTER(order[i] + 1));
+	}
+	time_random = PIL_check_seconds_timer() - time_start;
+	EXPECT_EQ(LOOKUPS_TOT, found);
+
+	/* Misses must not be found. */
+	EXPECT_EQ(NULL, oldnewmap_lookup_and_inc(onm, (void *)(addrs[tot - 1] + 4), false));
+	EXPECT_EQ(-1, oldnewmap_lookup_index(onm, (void *)0x8));
+
+	printf("%8d blocks: insert %7.2f M/s, lookup in order %7.2f M/s, random %7.2f M/s\n",
+	       tot, tot / time_insert * 1e-6,
+	       LOOKUPS_TOT / time_in_order * 1e-6, LOOKUPS_TOT / time_random * 1e-6);
+
+	oldnewmap_free(onm);
+	MEM_freeN(addrs);
+	MEM_freeN(order);
+	BLI_rng_free(rng);
+}
+
+TEST(oldnewmap, LookupThroughput)
+{
+	for (int tot = 1000; tot <= 10000000; tot *= 10) {
+		oldnewmap_lookup_test(tot);
+	}
+}
+
+TEST(oldnewmap, Duplicates)
+{
+	OldNewMap *onm = oldnewmap_new();
+	int a, b;
+
+	/* Last insertion wins. */
+	oldnewmap_insert(onm, (void *)0x1000, &a, 0);
+	oldnewmap_insert(onm, (void *)0x2000, &b, 0);
+	oldnewmap_insert(onm, (void *)0x1000, &b, 0);
+	EXPECT_EQ(2, oldnewmap_lookup_index(onm, (void *)0x1000));
+
+	oldnewmap_clear(onm);
+	EXPECT_EQ(-1, oldnewmap_lookup_index(onm, (void *)0x1000));
+	EXPECT_EQ(NULL, oldnewmap_lookup_and_inc(onm, (void *)0x2000, true));
+
+	oldnewmap_free(onm);
+}